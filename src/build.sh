@@ -1,3 +1,7 @@
 #!/bin/bash
 
-gcc -o uviemon *.c -L./lib/ftdi/build -lftd2xx -lreadline -lm -Wall -std=c17
+# Everything but the console goes into the library, the console links against it
+LIB_SOURCES=$(ls *.c | grep -v -x -e uviemon.c -e uviemon_cli.c -e uviemon_daemon.c -e uviemon_gang.c -e uviemon_farm.c)
+
+gcc -shared -fPIC -o libuviemon.so $LIB_SOURCES -L./lib/ftdi/build -lftd2xx -lm -lpthread -Wall -std=c17
+gcc -o uviemon uviemon.c uviemon_cli.c uviemon_daemon.c uviemon_gang.c uviemon_farm.c -L. -luviemon -Wl,-rpath,'$ORIGIN' -L./lib/ftdi/build -lftd2xx -lreadline -lm -lpthread -Wall -std=c17
@@ -8,13 +8,18 @@
 	communicate to the processor via JTAG.
 
 	Can be used to instantiate multiple JTAG devices
-	at the same time, in the same program.
+	at the same time, in the same program, one
+	thread per device.
 	==========================================
 */
 
+#define _DEFAULT_SOURCE // usleep
+
 #include "ftdi_device.h"
 
 #include "address_map.h"
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +28,14 @@
 #include <math.h>	// For std::ceil in ioread/write32()
 
 #include "leon3_dsu.h" // Interface to the GR712 debug support unit
+#include "uviemon_uart.h"
+#include "uviemon_rtt.h"
+#include "uviemon_semihost.h"
+#include "uviemon_break.h"
+#include "uviemon_coverage.h"
+#include "uviemon_step.h"
+#include "uviemon_serial.h"
+#include "uviemon_ahbuart.h"
 
 const unsigned int CODE_ADDR_COMM = 0x2; // address/command register opcode, 35-bit length
 const DWORD CODE_DATA = 0x3;			 // data register opcode, 33-bit length
@@ -37,74 +50,245 @@ const BYTE RW_BYTE = 0b00000000; // 00 for 8-bit BYTE
 
 const DWORD UART0_STATUS_REG = 0x4;
 const DWORD UART0_CTRL_REG = 0x8;
+const DWORD UART0_SCALER_REG = 0xC;
 const DWORD UART0_FIFO_REG = 0x10;
 
+#define UART_FIFO_MAX 63	// Largest TCNT value
+#define UART_POLL_MIN_US 50	// Poll interval bounds while the UART is quiet
+#define UART_POLL_MAX_US 10000
+#define CORE_STACK_SIZE (64 * 1024) // Distance of the default stacks of a multi-core run
+#define TRACE_LINE_TRAP 0x2		// The instruction of a trace line trapped
+#define TCK_DIVISOR 0x0004		// TCK = 60MHz / ((1 + divisor) * 2), 6 MHz
+
+
+static ftdi_device default_device;
+static _Thread_local ftdi_device *device = &default_device;
+
+static atomic_bool slot_taken[FTDI_MAX_DEVICES];
+
+static void log_message(enum ftdi_log_level level, const char *format, va_list args)
+{
+	char message[256];
+
+	if (device->log == NULL) {
+		vfprintf(level == FTDI_LOG_ERROR ? stderr : stdout, format, args);
+		return;
+	}
+
+	vsnprintf(message, sizeof(message), format, args);
+	device->log(level, message, device->log_arg);
+}
+
+static void log_info(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	log_message(FTDI_LOG_INFO, format, args);
+	va_end(args);
+}
+
+static void log_error(const char *format, ...)
+{
+	va_list args;
 
-static ftdi_device device;
+	va_start(args, format);
+	log_message(FTDI_LOG_ERROR, format, args);
+	va_end(args);
+}
 
 static FT_STATUS init_MPSSE_mode();
 static FT_STATUS reset_JTAG_state_machine();
+static bool reconnect();
+static FT_STATUS init_target();
 static void init_core_1();
 static void set_other_cores_idle();
+static void reset_slot();
+
+/* The built in device always has slot 0, the others take the first free one */
+static bool take_slot()
+{
+	if (device == &default_device) {
+		device->slot = 0;
+		return true;
+	}
+
+	for (unsigned int i = 1; i < FTDI_MAX_DEVICES; i++) {
+		if (!atomic_exchange(&slot_taken[i], true)) {
+			device->slot = i;
+			return true;
+		}
+	}
 
+	return false;
+}
+
+static void release_slot()
+{
+	if (device->slot != 0)
+		atomic_store(&slot_taken[device->slot], false);
+}
+
+static FT_STATUS open_device(DWORD device_index, int cpu_type);
+static FT_STATUS init_probe();
+static FT_STATUS open_ahbuart(const char *path, unsigned int baud, int cpu_type);
 
 FT_STATUS ftdi_open_device(DWORD device_index, int cpu_type)
 {
-	device.device_index = device_index;
-	device.cpu_type = cpu_type;
-	device.first_run = true;
-	device.active_cpu = 0;
+	if (!take_slot()) {
+		log_error("No more than %d devices can be open at the same time\n", FTDI_MAX_DEVICES - 1);
+		return FT_INSUFFICIENT_RESOURCES;
+	}
+
+	// Whatever the previous device of the slot left behind
+	reset_slot();
+
+	const FT_STATUS ftStatus = open_device(device_index, cpu_type);
+
+	if (ftStatus != FT_OK)
+		release_slot();
+
+	return ftStatus;
+}
+
+FT_STATUS ftdi_open_ahbuart(const char *path, unsigned int baud, int cpu_type)
+{
+	if (!take_slot()) {
+		log_error("No more than %d devices can be open at the same time\n", FTDI_MAX_DEVICES - 1);
+		return FT_INSUFFICIENT_RESOURCES;
+	}
+
+	reset_slot();
+
+	const FT_STATUS ftStatus = open_ahbuart(path, baud, cpu_type);
+
+	if (ftStatus != FT_OK)
+		release_slot();
+
+	return ftStatus;
+}
+
+static FT_STATUS open_device(DWORD device_index, int cpu_type)
+{
+	device->device_index = device_index;
+	device->cpu_type = cpu_type;
+	device->first_run = true;
+	device->active_cpu = 0;
+	device->link = FTDI_LINK_JTAG;
 	
 	// Open FTDI device handle
-	FT_STATUS ftStatus = FT_Open(device_index, &device.ft_handle);
+	const FT_STATUS ftStatus = FT_Open(device_index, &device->ft_handle);
 	if (ftStatus != FT_OK) {
-		fprintf(stderr, "Cannot open the device number %d\n", device_index);
+		log_error("Cannot open the device number %d\n", device_index);
 		return ftStatus;
 	}
 
+	// Don't keep the probe claimed if anything after the open fails
+	const FT_STATUS status = init_probe();
+
+	if (status != FT_OK)
+		FT_Close(device->ft_handle);
+
+	return status;
+}
+
+static FT_STATUS init_probe()
+{
+	const DWORD device_index = device->device_index;
+
 	// Get chip driver version
 	DWORD driver_version;
-	ftStatus = FT_GetDriverVersion(device.ft_handle, &driver_version);
+	FT_STATUS ftStatus = FT_GetDriverVersion(device->ft_handle, &driver_version);
 
 	if (ftStatus == FT_OK) {
 		unsigned long majorVer = (driver_version >> 16) & 0xFF;
 		unsigned long minorVer = (driver_version >> 8) & 0xFF;
 		unsigned long buildVer = driver_version & 0xFF;
 
-		printf("Device driver version: %lu.%lu.%lu\n", majorVer, minorVer, buildVer);
+		log_info("Device driver version: %lu.%lu.%lu\n", majorVer, minorVer, buildVer);
 	} else {
-		fprintf(stderr, "Cannot get driver version for device %d\n", device_index);
+		log_error("Cannot get driver version for device %d\n", device_index);
 		return ftStatus;
 	}
 
+	// Without a serial number the probe is looked for under its index again
+	if (FT_GetDeviceInfo(device->ft_handle, NULL, NULL, device->serial, NULL, NULL) != FT_OK)
+		device->serial[0] = '\0';
+
 	ftStatus = init_MPSSE_mode(); // Initialize MPSSE mode on the FTDI chip and get ready for JTAG usage
 	if (ftStatus != FT_OK) {
-		fprintf(stderr, "Could not intialize MPSSE mode on device %d\n", device_index);
+		log_error("Could not intialize MPSSE mode on device %d\n", device_index);
 		return ftStatus;
 	}
 
 	ftStatus = reset_JTAG_state_machine();
 	if (ftStatus != FT_OK) {
-		fprintf(stderr, "Could not reset JTAG state machine on device %d\n", device_index);
+		log_error("Could not reset JTAG state machine on device %d\n", device_index);
+		return ftStatus;
+	}
+
+	return init_target();
+}
+
+static FT_STATUS open_ahbuart(const char *path, unsigned int baud, int cpu_type)
+{
+	ftdi_batch batch;
+	DWORD pnp;
+
+	device->device_index = 0;
+	device->cpu_type = cpu_type;
+	device->first_run = true;
+	device->active_cpu = 0;
+	device->link = FTDI_LINK_AHBUART;
+	device->serial[0] = '\0';
+
+	log_info("Opening AHBUART %s at %u baud... ", path, baud);
+	device->uart_fd = ahbuart_open(path, baud);
+
+	if (device->uart_fd < 0)
+		return FT_DEVICE_NOT_OPENED;
+
+	// Something has to answer before the target is touched
+	ftdi_batch_init(&batch);
+	ftdi_batch_read32(&batch, AHB_PNP);
+	const FT_STATUS ftStatus = ftdi_batch_transfer(&batch, &pnp);
+	ftdi_batch_free(&batch);
+
+	if (ftStatus != FT_OK) {
+		log_error("No answer from the AHBUART on %s\n", path);
+		ahbuart_close(device->uart_fd);
 		return ftStatus;
 	}
 
+	log_info("Done!\n");
+
+	const FT_STATUS status = init_target();
+
+	if (status != FT_OK)
+		ahbuart_close(device->uart_fd);
+
+	return status;
+}
+
+/* Everything after the link is up, the same for JTAG and the AHBUART */
+static FT_STATUS init_target()
+{
 	// Try to autodetect CPU type
-	if (device.cpu_type == -1) {
-		printf("Autodetecting CPU...");
+	if (device->cpu_type == -1) {
+		log_info("Autodetecting CPU...");
 		DWORD cpu = amba_pnp_device(ioread32(AHB_PNP));
 
 		for(int i = 0; i < KNOWN_CPUS; i++) {
 			if (cpu == CPU_MAP[i][0]) {
-				device.cpu_type = CPU_MAP[i][1];
-				printf("%s CPU found!\n", CPU_NAMES[device.cpu_type]);
+				device->cpu_type = CPU_MAP[i][1];
+				log_info("%s CPU found!\n", CPU_NAMES[device->cpu_type]);
 				break;
 			}
 		}
 
-		if (device.cpu_type == -1) {
-			printf("Unknown cpu type: %03x ... Try to explicitly indicate a cpu with -cpu_type\n", cpu);
-			exit(-1);
+		if (device->cpu_type == -1) {
+			log_error("Unknown cpu type: %03x ... Try to explicitly indicate a cpu with -cpu_type\n", cpu);
+			return FT_OTHER_ERROR;
 		}
 		
 	}
@@ -114,37 +298,68 @@ FT_STATUS ftdi_open_device(DWORD device_index, int cpu_type)
 	//_initCore2();  // Initialize core 2 (this will be idle)
 	set_other_cores_idle(); // can be the second core for leon3 or core 2,3,4 for leon4
 
-	return ftStatus;
+	return FT_OK;
 }
 
 void ftdi_close_device()
 {
-	// Reset device before closing handle, good practice
-	FT_SetBitMode(device.ft_handle, 0x0, 0x00);
-	FT_ResetDevice(device.ft_handle);
+	// Files the program opened through semihosting
+	semihost_finish();
+	serial_close();
+	uart_flush();
+
+	if (device->link == FTDI_LINK_AHBUART) {
+		ahbuart_close(device->uart_fd);
+	} else {
+		// Reset device before closing handle, good practice
+		FT_SetBitMode(device->ft_handle, 0x0, 0x00);
+		FT_ResetDevice(device->ft_handle);
+
+		// Close device
+		FT_Close(device->ft_handle);
+	}
+
+	log_info("Goodbye\n");
+
+	release_slot();
+}
+
+ftdi_device *ftdi_select_device(ftdi_device *dev)
+{
+	ftdi_device *previous = device;
+
+	device = dev != NULL ? dev : &default_device;
+
+	return previous;
+}
+
+ftdi_device *ftdi_get_device()
+{
+	return device;
+}
 
-	// Close device
-	FT_Close(device.ft_handle);
-	printf("Goodbye\n");
+unsigned int ftdi_get_device_slot()
+{
+	return device->slot;
 }
 
 int ftdi_get_connected_cpu_type()
 {
-	return device.cpu_type;
+	return device->cpu_type;
 }
 
 void ftdi_set_active_cpu(uint32_t cpu)
 {
-	if ((device.cpu_type == 0 && cpu > 2) || (device.cpu_type == 1 && cpu > 4))
+	if ((device->cpu_type == 0 && cpu > 2) || (device->cpu_type == 1 && cpu > 4))
 		return;
 
-	device.active_cpu = cpu;
+	device->active_cpu = cpu;
 }
 
 
 uint32_t ftdi_get_active_cpu()
 {
-	return device.active_cpu;
+	return device->active_cpu;
 }
 
 DWORD get_devices_count()
@@ -153,7 +368,7 @@ DWORD get_devices_count()
 	DWORD num_devs;
 
 	if (!FT_SUCCESS(FT_CreateDeviceInfoList(&num_devs))) {
-		fprintf(stderr, "Failed to grab number of attached devices\n");
+		log_error("Failed to grab number of attached devices\n");
 		return 0;
 	}
 
@@ -186,7 +401,7 @@ void get_device_list()
 			}
 				
 		} else {
-			fprintf(stderr, "Failed to get device info for device %d", i);
+			log_error("Failed to get device info for device %d", i);
 		}
 	}
 
@@ -200,52 +415,52 @@ static FT_STATUS init_MPSSE_mode()
 	 * Configure port for MPSSE use
 	 */
 
-	printf("Configureing port... ");
+	log_info("Configureing port... ");
 
 	/* Reset FTDI chip */
-	FT_STATUS ft_status = FT_ResetDevice(device.ft_handle);
+	FT_STATUS ft_status = FT_ResetDevice(device->ft_handle);
 	if (ft_status != FT_OK) {
-		fprintf(stderr, "Failed to reset device %i", device.device_index);
-		FT_Close(device.ft_handle);
+		log_error("Failed to reset device %i", device->device_index);
+		FT_Close(device->ft_handle);
 		return ft_status;
 	}
 
 	/* Set in an out transfer size to 16KB  */
-	ft_status = FT_SetUSBParameters(device.ft_handle, 16384, 16384);
+	ft_status = FT_SetUSBParameters(device->ft_handle, 16384, 16384);
 	if (ft_status != FT_OK) {
-		fprintf(stderr, "Failed to set USB params on device %d\n", device.device_index);
-		FT_Close(device.ft_handle);
+		log_error("Failed to set USB params on device %d\n", device->device_index);
+		FT_Close(device->ft_handle);
 		return ft_status;
 	}
 
 	/* Purge the RX and TX buffers */
-	ft_status = FT_Purge(device.ft_handle, FT_PURGE_RX | FT_PURGE_TX);
+	ft_status = FT_Purge(device->ft_handle, FT_PURGE_RX | FT_PURGE_TX);
 	if (ft_status != FT_OK) {
-		fprintf(stderr, "Failed to purge buffers on device %d\n", device.device_index);
-		FT_Close(device.ft_handle);
+		log_error("Failed to purge buffers on device %d\n", device->device_index);
+		FT_Close(device->ft_handle);
 		return ft_status;
 	}
 
 	/* Set read and write timeouts to 10ms  */
-	ft_status = FT_SetTimeouts(device.ft_handle, 10, 10);
+	ft_status = FT_SetTimeouts(device->ft_handle, 10, 10);
 	if (ft_status != FT_OK) {
-		fprintf(stderr, "Failed to set timeoutson device %d\n", device.device_index);
-		FT_Close(device.ft_handle);
+		log_error("Failed to set timeoutson device %d\n", device->device_index);
+		FT_Close(device->ft_handle);
 		return ft_status;
 	}
 
 	/* Enable MPSSE mode */
-	ft_status = FT_SetBitMode(device.ft_handle, 0x0, FT_BITMODE_RESET);
+	ft_status = FT_SetBitMode(device->ft_handle, 0x0, FT_BITMODE_RESET);
 	if (ft_status != FT_OK) {
-		fprintf(stderr, "Failed to set bit mode reset on device %d\n", device.device_index);
-		FT_Close(device.ft_handle);
+		log_error("Failed to set bit mode reset on device %d\n", device->device_index);
+		FT_Close(device->ft_handle);
 		return ft_status;
 	}
 
-	ft_status = FT_SetBitMode(device.ft_handle, 0x0, FT_BITMODE_MPSSE);
+	ft_status = FT_SetBitMode(device->ft_handle, 0x0, FT_BITMODE_MPSSE);
 	if (ft_status != FT_OK) {
-		fprintf(stderr, "Failed to set bit mode MPSSE on device %d\n", device.device_index);
-		FT_Close(device.ft_handle);
+		log_error("Failed to set bit mode MPSSE on device %d\n", device->device_index);
+		FT_Close(device->ft_handle);
 		return ft_status;
 	}
 	/*
@@ -254,8 +469,8 @@ static FT_STATUS init_MPSSE_mode()
 	 */
 	sleep(1); 
 
-	printf("Done!\n");
-	printf("Configuring MPSSE... ");
+	log_info("Done!\n");
+	log_info("Configuring MPSSE... ");
 
 	/*
 	 *	===============
@@ -275,17 +490,17 @@ static FT_STATUS init_MPSSE_mode()
 	DWORD bytes_to_read = 0;
 
 	/* enable internal loop-back */
-	ft_status = FT_Write(device.ft_handle, out_buf,
+	ft_status = FT_Write(device->ft_handle, out_buf,
 						 buf_len, &len_sent);
 
 	/* check receive buffer - it should be empty */
-	ft_status |= FT_GetQueueStatusEx(device.ft_handle, &bytes_read);
+	ft_status |= FT_GetQueueStatusEx(device->ft_handle, &bytes_read);
 
 	if (bytes_read != 0) {
-		fprintf(stderr, "Error - MPSSE receive buffer should be empty: %d\n", ft_status);
+		log_error("Error - MPSSE receive buffer should be empty: %d\n", ft_status);
 		/* reset port to disable MPSSE */
-		FT_SetBitMode(device.ft_handle, 0x0, 0x0);
-		FT_Close(device.ft_handle);
+		FT_SetBitMode(device->ft_handle, 0x0, 0x0);
+		FT_Close(device->ft_handle);
 		return 1;
 	}
 
@@ -298,17 +513,17 @@ static FT_STATUS init_MPSSE_mode()
 	out_buf[0] = 0xAB;
 
 	/* send the bad command */
-	ft_status |= FT_Write(device.ft_handle, out_buf,
+	ft_status |= FT_Write(device->ft_handle, out_buf,
 						  buf_len, &len_sent);
 
 
 	do {
-		ft_status |= FT_GetQueueStatus(device.ft_handle, &bytes_to_read);
+		ft_status |= FT_GetQueueStatus(device->ft_handle, &bytes_to_read);
 	} while( bytes_to_read == 0 && ft_status == FT_OK);
 
 
 	/* Read out the data from input buffer  */
-	ft_status |= FT_Read(device.ft_handle, in_buf,
+	ft_status |= FT_Read(device->ft_handle, in_buf,
 						 bytes_to_read, &bytes_read);
 
 	/*
@@ -324,22 +539,22 @@ static FT_STATUS init_MPSSE_mode()
 	}
 
 	if (!command_echoed) {
-		fprintf(stderr, "Error in synchronizing the MPSSE\n");
-		FT_Close(device.ft_handle);
+		log_error("Error in synchronizing the MPSSE\n");
+		FT_Close(device->ft_handle);
 		return 1;
 	}
 
 	/* Disable internal loop-back */
 	out_buf[0] = 0x85;
-	ft_status |= FT_Write(device.ft_handle, out_buf,
+	ft_status |= FT_Write(device->ft_handle, out_buf,
 						  buf_len, &len_sent);
 
-	ft_status |= FT_GetQueueStatus(device.ft_handle, &bytes_to_read);
+	ft_status |= FT_GetQueueStatus(device->ft_handle, &bytes_to_read);
 
 	if (bytes_to_read != 0) {
-		fprintf(stderr, "Error - MPSSE receive buffer should be empty: %d", ft_status);
-		FT_SetBitMode(device.ft_handle, 0x0, 0x0);
-		FT_Close(device.ft_handle);
+		log_error("Error - MPSSE receive buffer should be empty: %d", ft_status);
+		FT_SetBitMode(device->ft_handle, 0x0, 0x0);
+		FT_Close(device->ft_handle);
 		return 1;
 	}
 
@@ -358,14 +573,14 @@ static FT_STATUS init_MPSSE_mode()
 	/* Disable three-phase clocking  */
 	out_buf[buf_len++] = 0x8D;
 
-	ft_status |= FT_Write(device.ft_handle, out_buf,
+	ft_status |= FT_Write(device->ft_handle, out_buf,
 						  buf_len, &len_sent);
 
 	/*
 	 * Set TCK frequency
 	 * TCK = 60MHz / ((1 + [(1 + 0xValueH*256) OR 0xValueL]) * 2)
 	 */
-	DWORD clock_divisor = 0x0004;
+	DWORD clock_divisor = TCK_DIVISOR;
 	buf_len = 0;
 	/* Command to set clock divisor */
 	out_buf[buf_len++] = '\x86';
@@ -374,7 +589,7 @@ static FT_STATUS init_MPSSE_mode()
 	/* Set 0xValueH of clock divisor (should be 0) */
 	out_buf[buf_len++] = (clock_divisor >> 8) & 0xFF;
 
-	ft_status |= FT_Write(device.ft_handle, out_buf,
+	ft_status |= FT_Write(device->ft_handle, out_buf,
 						  buf_len, &len_sent);
 	
 	
@@ -399,7 +614,7 @@ static FT_STATUS init_MPSSE_mode()
 	out_buf[buf_len++] = 0b00001011;
 
 	/* Send of the low GPIO config commands */
-	ft_status |= FT_Write(device.ft_handle, out_buf,
+	ft_status |= FT_Write(device->ft_handle, out_buf,
 						  buf_len, &len_sent);
 
 	
@@ -431,16 +646,16 @@ static FT_STATUS init_MPSSE_mode()
 	/* Direction config above */
 	out_buf[buf_len++] = 0x00;
 
-	ft_status |= FT_Write(device.ft_handle, out_buf,
+	ft_status |= FT_Write(device->ft_handle, out_buf,
 						  buf_len, &len_sent);
 
 	if (ft_status != FT_OK) {
-		fprintf(stderr, "Failed to config MPSSE on device %d\n", device.device_index);
-		FT_Close(device.ft_handle);
+		log_error("Failed to config MPSSE on device %d\n", device->device_index);
+		FT_Close(device->ft_handle);
 		return ft_status;
 	}
 
-	printf("Done!\n");
+	log_info("Done!\n");
 
 	return ft_status;
 }
@@ -472,7 +687,7 @@ static void init_core_1()
 	 *	   else end of physical ram was reached, decrement bank size by one
 	 */
 	
-	uint32_t base_address = ADDRESSES[device.cpu_type][UART0_START_ADDRESS];
+	uint32_t base_address = ADDRESSES[device->cpu_type][UART0_START_ADDRESS];
 	
 	iowrite32(base_address, 0x0003c0ff);
 	iowrite32(base_address + 0x4, 0x9a20546a);
@@ -486,6 +701,162 @@ static void init_core_1()
 	iowrite32(base_address + 0x348, 0x0);
 }
 
+/*
+ * Precompiled core preparation scripts
+ *
+ * Resetting, starting or parking a core used to be a few hundred single
+ * AHB transactions (every special register, all of the IU register file and
+ * each control bit on its own). The command streams only depend on the core
+ * and the CPU type, so they are encoded once per core and only the run control
+ * words, the entry point and the stack pointer are patched in before the whole
+ * script goes out in a single USB write.
+ */
+
+typedef struct {
+	ftdi_batch batch;
+	/* Offsets of the patchable data words in batch */
+	DWORD mode_mask;
+	DWORD ctrl_halt;
+	DWORD break_halt;
+	DWORD special;		// First word of the special register burst
+	DWORD iu_reg;		// First word of the IU register file burst
+	DWORD ctrl_resume;
+	DWORD break_resume;
+} core_script;
+
+typedef struct {
+	core_script reset[DSU_NCPUS];
+	core_script run[DSU_NCPUS];
+	core_script idle[DSU_NCPUS];
+} core_scripts;
+
+static core_scripts script_slots[FTDI_MAX_DEVICES];
+
+static inline core_scripts *script_slot()
+{
+	return &script_slots[device->slot];
+}
+
+// Word index of %o6 (%sp) and %i6 (%fp) of window 1 in the IU register file burst
+#define IU_REG_SP_WIN1	((DSU_REG_OUT(0, 1) + 6 * 4 - DSU_BASE(0) - DSU_IU_REG) / 4)
+#define IU_REG_FP_WIN1	((DSU_REG_IN(0, 1) + 6 * 4 - DSU_BASE(0) - DSU_IU_REG) / 4)
+
+static void build_reset_script(core_script *script, uint32_t cpu)
+{
+	const DWORD base_address = ADDRESSES[device->cpu_type][DSU];
+	ftdi_batch *batch = &script->batch;
+
+	ftdi_batch_write32(batch, base_address + 0x400024, 0x00000002); // Reset DSU ASI register
+	ftdi_batch_write32(batch, base_address + 0x700000, 0x00eb800f); // Reset ASI diagnostic access
+
+	// Clear Y, PSR, WIM, TBR, PC, NPC, FSR and CPSR in one burst
+	script->special = ftdi_batch_write32_seq(batch, DSU_BASE(cpu) + DSU_REG_Y, NULL, 8);
+	// Clear IU register file
+	script->iu_reg = ftdi_batch_write32_seq(batch, DSU_BASE(cpu) + DSU_IU_REG, NULL, DSU_IU_REG_WORDS);
+
+	// Clear PE bit, patched with the current control register
+	script->ctrl_resume = ftdi_batch_write32(batch, DSU_BASE(cpu), 0);
+}
+
+static void build_run_script(core_script *script, uint32_t cpu)
+{
+	const DWORD base_address = ADDRESSES[device->cpu_type][DSU];
+	ftdi_batch *batch = &script->batch;
+
+	/* Y, PSR (CWP 1), WIM (default invalid mask), TBR, PC, NPC, FSR, CPSR
+	 * TBR, PC and NPC are patched with the entry point
+	 */
+	const DWORD special[8] = { 0, 0xf34010e1, 0x2, 0, 0, 0, 0, 0 };
+
+	ftdi_batch_write32(batch, base_address + 0x400024, 0x00000002); // Reset DSU ASI register
+	ftdi_batch_write32(batch, base_address + 0x700000, 0x00eb800f); // Reset ASI diagnostic access
+
+	// Halt the core first, it may still be running from a previous crash
+	script->mode_mask = ftdi_batch_write32(batch, DSU_CTRL + DSU_MODE_MASK, 0);
+	script->ctrl_halt = ftdi_batch_write32(batch, DSU_BASE(cpu), 0);
+	script->break_halt = ftdi_batch_write32(batch, DSU_CTRL + DSU_BREAK_STEP, 0);
+
+	script->special = ftdi_batch_write32_seq(batch, DSU_BASE(cpu) + DSU_REG_Y, special, 8);
+	script->iu_reg = ftdi_batch_write32_seq(batch, DSU_BASE(cpu) + DSU_IU_REG, NULL, DSU_IU_REG_WORDS);
+
+	// Wake up, resume and UART setup are shared by all cores of a run, see start_cpus()
+	script->ctrl_resume = 0;
+	script->break_resume = 0;
+}
+
+static void build_idle_script(core_script *script, uint32_t cpu)
+{
+	ftdi_batch *batch = &script->batch;
+
+	/* PSR (CWP 7), WIM (default invalid mask), TBR, PC, NPC
+	 * TBR, PC and NPC are patched with the trap base of CPU0
+	 */
+	const DWORD special[5] = { 0xf34010e1, 0x2, 0, 0, 0 };
+
+	script->mode_mask = ftdi_batch_write32(batch, DSU_CTRL + DSU_MODE_MASK, 0);
+	script->ctrl_halt = ftdi_batch_write32(batch, DSU_BASE(cpu), 0);
+	script->break_halt = ftdi_batch_write32(batch, DSU_CTRL + DSU_BREAK_STEP, 0);
+
+	script->special = ftdi_batch_write32_seq(batch, DSU_BASE(cpu) + DSU_REG_PSR, special, 5);
+	script->iu_reg = ftdi_batch_write32_seq(batch, DSU_BASE(cpu) + DSU_IU_REG, NULL, DSU_IU_REG_WORDS);
+
+	script->ctrl_resume = ftdi_batch_write32(batch, DSU_BASE(cpu), 0);
+	script->break_resume = ftdi_batch_write32(batch, DSU_CTRL + DSU_BREAK_STEP, 0);
+}
+
+/*
+ * Control word releasing a halted core: halt mode off, the instruction trace
+ * on, errors, error traps and software breakpoints into debug mode and the
+ * error mode cleared. break_ctrl adds the bits the breakpoints need.
+ */
+static uint32_t release_ctrl(uint32_t ctrl, uint32_t break_ctrl)
+{
+	return (ctrl & ~(DSU_CTRL_BW | DSU_CTRL_HL))
+	       | DSU_CTRL_TE | DSU_CTRL_BE | DSU_CTRL_BS | DSU_CTRL_BZ | DSU_CTRL_PE | break_ctrl;
+}
+
+static core_script *get_core_script(core_script *scripts, uint32_t cpu,
+				    void (*build)(core_script *, uint32_t))
+{
+	core_script *script = &scripts[cpu & (DSU_NCPUS - 1)];
+
+	if (script->batch.len == 0)
+		build(script, cpu);
+
+	return script;
+}
+
+/*
+ * Patch the idle script of a core and add it to batch. The run control words
+ * are chained through mask, ctrl and brk so that several cores can be parked
+ * in the same USB write.
+ */
+static void append_idle_script(ftdi_batch *batch, uint32_t cpu, uint32_t tbr,
+			       uint32_t *mask, uint32_t *brk)
+{
+	core_script *script = get_core_script(script_slot()->idle, cpu, build_idle_script);
+	const uint32_t ctrl = dsu_shadow_get_ctrl(cpu) | DSU_CTRL_BW;
+
+	*mask |= DSU_DEBUG_MASK(cpu);
+	*brk |= DSU_BREAK_NOW(cpu);
+
+	ftdi_batch_patch32(&script->batch, script->mode_mask, *mask);
+	ftdi_batch_patch32(&script->batch, script->ctrl_halt, ctrl);
+	ftdi_batch_patch32(&script->batch, script->break_halt, *brk);
+
+	ftdi_batch_patch32(&script->batch, ftdi_batch_seq_offset(script->special, 2), tbr);
+	ftdi_batch_patch32(&script->batch, ftdi_batch_seq_offset(script->special, 3), tbr);
+	ftdi_batch_patch32(&script->batch, ftdi_batch_seq_offset(script->special, 4), tbr + 0x4);
+
+	*brk &= ~DSU_BREAK_NOW(cpu);
+
+	// Resume the core and clear its error mode
+	ftdi_batch_patch32(&script->batch, script->ctrl_resume, release_ctrl(ctrl, 0));
+	ftdi_batch_patch32(&script->batch, script->break_resume, *brk);
+
+	ftdi_batch_append(batch, &script->batch);
+}
+
 static void set_other_cores_idle()
 {
 	/* Initialize the debug support unit for one CPU core
@@ -508,64 +879,90 @@ static void set_other_cores_idle()
 	 * Set core count depending on the cpu_type
 	 * this will probably need a proper function at some point
 	 */
-	int core_count = device.cpu_type == LEON3 ? 2 : 4;
+	int core_count = ftdi_get_cpu_count();
 
-	for (int i = 1; i < core_count; i++) {
-		printf("Configuring CPU core %d idle... ", i + 1);
-		
-		dsu_set_noforce_debug_mode(i);
-		dsu_set_cpu_break_on_iu_watchpoint(i);
+	uint32_t mask = dsu_shadow_get_mode_mask();
+	uint32_t brk = dsu_shadow_get_break_step();
+	ftdi_batch batch;
 
-		dsu_set_force_debug_on_watchpoint(i);
+	ftdi_batch_init(&batch);
 
-		dsu_set_reg_tbr(i, tmp);
-		dsu_set_reg_pc(i, tmp);
-		dsu_set_reg_npc(i, tmp + 0x4);
-
-		dsu_clear_iu_reg_file(i);
-		// Default invalid mask
-		dsu_set_reg_wim(i, 0x2);
+	for (int i = 1; i < core_count; i++) {
+		log_info("Configuring CPU core %d idle...\n", i + 1);
+		append_idle_script(&batch, i, tmp, &mask, &brk);
+	}
 
-		// Set CWP to 7
-		dsu_set_reg_psr(i, 0xf34010e1);
+	ftdi_batch_send(&batch);
+	ftdi_batch_free(&batch);
+	dsu_shadow_invalidate_all();
 
-		dsu_clear_cpu_break_on_iu_watchpoint(i);
-		// Resume cpu 1
-		dsu_clear_force_debug_on_watchpoint(i);
+	log_info("Done!\n");
+}
 
-		dsu_clear_cpu_error_mode(i);
+void ftdi_set_cpu_idle(uint32_t cpu)
+{
+	uint32_t tmp = dsu_get_reg_tbr(0) & ~0xfff;
+	uint32_t mask = dsu_shadow_get_mode_mask();
+	uint32_t brk = dsu_shadow_get_break_step();
+	ftdi_batch batch;
 
-		printf("Done!\n");
-	}
+	ftdi_batch_init(&batch);
+	append_idle_script(&batch, cpu, tmp, &mask, &brk);
+	ftdi_batch_send(&batch);
+	ftdi_batch_free(&batch);
 
-	
+	dsu_shadow_invalidate_all();
 }
 
-void ftdi_set_cpu_idle(uint32_t cpu)
+/*
+ * After a USB reset or a replug the handle is dead for good, the probe
+ * comes back as a new device. It gets the MPSSE setup of open_device()
+ * and a TAP reset, the chain and the cores are left as they are. The
+ * shadows are dropped as the failed batch may have been cut short.
+ */
+static bool reconnect()
 {
-	uint32_t tmp = dsu_get_reg_tbr(0) & ~0xfff;
+	DWORD modem_status;
 
-	dsu_set_noforce_debug_mode(cpu);
-	dsu_set_cpu_break_on_iu_watchpoint(cpu);
+	// Still there, the transfer failed for another reason
+	if (device->reconnecting || FT_GetModemStatus(device->ft_handle, &modem_status) == FT_OK)
+		return false;
 
-	dsu_set_force_debug_on_watchpoint(cpu);
+	log_error("Lost device %d, waiting %d s for it to come back...\n",
+		  device->device_index, FTDI_RECONNECT_TIMEOUT);
 
-	dsu_set_reg_tbr(cpu, tmp);
-	dsu_set_reg_pc(cpu, tmp);
-	dsu_set_reg_npc(cpu, tmp + 0x4);
+	FT_Close(device->ft_handle);
+	device->reconnecting = true;
 
-	dsu_clear_iu_reg_file(cpu);
-	// Default invalid mask
-	dsu_set_reg_wim(cpu, 0x2);
-	
-	// Set CWP to 7
-	dsu_set_reg_psr(cpu, 0xf34010e1);
+	FT_STATUS ft_status = FT_DEVICE_NOT_FOUND;
+
+	for (int tries = 0; ft_status != FT_OK && tries < FTDI_RECONNECT_TIMEOUT * 10; tries++) {
+		usleep(100000);
+
+		if (device->serial[0] != '\0')
+			ft_status = FT_OpenEx(device->serial, FT_OPEN_BY_SERIAL_NUMBER, &device->ft_handle);
+		else
+			ft_status = FT_Open(device->device_index, &device->ft_handle);
+
+		// init_MPSSE_mode() closes the handle if it fails
+		if (ft_status == FT_OK)
+			ft_status = init_MPSSE_mode();
+	}
+
+	if (ft_status == FT_OK)
+		ft_status = reset_JTAG_state_machine();
+
+	device->reconnecting = false;
+
+	if (ft_status != FT_OK) {
+		log_error("Device %d did not come back\n", device->device_index);
+		return false;
+	}
 
-	dsu_clear_cpu_break_on_iu_watchpoint(cpu);
-	// Resume cpu 1
-	dsu_clear_force_debug_on_watchpoint(cpu);
+	dsu_shadow_invalidate_all();
+	log_error("Device %d is back, sending the last transfer again\n", device->device_index);
 
-	dsu_clear_cpu_error_mode(cpu);
+	return true;
 }
 
 static FT_STATUS reset_JTAG_state_machine()
@@ -579,11 +976,15 @@ static FT_STATUS reset_JTAG_state_machine()
 	const DWORD buf_len = 3;
 	DWORD bytes_sent;
 
-	FT_STATUS ft_status = FT_Write(device.ft_handle, out_buf,
+	FT_STATUS ft_status = FT_Write(device->ft_handle, out_buf,
 								   buf_len, &bytes_sent);
 
+	// The single transactions all start here, a lost probe is picked up again before them
+	if (ft_status != FT_OK && reconnect())
+		ft_status = FT_Write(device->ft_handle, out_buf, buf_len, &bytes_sent);
+
 	if (ft_status != FT_OK || buf_len != bytes_sent)
-		printf("Could not reset JTAG state machine on device %d\n", device.device_index);
+		log_error("Could not reset JTAG state machine on device %d\n", device->device_index);
 
 	return ft_status;
 }
@@ -591,200 +992,602 @@ static FT_STATUS reset_JTAG_state_machine()
 
 void reset(BYTE cpuID)
 {
-	DWORD base_address = ADDRESSES[device.cpu_type][DSU];
-	
-	iowrite32(base_address + 0x400024, 0x00000002); // Reset DSU ASI register
-	iowrite32(base_address + 0x700000, 0x00eb800f); // Reset ASI diagnostic access
-
-	dsu_set_reg_y(cpuID, 0x0);	  // Clear Y register
-	dsu_set_reg_psr(cpuID, 0x0);  // Clear PSR register
-	dsu_set_reg_wim(cpuID, 0x0);  // Clear WIM register
-	dsu_set_reg_tbr(cpuID, 0x0);  // Clear TBR register
-	dsu_set_reg_pc(cpuID, 0x0);	  // Clear PC register
-	dsu_set_reg_npc(cpuID, 0x0);  // Clear NPC register
-	dsu_set_reg_fsr(cpuID, 0x0);  // Clear FSR register
-	dsu_set_reg_cpsr(cpuID, 0x0); // Clear CPSR register
-
-	dsu_clear_iu_reg_file(cpuID); //  Clear IU register file
+	core_script *script = get_core_script(script_slot()->reset, cpuID, build_reset_script);
 
 	// Optional: Clear FPU register file, not actually strictly needed
-	dsu_clear_cpu_error_mode(cpuID); // Clear PE bit of CPU 1
+	ftdi_batch_patch32(&script->batch, script->ctrl_resume,
+			   dsu_shadow_get_ctrl(cpuID) | DSU_CTRL_PE); // Clear PE bit of the CPU
+
+	ftdi_batch_send(&script->batch);
+	dsu_shadow_invalidate(cpuID);
 }
 
-BYTE runCPU(BYTE cpuID)
+/*
+ * Reset all cores of a run, point each at its entry with its own stack and
+ * release them together with a single write to the wake up register, all in
+ * one USB write. With sync, a core entering debug mode forces all others of
+ * the run into debug mode within a few cycles. The DSU time tag is read in the
+ * same transaction, right after the release. False if the transfer failed,
+ * the cores may or may not run then.
+ */
+static bool start_cpus(DWORD cores, const ftdi_core_entry *entries, bool sync, DWORD *timetag)
 {
-	reset(cpuID); // Reset CPU first in case a crash happened in a previous execution
+	core_scripts *scripts = script_slot();
+	uint32_t mask = dsu_shadow_get_mode_mask();
+	uint32_t brk = dsu_shadow_get_break_step();
+	uint32_t ctrl[DSU_NCPUS];
+	ftdi_batch batch;
 
-	const uint32_t addr = ADDRESSES[device.cpu_type][SDRAM_START_ADDRESS];
- 
-	dsu_set_noforce_debug_mode(cpuID);
-	dsu_set_cpu_break_on_iu_watchpoint(cpuID);
-	dsu_set_cpu_halt_mode(cpuID);
+	ftdi_batch_init(&batch);
 
-	dsu_set_force_debug_on_watchpoint(cpuID);
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (!(cores & (1 << cpu)))
+			continue;
 
-	dsu_set_reg_tbr(cpuID, addr);
-	dsu_set_reg_pc(cpuID, addr);
-	dsu_set_reg_npc(cpuID, addr + 0x4);
+		core_script *script = get_core_script(scripts->run, cpu, build_run_script);
+		ftdi_batch *prepare = &script->batch;
 
-	dsu_clear_iu_reg_file(cpuID);
+		ctrl[cpu] = dsu_shadow_get_ctrl(cpu) | DSU_CTRL_BW | DSU_CTRL_HL;
 
-	// Default invalid mask
-	dsu_set_reg_wim(cpuID, 0x2);
-	// Set CWP to 7
-	dsu_set_reg_psr(cpuID, 0xf34010e1); 
+		// Without sync, a core entering debug mode does not force the others of the run
+		if (sync)
+			mask = (mask & ~DSU_DEBUG_MASK(cpu)) | DSU_ENTER_DEBUG(cpu);
+		else
+			mask = (mask & ~DSU_ENTER_DEBUG(cpu)) | DSU_DEBUG_MASK(cpu);
+		brk |= DSU_BREAK_NOW(cpu);
 
-	// Set to start of RAM + 8 MiB
-	const uint32_t start = ADDRESSES[device.cpu_type][SDRAM_START_ADDRESS] + 8 * 1024 * 1024; 
+		ftdi_batch_patch32(prepare, script->mode_mask, mask);
+		// Also clears the error mode in case a crash happened in a previous execution
+		ftdi_batch_patch32(prepare, script->ctrl_halt, ctrl[cpu] | DSU_CTRL_PE);
+		ftdi_batch_patch32(prepare, script->break_halt, brk);
+
+		ftdi_batch_patch32(prepare, ftdi_batch_seq_offset(script->special, 3), entries[cpu].entry); // TBR
+		ftdi_batch_patch32(prepare, ftdi_batch_seq_offset(script->special, 4), entries[cpu].entry); // PC
+		ftdi_batch_patch32(prepare, ftdi_batch_seq_offset(script->special, 5), entries[cpu].entry + 0x4); // NPC
+
+		ftdi_batch_patch32(prepare, ftdi_batch_seq_offset(script->iu_reg, IU_REG_SP_WIN1), entries[cpu].stack);
+		ftdi_batch_patch32(prepare, ftdi_batch_seq_offset(script->iu_reg, IU_REG_FP_WIN1), entries[cpu].stack);
 
-	dsu_set_reg_sp(cpuID, 1, start);
-	dsu_set_reg_fp(cpuID, 1, start);
+		ftdi_batch_append(&batch, prepare);
+	}
+
+	// The cores are halted now, breakpoints go in before they are released
+	const uint32_t break_ctrl = break_arm(&batch, cores);
 
 	// CPU wake from setup.c
-	dsu_set_cpu_wake_up(cpuID);
-	// Not strictly needed with the iowrite down below
-	dsu_clear_cpu_break_on_iu_watchpoint(cpuID);
-	// Needed to resume cpu
-	dsu_clear_force_debug_on_watchpoint(cpuID);
-	// Not strictly needed with the iowrite down below
-	dsu_clear_cpu_error_mode(cpuID);			 
-
-	// Set TE, RE, DB, LB bits 1 and clear all other parameters on UART0
-	iowrite32( ADDRESSES[device.cpu_type][UART0_START_ADDRESS] + UART0_CTRL_REG,
-					 0x00000883); 
-
-	// ACTUALLY RESUMES CPU
-	iowrite32(ADDRESSES[device.cpu_type][DSU], 0x0000022f); 
-
-	bool stopped = false;
-	// Create a mask with bits 20 to 25 set to 1 (0b11111100000000000000000000) to get TCNT
-	const unsigned int mask = 0x3F00000; 
+	ftdi_batch_write32(&batch, ADDRESSES[device->cpu_type][WAKE_STATE], cores);
 
-	while (!stopped)
-	{
-		// Extract the number of data frames in the transmitter FIFO from the UART status register
-		const DWORD status = ADDRESSES[device.cpu_type][UART0_START_ADDRESS] + UART0_STATUS_REG;
-		unsigned int TCNT_bits = (ioread32(status) & mask) >> 20;
+	// Channel B takes the pin at its baud rate, unless the target software sets the scaler
+	if (serial_scaler() >= 0)
+		ftdi_batch_write32(&batch, ADDRESSES[device->cpu_type][UART0_START_ADDRESS] + UART0_SCALER_REG,
+				   serial_scaler());
 
-		if (TCNT_bits > 0)
-		{
-			// Grab all data from UART if available
-			for (size_t i = 0; i < TCNT_bits; i++)
-			{
-				const DWORD fifo = ADDRESSES[device.cpu_type][UART0_START_ADDRESS] + UART0_FIFO_REG;
-				// TODO: ioread32 reads a DWORD but is casted to a char, why?
-				printf("%c", ioread32(fifo));
-			}
-		}
-		else
-		{
-			// UART is empty, don't know if it's done or it crashed, check debug mode
-			stopped = dsu_get_cpu_in_debug_mode(cpuID);
-		}
-	}
+	// Set TE, RE, DB, LB bits 1 and clear all other parameters on UART0, only TE and RE to send on the pin to channel B
+	ftdi_batch_write32(&batch, ADDRESSES[device->cpu_type][UART0_START_ADDRESS] + UART0_CTRL_REG,
+			   serial_active() ? 0x00000003 : 0x00000883);
 
-	// Get bits 4 to 11
-	unsigned int bitmask = (1 << (11 - 4 + 1)) - 1;
-	// Shift the bitmask to align with the start position
-	bitmask <<= 4;
-	// Use bitwise AND to extract the desired bits
-	unsigned int tt = dsu_get_reg_trap(cpuID) & bitmask;
-	// Shift the result back to the rightmost position
-	tt >>= 4;											 
-
-	// Use bitwise AND to extract the desired bits
-	unsigned int tbr_tt = dsu_get_reg_tbr(cpuID) & bitmask;
-	// Shift the result back to the rightmost position
-	tbr_tt >>= 4;											
-
-	// Sometimes fixes an issue that can throw an error on first run
-	if (device.first_run && (tt != 0x80 || tbr_tt != 0x80))
-	{
-		device.first_run = false;
-		// Just run it again and it'll probably work
-		return runCPU(cpuID); 
+	// Releases the cores of the run, the other cores keep their control register
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (cores & (1 << cpu))
+			ftdi_batch_write32(&batch, DSU_BASE(cpu), release_ctrl(ctrl[cpu], break_ctrl));
 	}
 
-	if (tt == 0x80 && tbr_tt != 0x80)
-	{
-		return tbr_tt;
-	}
+	ftdi_batch_write32(&batch, DSU_CTRL + DSU_BREAK_STEP, brk & ~(cores & DSU_BREAK_NOW_MASK));
+	ftdi_batch_read32(&batch, DSU_CTRL + DSU_TIMETAG);
 
-	/* Actually not needed because we're monitoring both DSU reg and TBR reg
-	if (dsu_get_global_reg(cpuID, 1) != 1 && tt == 0x80) // Check if global failed when tt is OK
-	{
-		return 0x82; // Return a Software trap instruction
+	const FT_STATUS status = ftdi_batch_transfer(&batch, timetag);
+
+	ftdi_batch_free(&batch);
+	dsu_shadow_invalidate_all();
+
+	if (status != FT_OK) {
+		log_error("Could not start the cores on device %d\n", device->device_index);
+		return false;
 	}
-	*/
 
-	return tt;
+	*timetag &= DSU_TIMETAG_MASK;
+
+	return true;
 }
 
-BYTE get_JTAG_count()
+/*
+ * Execution monitoring of the running program, one poll at a time so the
+ * caller can do other work in between, see runCPU_poll()
+ */
+typedef struct {
+	DWORD cores;		// Cores of the run
+	DWORD stopped;		// Cores in debug mode for good
+	bool sync;		// Cores enter debug mode together
+	bool resumed;		// Continued after a stop instead of started from reset
+	unsigned int pending;	// Characters known to be waiting in the UART FIFO
+	unsigned int interval;	// Current poll interval in us
+	ftdi_batch batch;
+
+	// The time tag wraps after 2^30 cycles, it is extended with every poll
+	DWORD timetag;			// Time tag at the last poll
+	uint64_t cycles;		// Cycles since the release
+	uint64_t stop_cycles[DSU_NCPUS];	// Cycles at the poll that found a core stopped
+	DWORD stop_timetag[DSU_NCPUS];
+} run_monitor;
+
+static run_monitor monitor_slots[FTDI_MAX_DEVICES];
+
+static inline run_monitor *monitor_slot()
 {
-	if (reset_JTAG_state_machine() != FT_OK) // Reset back to TLR
-		return 0;
-
-	DWORD bytes_sent;
-	
-	/* GOTO shift-ir */
-	BYTE out_buf[100] = {
-		0x4B,       // Clock out TMS without read
-		0x05,       // Number of clock pulses = Length + 1 (6 bits here)
-		0b00001101, // Data is shifted LSB first, so actually 101100
-		/* Write one byte of OxFF, but leave immediately to Exit-IR on this last byte with TMS */
-		0x1B,       // Clock bits out with read
-		0x06,       // Length + 1 (7 bits here), only 7 because the las one will be clocked out by the next TMS command 
-		0xFF,       // Ones only
-		/* Clock out last bit of the 0xFF byte and leave Exit-IR */
-		0x4B,       // Clock bits out to TMS with read, move out of Shift-IR and clock out the last TDI/DO bit 
-		0x00,       // Length + 1 (1 bit here)
-		0b10000011, // One only
-		/* We are in Exit1-IR, go to Shift-DR */
-		0x4B,       // Clock out TMS without read
-		0x03,      // Number of clock pulses = Length + 1 (4 bits here)
-		0b00000011,// Data is shifted LSB first
-	};
+	return &monitor_slots[device->slot];
+}
 
-	DWORD buf_len = 12;
+/* The scripts are built again for the CPU type of the new device */
+static void reset_slot()
+{
+	core_scripts *scripts = script_slot();
 
-	
-	for (int i = 0; i < 10; i++) {
-		out_buf[buf_len++] = 0x1B; // Clock data bits out with read
-		out_buf[buf_len++] = 0x07; // Length + 1 (8 bits here)
-		out_buf[buf_len++] = 0x00; // Zeros only
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		ftdi_batch_clear(&scripts->reset[cpu].batch);
+		ftdi_batch_clear(&scripts->run[cpu].batch);
+		ftdi_batch_clear(&scripts->idle[cpu].batch);
 	}
 
-	out_buf[buf_len++] = 0x2A; // Clock bits in by reading
-	out_buf[buf_len++] = 0x07; // Length + 1 (8 bits here);
+	dsu_shadow_invalidate_all();
+	step_invalidate_inst_cache();
+	break_reset();
+	rtt_detach();
+	coverage_stop();
+}
 
-	FT_STATUS ft_status = FT_Write(device.ft_handle, out_buf,
-								   buf_len, &bytes_sent);
+uint32_t ftdi_get_cpu_count()
+{
+	return device->cpu_type == LEON3 ? 2 : 4;
+}
 
+/*
+ * Default entry points: all cores start at the beginning of RAM, the first
+ * core of the run gets its stack at RAM + 8 MiB and every further core 64 KiB
+ * below the one before
+ */
+void ftdi_default_entries(DWORD cores, ftdi_core_entry *entries)
+{
+	const uint32_t addr = ADDRESSES[device->cpu_type][SDRAM_START_ADDRESS];
+	// Set to start of RAM + 8 MiB
+	uint32_t stack = ADDRESSES[device->cpu_type][SDRAM_START_ADDRESS] + 8 * 1024 * 1024; 
 
-	if (ft_status != FT_OK && bytes_sent != 42) {
-		fprintf(stderr, "Communication error with JTAG device!\n");
-		return 0;
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		entries[cpu].entry = addr;
+		entries[cpu].stack = stack;
+
+		if (cores & (1 << cpu))
+			stack -= CORE_STACK_SIZE;
 	}
-	
+}
 
-	DWORD bytes_to_read;
-	DWORD bytes_read;
-	BYTE in_buf[100];
-	// Do a read to flush the read buffer, the data is not needed...
-	do {
-		ft_status = FT_GetQueueStatus(device.ft_handle, &bytes_to_read);					   // Get the number of bytes in the device input buffer
-	} while ((bytes_to_read == 0) && (ft_status == FT_OK)); // or Timeout
+bool runCPU_start(DWORD cores, const ftdi_core_entry *entries, bool sync)
+{
+	run_monitor *monitor = monitor_slot();
 
-	/* Read out the data from input buffer */
-	ft_status |= FT_Read(device.ft_handle, &in_buf,
-						 bytes_to_read, &bytes_read); 
+	monitor->cores = cores;
+	monitor->sync = sync;
+	monitor->resumed = false;
+	monitor->stopped = 0;
+	monitor->pending = 0;
+	monitor->interval = 0;
+	monitor->cycles = 0;
+	ftdi_batch_init(&monitor->batch);
 
-	BYTE numberOfJTAGs = 0;
-	buf_len = 0;
+	semihost_start();
 
-	// Now clock out 100 1s max with read until we receive one back
-	for (int i = 0; i < 100; i++) {
+	return start_cpus(cores, entries, sync, &monitor->timetag);
+}
+
+/*
+ * Let cores that are in debug mode continue where they stopped, breakpoint
+ * and watchpoint hits bring them back into debug mode
+ */
+bool runCPU_resume(DWORD cores)
+{
+	run_monitor *monitor = monitor_slot();
+	ftdi_batch batch;
+
+	monitor->cores = cores;
+	monitor->sync = false;
+	monitor->resumed = true;
+	monitor->stopped = 0;
+	monitor->pending = 0;
+	monitor->interval = 0;
+	monitor->cycles = 0;
+	ftdi_batch_init(&monitor->batch);
+
+	break_step_over(cores);
+
+	ftdi_batch_init(&batch);
+	const uint32_t break_ctrl = break_arm(&batch, cores);
+	uint32_t brk = dsu_shadow_get_break_step();
+
+	// Released like a new run, the break and single step register goes last
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (!(cores & (1 << cpu)))
+			continue;
+
+		ftdi_batch_write32(&batch, DSU_BASE(cpu), release_ctrl(dsu_shadow_get_ctrl(cpu), break_ctrl));
+		brk &= ~(DSU_BREAK_NOW(cpu) | DSU_SINGLE_STEP(cpu));
+	}
+
+	ftdi_batch_write32(&batch, DSU_CTRL + DSU_BREAK_STEP, brk);
+	ftdi_batch_read32(&batch, DSU_CTRL + DSU_TIMETAG);
+
+	const FT_STATUS status = ftdi_batch_transfer(&batch, &monitor->timetag);
+
+	ftdi_batch_free(&batch);
+	dsu_shadow_invalidate_all();
+
+	if (status != FT_OK) {
+		log_error("Could not resume the cores on device %d\n", device->device_index);
+		return false;
+	}
+
+	monitor->timetag &= DSU_TIMETAG_MASK;
+
+	return true;
+}
+
+/*
+ * Print everything the program sent on UART0 since the last poll
+ *
+ * Every poll is a single USB transaction: the characters the last status read
+ * reported as waiting in the transmitter FIFO, the DSU control registers of
+ * all cores of the run, the UART status and the DSU time tag, in that order.
+ * The time tag at the poll that finds a core stopped bounds its cycle count,
+ * runCPU_finish() narrows it down from the trace buffer. Once all cores are
+ * in debug mode and the FIFO was empty after that, all output has been
+ * collected. The poll interval backs off while the program is quiet and drops
+ * back to zero as soon as there is traffic again. An attached memory console
+ * is polled along with the UART and semihosting requests are served when a
+ * core stops for one.
+ *
+ * Returns FTDI_RUN_DONE once all cores stopped for good and FTDI_RUN_FAILED
+ * if the poll could not be transferred, wait_us is set to the time to wait
+ * before the next poll.
+ */
+enum ftdi_run_state runCPU_poll(unsigned int *wait_us)
+{
+	run_monitor *monitor = monitor_slot();
+	const DWORD uart = ADDRESSES[device->cpu_type][UART0_START_ADDRESS];
+	// Create a mask with bits 20 to 25 set to 1 (0b11111100000000000000000000) to get TCNT
+	const unsigned int mask = 0x3F00000;
+
+	DWORD results[UART_FIFO_MAX + DSU_NCPUS + 2];
+	DWORD ctrl[DSU_NCPUS];
+	ftdi_batch *batch = &monitor->batch;
+	bool served = false;
+
+	*wait_us = 0;
+	ftdi_batch_clear(batch);
+
+	for (unsigned int i = 0; i < monitor->pending; i++)
+		ftdi_batch_read32(batch, uart + UART0_FIFO_REG);
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (monitor->cores & (1 << cpu))
+			ctrl[cpu] = ftdi_batch_read32(batch, DSU_BASE(cpu));
+	}
+
+	const DWORD status = ftdi_batch_read32(batch, uart + UART0_STATUS_REG);
+	const DWORD timetag = ftdi_batch_read32(batch, DSU_CTRL + DSU_TIMETAG);
+
+	if (ftdi_batch_transfer(batch, results) != FT_OK) {
+		uart_flush();
+		ftdi_batch_free(batch);
+		return FTDI_RUN_FAILED;
+	}
+
+	monitor->cycles += (results[timetag] - monitor->timetag) & DSU_TIMETAG_MASK;
+	monitor->timetag = results[timetag] & DSU_TIMETAG_MASK;
+
+	for (unsigned int i = 0; i < monitor->pending; i++)
+		uart_putc((char) results[i]);
+
+	// The memory console is drained in its own transactions, as is the instruction trace
+	const int rtt_bytes = rtt_poll();
+	const int traced = coverage_poll();
+
+	// Extract the number of data frames in the transmitter FIFO from the UART status register
+	const unsigned int TCNT_bits = (results[status] & mask) >> 20;
+
+	DWORD halted = 0;
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if ((monitor->cores & ~monitor->stopped & (1 << cpu)) && (results[ctrl[cpu]] & DSU_CTRL_DM)) {
+			halted |= 1 << cpu;
+			monitor->stop_cycles[cpu] = monitor->cycles;
+			monitor->stop_timetag[cpu] = monitor->timetag;
+		}
+	}
+
+	/*
+	 * Cores that entered debug mode since the last poll, semihosting requests
+	 * resume them. With cross halting the other cores only followed the one
+	 * with the request and are resumed with it.
+	 */
+	if (halted)
+		uart_flush();
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (!(halted & (1 << cpu)))
+			continue;
+
+		if (semihost_service(cpu, monitor->sync ? halted : 0)) {
+			served = true;
+
+			if (monitor->sync)
+				break;
+		} else if (!monitor->sync) {
+			monitor->stopped |= 1 << cpu;
+		}
+	}
+
+	if (monitor->sync && !served)
+		monitor->stopped |= halted;
+
+	// UART is empty, check if the cores are done or crashed
+	if (monitor->stopped == monitor->cores && TCNT_bits == 0 && rtt_bytes <= 0)
+		return FTDI_RUN_DONE;
+
+	if (monitor->pending == 0 && TCNT_bits == 0 && rtt_bytes <= 0 && traced <= 0 && !served) {
+		*wait_us = monitor->interval;
+		monitor->interval = monitor->interval ? monitor->interval * 2 : UART_POLL_MIN_US;
+
+		if (monitor->interval > UART_POLL_MAX_US)
+			monitor->interval = UART_POLL_MAX_US;
+	} else {
+		monitor->interval = 0;
+	}
+
+	// Channel B gets the characters from the pin, the FIFO only tells when it went out
+	monitor->pending = serial_active() ? 0 : TCNT_bits;
+
+	return FTDI_RUN_ACTIVE;
+}
+
+/*
+ * Force all running cores into debug mode, the next poll picks them up
+ */
+void runCPU_stop()
+{
+	const run_monitor *monitor = monitor_slot();
+
+	dsu_batch_begin();
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (!(monitor->cores & (1 << cpu)) || (monitor->stopped & (1 << cpu)))
+			continue;
+
+		dsu_set_cpu_break_on_iu_watchpoint(cpu);
+		dsu_set_force_debug_on_watchpoint(cpu);
+	}
+
+	dsu_batch_commit();
+}
+
+/*
+ * The newest trace line of a stopped core is the instruction it stopped at,
+ * its time tag makes the cycle count exact. Without the trace enabled the line
+ * is older than the run and the count of the poll is kept.
+ */
+static void refine_stop_cycles(uint32_t cpu)
+{
+	run_monitor *monitor = monitor_slot();
+	struct instr_trace_buffer_line line;
+
+	dsu_get_instr_trace_buffer(cpu, &line, 1, 0);
+
+	const DWORD back = (monitor->stop_timetag[cpu] - line.field[0]) & DSU_TIMETAG_MASK;
+
+	if ((line.field[2] & TRACE_LINE_TRAP) && back < monitor->stop_cycles[cpu])
+		monitor->stop_cycles[cpu] -= back;
+}
+
+uint64_t runCPU_cycles(uint32_t cpu)
+{
+	return monitor_slot()->stop_cycles[cpu & (DSU_NCPUS - 1)];
+}
+
+/*
+ * Evaluate how the program ended on each core of the run, traps is indexed
+ * by core. Returns false if the run has to be started again.
+ */
+bool runCPU_finish(BYTE *traps)
+{
+	run_monitor *monitor = monitor_slot();
+	bool retry = false;
+
+	serial_drain();
+	uart_flush();
+	ftdi_batch_free(&monitor->batch);
+	break_disarm();
+
+	// Get bits 4 to 11
+	unsigned int bitmask = (1 << (11 - 4 + 1)) - 1;
+	// Shift the bitmask to align with the start position
+	bitmask <<= 4;
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (!(monitor->cores & (1 << cpu)))
+			continue;
+
+		refine_stop_cycles(cpu);
+
+		// Use bitwise AND to extract the desired bits
+		unsigned int tt = dsu_get_reg_trap(cpu) & bitmask;
+		// Shift the result back to the rightmost position
+		tt >>= 4;											 
+
+		// Use bitwise AND to extract the desired bits
+		unsigned int tbr_tt = dsu_get_reg_tbr(cpu) & bitmask;
+		// Shift the result back to the rightmost position
+		tbr_tt >>= 4;											
+
+		// Sometimes fixes an issue that can throw an error on first run
+		if (device->first_run && !monitor->resumed && (tt != 0x80 || tbr_tt != 0x80))
+			retry = true;
+
+		if (tt == 0x80 && tbr_tt != 0x80)
+			traps[cpu] = tbr_tt;
+		else
+			traps[cpu] = tt;
+
+		/* Actually not needed because we're monitoring both DSU reg and TBR reg
+		if (dsu_get_global_reg(cpuID, 1) != 1 && tt == 0x80) // Check if global failed when tt is OK
+		{
+			return 0x82; // Return a Software trap instruction
+		}
+		*/
+	}
+
+	if (retry) {
+		device->first_run = false;
+		// Just run it again and it'll probably work
+		return false;
+	}
+
+	return true;
+}
+
+/* Polls until all cores stopped, false if the link failed on the way */
+static bool wait_run(BYTE *traps)
+{
+	enum ftdi_run_state state;
+	unsigned int wait_us;
+
+	while ((state = runCPU_poll(&wait_us)) == FTDI_RUN_ACTIVE)
+		usleep(wait_us);
+
+	if (state == FTDI_RUN_FAILED) {
+		log_error("Lost device %d during the run\n", device->device_index);
+		memset(traps, 0, DSU_NCPUS);
+	}
+
+	return state == FTDI_RUN_DONE;
+}
+
+bool runCPUs(DWORD cores, const ftdi_core_entry *entries, bool sync, BYTE *traps)
+{
+	do {
+		if (!runCPU_start(cores, entries, sync)) {
+			memset(traps, 0, DSU_NCPUS);
+			return false;
+		}
+
+		if (!wait_run(traps))
+			return false;
+	} while (!runCPU_finish(traps));
+
+	return true;
+}
+
+bool resumeCPUs(DWORD cores, BYTE *traps)
+{
+	if (!runCPU_resume(cores)) {
+		memset(traps, 0, DSU_NCPUS);
+		return false;
+	}
+
+	if (!wait_run(traps))
+		return false;
+
+	runCPU_finish(traps);
+
+	return true;
+}
+
+BYTE runCPU(BYTE cpuID)
+{
+	ftdi_core_entry entries[DSU_NCPUS];
+	BYTE traps[DSU_NCPUS];
+
+	ftdi_default_entries(1 << cpuID, entries);
+	runCPUs(1 << cpuID, entries, false, traps);
+
+	return traps[cpuID];
+}
+
+/* The AHBUART reaches the AHB, there is no chain behind it */
+static bool jtag_only(const char *what)
+{
+	if (device->link == FTDI_LINK_JTAG)
+		return false;
+
+	log_error("%s needs a device on JTAG\n", what);
+
+	return true;
+}
+
+BYTE get_JTAG_count()
+{
+	if (jtag_only("Scanning the chain"))
+		return 0;
+
+	if (reset_JTAG_state_machine() != FT_OK) // Reset back to TLR
+		return 0;
+
+	DWORD bytes_sent;
+	
+	/* GOTO shift-ir */
+	BYTE out_buf[100] = {
+		0x4B,       // Clock out TMS without read
+		0x05,       // Number of clock pulses = Length + 1 (6 bits here)
+		0b00001101, // Data is shifted LSB first, so actually 101100
+		/* Write one byte of OxFF, but leave immediately to Exit-IR on this last byte with TMS */
+		0x1B,       // Clock bits out with read
+		0x06,       // Length + 1 (7 bits here), only 7 because the las one will be clocked out by the next TMS command 
+		0xFF,       // Ones only
+		/* Clock out last bit of the 0xFF byte and leave Exit-IR */
+		0x4B,       // Clock bits out to TMS with read, move out of Shift-IR and clock out the last TDI/DO bit 
+		0x00,       // Length + 1 (1 bit here)
+		0b10000011, // One only
+		/* We are in Exit1-IR, go to Shift-DR */
+		0x4B,       // Clock out TMS without read
+		0x03,      // Number of clock pulses = Length + 1 (4 bits here)
+		0b00000011,// Data is shifted LSB first
+	};
+
+	DWORD buf_len = 12;
+
+	
+	for (int i = 0; i < 10; i++) {
+		out_buf[buf_len++] = 0x1B; // Clock data bits out with read
+		out_buf[buf_len++] = 0x07; // Length + 1 (8 bits here)
+		out_buf[buf_len++] = 0x00; // Zeros only
+	}
+
+	out_buf[buf_len++] = 0x2A; // Clock bits in by reading
+	out_buf[buf_len++] = 0x07; // Length + 1 (8 bits here);
+
+	FT_STATUS ft_status = FT_Write(device->ft_handle, out_buf,
+								   buf_len, &bytes_sent);
+
+
+	if (ft_status != FT_OK && bytes_sent != 42) {
+		log_error("Communication error with JTAG device!\n");
+		return 0;
+	}
+	
+
+	DWORD bytes_to_read;
+	DWORD bytes_read;
+	BYTE in_buf[100];
+	// Do a read to flush the read buffer, the data is not needed...
+	do {
+		ft_status = FT_GetQueueStatus(device->ft_handle, &bytes_to_read);					   // Get the number of bytes in the device input buffer
+	} while ((bytes_to_read == 0) && (ft_status == FT_OK)); // or Timeout
+
+	/* Read out the data from input buffer */
+	ft_status |= FT_Read(device->ft_handle, &in_buf,
+						 bytes_to_read, &bytes_read); 
+
+	BYTE numberOfJTAGs = 0;
+	buf_len = 0;
+
+	// Now clock out 100 1s max with read until we receive one back
+	for (int i = 0; i < 100; i++) {
 		/* Clock bits out with read */
 		out_buf[buf_len++] = 0x3B;
 		/* Length + 1 (1 bit here) */
@@ -792,24 +1595,24 @@ BYTE get_JTAG_count()
 		/* Ones only */
 		out_buf[buf_len++] = 0xFF;
 
-		ft_status |= FT_Write(device.ft_handle, out_buf,
+		ft_status |= FT_Write(device->ft_handle, out_buf,
 							 buf_len, &bytes_sent); 
 		buf_len = 0;
 
 		if (ft_status != FT_OK || bytes_sent != 3) {
-			fprintf(stderr, "Error while scanning for number of JTAG devices with device %d", device.device_index);
+			log_error("Error while scanning for number of JTAG devices with device %d", device->device_index);
 			return 0;
 		}
 
 		do {
-			ft_status = FT_GetQueueStatus(device.ft_handle, &bytes_to_read);					   // Get the number of bytes in the device input buffer
+			ft_status = FT_GetQueueStatus(device->ft_handle, &bytes_to_read);					   // Get the number of bytes in the device input buffer
 		} while ((bytes_to_read == 0) && (ft_status == FT_OK));
 
-		ft_status |= FT_Read(device.ft_handle, &in_buf,
+		ft_status |= FT_Read(device->ft_handle, &in_buf,
 							 bytes_to_read, &bytes_read);
 
 		if (ft_status != FT_OK || bytes_read == 0) {
-			fprintf(stderr, "Error while reading number of JTAG devices with device  %d\n", device.device_index);
+			log_error("Error while reading number of JTAG devices with device  %d\n", device->device_index);
 				
 			return 0;
 		}
@@ -828,6 +1631,9 @@ BYTE get_JTAG_count()
 
 DWORD read_idcode()
 {
+	if (jtag_only("Scanning the chain"))
+		return 0;
+
 	if (reset_JTAG_state_machine() != FT_OK) // Reset back to TLR
 		return 0;
 
@@ -845,11 +1651,11 @@ DWORD read_idcode()
 
 	DWORD bytes_sent;
 
-	FT_STATUS ft_status = FT_Write(device.ft_handle, out_buf,
+	FT_STATUS ft_status = FT_Write(device->ft_handle, out_buf,
 								   6, &bytes_sent);
 
 	if (ft_status != FT_OK || bytes_sent != 6) {
-		fprintf(stderr, "Error while querying ID for device %d\n", device.device_index);
+		log_error("Error while querying ID for device %d\n", device->device_index);
 		return 0;
 	}
 
@@ -857,21 +1663,21 @@ DWORD read_idcode()
 	BYTE in_buf[10];
 	
 	do {
-		ft_status = FT_GetQueueStatus(device.ft_handle, &bytes_to_read);					   // Get the number of bytes in the device input buffer
+		ft_status = FT_GetQueueStatus(device->ft_handle, &bytes_to_read);					   // Get the number of bytes in the device input buffer
 	} while ((bytes_to_read == 0) && (ft_status == FT_OK));						   // or Timeout
 
 	// Read out the data from input buffer
-	ft_status |= FT_Read(device.ft_handle, &in_buf,
+	ft_status |= FT_Read(device->ft_handle, &in_buf,
 						 bytes_to_read, &bytes_read); 
 
 	if (ft_status != FT_OK) {
-		fprintf(stderr, "Error while reading ID for device %d\n",
-				device.device_index);
+		log_error("Error while reading ID for device %d\n",
+				device->device_index);
 		return 0;
 	}
 
 	if (bytes_read != 4) {
-		fprintf(stderr, "Device did not return the correct number of bytes for IDCODE! \n");
+		log_error("Device did not return the correct number of bytes for IDCODE! \n");
 		return 0;
 	}
 
@@ -892,6 +1698,9 @@ DWORD read_idcode()
 
 BYTE scan_IR_length()
 {
+	if (jtag_only("Scanning the chain"))
+		return 0;
+
 	if (reset_JTAG_state_machine() != FT_OK) // Reset back to TLR first
 		return 0;
 
@@ -911,11 +1720,11 @@ BYTE scan_IR_length()
 
 	DWORD bytes_sent;
 
-	FT_STATUS ft_status = FT_Write(device.ft_handle, out_buf,
+	FT_STATUS ft_status = FT_Write(device->ft_handle, out_buf,
 								   8, &bytes_sent);
 	
 	if (ft_status != FT_OK || bytes_sent != 8) {
-		fprintf(stderr, "Communication error with JTAG device!\n");
+		log_error("Communication error with JTAG device!\n");
 		return 0;
 	}
 
@@ -925,11 +1734,11 @@ BYTE scan_IR_length()
 	// Do a read to flush the read buffer, the data is not needed...
 	do {
 		// Get the number of bytes in the device input buffer
-		ft_status |= FT_GetQueueStatus(device.ft_handle, &bytes_to_read);				   
+		ft_status |= FT_GetQueueStatus(device->ft_handle, &bytes_to_read);				   
 	} while ((bytes_to_read == 0) && (ft_status == FT_OK));						   // or Timeout
 
 	// Read out the data from input buffer
-	ft_status |= FT_Read(device.ft_handle, &in_buf,
+	ft_status |= FT_Read(device->ft_handle, &in_buf,
 						 bytes_to_read, &bytes_read); 
 
 	BYTE lengthIR = 0;
@@ -945,13 +1754,13 @@ BYTE scan_IR_length()
 		out_buf[buf_len++] = 0xFF;											
 
 		// Send off the TMS command
-		ft_status |= FT_Write(device.ft_handle, out_buf,
+		ft_status |= FT_Write(device->ft_handle, out_buf,
 							  buf_len, &bytes_sent); 
 
 		// Check if everything has been sent!
 		if (ft_status != FT_OK || bytes_sent != buf_len)  {
-			fprintf(stderr, "Error in IR length scan for device %d\n",
-					device.device_index);
+			log_error("Error in IR length scan for device %d\n",
+					device->device_index);
 			return 0;
 		}
 
@@ -959,16 +1768,16 @@ BYTE scan_IR_length()
 
 		do {
 			// Get the number of bytes in the device input buffer
-			ft_status = FT_GetQueueStatus(device.ft_handle, &bytes_to_read);					   
+			ft_status = FT_GetQueueStatus(device->ft_handle, &bytes_to_read);					   
 		} while ((bytes_to_read == 0) && (ft_status == FT_OK));
 
 		// Read out the data from input buffer
-		ft_status |= FT_Read(device.ft_handle, &in_buf,
+		ft_status |= FT_Read(device->ft_handle, &in_buf,
 							 bytes_to_read, &bytes_read); 
 
 		if (ft_status != FT_OK || bytes_read != bytes_to_read) {
-			fprintf(stderr, "Error while reading length of IR with device %d\n",
-					device.device_index);
+			log_error("Error while reading length of IR with device %d\n",
+					device->device_index);
 			return 0;
 		}
 
@@ -988,6 +1797,9 @@ BYTE scan_IR_length()
 
 void scan_instruction_codes(BYTE bitLengthIR)
 {
+	if (jtag_only("Scanning the chain"))
+		return;
+
 	printf("Scanning for IR opcodes that return a non-zero DR length. This might take a while...\n");
 
 	BYTE maxIRLength = 0; // Get the highest opcode possible for the IR length
@@ -1013,6 +1825,9 @@ void scan_instruction_codes(BYTE bitLengthIR)
 
 BYTE scan_DR_length(BYTE opcode)
 {
+	if (jtag_only("Scanning the chain"))
+		return 0;
+
 	BYTE byOutputBuffer[100];	// Buffer to hold MPSSE commands and data to be sent to the FT2232H
 	BYTE byInputBuffer[100];	// Buffer to hold data read from the FT2232H
 	DWORD dwNumBytesToSend = 0; // Index to the output buffer
@@ -1057,12 +1872,12 @@ BYTE scan_DR_length(BYTE opcode)
 	byOutputBuffer[dwNumBytesToSend++] = 0x2A;													 // Read back bits
 	byOutputBuffer[dwNumBytesToSend++] = 0x07;													 // Length + 1 (8 bits here)
 
-	FT_STATUS ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	FT_STATUS ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 								  dwNumBytesToSend, &dwNumBytesSent);
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend)
 	{
-		fprintf(stderr, "Communication error with JTAG device!\n");
+		log_error("Communication error with JTAG device!\n");
 		return 0;
 	}
 	
@@ -1071,10 +1886,10 @@ BYTE scan_DR_length(BYTE opcode)
 	// Do a read to flush the read buffer, the data is not needed...
 	do {
 		// Get the number of bytes in the device input buffer
-		ftStatus = FT_GetQueueStatus(device.ft_handle, &dwNumBytesToRead);					   
+		ftStatus = FT_GetQueueStatus(device->ft_handle, &dwNumBytesToRead);					   
 	} while ((dwNumBytesToRead == 0) && (ftStatus == FT_OK));						   // or Timeout
 
-	ftStatus |= FT_Read(device.ft_handle, &byInputBuffer, dwNumBytesToRead, &dwNumBytesRead);
+	ftStatus |= FT_Read(device->ft_handle, &byInputBuffer, dwNumBytesToRead, &dwNumBytesRead);
 
 	BYTE lengthDR = 0;
 
@@ -1084,11 +1899,11 @@ BYTE scan_DR_length(BYTE opcode)
 		byOutputBuffer[dwNumBytesToSend++] = 0x00;											// Length + 1 (1 bit here)
 		byOutputBuffer[dwNumBytesToSend++] = 0xFF;											// Ones only
 
-		ftStatus |= FT_Write(device.ft_handle, byOutputBuffer,
+		ftStatus |= FT_Write(device->ft_handle, byOutputBuffer,
 							 dwNumBytesToSend, &dwNumBytesSent);
 
 		if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-			fprintf(stderr, "Error in DR length scan for device %d (opcode %#10x)\n", device.device_index, CODE_DATA);
+			log_error("Error in DR length scan for device %d (opcode %#10x)\n", device->device_index, CODE_DATA);
 			return 0;
 		}
 
@@ -1096,13 +1911,13 @@ BYTE scan_DR_length(BYTE opcode)
 
 		do {
 			// Get the number of bytes in the device input buffer
-			ftStatus = FT_GetQueueStatus(device.ft_handle, &dwNumBytesToRead);					   
+			ftStatus = FT_GetQueueStatus(device->ft_handle, &dwNumBytesToRead);					   
 		} while ((dwNumBytesToRead == 0) && (ftStatus == FT_OK));						   // or Timeout
 
-		ftStatus |= FT_Read(device.ft_handle, &byInputBuffer, dwNumBytesToRead, &dwNumBytesRead); 
+		ftStatus |= FT_Read(device->ft_handle, &byInputBuffer, dwNumBytesToRead, &dwNumBytesRead); 
 
 		if (ftStatus != FT_OK || dwNumBytesRead != dwNumBytesToRead) {
-			fprintf(stderr, "Error while reading length of DR with device %d (opcode %#10x)\n", device.device_index, CODE_DATA);
+			log_error("Error while reading length of DR with device %d (opcode %#10x)\n", device->device_index, CODE_DATA);
 			return 0;
 		}
 
@@ -1119,6 +1934,46 @@ BYTE scan_DR_length(BYTE opcode)
 	return lengthDR; // Exit with success
 }
 
+/*
+ * Single transactions over the AHBUART, it only moves whole words. Bytes
+ * and halfwords are merged into the word as it is in memory.
+ */
+static DWORD link_read32(DWORD addr)
+{
+	ftdi_batch batch;
+	DWORD data = 0;
+
+	ftdi_batch_init(&batch);
+	ftdi_batch_read32(&batch, addr & ~0x3);
+
+	if (ftdi_batch_transfer(&batch, &data) != FT_OK)
+		log_error("Error while reading from the AHBUART\n");
+
+	ftdi_batch_free(&batch);
+
+	return data;
+}
+
+static void link_write32(DWORD addr, DWORD data)
+{
+	ftdi_batch batch;
+
+	ftdi_batch_init(&batch);
+	ftdi_batch_write32(&batch, addr, data);
+
+	if (ftdi_batch_send(&batch) != FT_OK)
+		log_error("Error while writing to the AHBUART\n");
+
+	ftdi_batch_free(&batch);
+}
+
+static void link_write_lanes(DWORD addr, DWORD data, DWORD mask)
+{
+	const DWORD word = link_read32(addr & ~0x3);
+
+	link_write32(addr & ~0x3, (word & ~mask) | (data & mask));
+}
+
 BYTE ioread8(DWORD addr)
 {
 	DWORD bigData = ioread32(addr);
@@ -1175,6 +2030,9 @@ WORD ioread16(DWORD addr)
 
 DWORD ioread32(DWORD addr)
 {
+	if (device->link == FTDI_LINK_AHBUART)
+		return link_read32(addr);
+
 	BYTE byOutputBuffer[100];	// Buffer to hold MPSSE commands and data to be sent to the FT2232H
 	BYTE byInputBuffer[100];	// Buffer to hold data read from the FT2232H
 	DWORD dwNumBytesToSend = 0; // Index to the output buffer
@@ -1286,10 +2144,10 @@ DWORD ioread32(DWORD addr)
 	byOutputBuffer[dwNumBytesToSend++] = 0x28; // Read Bytes
 	byOutputBuffer[dwNumBytesToSend++] = 0x03; // 3 + 1 Bytes = 32 bit AHB Data -> Does not read SEQ Bit!
 	byOutputBuffer[dwNumBytesToSend++] = 0x00;
-	FT_STATUS ftStatus = FT_Write(device.ft_handle, byOutputBuffer, dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
+	FT_STATUS ftStatus = FT_Write(device->ft_handle, byOutputBuffer, dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Communication error with JTAG device %d!\n", device.device_index);
+		log_error("Communication error with JTAG device %d!\n", device->device_index);
 		return 0;
 	}
 
@@ -1297,20 +2155,20 @@ DWORD ioread32(DWORD addr)
 
 	do {
 		// Get the number of bytes in the device input buffer
-		ftStatus = FT_GetQueueStatus(device.ft_handle, &dwNumBytesToRead);					   
+		ftStatus = FT_GetQueueStatus(device->ft_handle, &dwNumBytesToRead);					   
 	} while ((dwNumBytesToRead == 0) && (ftStatus == FT_OK));						   // or Timeout
 
 	// Read out the data from input buffer
-	ftStatus |= FT_Read(device.ft_handle, &byInputBuffer, dwNumBytesToRead, &dwNumBytesRead); 
+	ftStatus |= FT_Read(device->ft_handle, &byInputBuffer, dwNumBytesToRead, &dwNumBytesRead); 
 
 	if (ftStatus != FT_OK) {
-		fprintf(stderr, "Error while reading data register for device %d\n", device.device_index);
+		log_error("Error while reading data register for device %d\n", device->device_index);
 		return 0;
 	}
 
 	if (dwNumBytesRead != dwNumBytesToRead) {
-		fprintf(stderr, "Bytes read: %d\n", dwNumBytesRead);
-		fprintf(stderr, "Device did not return the correct number of bytes for the data register.\n");
+		log_error("Bytes read: %d\n", dwNumBytesRead);
+		log_error("Device did not return the correct number of bytes for the data register.\n");
 		return 0;
 	}
 
@@ -1323,198 +2181,29 @@ DWORD ioread32(DWORD addr)
 
 void ioread32raw(DWORD startAddr, DWORD *data, WORD size)
 {
+	ftdi_batch batch;
 
-	// Check 1kB boundary for SEQ transfers
-	if (size > 256)
-		fprintf(stderr, "Warning: Size is bigger than recommended 1 kB maximum (GR712RC-UM)!");
+	// All reads of the burst go out in one USB write and come back in one read
+	ftdi_batch_init(&batch);
+	ftdi_batch_read32_seq(&batch, startAddr, size);
 
-	BYTE byOutputBuffer[100];	// Buffer to hold MPSSE commands and data to be sent to the FT2232H
-	BYTE byInputBuffer[100];	// Buffer to hold data read from the FT2232H
-	DWORD dwNumBytesToSend = 0; // Index to the output buffer
-	DWORD dwNumBytesSent = 0;	// Count of actual bytes sent - used with FT_Write
-	DWORD dwNumBytesToRead = 0; // Number of bytes available to read in the driver's input buffer
-	DWORD dwNumBytesRead = 0;	// Count of actual bytes read - used with FT_Read
+	if (ftdi_batch_transfer(&batch, data) != FT_OK)
+		log_error("Error while reading data register for device %d\n", device->device_index);
 
-	if (reset_JTAG_state_machine() != FT_OK) // Reset back to TLR
-	{
-		return;
-	}
+	ftdi_batch_free(&batch);
+}
 
-	// Goto Shift-IR
-	byOutputBuffer[dwNumBytesToSend++] = 0x4B;		 // Clock out TMS without read
-	byOutputBuffer[dwNumBytesToSend++] = 0x05;		 // Number of clock pulses = Length + 1 (6 clocks here)
-	byOutputBuffer[dwNumBytesToSend++] = 0b00001101; // Data is shifted LSB first, so actually 101100
+void ioread32_buffer(DWORD startAddr, DWORD *data, WORD size)
+{
+	ioread32_progress(startAddr, data, size, false);
+}
 
-	// Clock out Command/Address register opcode
-	byOutputBuffer[dwNumBytesToSend++] = 0x1B;			 // Clock bits out without read
-	byOutputBuffer[dwNumBytesToSend++] = 0x04;			 // Length + 1 (5 bits here), only 5 because the last one will be clocked by the next TMS command
-	byOutputBuffer[dwNumBytesToSend++] = CODE_ADDR_COMM; // First 5 bits of the 6-bit-long opcode
+void ioread32_progress(DWORD startAddr, DWORD *data, WORD size, bool progress)
+{
+	if (progress) // Optional terminal progress output
+		printf("Reading data from memory... \n");
 
-	// Clock out last bit of the opcode and leave to Exit-IR immediately
-	byOutputBuffer[dwNumBytesToSend++] = 0x4B;						// Clock bits out to TMS without read, move out of Shift-IR and clock out the last TDI/DO bit
-	byOutputBuffer[dwNumBytesToSend++] = 0x00;						// Length + 1 (1 bits here)
-	byOutputBuffer[dwNumBytesToSend++] = (CODE_ADDR_COMM << 2) | 1; // Move the MSB of the opcode to the MSB of the BYTE, then make the first bit a 1 for TMS
-
-	// Goto Shift-DR
-	byOutputBuffer[dwNumBytesToSend++] = 0x4B;		 // Clock out TMS without read
-	byOutputBuffer[dwNumBytesToSend++] = 0x03;		 // Number of clock pulses = Length + 1 (4 clocks here)
-	byOutputBuffer[dwNumBytesToSend++] = 0b00000011; // Data is shifted LSB first, so the TMS pattern is 1100
-
-	// Clock out 6 x 8 bits of 0s only to clear out any other values
-	byOutputBuffer[dwNumBytesToSend++] = 0x19; // Clock bytes out without read
-	byOutputBuffer[dwNumBytesToSend++] = 0x05; // Length + 1 (6 bytes here)
-	byOutputBuffer[dwNumBytesToSend++] = 0x00;
-	for (BYTE i = 0; i < 6; i++)
-	{
-		byOutputBuffer[dwNumBytesToSend++] = 0x00; // Zeros only
-	}
-
-	/*
-	// Clock out Read: FIXES SOME ISSUES; I DONT KNOW WHY?!
-	byOutputBuffer[dwNumBytesToSend++] = 0x2A;													 // Read back bits
-	byOutputBuffer[dwNumBytesToSend++] = 0x07;													 // Length + 1 (8 bits here)
-	FT_STATUS ftStatus = FT_Write(_ftHandle, byOutputBuffer, dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
-
-	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend)
-	{
-		cerr << "Communication error with JTAG device!" << endl;
-		return;
-	}
-	dwNumBytesToSend = 0; // Reset output buffer pointer
-
-	// Do a read to flush the read buffer, the data is not needed...
-	do
-	{
-		ftStatus = FT_GetQueueStatus(_ftHandle, &dwNumBytesToRead);					   // Get the number of bytes in the device input buffer
-	} while ((dwNumBytesToRead == 0) && (ftStatus == FT_OK));						   // or Timeout
-	ftStatus |= FT_Read(_ftHandle, &byInputBuffer, dwNumBytesToRead, &dwNumBytesRead); // Read out the data from input buffer
-	*/
-
-	// Clock out come clock cycles: FIXES SOME ISSUES WITH READING; I DONT KNOW WHY?!
-	// Much faster way of doing the above with the added (very low) risk of producing garbage output apparently?
-	byOutputBuffer[dwNumBytesToSend++] = 0x8E; // Clock output
-	byOutputBuffer[dwNumBytesToSend++] = 0x07; // Length + 1 (8 bits here)
-
-	// Shift out AHB address DWORD (4 bytes)
-	byOutputBuffer[dwNumBytesToSend++] = 0x19; // Clock bytes out without read
-	byOutputBuffer[dwNumBytesToSend++] = 0x03; // Length + 1 (4 bytes here)
-	byOutputBuffer[dwNumBytesToSend++] = 0x00;
-
-	byOutputBuffer[dwNumBytesToSend++] = (startAddr & 0xFF);		 // First Byte of DWORD address
-	byOutputBuffer[dwNumBytesToSend++] = ((startAddr >> 8) & 0xFF);	 // Second Byte of DWORD address
-	byOutputBuffer[dwNumBytesToSend++] = ((startAddr >> 16) & 0xFF); // Third Byte of DWORD address
-	byOutputBuffer[dwNumBytesToSend++] = ((startAddr >> 24) & 0xFF); // Last Byte of DWORD address
-
-	// Shift out 2-bit AHB transfer size: 10 for WORD
-	byOutputBuffer[dwNumBytesToSend++] = 0x1B;	   // Clock bits out without read
-	byOutputBuffer[dwNumBytesToSend++] = 0x01;	   // Length + 1 (2 bits here)
-	byOutputBuffer[dwNumBytesToSend++] = RW_DWORD; // Read 32-bit DWORD
-
-	// Shift out 1-bit Read/Write Instruction: 0x0 for READ while simultaneously leaving Shift-DR via TMS Exit-DR
-	byOutputBuffer[dwNumBytesToSend++] = 0x4B;		 // Clock bits out with read
-	byOutputBuffer[dwNumBytesToSend++] = 0x00;		 // Length + 1 (1 bits here)
-	byOutputBuffer[dwNumBytesToSend++] = 0b00000001; // Ones only
-
-	// Go to Shift-IR
-	byOutputBuffer[dwNumBytesToSend++] = 0x4B;		// Clock bits out without read
-	byOutputBuffer[dwNumBytesToSend++] = 0x04;		// Length + 1 (5 bits here)
-	byOutputBuffer[dwNumBytesToSend++] = 0b0000111; // 11100
-
-	// Clock out Data register opcode
-	byOutputBuffer[dwNumBytesToSend++] = 0x1B;		// Clock bits out without read
-	byOutputBuffer[dwNumBytesToSend++] = 0x04;		// Length + 1 (5 bits here), only 5 because the last one will be clocked by the next TMS command
-	byOutputBuffer[dwNumBytesToSend++] = CODE_DATA; // First 5 bits of the 6-bit-long opcode
-
-	// Clock out last bit of the opcode and leave to Exit-IR immediately
-	byOutputBuffer[dwNumBytesToSend++] = 0x4B;				   // Clock bits out to TMS, move out of Shift-IR and clock out the last TDI/DO bit
-	byOutputBuffer[dwNumBytesToSend++] = 0x00;				   // Length + 1 (1 bits here)
-	byOutputBuffer[dwNumBytesToSend++] = (CODE_DATA << 2) | 1; // Move the MSB of the opcode to the MSB of the BYTE, then make the first bit a 1 for TMS
-
-	// Goto Shift-DR
-	byOutputBuffer[dwNumBytesToSend++] = 0x4B;													 // Clock out TMS without read
-	byOutputBuffer[dwNumBytesToSend++] = 0x03;													 // Number of clock pulses = Length + 1 (4 clocks here)
-	byOutputBuffer[dwNumBytesToSend++] = 0b00000011;											 // Data is shifted LSB first, so the TMS pattern is 1100
-	FT_STATUS ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
-								  dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
-
-	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Communication error with JTAG device %d!\n", device.device_index);
-		return;
-	}
-	dwNumBytesToSend = 0; // Reset output buffer pointer
-
-	for (WORD i = 0; i < size; i++) {
-		// Clock out read command
-		byOutputBuffer[dwNumBytesToSend++] = 0x28; // Read Bytes
-		byOutputBuffer[dwNumBytesToSend++] = 0x03; // 3 + 1 Bytes = 32 bit AHB Data -> Does not read SEQ Bit!
-		byOutputBuffer[dwNumBytesToSend++] = 0x00;
-
-		// Send off the TMS command
-		ftStatus |= FT_Write(device.ft_handle, byOutputBuffer,
-							 dwNumBytesToSend, &dwNumBytesSent); 
-
-		if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-			fprintf(stderr, "Error while shifting out read instruction for device %d\n", device.device_index);
-			break;
-		}
-
-		dwNumBytesToSend = 0; // Reset output buffer pointer
-
-		do {
-			// Get the number of bytes in the device input buffer
-			ftStatus = FT_GetQueueStatus(device.ft_handle, &dwNumBytesToRead);					   
-		} while ((dwNumBytesToRead == 0) && (ftStatus == FT_OK));						   // or Timeout
-
-		// Read out the data from input buffer
-		ftStatus |= FT_Read(device.ft_handle, &byInputBuffer, dwNumBytesToRead, &dwNumBytesRead); 
-
-		if (ftStatus != FT_OK) {
-			fprintf(stderr, "Error while reading data register for device %d\n", device.device_index);
-			break;
-		}
-
-		if (dwNumBytesRead != dwNumBytesToRead) {
-			fprintf(stderr, "Bytes read: %d\n", dwNumBytesRead);
-			fprintf(stderr, "Device did not return the correct number of bytes for the data register.\n");
-			break;
-		}
-
-		// Format data
-		DWORD newData = (DWORD)((unsigned char)(byInputBuffer[3]) << 24 |
-								(unsigned char)(byInputBuffer[2]) << 16 |
-								(unsigned char)(byInputBuffer[1]) << 8 |
-								(unsigned char)(byInputBuffer[0]));
-		data[i] = newData;
-
-		// Loop around once through Update-DR and then go back to Shift-DR
-		byOutputBuffer[dwNumBytesToSend++] = 0x4B;										   // Clock bits out without read
-		byOutputBuffer[dwNumBytesToSend++] = 0x04;										   // Length + 1 (4 bits here)
-		byOutputBuffer[dwNumBytesToSend++] = 0b10000111;								   // 11100
-
-		// Send off the TMS command
-		ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
-							dwNumBytesToSend, &dwNumBytesSent); 
-
-		if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-			fprintf(stderr, "Communication error with JTAG device!\n");
-			break;
-		}
-
-		dwNumBytesToSend = 0; // Reset output buffer pointer
-	}
-}
-
-void ioread32_buffer(DWORD startAddr, DWORD *data, WORD size)
-{
-	ioread32_progress(startAddr, data, size, false);
-}
-
-void ioread32_progress(DWORD startAddr, DWORD *data, WORD size, bool progress)
-{
-	if (progress) // Optional terminal progress output
-		printf("Reading data from memory... \n");
-
-	WORD readChunks = ceil((float)size / 256.0); // How many individual read chunks are needed
+	WORD readChunks = ceil((float)size / 256.0); // How many individual read chunks are needed
 
 	DWORD tempData[256]; // Allocate the tempData array outside the loop with max size
 
@@ -1542,6 +2231,13 @@ void ioread32_progress(DWORD startAddr, DWORD *data, WORD size, bool progress)
 
 void iowrite8(DWORD addr, BYTE data)
 {
+	if (device->link == FTDI_LINK_AHBUART) {
+		const int shift = 8 * (3 - (addr & 0x3));
+
+		link_write_lanes(addr, (DWORD) data << shift, 0xFFu << shift);
+		return;
+	}
+
 	BYTE byOutputBuffer[100];	// Buffer to hold MPSSE commands and data to be sent to the FT2232H
 	DWORD dwNumBytesToSend = 0; // Index to the output buffer
 	DWORD dwNumBytesSent = 0;	// Count of actual bytes sent - used with FT_Write
@@ -1588,11 +2284,11 @@ void iowrite8(DWORD addr, BYTE data)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;													 // Clock bits out with read
 	byOutputBuffer[dwNumBytesToSend++] = 0x00;													 // Length + 1 (1 bits here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b10000001;											 // Ones only
-	FT_STATUS ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	FT_STATUS ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 								  dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Error while shifting out WRITE command for device %d\n", device.device_index);
+		log_error("Error while shifting out WRITE command for device %d\n", device->device_index);
 		return;
 	}
 	dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -1616,7 +2312,7 @@ void iowrite8(DWORD addr, BYTE data)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;										   // Clock out TMS without read
 	byOutputBuffer[dwNumBytesToSend++] = 0x03;										   // Number of clock pulses = Length + 1 (4 clocks here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b00000011;								   // Data is shifted LSB first, so the TMS pattern is 1100
-	ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 						dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
@@ -1665,11 +2361,11 @@ void iowrite8(DWORD addr, BYTE data)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;										   // Clock bits out with read
 	byOutputBuffer[dwNumBytesToSend++] = 0x00;										   // Length + 1 (1 bits here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b00000001;								   // Only 1 to leave Shift-DR
-	ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 						dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Error while shifting out data for device %d\n", device.device_index);
+		log_error("Error while shifting out data for device %d\n", device->device_index);
 		return;
 	}
 	// dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -1677,6 +2373,13 @@ void iowrite8(DWORD addr, BYTE data)
 
 void iowrite16(DWORD addr, WORD data)
 {
+	if (device->link == FTDI_LINK_AHBUART) {
+		const int shift = (addr & 0x2) ? 0 : 16;
+
+		link_write_lanes(addr, (DWORD) data << shift, 0xFFFFu << shift);
+		return;
+	}
+
 	BYTE byOutputBuffer[100];	// Buffer to hold MPSSE commands and data to be sent to the FT2232H
 	DWORD dwNumBytesToSend = 0; // Index to the output buffer
 	DWORD dwNumBytesSent = 0;	// Count of actual bytes sent - used with FT_Write
@@ -1723,11 +2426,11 @@ void iowrite16(DWORD addr, WORD data)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;													 // Clock bits out with read
 	byOutputBuffer[dwNumBytesToSend++] = 0x00;													 // Length + 1 (1 bits here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b10000001;											 // Ones only
-	FT_STATUS ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	FT_STATUS ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 								  dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Error while shifting out WRITE command for device %d\n", device.device_index);
+		log_error("Error while shifting out WRITE command for device %d\n", device->device_index);
 		return;
 	}
 	
@@ -1752,11 +2455,11 @@ void iowrite16(DWORD addr, WORD data)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;										   // Clock out TMS without read
 	byOutputBuffer[dwNumBytesToSend++] = 0x03;										   // Number of clock pulses = Length + 1 (4 clocks here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b00000011;								   // Data is shifted LSB first, so the TMS pattern is 1100
-	ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 						dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Communication error with JTAG device!\n");
+		log_error("Communication error with JTAG device!\n");
 		return;
 	}
 	dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -1785,11 +2488,11 @@ void iowrite16(DWORD addr, WORD data)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;										   // Clock bits out with read
 	byOutputBuffer[dwNumBytesToSend++] = 0x00;										   // Length + 1 (1 bits here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b00000001;								   // Only 1 to leave Shift-DR
-	ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 						dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Error while shifting out data for device %d\n", device.device_index);
+		log_error("Error while shifting out data for device %d\n", device->device_index);
 		return;
 	}
 	// dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -1797,6 +2500,11 @@ void iowrite16(DWORD addr, WORD data)
 
 void iowrite32(DWORD addr, DWORD data)
 {
+	if (device->link == FTDI_LINK_AHBUART) {
+		link_write32(addr, data);
+		return;
+	}
+
 	BYTE byOutputBuffer[100];	// Buffer to hold MPSSE commands and data to be sent to the FT2232H
 	DWORD dwNumBytesToSend = 0; // Index to the output buffer
 	DWORD dwNumBytesSent = 0;	// Count of actual bytes sent - used with FT_Write
@@ -1843,11 +2551,11 @@ void iowrite32(DWORD addr, DWORD data)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;													 // Clock bits out with read
 	byOutputBuffer[dwNumBytesToSend++] = 0x00;													 // Length + 1 (1 bits here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b10000001;											 // Ones only
-	FT_STATUS ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	FT_STATUS ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 								  dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Error while shifting out WRITE command for device %d\n", device.device_index);
+		log_error("Error while shifting out WRITE command for device %d\n", device->device_index);
 		return;
 	}
 	dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -1871,11 +2579,11 @@ void iowrite32(DWORD addr, DWORD data)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;										   // Clock out TMS without read
 	byOutputBuffer[dwNumBytesToSend++] = 0x03;										   // Number of clock pulses = Length + 1 (4 clocks here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b00000011;								   // Data is shifted LSB first, so the TMS pattern is 1100
-	ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 						dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Communication error with JTAG device!\n");
+		log_error("Communication error with JTAG device!\n");
 		return;
 	}
 	dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -1894,11 +2602,11 @@ void iowrite32(DWORD addr, DWORD data)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;										   // Clock bits out with read
 	byOutputBuffer[dwNumBytesToSend++] = 0x00;										   // Length + 1 (1 bits here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b00000001;								   // Only 1 to leave Shift-DR
-	ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 						dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Error while shifting out data for device %d\n", device.device_index);
+		log_error("Error while shifting out data for device %d\n", device->device_index);
 		return;
 	}
 	// dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -1907,7 +2615,20 @@ void iowrite32(DWORD addr, DWORD data)
 void iowrite32raw(DWORD startAddr, DWORD *data, WORD size)
 {
 	if (size > 256) // Check 1kB boundary for SEQ transfers
-		fprintf(stderr, "Warning: Size is bigger than recommended 1 kB maximum (GR712RC-UM)!\n");
+		log_error("Warning: Size is bigger than recommended 1 kB maximum (GR712RC-UM)!\n");
+
+	if (device->link == FTDI_LINK_AHBUART) {
+		ftdi_batch batch;
+
+		ftdi_batch_init(&batch);
+		ftdi_batch_write32_seq(&batch, startAddr, data, size);
+
+		if (ftdi_batch_send(&batch) != FT_OK)
+			log_error("Error while writing to the AHBUART\n");
+
+		ftdi_batch_free(&batch);
+		return;
+	}
 
 	BYTE byOutputBuffer[100];	// Buffer to hold MPSSE commands and data to be sent to the FT2232H
 	DWORD dwNumBytesToSend = 0; // Index to the output buffer
@@ -1955,11 +2676,11 @@ void iowrite32raw(DWORD startAddr, DWORD *data, WORD size)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;													 // Clock bits out with read
 	byOutputBuffer[dwNumBytesToSend++] = 0x00;													 // Length + 1 (1 bits here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b10000001;											 // Ones only
-	FT_STATUS ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	FT_STATUS ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 								  dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Error while shifting out WRITE command for device %d\n", device.device_index);
+		log_error("Error while shifting out WRITE command for device %d\n", device->device_index);
 		return;
 	}
 	dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -1983,11 +2704,11 @@ void iowrite32raw(DWORD startAddr, DWORD *data, WORD size)
 	byOutputBuffer[dwNumBytesToSend++] = 0x4B;										   // Clock out TMS without read
 	byOutputBuffer[dwNumBytesToSend++] = 0x03;										   // Number of clock pulses = Length + 1 (4 clocks here)
 	byOutputBuffer[dwNumBytesToSend++] = 0b00000011;								   // Data is shifted LSB first, so the TMS pattern is 1100
-	ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+	ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 						dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 	if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-		fprintf(stderr, "Communication error with JTAG device!\n");
+		log_error("Communication error with JTAG device!\n");
 		return;
 	}
 	dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -2017,11 +2738,11 @@ void iowrite32raw(DWORD startAddr, DWORD *data, WORD size)
 			byOutputBuffer[dwNumBytesToSend++] = 0x03;		 // Length + 1 (3 bits here)
 			byOutputBuffer[dwNumBytesToSend++] = 0b00000011; // 1100
 		}
-		ftStatus = FT_Write(device.ft_handle, byOutputBuffer,
+		ftStatus = FT_Write(device->ft_handle, byOutputBuffer,
 							dwNumBytesToSend, &dwNumBytesSent); // Send off the TMS command
 
 		if (ftStatus != FT_OK || dwNumBytesSent != dwNumBytesToSend) {
-			fprintf(stderr, "Communication error with JTAG device!\n");
+			log_error("Communication error with JTAG device!\n");
 			break;
 		}
 		dwNumBytesToSend = 0; // Reset output buffer pointer
@@ -2064,6 +2785,730 @@ void iowrite32_progress(DWORD startAddr, DWORD *data, WORD size, bool progress)
 		printf("Writing data to memory... Complete!   \n");
 }
 
+/*
+ * Byte buffers at any alignment, moved with SEQ bursts of whole DWORDs;
+ * memory is big endian, so the first byte of a DWORD is its MSB
+ */
+
+#define BYTE_BUFFER_CHUNK (16 * 1024) // Bytes per USB transaction
+
+bool ioread8_buffer(DWORD startAddr, BYTE *data, DWORD size)
+{
+	DWORD words[BYTE_BUFFER_CHUNK / 4 + 2];
+	ftdi_batch batch;
+	bool ok = true;
+
+	ftdi_batch_init(&batch);
+
+	while (ok && size > 0) {
+		const DWORD length = size > BYTE_BUFFER_CHUNK ? BYTE_BUFFER_CHUNK : size;
+		const DWORD first = startAddr & ~0x3;
+		const DWORD last = (startAddr + length + 3) & ~0x3;
+
+		ftdi_batch_clear(&batch);
+		ftdi_batch_read32_block(&batch, first, (last - first) / 4);
+
+		ok = ftdi_batch_transfer(&batch, words) == FT_OK;
+
+		for (DWORD i = 0; ok && i < length; i++) {
+			const DWORD addr = startAddr + i;
+
+			data[i] = (words[(addr - first) / 4] >> (8 * (3 - (addr & 0x3)))) & 0xFF;
+		}
+
+		startAddr += length;
+		data += length;
+		size -= length;
+	}
+
+	ftdi_batch_free(&batch);
+
+	return ok;
+}
+
+bool iowrite8_buffer(DWORD startAddr, const BYTE *data, DWORD size)
+{
+	ftdi_batch batch;
+	bool ok = true;
+
+	ftdi_batch_init(&batch);
+
+	while (ok && size > 0) {
+		DWORD length = size > BYTE_BUFFER_CHUNK ? BYTE_BUFFER_CHUNK : size;
+
+		ftdi_batch_clear(&batch);
+		ftdi_batch_write8_buffer(&batch, startAddr, data, length);
+
+		ok = ftdi_batch_send(&batch) == FT_OK;
+
+		startAddr += length;
+		data += length;
+		size -= length;
+	}
+
+	ftdi_batch_free(&batch);
+
+	return ok;
+}
+
+/*
+ * Batched transactions
+ */
+
+static void batch_write_bytes(ftdi_batch *batch, DWORD addr, const BYTE *data, DWORD count);
+
+void ftdi_batch_write8_buffer(ftdi_batch *batch, DWORD startAddr, const BYTE *data, DWORD size)
+{
+	DWORD words[BYTE_BUFFER_CHUNK / 4];
+
+	while (size > 0) {
+		DWORD length = size > BYTE_BUFFER_CHUNK ? BYTE_BUFFER_CHUNK : size;
+		DWORD i = 0;
+
+		// Unaligned head and tail are written byte by byte, on the AHBUART merged into their word
+		while (i < length && ((startAddr + i) & 0x3))
+			i++;
+
+		batch_write_bytes(batch, startAddr, data, i);
+
+		const DWORD aligned = (length - i) / 4;
+
+		for (DWORD w = 0; w < aligned; w++, i += 4)
+			words[w] = (DWORD)data[i] << 24 | (DWORD)data[i + 1] << 16
+				   | (DWORD)data[i + 2] << 8 | data[i + 3];
+
+		ftdi_batch_write32_block(batch, startAddr + i - aligned * 4, words, aligned);
+
+		batch_write_bytes(batch, startAddr + i, &data[i], length - i);
+
+		startAddr += length;
+		data += length;
+		size -= length;
+	}
+}
+
+// Bytes between two data DWORDs of a sequential write in the command stream
+#define BATCH_SEQ_STRIDE 13
+
+void ftdi_batch_init(ftdi_batch *batch)
+{
+	batch->buf = NULL;
+	batch->len = 0;
+	batch->size = 0;
+	batch->reads = 0;
+}
+
+void ftdi_batch_free(ftdi_batch *batch)
+{
+	free(batch->buf);
+	ftdi_batch_init(batch);
+}
+
+void ftdi_batch_clear(ftdi_batch *batch)
+{
+	batch->len = 0;
+	batch->reads = 0;
+}
+
+static void batch_reserve(ftdi_batch *batch, DWORD len)
+{
+	if (batch->len + len <= batch->size)
+		return;
+
+	DWORD size = batch->size ? batch->size : 256;
+
+	while (size < batch->len + len)
+		size *= 2;
+
+	BYTE *buf = realloc(batch->buf, size);
+
+	if (buf == NULL) {
+		log_error("Out of memory while building JTAG batch!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	batch->buf = buf;
+	batch->size = size;
+}
+
+static void batch_put3(ftdi_batch *batch, BYTE b0, BYTE b1, BYTE b2)
+{
+	batch_reserve(batch, 3);
+
+	batch->buf[batch->len++] = b0;
+	batch->buf[batch->len++] = b1;
+	batch->buf[batch->len++] = b2;
+}
+
+void ftdi_batch_append(ftdi_batch *batch, const ftdi_batch *script)
+{
+	batch_reserve(batch, script->len);
+	memcpy(batch->buf + batch->len, script->buf, script->len);
+	batch->len += script->len;
+	batch->reads += script->reads;
+}
+
+/*
+ * Shift out the AHB address/command and leave the TAP in Shift-DR of the data register,
+ * this is the same sequence that iowrite32() sends in its first two USB writes
+ */
+static void batch_command(ftdi_batch *batch, DWORD addr, BYTE size, bool write)
+{
+	batch_put3(batch, 0x4B, 0x04, 0b00111111);	 // Reset back to TLR
+	batch_put3(batch, 0x4B, 0x05, 0b00001101);	 // Goto Shift-IR
+	batch_put3(batch, 0x1B, 0x04, CODE_ADDR_COMM);	 // First 5 bits of the Command/Address register opcode
+	batch_put3(batch, 0x4B, 0x00, (CODE_ADDR_COMM << 2) | 1); // Last bit of the opcode and leave to Exit-IR
+	batch_put3(batch, 0x4B, 0x03, 0b00000011);	 // Goto Shift-DR
+
+	batch_reserve(batch, 7);
+	batch->buf[batch->len++] = 0x19; // Clock bytes out without read
+	batch->buf[batch->len++] = 0x03; // Length + 1 (4 bytes here)
+	batch->buf[batch->len++] = 0x00;
+	batch->buf[batch->len++] = (addr & 0xFF);
+	batch->buf[batch->len++] = ((addr >> 8) & 0xFF);
+	batch->buf[batch->len++] = ((addr >> 16) & 0xFF);
+	batch->buf[batch->len++] = ((addr >> 24) & 0xFF);
+
+	batch_put3(batch, 0x1B, 0x01, size);		// 2-bit AHB transfer size
+	batch_put3(batch, 0x4B, 0x00, write ? 0b10000001 : 0b00000001); // R/W bit and leave Shift-DR
+
+	batch_put3(batch, 0x4B, 0x04, 0b0000111);	// Go to Shift-IR
+	batch_put3(batch, 0x1B, 0x04, CODE_DATA);	// First 5 bits of the Data register opcode
+	batch_put3(batch, 0x4B, 0x00, (CODE_DATA << 2) | 1); // Last bit of the opcode and leave to Exit-IR
+	batch_put3(batch, 0x4B, 0x03, 0b00000011);	// Goto Shift-DR
+}
+
+// Shift out one data DWORD and leave Shift-DR with the SEQ bit set or cleared
+static DWORD batch_data(ftdi_batch *batch, DWORD data, bool seq)
+{
+	batch_reserve(batch, 10);
+
+	batch->buf[batch->len++] = 0x19; // Clock bytes out without read
+	batch->buf[batch->len++] = 0x03; // Length + 1 (4 bytes here)
+	batch->buf[batch->len++] = 0x00;
+
+	DWORD offset = batch->len;
+
+	batch->buf[batch->len++] = (data & 0xFF);
+	batch->buf[batch->len++] = ((data >> 8) & 0xFF);
+	batch->buf[batch->len++] = ((data >> 16) & 0xFF);
+	batch->buf[batch->len++] = ((data >> 24) & 0xFF);
+
+	batch_put3(batch, 0x4B, 0x00, seq ? 0b10000001 : 0b00000001);
+
+	return offset;
+}
+
+/* The same for the AHBUART, with up to AHBUART_MAX_BURST words after one command */
+static void ahbuart_command(ftdi_batch *batch, BYTE command, DWORD addr, WORD words)
+{
+	batch_reserve(batch, AHBUART_HEADER);
+
+	batch->buf[batch->len++] = command | (words - 1);
+	batch->buf[batch->len++] = (addr >> 24) & 0xFF;
+	batch->buf[batch->len++] = (addr >> 16) & 0xFF;
+	batch->buf[batch->len++] = (addr >> 8) & 0xFF;
+	batch->buf[batch->len++] = addr & 0xFF;
+}
+
+static DWORD ahbuart_data(ftdi_batch *batch, DWORD data)
+{
+	batch_reserve(batch, 4);
+
+	const DWORD offset = batch->len;
+
+	batch->buf[batch->len++] = (data >> 24) & 0xFF;
+	batch->buf[batch->len++] = (data >> 16) & 0xFF;
+	batch->buf[batch->len++] = (data >> 8) & 0xFF;
+	batch->buf[batch->len++] = data & 0xFF;
+
+	return offset;
+}
+
+static DWORD ahbuart_write_seq(ftdi_batch *batch, DWORD startAddr, const DWORD *data, WORD size)
+{
+	const DWORD offset = batch->len + AHBUART_HEADER;
+
+	for (WORD i = 0; i < size; i++) {
+		if (i % AHBUART_MAX_BURST == 0)
+			ahbuart_command(batch, AHBUART_WRITE, startAddr + i * 4,
+					size - i < AHBUART_MAX_BURST ? size - i : AHBUART_MAX_BURST);
+
+		ahbuart_data(batch, data ? data[i] : 0);
+	}
+
+	return offset;
+}
+
+DWORD ftdi_batch_write32(ftdi_batch *batch, DWORD addr, DWORD data)
+{
+	if (device->link == FTDI_LINK_AHBUART)
+		return ahbuart_write_seq(batch, addr, &data, 1);
+
+	batch_command(batch, addr, RW_DWORD, true);
+
+	return batch_data(batch, data, false);
+}
+
+DWORD ftdi_batch_write32_seq(ftdi_batch *batch, DWORD startAddr, const DWORD *data, WORD size)
+{
+	DWORD offset = 0;
+
+	if (size > 256) // Check 1kB boundary for SEQ transfers
+		log_error("Warning: Size is bigger than recommended 1 kB maximum (GR712RC-UM)!\n");
+
+	if (device->link == FTDI_LINK_AHBUART)
+		return ahbuart_write_seq(batch, startAddr, data, size);
+
+	batch_command(batch, startAddr, RW_DWORD, true);
+
+	for (WORD i = 0; i < size; i++) {
+		DWORD o = batch_data(batch, data ? data[i] : 0, true);
+
+		if (i == 0)
+			offset = o;
+
+		// Loop around once through Update-DR and then go back to Shift-DR, see iowrite32raw()
+		if (i < size - 1)
+			batch_put3(batch, 0x4B, 0x03, 0b00000011);
+	}
+
+	return offset;
+}
+
+DWORD ftdi_batch_seq_offset(DWORD offset, WORD index)
+{
+	if (device->link == FTDI_LINK_AHBUART)
+		return offset + index * 4 + index / AHBUART_MAX_BURST * AHBUART_HEADER;
+
+	return offset + index * BATCH_SEQ_STRIDE;
+}
+
+void ftdi_batch_patch32(ftdi_batch *batch, DWORD offset, DWORD data)
+{
+	if (device->link == FTDI_LINK_AHBUART) {
+		batch->buf[offset] = (data >> 24) & 0xFF;
+		batch->buf[offset + 1] = (data >> 16) & 0xFF;
+		batch->buf[offset + 2] = (data >> 8) & 0xFF;
+		batch->buf[offset + 3] = data & 0xFF;
+		return;
+	}
+
+	batch->buf[offset] = (data & 0xFF);
+	batch->buf[offset + 1] = ((data >> 8) & 0xFF);
+	batch->buf[offset + 2] = ((data >> 16) & 0xFF);
+	batch->buf[offset + 3] = ((data >> 24) & 0xFF);
+}
+
+/*
+ * Shift out the AHB address/read command with the same clear out and extra
+ * clocks as ioread32() and leave the TAP in Shift-DR of the data register
+ */
+static void batch_read_command(ftdi_batch *batch, DWORD addr)
+{
+	batch_put3(batch, 0x4B, 0x04, 0b00111111);	 // Reset back to TLR
+	batch_put3(batch, 0x4B, 0x05, 0b00001101);	 // Goto Shift-IR
+	batch_put3(batch, 0x1B, 0x04, CODE_ADDR_COMM);	 // First 5 bits of the Command/Address register opcode
+	batch_put3(batch, 0x4B, 0x00, (CODE_ADDR_COMM << 2) | 1); // Last bit of the opcode and leave to Exit-IR
+	batch_put3(batch, 0x4B, 0x03, 0b00000011);	 // Goto Shift-DR
+
+	batch_reserve(batch, 9 + 2 + 7);
+	batch->buf[batch->len++] = 0x19; // Clock bytes out without read
+	batch->buf[batch->len++] = 0x05; // Length + 1 (6 bytes here)
+	batch->buf[batch->len++] = 0x00;
+	for (BYTE i = 0; i < 6; i++)
+		batch->buf[batch->len++] = 0x00;
+
+	batch->buf[batch->len++] = 0x8E; // Clock output
+	batch->buf[batch->len++] = 0x07; // Length + 1 (8 bits here)
+
+	batch->buf[batch->len++] = 0x19; // Clock bytes out without read
+	batch->buf[batch->len++] = 0x03; // Length + 1 (4 bytes here)
+	batch->buf[batch->len++] = 0x00;
+	batch->buf[batch->len++] = (addr & 0xFF);
+	batch->buf[batch->len++] = ((addr >> 8) & 0xFF);
+	batch->buf[batch->len++] = ((addr >> 16) & 0xFF);
+	batch->buf[batch->len++] = ((addr >> 24) & 0xFF);
+
+	batch_put3(batch, 0x1B, 0x01, RW_DWORD);	// 2-bit AHB transfer size
+	batch_put3(batch, 0x4B, 0x00, 0b00000001);	// Read and leave Shift-DR
+
+	batch_put3(batch, 0x4B, 0x04, 0b0000111);	// Go to Shift-IR
+	batch_put3(batch, 0x1B, 0x04, CODE_DATA);	// First 5 bits of the Data register opcode
+	batch_put3(batch, 0x4B, 0x00, (CODE_DATA << 2) | 1); // Last bit of the opcode and leave to Exit-IR
+	batch_put3(batch, 0x4B, 0x03, 0b00000011);	// Goto Shift-DR
+}
+
+DWORD ftdi_batch_read32(ftdi_batch *batch, DWORD addr)
+{
+	if (device->link == FTDI_LINK_AHBUART) {
+		ahbuart_command(batch, AHBUART_READ, addr, 1);
+		return batch->reads++;
+	}
+
+	batch_read_command(batch, addr);
+	batch_put3(batch, 0x28, 0x03, 0x00);		// Read 32 bit AHB data, without the SEQ bit
+
+	return batch->reads++;
+}
+
+DWORD ftdi_batch_read32_seq(ftdi_batch *batch, DWORD startAddr, WORD size)
+{
+	const DWORD first = batch->reads;
+
+	if (size > 256) // Check 1kB boundary for SEQ transfers
+		log_error("Warning: Size is bigger than recommended 1 kB maximum (GR712RC-UM)!\n");
+
+	if (device->link == FTDI_LINK_AHBUART) {
+		for (WORD i = 0; i < size; i += AHBUART_MAX_BURST)
+			ahbuart_command(batch, AHBUART_READ, startAddr + i * 4,
+					size - i < AHBUART_MAX_BURST ? size - i : AHBUART_MAX_BURST);
+
+		batch->reads += size;
+
+		return first;
+	}
+
+	batch_read_command(batch, startAddr);
+
+	for (WORD i = 0; i < size; i++) {
+		batch_put3(batch, 0x28, 0x03, 0x00);		// Read 32 bit AHB data, without the SEQ bit
+		batch_put3(batch, 0x4B, 0x04, 0b10000111);	// SEQ bit, loop through Update-DR back to Shift-DR
+	}
+
+	batch->reads += size;
+
+	return first;
+}
+
+// SEQ transfers must not cross a 1 kB boundary (GR712RC-UM)
+#define SEQ_BOUNDARY 1024
+
+static WORD seq_burst_size(DWORD addr, DWORD words)
+{
+	DWORD burst = (SEQ_BOUNDARY - (addr % SEQ_BOUNDARY)) / 4;
+
+	return burst > words ? words : burst;
+}
+
+DWORD ftdi_batch_read32_block(ftdi_batch *batch, DWORD startAddr, DWORD size)
+{
+	const DWORD first = batch->reads;
+
+	while (size > 0) {
+		const WORD burst = seq_burst_size(startAddr, size);
+
+		ftdi_batch_read32_seq(batch, startAddr, burst);
+
+		startAddr += burst * 4;
+		size -= burst;
+	}
+
+	return first;
+}
+
+void ftdi_batch_write32_block(ftdi_batch *batch, DWORD startAddr, const DWORD *data, DWORD size)
+{
+	while (size > 0) {
+		const WORD burst = seq_burst_size(startAddr, size);
+
+		ftdi_batch_write32_seq(batch, startAddr, data, burst);
+
+		startAddr += burst * 4;
+		data += burst;
+		size -= burst;
+	}
+}
+
+/* Last value the batch writes to the word, the commands are walked from the start */
+static bool ahbuart_batch_word(const ftdi_batch *batch, DWORD addr, DWORD *word)
+{
+	bool found = false;
+	DWORD i = 0;
+
+	addr &= ~0x3;
+
+	while (i + AHBUART_HEADER <= batch->len) {
+		const BYTE *command = &batch->buf[i];
+		const DWORD words = (command[0] & ~AHBUART_WRITE) + 1;
+		const DWORD start = (DWORD) command[1] << 24 | command[2] << 16 | command[3] << 8 | command[4];
+
+		i += AHBUART_HEADER;
+
+		if ((command[0] & AHBUART_WRITE) != AHBUART_WRITE)
+			continue;
+
+		if (addr - start < words * 4) {
+			const BYTE *data = &batch->buf[i + addr - start];
+
+			*word = (DWORD) data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+			found = true;
+		}
+
+		i += words * 4;
+	}
+
+	return found;
+}
+
+/*
+ * The AHBUART only writes words, the other bytes of the word are read right
+ * away. If the batch already writes that word, they are taken from there,
+ * the read would not see that write yet.
+ */
+static void ahbuart_write_bytes(ftdi_batch *batch, DWORD addr, const BYTE *data, DWORD count)
+{
+	DWORD word;
+
+	if (!ahbuart_batch_word(batch, addr, &word))
+		word = link_read32(addr);
+
+	for (DWORD i = 0; i < count; i++) {
+		const int shift = 8 * (3 - ((addr + i) & 0x3));
+
+		word = (word & ~(0xFFu << shift)) | (DWORD) data[i] << shift;
+	}
+
+	ahbuart_write_seq(batch, addr & ~0x3, &word, 1);
+}
+
+void ftdi_batch_write8(ftdi_batch *batch, DWORD addr, BYTE data)
+{
+	if (device->link == FTDI_LINK_AHBUART) {
+		ahbuart_write_bytes(batch, addr, &data, 1);
+		return;
+	}
+
+	batch_command(batch, addr, RW_BYTE, true);
+
+	// Big endian byte lanes, see iowrite8()
+	batch_data(batch, (DWORD) data << (8 * (3 - (addr & 0x3))), false);
+}
+
+// Up to the bytes of one word
+static void batch_write_bytes(ftdi_batch *batch, DWORD addr, const BYTE *data, DWORD count)
+{
+	if (device->link == FTDI_LINK_AHBUART) {
+		if (count > 0)
+			ahbuart_write_bytes(batch, addr, data, count);
+		return;
+	}
+
+	for (DWORD i = 0; i < count; i++)
+		ftdi_batch_write8(batch, addr + i, data[i]);
+}
+
+/*
+ * Shift out the batch followed by a TAP reset. The data of the last write is
+ * only committed when the TAP passes Update-DR, don't leave it pending until
+ * whatever transaction comes next.
+ */
+static FT_STATUS batch_write(ftdi_batch *batch, bool send_immediate)
+{
+	DWORD len = batch->len;
+	DWORD bytes_sent = 0;
+
+	if (device->link == FTDI_LINK_AHBUART)
+		return ahbuart_transfer(device->uart_fd, batch->buf, len, NULL, 0) ? FT_OK : FT_IO_ERROR;
+
+	batch_reserve(batch, 4);
+	batch->buf[len++] = 0x4B;	// Reset back to TLR
+	batch->buf[len++] = 0x04;
+	batch->buf[len++] = 0b00111111;
+
+	// Send immediate, don't wait for the latency timer to return the data
+	if (send_immediate)
+		batch->buf[len++] = 0x87;
+
+	FT_STATUS ft_status = FT_Write(device->ft_handle, batch->buf, len, &bytes_sent);
+
+	if (ft_status != FT_OK && reconnect())
+		ft_status = FT_Write(device->ft_handle, batch->buf, len, &bytes_sent);
+
+	if (ft_status != FT_OK || bytes_sent != len) {
+		log_error("Error while sending batched transactions to device %d\n", device->device_index);
+		return ft_status != FT_OK ? ft_status : FT_IO_ERROR;
+	}
+
+	return FT_OK;
+}
+
+FT_STATUS ftdi_batch_send(ftdi_batch *batch)
+{
+	if (batch->len == 0)
+		return FT_OK;
+
+	return batch_write(batch, false);
+}
+
+void ftdi_batch_seal(ftdi_batch *batch)
+{
+	// Nothing is left pending on the AHBUART
+	if (device->link == FTDI_LINK_AHBUART)
+		return;
+
+	batch_put3(batch, 0x4B, 0x04, 0b00111111); // Reset back to TLR
+}
+
+/* The stream is not touched, unlike with ftdi_batch_send() */
+FT_STATUS ftdi_batch_send_sealed(const ftdi_batch *batch)
+{
+	DWORD bytes_sent = 0;
+
+	if (batch->len == 0)
+		return FT_OK;
+
+	if (device->link == FTDI_LINK_AHBUART)
+		return ahbuart_transfer(device->uart_fd, batch->buf, batch->len, NULL, 0) ? FT_OK : FT_IO_ERROR;
+
+	FT_STATUS ft_status = FT_Write(device->ft_handle, (LPVOID) batch->buf, batch->len, &bytes_sent);
+
+	if (ft_status != FT_OK && reconnect())
+		ft_status = FT_Write(device->ft_handle, (LPVOID) batch->buf, batch->len, &bytes_sent);
+
+	if (ft_status != FT_OK || bytes_sent != batch->len) {
+		log_error("Error while sending batched transactions to device %d\n", device->device_index);
+		return ft_status != FT_OK ? ft_status : FT_IO_ERROR;
+	}
+
+	return FT_OK;
+}
+
+/*
+ * Send the batch and collect the results of all reads in it, in the order
+ * they were added
+ */
+FT_STATUS ftdi_batch_transfer(ftdi_batch *batch, DWORD *data)
+{
+	const DWORD bytes_to_read = batch->reads * 4;
+	DWORD bytes_read = 0;
+	BYTE *in_buf;
+
+	if (batch->reads == 0)
+		return ftdi_batch_send(batch);
+
+	in_buf = malloc(bytes_to_read);
+
+	if (in_buf == NULL) {
+		log_error("Out of memory while reading JTAG batch!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// The AHBUART answers with big endian words
+	if (device->link == FTDI_LINK_AHBUART) {
+		const bool ok = ahbuart_transfer(device->uart_fd, batch->buf, batch->len, in_buf, bytes_to_read);
+
+		for (DWORD i = 0; ok && i < batch->reads; i++)
+			data[i] = (DWORD)in_buf[i * 4] << 24
+				  | (DWORD)in_buf[i * 4 + 1] << 16
+				  | (DWORD)in_buf[i * 4 + 2] << 8
+				  | (DWORD)in_buf[i * 4 + 3];
+
+		free(in_buf);
+
+		if (!ok)
+			log_error("Error while transferring batched transactions over the AHBUART\n");
+
+		return ok ? FT_OK : FT_IO_ERROR;
+	}
+
+	FT_STATUS ft_status = batch_write(batch, true);
+	bool replayed = false;
+
+	if (ft_status != FT_OK) {
+		free(in_buf);
+		return ft_status;
+	}
+
+	// The read timeout is 10 ms, give the device a second for all of it
+	for (int tries = 0; bytes_read < bytes_to_read && tries < 100; tries++) {
+		DWORD len = 0;
+
+		ft_status = FT_Read(device->ft_handle, in_buf + bytes_read,
+				    bytes_to_read - bytes_read, &len);
+
+		// The whole batch again, what came back so far belongs to the lost probe
+		if (ft_status != FT_OK && !replayed && reconnect()) {
+			replayed = true;
+			bytes_read = 0;
+			ft_status = batch_write(batch, true);
+			tries = 0;
+			len = 0;
+		}
+
+		if (ft_status != FT_OK)
+			break;
+
+		bytes_read += len;
+	}
+
+	if (ft_status != FT_OK || bytes_read != bytes_to_read) {
+		log_error("Device %d returned %d of %d bytes for batched reads\n",
+			device->device_index, bytes_read, bytes_to_read);
+		free(in_buf);
+		return ft_status != FT_OK ? ft_status : FT_IO_ERROR;
+	}
+
+	for (DWORD i = 0; i < batch->reads; i++)
+		data[i] = (DWORD)in_buf[i * 4 + 3] << 24
+			  | (DWORD)in_buf[i * 4 + 2] << 16
+			  | (DWORD)in_buf[i * 4 + 1] << 8
+			  | (DWORD)in_buf[i * 4];
+
+	free(in_buf);
+
+	return FT_OK;
+}
+
+/*
+ * Raw MPSSE access for other JTAG clients. The TAP is left wherever the
+ * commands put it, the batches start with a TAP reset anyway. Nothing is
+ * sent again if the probe is lost, the TAP state the commands depend on
+ * is lost with it. The next batch picks the probe up again.
+ */
+
+DWORD ftdi_get_tck_period()
+{
+	return (1 + TCK_DIVISOR) * 2 * 1000 / 60;
+}
+
+FT_STATUS ftdi_mpsse_transfer(const BYTE *out, DWORD out_len, BYTE *in, DWORD in_len)
+{
+	DWORD bytes_sent = 0;
+	DWORD bytes_read = 0;
+
+	if (jtag_only("Raw MPSSE access"))
+		return FT_NOT_SUPPORTED;
+
+	FT_STATUS ft_status = FT_Write(device->ft_handle, (LPVOID) out, out_len, &bytes_sent);
+
+	if (ft_status != FT_OK || bytes_sent != out_len) {
+		log_error("Error while sending MPSSE commands to device %d\n", device->device_index);
+		return ft_status != FT_OK ? ft_status : FT_IO_ERROR;
+	}
+
+	// One read for all of it, repeated only when the 10 ms timeout cuts it short
+	for (int tries = 0; bytes_read < in_len && tries < 100; tries++) {
+		DWORD len = 0;
+
+		ft_status = FT_Read(device->ft_handle, in + bytes_read, in_len - bytes_read, &len);
+
+
+		if (ft_status != FT_OK)
+			break;
+
+		bytes_read += len;
+	}
+
+	if (ft_status != FT_OK || bytes_read != in_len) {
+		log_error("Device %d returned %d of %d bytes for MPSSE commands\n",
+			device->device_index, bytes_read, in_len);
+		return ft_status != FT_OK ? ft_status : FT_IO_ERROR;
+	}
+
+	return FT_OK;
+}
+
 
 void pr_err(const char * const output)
 {
@@ -8,7 +8,10 @@
 	communicate to the processor via JTAG.
 
 	Can be used to instantiate multiple JTAG devices
-	at the same time, in the same program.
+	at the same time, in the same program. Each
+	thread works on the device it selected, the
+	state the modules keep per probe is indexed
+	by the slot of that device.
 	==========================================
 */
 
@@ -23,18 +26,60 @@
 extern const unsigned int CODE_ADDR_COMM;
 extern const DWORD CODE_DATA;
 
+enum ftdi_log_level {
+	FTDI_LOG_INFO,	// Progress of opening and closing
+	FTDI_LOG_ERROR
+};
+
+typedef void (*ftdi_log_handler)(enum ftdi_log_level level, const char *message, void *arg);
+
+#define FTDI_MAX_DEVICES 16	// Open at the same time, slot 0 is the built in device
+
+// How the AHB accesses of a device reach the target
+enum ftdi_link {
+	FTDI_LINK_JTAG,		// MPSSE of the FTDI chip
+	FTDI_LINK_AHBUART	// Serial device of the host, see uviemon_ahbuart.h
+};
+
 typedef struct {
 	FT_HANDLE ft_handle;
 	DWORD device_index;
 	int cpu_type;
 	bool first_run;
 	uint32_t active_cpu;
+	ftdi_log_handler log;	// NULL prints info to stdout and errors to stderr
+	void *log_arg;
+	unsigned int slot;	// Of the per probe state, taken by ftdi_open_device()
+	char serial[16];	// Finds the probe again after it was reset or plugged in again
+	bool reconnecting;
+	enum ftdi_link link;
+	int uart_fd;		// Of FTDI_LINK_AHBUART
 } ftdi_device;
 
+// The device all other functions of the calling thread work on, NULL for the built in one. Returns the previous one.
+ftdi_device *ftdi_select_device(ftdi_device *dev);
+ftdi_device *ftdi_get_device();
+unsigned int ftdi_get_device_slot();
+
 FT_STATUS ftdi_open_device(DWORD device_index, int cpu_type);
 void ftdi_close_device();
 
+/*
+ * When a transfer fails because the probe is gone, it is waited for up to
+ * FTDI_RECONNECT_TIMEOUT seconds and opened again by its serial number.
+ * Only the MPSSE and the TAP are set up again, the target keeps running,
+ * and the batch that failed is sent once more.
+ */
+#define FTDI_RECONNECT_TIMEOUT 10
+
+/*
+ * The same device over the AHBUART, memory and DSU access and runs work as
+ * with JTAG. The scans and raw MPSSE transfers need JTAG.
+ */
+FT_STATUS ftdi_open_ahbuart(const char *path, unsigned int baud, int cpu_type);
+
 int ftdi_get_connected_cpu_type();
+uint32_t ftdi_get_cpu_count();
 
 void ftdi_set_active_cpu(uint32_t cpu);
 uint32_t ftdi_get_active_cpu();
@@ -57,7 +102,34 @@ void scan_instruction_codes(BYTE max_ir_length);
  * DSU operations for runnning programs
  */
 
+// Entry point and initial stack pointer of a core
+typedef struct {
+	DWORD entry;
+	DWORD stack;
+} ftdi_core_entry;
+
+// Core sets are bit masks, entries and traps are arrays indexed by core.
+// With sync, all cores enter debug mode as soon as one of them does.
+void ftdi_default_entries(DWORD cores, ftdi_core_entry *entries);
+// Both return false if the link failed before or during the run, the traps are 0 then
+bool runCPUs(DWORD cores, const ftdi_core_entry *entries, bool sync, BYTE *traps);
+bool resumeCPUs(DWORD cores, BYTE *traps);
 BYTE runCPU(BYTE cpuID);	
+
+// runCPUs() in steps, for callers that need to do other work between polls
+enum ftdi_run_state {
+	FTDI_RUN_ACTIVE,
+	FTDI_RUN_DONE,		// All cores stopped, runCPU_finish() evaluates the run
+	FTDI_RUN_FAILED		// The link failed, the run is over without runCPU_finish()
+};
+
+// Both return false if the cores could not be released, the run is over then
+bool runCPU_start(DWORD cores, const ftdi_core_entry *entries, bool sync);
+bool runCPU_resume(DWORD cores);
+enum ftdi_run_state runCPU_poll(unsigned int *wait_us);
+void runCPU_stop();
+bool runCPU_finish(BYTE *traps);
+uint64_t runCPU_cycles(uint32_t cpu); // From the release to the stop of cpu in the last run
 void reset(BYTE cpuID); 
 
 
@@ -74,7 +146,7 @@ void iowrite16(DWORD addr, WORD data);
 void iowrite32(DWORD addr, DWORD data);
 
 // Sequential RW w/ optional progress output
-void ioread32raw(DWORD startAddr, DWORD *data, WORD size); // Extremely slow, it's actually faster to write data...
+void ioread32raw(DWORD startAddr, DWORD *data, WORD size);
 void iowrite32raw(DWORD startAddr, DWORD *data, WORD size);
 
 void ioread32_buffer(DWORD startAddr, DWORD *data, WORD size);
@@ -82,6 +154,56 @@ void iowrite32_buffer(DWORD startAddr, DWORD *data, WORD size);
 void ioread32_progress(DWORD startAddr, DWORD *data, WORD size, bool progress);
 void iowrite32_progress(DWORD startAddr, DWORD *data, WORD size, bool progress);
 
+// Byte buffers at any address and of any size
+bool ioread8_buffer(DWORD startAddr, BYTE *data, DWORD size);
+bool iowrite8_buffer(DWORD startAddr, const BYTE *data, DWORD size);
+
+
+/*
+ * Batched transactions: AHB accesses are encoded into one MPSSE command
+ * stream that is shifted out with a single FT_Write. A batch can be kept
+ * around as a precompiled script and patched before it is sent again.
+ * Devices on the AHBUART get AHBUART commands instead, the stream only
+ * works with devices of the link it was built for.
+ */
+
+typedef struct {
+	BYTE *buf;	// MPSSE or AHBUART command stream
+	DWORD len;	// Bytes used in buf
+	DWORD size;	// Bytes allocated for buf
+	DWORD reads;	// DWORDs returned by ftdi_batch_transfer()
+} ftdi_batch;
+
+void ftdi_batch_init(ftdi_batch *batch);
+void ftdi_batch_free(ftdi_batch *batch);
+void ftdi_batch_clear(ftdi_batch *batch);
+void ftdi_batch_append(ftdi_batch *batch, const ftdi_batch *script);
+
+// Both return the offset of the (first) data DWORD for ftdi_batch_patch32()
+DWORD ftdi_batch_write32(ftdi_batch *batch, DWORD addr, DWORD data);
+DWORD ftdi_batch_write32_seq(ftdi_batch *batch, DWORD startAddr, const DWORD *data, WORD size);
+DWORD ftdi_batch_seq_offset(DWORD offset, WORD index);
+void ftdi_batch_patch32(ftdi_batch *batch, DWORD offset, DWORD data);
+void ftdi_batch_write8(ftdi_batch *batch, DWORD addr, BYTE data);
+void ftdi_batch_write32_block(ftdi_batch *batch, DWORD startAddr, const DWORD *data, DWORD size); // Split at 1 kB boundaries
+void ftdi_batch_write8_buffer(ftdi_batch *batch, DWORD startAddr, const BYTE *data, DWORD size); // Any alignment
+
+// Return the index of the (first) result in the data array of ftdi_batch_transfer()
+DWORD ftdi_batch_read32(ftdi_batch *batch, DWORD addr);
+DWORD ftdi_batch_read32_seq(ftdi_batch *batch, DWORD startAddr, WORD size);
+DWORD ftdi_batch_read32_block(ftdi_batch *batch, DWORD startAddr, DWORD size); // Split at 1 kB boundaries
+
+FT_STATUS ftdi_batch_send(ftdi_batch *batch);
+FT_STATUS ftdi_batch_transfer(ftdi_batch *batch, DWORD *data);
+
+// A sealed batch of writes is complete and sent as it is, by any number of devices at the same time
+void ftdi_batch_seal(ftdi_batch *batch);
+FT_STATUS ftdi_batch_send_sealed(const ftdi_batch *batch);
+
+// Raw MPSSE commands, in_len bytes of results are read back
+DWORD ftdi_get_tck_period(); // ns
+FT_STATUS ftdi_mpsse_transfer(const BYTE *out, DWORD out_len, BYTE *in, DWORD in_len);
+
 
 void pr_err(const char * const output);
 
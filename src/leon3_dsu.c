@@ -41,6 +41,7 @@
 
 #include <stddef.h>	// size_t
 #include <stdlib.h> // malloc, free
+#include <string.h> // memset
 #include "leon3_dsu.h"
 
 
@@ -172,6 +173,270 @@ static uint32_t dsu_get_fpu_reg_addr(uint32_t cpu, uint32_t n)
 }*/
 
 
+/**
+ * host-side shadow copies of the run control registers
+ *
+ * The DSU control register of every processor as well as the (shared) break
+ * and single step and debug mode mask registers are only ever changed a bit
+ * at a time. Instead of a read-modify-write over JTAG for every single bit,
+ * the register contents are read once and the bit changes are composed on
+ * the host. The copies are only trustworthy while the processors are halted,
+ * anything that resumes a processor or changes these registers behind our
+ * back must invalidate them.
+ *
+ * Between dsu_batch_begin() and dsu_batch_commit() the changes are not
+ * written out at all, so every register is written at most once per batch.
+ */
+
+struct dsu_shadow_reg {
+	uint32_t val;
+	uint8_t valid;
+	uint8_t dirty;
+};
+
+struct dsu_shadow_set {
+	struct dsu_shadow_reg ctrl[DSU_NCPUS];
+	struct dsu_shadow_reg break_step;
+	struct dsu_shadow_reg mode_mask;
+
+	uint32_t batch_depth;
+	uint32_t resume_pending;
+};
+
+/* one set per device, see ftdi_get_device_slot() */
+static struct dsu_shadow_set dsu_slots[FTDI_MAX_DEVICES];
+
+
+/**
+ * @brief get the shadow registers of the selected device
+ */
+
+static inline struct dsu_shadow_set *dsu_slot(void)
+{
+	return &dsu_slots[ftdi_get_device_slot()];
+}
+
+
+/**
+ * @brief get the shadow of the DSU control register of a cpu
+ *
+ * @param cpu the cpu number
+ */
+
+static struct dsu_shadow_reg *dsu_ctrl_reg(uint32_t cpu)
+{
+	return &dsu_slot()->ctrl[cpu & (DSU_NCPUS - 1)];
+}
+
+
+/**
+ * @brief make sure a shadow register holds the current hardware value
+ *
+ * @param reg  the shadow register
+ * @param addr the AHB address of the register
+ */
+
+static void dsu_shadow_fetch(struct dsu_shadow_reg *reg, uint32_t addr)
+{
+	if (reg->valid)
+		return;
+
+	reg->val   = ioread32(addr);
+	reg->valid = 1;
+	reg->dirty = 0;
+}
+
+
+/**
+ * @brief write a shadow register back to the hardware
+ *
+ * @param reg  the shadow register
+ * @param addr the AHB address of the register
+ * @param w1c  bits which clear a condition when written as one, these are
+ *	       not kept in the shadow after they have been written
+ */
+
+static void dsu_shadow_flush(struct dsu_shadow_reg *reg, uint32_t addr,
+			     uint32_t w1c)
+{
+	if (!reg->dirty)
+		return;
+
+	iowrite32(addr, reg->val);
+
+	reg->val  &= ~w1c;
+	reg->dirty = 0;
+}
+
+
+/**
+ * @brief update a shadow register, write it unless a batch is open
+ *
+ * @param reg  the shadow register
+ * @param addr the AHB address of the register
+ * @param val  the new register value
+ * @param w1c  write-one-to-clear bits of the register
+ */
+
+static void dsu_shadow_store(struct dsu_shadow_reg *reg, uint32_t addr,
+			     uint32_t val, uint32_t w1c)
+{
+	const struct dsu_shadow_set *dsu = dsu_slot();
+
+
+	reg->val   = val;
+	reg->valid = 1;
+	reg->dirty = 1;
+
+	if (dsu->batch_depth)
+		return;
+
+	dsu_shadow_flush(reg, addr, w1c);
+
+	if (dsu->resume_pending)
+		dsu_shadow_invalidate_all();
+}
+
+
+/**
+ * @brief drop the shadow of the DSU control register of a cpu
+ *
+ * @param cpu the cpu number
+ *
+ * @note pending changes of an open batch are lost
+ */
+
+void dsu_shadow_invalidate(uint32_t cpu)
+{
+	struct dsu_shadow_reg *reg = dsu_ctrl_reg(cpu);
+
+
+	reg->valid = 0;
+	reg->dirty = 0;
+}
+
+
+/**
+ * @brief drop all shadow registers, e.g. after a processor was resumed or
+ *	  the DSU was written to directly
+ *
+ * @note pending changes of an open batch are lost
+ */
+
+void dsu_shadow_invalidate_all(void)
+{
+	uint32_t i;
+	struct dsu_shadow_set *dsu = dsu_slot();
+
+
+	for (i = 0; i < DSU_NCPUS; i++)
+		dsu_shadow_invalidate(i);
+
+	dsu->break_step.valid = 0;
+	dsu->break_step.dirty = 0;
+	dsu->mode_mask.valid  = 0;
+	dsu->mode_mask.dirty  = 0;
+
+	dsu->resume_pending = 0;
+}
+
+
+/**
+ * @brief start composing run control changes on the host
+ *
+ * @note batches nest, the registers are written by the outermost commit
+ */
+
+void dsu_batch_begin(void)
+{
+	dsu_slot()->batch_depth++;
+}
+
+
+/**
+ * @brief write all run control registers changed since dsu_batch_begin()
+ *
+ * The control registers go first and the break and single step register
+ * last, as clearing a break now bit resumes the processor.
+ */
+
+void dsu_batch_commit(void)
+{
+	uint32_t i;
+	struct dsu_shadow_set *dsu = dsu_slot();
+
+
+	if (!dsu->batch_depth)
+		return;
+
+	if (--dsu->batch_depth)
+		return;
+
+	dsu_shadow_flush(&dsu->mode_mask, DSU_CTRL + DSU_MODE_MASK, 0);
+
+	for (i = 0; i < DSU_NCPUS; i++)
+		dsu_shadow_flush(dsu_ctrl_reg(i), DSU_BASE(i), DSU_CTRL_PE);
+
+	dsu_shadow_flush(&dsu->break_step, DSU_CTRL + DSU_BREAK_STEP, 0);
+
+	if (dsu->resume_pending)
+		dsu_shadow_invalidate_all();
+}
+
+
+/**
+ * @brief get the (shadowed) DSU control register
+ *
+ * @param cpu the cpu number
+ *
+ * @return the value the DSU control register has or will have after commit
+ */
+
+uint32_t dsu_shadow_get_ctrl(uint32_t cpu)
+{
+	struct dsu_shadow_reg *reg = dsu_ctrl_reg(cpu);
+
+
+	dsu_shadow_fetch(reg, DSU_BASE(cpu));
+
+	return reg->val;
+}
+
+
+/**
+ * @brief get the (shadowed) break and single step register
+ *
+ * @return the value the register has or will have after commit
+ */
+
+uint32_t dsu_shadow_get_break_step(void)
+{
+	struct dsu_shadow_reg *reg = &dsu_slot()->break_step;
+
+
+	dsu_shadow_fetch(reg, DSU_CTRL + DSU_BREAK_STEP);
+
+	return reg->val;
+}
+
+
+/**
+ * @brief get the (shadowed) debug mode mask register
+ *
+ * @return the value the register has or will have after commit
+ */
+
+uint32_t dsu_shadow_get_mode_mask(void)
+{
+	struct dsu_shadow_reg *reg = &dsu_slot()->mode_mask;
+
+
+	dsu_shadow_fetch(reg, DSU_CTRL + DSU_MODE_MASK);
+
+	return reg->val;
+}
+
+
 /**
  * @brief set bits in the DSU control register
  *
@@ -184,9 +449,9 @@ static void dsu_set_dsu_ctrl(uint32_t cpu, uint32_t flags)
 	uint32_t tmp;
 
 
-	tmp  = ioread32((uint32_t) (DSU_BASE(cpu)));
+	tmp  = dsu_shadow_get_ctrl(cpu);
 	tmp |= flags;
-	iowrite32((uint32_t) (DSU_BASE(cpu)), tmp);
+	dsu_shadow_store(dsu_ctrl_reg(cpu), DSU_BASE(cpu), tmp, DSU_CTRL_PE);
 }
 
 
@@ -196,11 +461,26 @@ static void dsu_set_dsu_ctrl(uint32_t cpu, uint32_t flags)
  * @param cpu   the cpu number
  *
  * @return the contents of the DSU control register
+ *
+ * @note this always reads the hardware, the status bits change while the
+ *	 processor runs; the value only refreshes the shadow if the processor
+ *	 is in debug mode, the shadow of a running processor is dropped
  */
 
 uint32_t dsu_get_dsu_ctrl(uint32_t cpu)
 {
-	return ioread32((uint32_t) (DSU_BASE(cpu)));
+	struct dsu_shadow_reg *reg = dsu_ctrl_reg(cpu);
+	uint32_t tmp;
+
+
+	tmp = ioread32((uint32_t) (DSU_BASE(cpu)));
+
+	if (!reg->dirty) {
+		reg->val   = tmp & ~DSU_CTRL_PE;
+		reg->valid = (tmp & DSU_CTRL_DM) ? 1 : 0;
+	}
+
+	return tmp;
 }
 
 
@@ -216,9 +496,84 @@ static void dsu_clear_dsu_ctrl(uint32_t cpu, uint32_t flags)
 	uint32_t tmp;
 
 
-	tmp  = ioread32((uint32_t) (DSU_BASE(cpu)));
+	tmp  = dsu_shadow_get_ctrl(cpu);
+	tmp &= ~flags;
+	dsu_shadow_store(dsu_ctrl_reg(cpu), DSU_BASE(cpu), tmp, DSU_CTRL_PE);
+}
+
+
+/**
+ * @brief set bits in the debug mode mask register
+ *
+ * @param flags the bitmask to set
+ */
+
+static void dsu_set_mode_mask(uint32_t flags)
+{
+	uint32_t tmp;
+
+
+	tmp  = dsu_shadow_get_mode_mask();
+	tmp |= flags;
+	dsu_shadow_store(&dsu_slot()->mode_mask, DSU_CTRL + DSU_MODE_MASK, tmp, 0);
+}
+
+
+/**
+ * @brief clear bits in the debug mode mask register
+ *
+ * @param flags the bitmask to clear
+ */
+
+static void dsu_clear_mode_mask(uint32_t flags)
+{
+	uint32_t tmp;
+
+
+	tmp  = dsu_shadow_get_mode_mask();
+	tmp &= ~flags;
+	dsu_shadow_store(&dsu_slot()->mode_mask, DSU_CTRL + DSU_MODE_MASK, tmp, 0);
+}
+
+
+/**
+ * @brief set bits in the break and single step register
+ *
+ * @param flags the bitmask to set
+ */
+
+static void dsu_set_break_step(uint32_t flags)
+{
+	uint32_t tmp;
+
+
+	tmp  = dsu_shadow_get_break_step();
+	tmp |= flags;
+	dsu_shadow_store(&dsu_slot()->break_step, DSU_CTRL + DSU_BREAK_STEP, tmp, 0);
+}
+
+
+/**
+ * @brief clear bits in the break and single step register
+ *
+ * @param flags the bitmask to clear
+ *
+ * @note clearing a break now bit resumes the processor, so the shadow
+ *	 registers are dropped once this was written
+ */
+
+static void dsu_clear_break_step(uint32_t flags)
+{
+	uint32_t tmp;
+
+
+	tmp  = dsu_shadow_get_break_step();
+
+	if (tmp & flags & DSU_BREAK_NOW_MASK)
+		dsu_slot()->resume_pending = 1;
+
 	tmp &= ~flags;
-	iowrite32((uint32_t) (DSU_BASE(cpu)), tmp);
+	dsu_shadow_store(&dsu_slot()->break_step, DSU_CTRL + DSU_BREAK_STEP, tmp, 0);
 }
 
 
@@ -229,14 +584,127 @@ static void dsu_clear_dsu_ctrl(uint32_t cpu, uint32_t flags)
  */
 
 void dsu_clear_iu_reg_file(uint32_t cpu)
+{
+	ftdi_batch batch;
+
+	/* one sequential burst instead of a write per register */
+	ftdi_batch_init(&batch);
+	ftdi_batch_write32_seq(&batch, DSU_BASE(cpu) + DSU_IU_REG,
+			       NULL, DSU_IU_REG_WORDS);
+	ftdi_batch_send(&batch);
+	ftdi_batch_free(&batch);
+}
+
+
+/**
+ * @brief force several processors into debug mode at the same time
+ *
+ * @param cpus bit mask of the cpu numbers
+ *
+ * @note the break now bits of all processors are set with a single write
+ */
+
+void dsu_halt_cpus(uint32_t cpus)
 {
 	uint32_t i;
-	/* (NWINDOWS * (%ln + %ion) + %gn) * 4 bytes */
-	const uint32_t iu_reg_size = (NWINDOWS * (8 + 8) + 8) * 4;
 
 
-	for (i = 0; i < iu_reg_size; i += 4)
-		iowrite32((uint32_t) (DSU_BASE(cpu) + DSU_IU_REG + i), 0x0);
+	dsu_batch_begin();
+
+	for (i = 0; i < DSU_NCPUS; i++) {
+		if (!(cpus & (1 << i)))
+			continue;
+
+		dsu_set_cpu_break_on_iu_watchpoint(i);
+		dsu_set_force_debug_on_watchpoint(i);
+	}
+
+	dsu_batch_commit();
+}
+
+
+/**
+ * @brief read the run state of several processors in one transaction
+ *
+ * @param cpus     bit mask of the cpu numbers
+ * @param snapshot array indexed by cpu number, only entries of cpus are set
+ */
+
+void dsu_get_snapshot(uint32_t cpus, struct dsu_cpu_snapshot *snapshot)
+{
+	uint32_t i;
+	uint32_t data[DSU_NCPUS * 9];
+	uint32_t ctrl[DSU_NCPUS];
+	uint32_t special[DSU_NCPUS];
+	ftdi_batch batch;
+
+
+	/* the control register and PSR up to the trap register in a burst */
+	ftdi_batch_init(&batch);
+
+	for (i = 0; i < DSU_NCPUS; i++) {
+		if (!(cpus & (1 << i)))
+			continue;
+
+		ctrl[i]    = ftdi_batch_read32(&batch, DSU_BASE(i));
+		special[i] = ftdi_batch_read32_seq(&batch, DSU_BASE(i) + DSU_REG_PSR,
+						   (DSU_REG_TRAP - DSU_REG_PSR) / 4 + 1);
+	}
+
+	if (ftdi_batch_transfer(&batch, data) != FT_OK)
+		memset(data, 0, sizeof(data));
+
+	ftdi_batch_free(&batch);
+
+	for (i = 0; i < DSU_NCPUS; i++) {
+		if (!(cpus & (1 << i)))
+			continue;
+
+		snapshot[i].ctrl = data[ctrl[i]];
+		snapshot[i].psr  = data[special[i]];
+		snapshot[i].wim  = data[special[i] + (DSU_REG_WIM - DSU_REG_PSR) / 4];
+		snapshot[i].tbr  = data[special[i] + (DSU_REG_TBR - DSU_REG_PSR) / 4];
+		snapshot[i].pc   = data[special[i] + (DSU_REG_PC - DSU_REG_PSR) / 4];
+		snapshot[i].npc  = data[special[i] + (DSU_REG_NPC - DSU_REG_PSR) / 4];
+		snapshot[i].trap = data[special[i] + (DSU_REG_TRAP - DSU_REG_PSR) / 4];
+	}
+}
+
+
+/**
+ * @brief map the trap a processor stopped for to a signal number
+ *
+ * @param trap the trap register
+ * @param tbr  the trap base register, holds the trap type if the trap
+ *             register only shows the final ta 0
+ *
+ * @return the signal number of SPARC Linux, as used by gdb
+ */
+
+uint32_t dsu_get_trap_signal(uint32_t trap, uint32_t tbr)
+{
+	uint32_t tt = (trap >> 4) & 0xff;
+
+
+	if (tt == 0x80)
+		tt = (tbr >> 4) & 0xff;
+
+	switch (tt) {
+	case 0x02:
+	case 0x03:
+		return DSU_SIGILL;
+	case 0x07:
+		return DSU_SIGBUS;
+	case 0x08:
+	case 0x2a:
+		return DSU_SIGFPE;
+	case 0x01:
+	case 0x09:
+	case 0x2b:
+		return DSU_SIGSEGV;
+	default:
+		return DSU_SIGTRAP;
+	}
 }
 
 
@@ -251,14 +719,7 @@ void dsu_clear_iu_reg_file(uint32_t cpu)
 
 void dsu_set_force_enter_debug_mode(uint32_t cpu)
 {
-	uint16_t tmp;
-
-	uint32_t addr = DSU_CTRL + DSU_MODE_MASK + offset_of(struct dsu_mode_mask, enter_debug);
-
-
-	tmp  = ioread16(addr);
-	tmp |= (1 << cpu);
-	iowrite16(addr, tmp);
+	dsu_set_mode_mask(DSU_ENTER_DEBUG(cpu));
 }
 
 
@@ -273,14 +734,7 @@ void dsu_set_force_enter_debug_mode(uint32_t cpu)
 
 void dsu_clear_force_enter_debug_mode(uint32_t cpu)
 {
-	uint16_t tmp;
-
-	uint32_t addr = DSU_CTRL + DSU_MODE_MASK + offset_of(struct dsu_mode_mask, enter_debug);
-
-
-	tmp  = ioread16(addr);
-	tmp &= ~(1 << cpu);
-	iowrite16(addr, tmp);
+	dsu_clear_mode_mask(DSU_ENTER_DEBUG(cpu));
 }
 
 
@@ -294,14 +748,7 @@ void dsu_clear_force_enter_debug_mode(uint32_t cpu)
 
 void dsu_set_noforce_debug_mode(uint32_t cpu)
 {
-	uint16_t tmp;
-
-	uint32_t addr = DSU_CTRL + DSU_MODE_MASK + offset_of(struct dsu_mode_mask, debug_mode);
-
-
-	tmp  = ioread16(addr);
-	tmp |= (1 << cpu);
-	iowrite16(addr, tmp);
+	dsu_set_mode_mask(DSU_DEBUG_MASK(cpu));
 }
 
 
@@ -315,14 +762,7 @@ void dsu_set_noforce_debug_mode(uint32_t cpu)
 
 void dsu_clear_noforce_debug_mode(uint32_t cpu)
 {
-	uint16_t tmp;
-
-	uint32_t addr = DSU_CTRL + DSU_MODE_MASK + offset_of(struct dsu_mode_mask, debug_mode);
-
-
-	tmp  = ioread16(addr);
-	tmp &= ~(1 << cpu);
-	iowrite16(addr, tmp);
+	dsu_clear_mode_mask(DSU_DEBUG_MASK(cpu));
 }
 
 
@@ -337,14 +777,7 @@ void dsu_clear_noforce_debug_mode(uint32_t cpu)
 
 void dsu_set_force_debug_on_watchpoint(uint32_t cpu)
 {
-	uint16_t tmp;
-
-	uint32_t addr = DSU_CTRL + DSU_BREAK_STEP + offset_of(struct dsu_break_step, break_now);
-
-
-	tmp  = ioread16(addr);
-	tmp |= (1 << cpu);
-	iowrite16(addr, tmp);
+	dsu_set_break_step(DSU_BREAK_NOW(cpu));
 }
 
 
@@ -360,14 +793,98 @@ void dsu_set_force_debug_on_watchpoint(uint32_t cpu)
 
 void dsu_clear_force_debug_on_watchpoint(uint32_t cpu)
 {
-	uint16_t tmp;
+	dsu_clear_break_step(DSU_BREAK_NOW(cpu));
+}
+
+
+/**
+ * @brief make a processor execute a single instruction and return to debug
+ *	  mode whenever it is resumed
+ *
+ * @param cpu the cpu number
+ *
+ * @see GR712-UM v2.3 pp. 83
+ */
+
+void dsu_set_cpu_single_step(uint32_t cpu)
+{
+	dsu_set_break_step(DSU_SINGLE_STEP(cpu));
+}
+
+
+/**
+ * @brief let a processor run freely when it is resumed
+ *
+ * @param cpu the cpu number
+ *
+ * @see GR712-UM v2.3 pp. 83
+ */
+
+void dsu_clear_cpu_single_step(uint32_t cpu)
+{
+	dsu_clear_break_step(DSU_SINGLE_STEP(cpu));
+}
 
-	uint32_t addr = DSU_CTRL + DSU_BREAK_STEP + offset_of(struct dsu_break_step, break_now);
 
+/**
+ * @brief add the writes setting an IU watchpoint of a processor to a batch
+ *
+ * @param batch the batch to append to
+ * @param cpu   the cpu number
+ * @param n     the watchpoint number
+ * @param addr  the address to watch
+ * @param mask  the address bits to compare
+ * @param flags DSU_WP_IF, DSU_WP_DL and DSU_WP_DS
+ *
+ * @note the processor enters debug mode on a hit if BW is set in its DSU
+ *	 control register, otherwise it takes a watchpoint trap
+ */
 
-	tmp  = ioread16(addr);
-	tmp &= ~(1 << cpu);
-	iowrite16(addr, tmp);
+void dsu_append_iu_watchpoint(ftdi_batch *batch, uint32_t cpu, uint32_t n,
+			      uint32_t addr, uint32_t mask, uint32_t flags)
+{
+	ftdi_batch_write32(batch, DSU_BASE(cpu) + DSU_REG_WADDR(n),
+			   (addr & ~0x3) | (flags & DSU_WP_IF));
+	/* %asr25 etc. hold the load flag in bit 1 and the store flag in bit 0 */
+	ftdi_batch_write32(batch, DSU_BASE(cpu) + DSU_REG_WMASK(n),
+			   (mask & ~0x3) | ((flags & DSU_WP_DL) ? 0x2 : 0) |
+			   ((flags & DSU_WP_DS) ? 0x1 : 0));
+}
+
+
+/**
+ * @brief set an IU watchpoint of a processor
+ *
+ * @param cpu   the cpu number
+ * @param n     the watchpoint number
+ * @param addr  the address to watch
+ * @param mask  the address bits to compare
+ * @param flags DSU_WP_IF, DSU_WP_DL and DSU_WP_DS
+ */
+
+void dsu_set_iu_watchpoint(uint32_t cpu, uint32_t n, uint32_t addr,
+			   uint32_t mask, uint32_t flags)
+{
+	ftdi_batch batch;
+
+
+	ftdi_batch_init(&batch);
+	dsu_append_iu_watchpoint(&batch, cpu, n, addr, mask, flags);
+	ftdi_batch_send(&batch);
+	ftdi_batch_free(&batch);
+}
+
+
+/**
+ * @brief disable an IU watchpoint of a processor
+ *
+ * @param cpu the cpu number
+ * @param n   the watchpoint number
+ */
+
+void dsu_clear_iu_watchpoint(uint32_t cpu, uint32_t n)
+{
+	dsu_set_iu_watchpoint(cpu, n, 0, 0, 0);
 }
 
 
@@ -649,6 +1166,7 @@ uint32_t dsu_get_cpu_in_halt_mode(uint32_t cpu)
 
 void dsu_clear_cpu_halt_mode(uint32_t cpu)
 {
+	dsu_slot()->resume_pending = 1;
 	dsu_clear_dsu_ctrl(cpu, DSU_CTRL_HL);
 }
 
@@ -680,6 +1198,12 @@ void dsu_set_cpu_wake_up(uint32_t cpu)
 	//iowrite32((uint32_t)0x80000210, 1 << cpu); // LEON3
 	// iowrite32be(1 << cpu, (uint32_t)0xFF904010); // LEON4
 	iowrite32((uint32_t)ADDRESSES[ftdi_get_connected_cpu_type()][WAKE_STATE], 1 << cpu);
+
+	/* the core may be running now, unless it is held in debug mode by the
+	 * batch that is being composed
+	 */
+	if (!dsu_slot()->batch_depth)
+		dsu_shadow_invalidate(cpu);
 }
 
 /**
@@ -725,6 +1249,20 @@ void dsu_clear_cpu_debug_on_error(uint32_t cpu)
 }
 
 
+/**
+ * @brief  enable the instruction trace buffer
+ *
+ * @param cpu the cpu number
+ *
+ * @see GR712-UM v2.3 pp. 82
+ */
+
+void dsu_set_cpu_trace_enable(uint32_t cpu)
+{
+	dsu_set_dsu_ctrl(cpu, DSU_CTRL_TE);
+}
+
+
 /**
  * @brief  enable debug mode on IU watchpoint
  *
@@ -39,6 +39,10 @@
 #define NWINDOWS	8	/* number of register windows */
 #endif
 
+#ifndef DSU_NCPUS
+#define DSU_NCPUS	8	/* max. number of cpus per DSU, power of 2 */
+#endif
+
 
 /**
  * @see GR712-UM v2.3 pp. 81
@@ -51,6 +55,7 @@
 
 // Addresses are all offsets from DSU_CTRL
 #define DSU_TIMETAG		0x000008
+#define DSU_TIMETAG_MASK	0x3fffffff	/* 30 bit counter, as in the trace lines */
 
 #define DSU_BREAK_STEP		0x000020	/* mapped only in CPU0 DSU */
 #define DSU_MODE_MASK		0x000024	/* mapped only in CPU0 DSU */
@@ -62,6 +67,16 @@
 #define DSU_AHB_MASK_1		0x000054
 #define DSU_AHB_BP_ADDR_2	0x000058
 #define DSU_AHB_MASK_2		0x00005c
+#define DSU_AHB_BREAKPOINTS	2
+
+/**
+ * AHB trace buffer control and breakpoint mask bits
+ * @see GR712-UM v2.3 pp. 84, 85
+ */
+#define DSU_AHB_TRACE_EN	(1 << 0)	/* trace enable                  */
+#define DSU_AHB_TRACE_BR	(1 << 2)	/* debug mode on AHB breakpoint  */
+#define DSU_AHB_BP_ST		(1 << 0)	/* break on data store           */
+#define DSU_AHB_BP_LD		(1 << 1)	/* break on data load            */
 
 #define DSU_INST_TRCE_BUF_START	0x100000
 #define DSU_INST_TRCE_BUF_SIZE 0x10000
@@ -89,6 +104,24 @@
 #define DSU_REG_FSR		0x400018
 #define DSU_REG_CPSR	0x40001C
 #define DSU_REG_TRAP	0x400020
+#define DSU_REG_ASR(n)	(0x400040 + ((n) - 16) * 4)	/* %asr16 - %asr31 */
+
+/* IU watchpoints: address and mask in %asr24 - %asr31 */
+#define DSU_IU_WATCHPOINTS	4
+#define DSU_REG_WADDR(n)	DSU_REG_ASR(24 + 2 * (n))
+#define DSU_REG_WMASK(n)	DSU_REG_ASR(25 + 2 * (n))
+
+#define DSU_WP_IF		(1 << 0)	/* break on instruction fetch */
+#define DSU_WP_DL		(1 << 1)	/* break on data load         */
+#define DSU_WP_DS		(1 << 2)	/* break on data store        */
+
+/* signal numbers of SPARC Linux, see dsu_get_trap_signal() */
+#define DSU_SIGINT		2
+#define DSU_SIGILL		4
+#define DSU_SIGTRAP		5
+#define DSU_SIGFPE		8
+#define DSU_SIGBUS		10
+#define DSU_SIGSEGV		11
 
 
 
@@ -100,11 +133,20 @@
 
 //#define DSU_BASE(x)		(ADDRESSES[get_connected_cpu_type()][DSU] + DSU_OFFSET_CPU(x))
 
+/* (NWINDOWS * (%ln + %ion) + %gn) 32 bit words */
+#define DSU_IU_REG_WORDS	(NWINDOWS * (8 + 8) + 8)
+
 #define DSU_REG_OUT(cpu, cwp) DSU_BASE(cpu) + DSU_IU_REG + ((cwp * 64 + 32) % (NWINDOWS * 64))
 #define DSU_REG_LOCAL(cpu, cwp) DSU_BASE(cpu) + DSU_IU_REG + ((cwp * 64 + 64) % (NWINDOWS * 64))
 #define DSU_REG_IN(cpu, cwp) DSU_BASE(cpu) + DSU_IU_REG + ((cwp * 64 + 96) % (NWINDOWS * 64))
 #define DSU_REG_GLOBAL(cpu) DSU_BASE(cpu) + DSU_IU_REG + (NWINDOWS * 64)
 
+/* word index of a window in a copy of the register file read from DSU_IU_REG */
+#define DSU_IU_OUT(cwp)		(((cwp) * 16 + 8) % (NWINDOWS * 16))
+#define DSU_IU_LOCAL(cwp)	(((cwp) * 16 + 16) % (NWINDOWS * 16))
+#define DSU_IU_IN(cwp)		(((cwp) * 16 + 24) % (NWINDOWS * 16))
+#define DSU_IU_GLOBAL		(NWINDOWS * 16)
+
 
 
 /**
@@ -123,6 +165,17 @@
 #define DSU_CTRL_PW		(1 << 11)	/* processor power mode    */
 
 
+/**
+ * @see GR712-UM v2.3 pp. 82, 83
+ */
+#define DSU_BREAK_NOW(x)	(1 << ((x) & 0xf))		/* force debug mode   */
+#define DSU_SINGLE_STEP(x)	(1 << (((x) & 0xf) + 16))	/* single step        */
+#define DSU_BREAK_NOW_MASK	0x0000ffff
+
+#define DSU_ENTER_DEBUG(x)	(1 << ((x) & 0xf))		/* enter debug mode   */
+#define DSU_DEBUG_MASK(x)	(1 << (((x) & 0xf) + 16))	/* do not force others */
+
+
 
 
 
@@ -159,6 +212,21 @@ struct dsu_mode_mask {
 
 
 
+/**
+ * run state of a cpu, read for several cpus at once by dsu_get_snapshot()
+ */
+
+struct dsu_cpu_snapshot {
+	uint32_t ctrl;
+	uint32_t psr;
+	uint32_t wim;
+	uint32_t tbr;
+	uint32_t pc;
+	uint32_t npc;
+	uint32_t trap;
+};
+
+
 /**
  * maps the AHB trace buffer registers from DSU_AHB_TRACE_CTRL to DSU_AHB_MASK_2
  * must be pointed to DSU_AHB_TRACE_CTRL
@@ -264,11 +332,30 @@ struct dsu_ahb_trace_buffer {
 //uint32_t DSU_BASE(uint32_t cpu);
 
 
+/* host-side shadows of the run control registers */
+void dsu_batch_begin(void);
+void dsu_batch_commit(void);
+void dsu_shadow_invalidate(uint32_t cpu);
+void dsu_shadow_invalidate_all(void);
+uint32_t dsu_shadow_get_ctrl(uint32_t cpu);
+uint32_t dsu_shadow_get_break_step(void);
+uint32_t dsu_shadow_get_mode_mask(void);
+
+void dsu_halt_cpus(uint32_t cpus);
+void dsu_get_snapshot(uint32_t cpus, struct dsu_cpu_snapshot *snapshot);
+uint32_t dsu_get_trap_signal(uint32_t trap, uint32_t tbr);
+
+void dsu_set_force_enter_debug_mode(uint32_t cpu);
+void dsu_clear_force_enter_debug_mode(uint32_t cpu);
+void dsu_clear_noforce_debug_mode(uint32_t cpu);
+
+
 void dsu_set_cpu_wake_up(uint32_t cpu);
 uint32_t dsu_get_cpu_state(uint32_t cpu);
 void dsu_set_noforce_debug_mode(uint32_t cpu);
 void dsu_set_cpu_halt_mode(uint32_t cpu);
 void dsu_set_cpu_debug_on_error(uint32_t cpu);
+void dsu_set_cpu_trace_enable(uint32_t cpu);
 void dsu_set_cpu_break_on_iu_watchpoint(uint32_t cpu);
 void dsu_set_cpu_break_on_breakpoint(uint32_t cpu);
 void dsu_set_cpu_break_on_trap(uint32_t cpu);
@@ -325,6 +412,13 @@ void dsu_clear_cpu_break_on_breakpoint(uint32_t cpu);
 void dsu_clear_cpu_break_on_trap(uint32_t cpu);
 void dsu_clear_cpu_break_on_error_trap(uint32_t cpu);
 void dsu_clear_force_debug_on_watchpoint(uint32_t cpu);
+void dsu_set_cpu_single_step(uint32_t cpu);
+void dsu_clear_cpu_single_step(uint32_t cpu);
+void dsu_append_iu_watchpoint(ftdi_batch *batch, uint32_t cpu, uint32_t n,
+			      uint32_t addr, uint32_t mask, uint32_t flags);
+void dsu_set_iu_watchpoint(uint32_t cpu, uint32_t n, uint32_t addr,
+			   uint32_t mask, uint32_t flags);
+void dsu_clear_iu_watchpoint(uint32_t cpu, uint32_t n);
 void dsu_clear_cpu_halt_mode(uint32_t cpu);
 void dsu_clear_cpu_error_mode(uint32_t cpu);
 uint32_t dsu_get_reg_cpsr(uint32_t cpu);
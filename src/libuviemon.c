@@ -0,0 +1,806 @@
+#define _DEFAULT_SOURCE // usleep, clock_gettime
+
+#include "libuviemon.h"
+
+#include "ftdi_device.h"
+#include "leon3_dsu.h"
+#include "address_map.h"
+#include "uviemon_uart.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHUNK_BYTES (16 * 1024)	// Per USB transaction, well within the read timeout of a batch
+#define IMAGE_OFFSET (64 * 1024)	// ELF header and alignment in front of the image
+
+struct uviemon_context {
+	ftdi_device device;
+	bool opened;
+	bool verbose;
+	uviemon_info info;
+	uviemon_progress progress;
+	void *progress_arg;
+	char error[256];
+
+	// Chunks of the bulk operations, contexts are used from threads of their own
+	uint32_t words[CHUNK_BYTES / 4];
+	BYTE buffer[CHUNK_BYTES];
+	BYTE memory[CHUNK_BYTES];
+};
+
+static void log_handler(enum ftdi_log_level level, const char *message, void *arg)
+{
+	uviemon_context *ctx = arg;
+
+	if (level == FTDI_LOG_ERROR) {
+		snprintf(ctx->error, sizeof(ctx->error), "%s", message);
+		ctx->error[strcspn(ctx->error, "\n")] = '\0';
+	}
+
+	if (ctx->verbose)
+		fputs(message, level == FTDI_LOG_ERROR ? stderr : stdout);
+}
+
+/* For the calling thread, the DSU shadows and run state are kept per device */
+static void select_context(uviemon_context *ctx)
+{
+	ftdi_select_device(&ctx->device);
+	ctx->error[0] = '\0';
+}
+
+/* Keeps the message of the transport if it already gave one */
+static int fail(uviemon_context *ctx, int error, const char *format, ...)
+{
+	va_list args;
+
+	if (ctx->error[0] == '\0') {
+		va_start(args, format);
+		vsnprintf(ctx->error, sizeof(ctx->error), format, args);
+		va_end(args);
+
+		if (ctx->verbose)
+			fprintf(stderr, "%s\n", ctx->error);
+	}
+
+	return error;
+}
+
+static void progress(const uviemon_context *ctx, uint64_t done, uint64_t total)
+{
+	if (ctx->progress)
+		ctx->progress(done, total, ctx->progress_arg);
+}
+
+/* Single GR712 or GR740 on the chain, with the DSU registers of the expected lengths */
+static int check_chain(uviemon_context *ctx)
+{
+	const uint32_t jtags = get_JTAG_count();
+
+	if (jtags == 0)
+		return fail(ctx, UVIEMON_ERR_OPEN, "No devices connected on the JTAG chain");
+
+	if (jtags > 1)
+		return fail(ctx, UVIEMON_ERR_OPEN, "More than one device found on the JTAG chain, can only interface a single GR712");
+
+	ctx->info.idcode = read_idcode();
+	ctx->info.ir_length = scan_IR_length();
+
+	// Must be a 6-bit IR, otherwise something's very wrong!
+	if (ctx->info.ir_length != 6)
+		return fail(ctx, UVIEMON_ERR_OPEN, "IR length of %d bits, can only work with the 6-bit GR712 IR",
+			    ctx->info.ir_length);
+
+	ctx->info.data_length = scan_DR_length(CODE_DATA);
+
+	if (ctx->info.data_length != 33)
+		return fail(ctx, UVIEMON_ERR_OPEN, "Data register of %d bits, need the 33-bit GR712 register",
+			    ctx->info.data_length);
+
+	ctx->info.command_length = scan_DR_length(CODE_ADDR_COMM);
+
+	if (ctx->info.command_length != 35)
+		return fail(ctx, UVIEMON_ERR_OPEN, "Address/command register of %d bits, need the 35-bit GR712 register",
+			    ctx->info.command_length);
+
+	return UVIEMON_OK;
+}
+
+static int create_context(bool verbose, uviemon_context **ctx)
+{
+	if (ctx == NULL)
+		return UVIEMON_ERR_ARGUMENT;
+
+	uviemon_context *c = calloc(1, sizeof(*c));
+
+	*ctx = c;
+
+	if (c == NULL)
+		return UVIEMON_ERR_MEMORY;
+
+	c->verbose = verbose;
+	c->device.log = log_handler;
+	c->device.log_arg = c;
+
+	return UVIEMON_OK;
+}
+
+static void read_info(uviemon_context *ctx)
+{
+	ctx->info.cpu_type = ftdi_get_connected_cpu_type();
+	ctx->info.cpu_count = ftdi_get_cpu_count();
+	ctx->info.ram_start = ADDRESSES[ctx->info.cpu_type][SDRAM_START_ADDRESS];
+}
+
+int uviemon_open(unsigned int device_index, int cpu_type, bool verbose, uviemon_context **ctx)
+{
+	const int created = create_context(verbose, ctx);
+
+	if (created != UVIEMON_OK)
+		return created;
+
+	uviemon_context *c = *ctx;
+
+	select_context(c);
+
+	const DWORD count = get_devices_count();
+
+	if (device_index >= count)
+		return fail(c, UVIEMON_ERR_OPEN, "Device index cannot be larger than %d", (int) count - 1);
+
+	if (!FT_SUCCESS(ftdi_open_device(device_index, cpu_type)))
+		return fail(c, UVIEMON_ERR_OPEN, "Unable to use device %d", device_index);
+
+	c->opened = true;
+
+	const int result = check_chain(c);
+
+	if (result != UVIEMON_OK)
+		return result;
+
+	read_info(c);
+
+	return UVIEMON_OK;
+}
+
+int uviemon_open_ahbuart(const char *path, unsigned int baud, int cpu_type, bool verbose, uviemon_context **ctx)
+{
+	const int created = create_context(verbose, ctx);
+
+	if (created != UVIEMON_OK)
+		return created;
+
+	uviemon_context *c = *ctx;
+
+	if (path == NULL)
+		return fail(c, UVIEMON_ERR_ARGUMENT, "No serial device for the AHBUART");
+
+	select_context(c);
+
+	if (!FT_SUCCESS(ftdi_open_ahbuart(path, baud, cpu_type)))
+		return fail(c, UVIEMON_ERR_OPEN, "Unable to use the AHBUART on %s", path);
+
+	c->opened = true;
+
+	// No chain to check, its fields stay 0
+	read_info(c);
+
+	return UVIEMON_OK;
+}
+
+void uviemon_close(uviemon_context *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	select_context(ctx);
+
+	if (ctx->opened)
+		ftdi_close_device();
+
+	ftdi_select_device(NULL);
+	free(ctx);
+}
+
+unsigned int uviemon_device_count()
+{
+	return get_devices_count();
+}
+
+int uviemon_get_info(uviemon_context *ctx, uviemon_info *info)
+{
+	if (ctx == NULL || !ctx->opened || info == NULL)
+		return UVIEMON_ERR_ARGUMENT;
+
+	*info = ctx->info;
+
+	return UVIEMON_OK;
+}
+
+const char *uviemon_strerror(int error)
+{
+	switch (error) {
+	case UVIEMON_OK:
+		return "OK";
+	case UVIEMON_ERR_ARGUMENT:
+		return "Invalid argument";
+	case UVIEMON_ERR_OPEN:
+		return "Could not open the probe";
+	case UVIEMON_ERR_IO:
+		return "JTAG transfer failed";
+	case UVIEMON_ERR_FILE:
+		return "File error";
+	case UVIEMON_ERR_VERIFY:
+		return "Memory differs from the image";
+	case UVIEMON_ERR_MEMORY:
+		return "Out of memory";
+	}
+
+	return "Unknown error";
+}
+
+const char *uviemon_last_error(const uviemon_context *ctx)
+{
+	return ctx != NULL ? ctx->error : "No context";
+}
+
+void uviemon_set_verbose(uviemon_context *ctx, bool verbose)
+{
+	ctx->verbose = verbose;
+}
+
+void uviemon_set_progress(uviemon_context *ctx, uviemon_progress progress, void *arg)
+{
+	ctx->progress = progress;
+	ctx->progress_arg = arg;
+}
+
+/*
+ * Bulk memory access
+ */
+
+int uviemon_read(uviemon_context *ctx, uint32_t addr, void *data, size_t length)
+{
+	if (ctx == NULL || !ctx->opened || (data == NULL && length > 0))
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+
+	for (size_t done = 0; done < length; done += CHUNK_BYTES) {
+		const DWORD chunk = length - done < CHUNK_BYTES ? length - done : CHUNK_BYTES;
+
+		if (!ioread8_buffer(addr + done, (BYTE *) data + done, chunk))
+			return fail(ctx, UVIEMON_ERR_IO, "Reading %u bytes at %#010x failed", chunk, addr + (DWORD) done);
+
+		progress(ctx, done + chunk, length);
+	}
+
+	return UVIEMON_OK;
+}
+
+int uviemon_write(uviemon_context *ctx, uint32_t addr, const void *data, size_t length)
+{
+	if (ctx == NULL || !ctx->opened || (data == NULL && length > 0))
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+
+	for (size_t done = 0; done < length; done += CHUNK_BYTES) {
+		const DWORD chunk = length - done < CHUNK_BYTES ? length - done : CHUNK_BYTES;
+
+		if (!iowrite8_buffer(addr + done, (const BYTE *) data + done, chunk))
+			return fail(ctx, UVIEMON_ERR_IO, "Writing %u bytes at %#010x failed", chunk, addr + (DWORD) done);
+
+		progress(ctx, done + chunk, length);
+	}
+
+	return UVIEMON_OK;
+}
+
+/* Results of the batch land in the buffer of the caller */
+int uviemon_read32(uviemon_context *ctx, uint32_t addr, uint32_t *data, size_t count)
+{
+	ftdi_batch batch;
+	int result = UVIEMON_OK;
+
+	if (ctx == NULL || !ctx->opened || (addr & 0x3) || (data == NULL && count > 0))
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+	ftdi_batch_init(&batch);
+
+	for (size_t done = 0; done < count; done += CHUNK_BYTES / 4) {
+		const DWORD chunk = count - done < CHUNK_BYTES / 4 ? count - done : CHUNK_BYTES / 4;
+
+		ftdi_batch_clear(&batch);
+		ftdi_batch_read32_block(&batch, addr + done * 4, chunk);
+
+		if (ftdi_batch_transfer(&batch, (DWORD *) data + done) != FT_OK) {
+			result = fail(ctx, UVIEMON_ERR_IO, "Reading %u words at %#010x failed", chunk, addr + (DWORD) done * 4);
+			break;
+		}
+
+		progress(ctx, (done + chunk) * 4, count * 4);
+	}
+
+	ftdi_batch_free(&batch);
+
+	return result;
+}
+
+int uviemon_write32(uviemon_context *ctx, uint32_t addr, const uint32_t *data, size_t count)
+{
+	ftdi_batch batch;
+	int result = UVIEMON_OK;
+
+	if (ctx == NULL || !ctx->opened || (addr & 0x3) || (data == NULL && count > 0))
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+	ftdi_batch_init(&batch);
+
+	for (size_t done = 0; done < count; done += CHUNK_BYTES / 4) {
+		const DWORD chunk = count - done < CHUNK_BYTES / 4 ? count - done : CHUNK_BYTES / 4;
+
+		ftdi_batch_clear(&batch);
+		ftdi_batch_write32_block(&batch, addr + done * 4, (const DWORD *) data + done, chunk);
+
+		if (ftdi_batch_send(&batch) != FT_OK) {
+			result = fail(ctx, UVIEMON_ERR_IO, "Writing %u words at %#010x failed", chunk, addr + (DWORD) done * 4);
+			break;
+		}
+
+		progress(ctx, (done + chunk) * 4, count * 4);
+	}
+
+	ftdi_batch_free(&batch);
+
+	return result;
+}
+
+int uviemon_fill32(uviemon_context *ctx, uint32_t addr, uint32_t pattern, size_t count)
+{
+	const uviemon_progress saved = ctx != NULL ? ctx->progress : NULL;
+	int result = UVIEMON_OK;
+
+	if (ctx == NULL)
+		return UVIEMON_ERR_ARGUMENT;
+
+	for (size_t i = 0; i < CHUNK_BYTES / 4; i++)
+		ctx->words[i] = pattern;
+
+	// Progress over the whole fill, not per chunk
+	ctx->progress = NULL;
+
+	for (size_t done = 0; result == UVIEMON_OK && done < count; done += CHUNK_BYTES / 4) {
+		const size_t chunk = count - done < CHUNK_BYTES / 4 ? count - done : CHUNK_BYTES / 4;
+
+		result = uviemon_write32(ctx, addr + done * 4, ctx->words, chunk);
+
+		if (result == UVIEMON_OK && saved)
+			saved((done + chunk) * 4, count * 4, ctx->progress_arg);
+	}
+
+	ctx->progress = saved;
+
+	return result;
+}
+
+int uviemon_snapshot(uviemon_context *ctx, unsigned int cpu, uviemon_registers *regs)
+{
+	DWORD data[DSU_REG_TRAP / 4 - DSU_REG_Y / 4 + 1 + UVIEMON_IU_REG_WORDS + UVIEMON_FPU_REG_WORDS];
+	ftdi_batch batch;
+
+	if (ctx == NULL || !ctx->opened || regs == NULL || cpu >= ctx->info.cpu_count)
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+	ftdi_batch_init(&batch);
+
+	const DWORD special = ftdi_batch_read32_seq(&batch, DSU_BASE(cpu) + DSU_REG_Y, (DSU_REG_TRAP - DSU_REG_Y) / 4 + 1);
+	const DWORD iu = ftdi_batch_read32_seq(&batch, DSU_BASE(cpu) + DSU_IU_REG, UVIEMON_IU_REG_WORDS);
+	const DWORD fpu = ftdi_batch_read32_seq(&batch, DSU_BASE(cpu) + DSU_FPU_REG, UVIEMON_FPU_REG_WORDS);
+
+	const bool ok = ftdi_batch_transfer(&batch, data) == FT_OK;
+
+	ftdi_batch_free(&batch);
+
+	if (!ok)
+		return fail(ctx, UVIEMON_ERR_IO, "Reading the registers of cpu %d failed", cpu);
+
+	regs->y = data[special];
+	regs->psr = data[special + 1];
+	regs->wim = data[special + 2];
+	regs->tbr = data[special + 3];
+	regs->pc = data[special + 4];
+	regs->npc = data[special + 5];
+	regs->fsr = data[special + 6];
+	regs->cpsr = data[special + 7];
+	regs->trap = data[special + 8];
+	memcpy(regs->iu, &data[iu], sizeof(regs->iu));
+	memcpy(regs->fpu, &data[fpu], sizeof(regs->fpu));
+
+	return UVIEMON_OK;
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int uviemon_run(uviemon_context *ctx, unsigned int cpu, unsigned int timeout_ms, FILE *uart,
+		uviemon_run_result *result)
+{
+	ftdi_core_entry entries[DSU_NCPUS];
+	BYTE traps[DSU_NCPUS];
+	struct timespec start;
+	unsigned int wait_us;
+
+	if (ctx == NULL || !ctx->opened || result == NULL || cpu >= ctx->info.cpu_count)
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+	uart_capture(uart);
+	ftdi_default_entries(1 << cpu, entries);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	result->timeout = false;
+
+	if (!runCPU_start(1 << cpu, entries, false)) {
+		uart_capture(NULL);
+		return fail(ctx, UVIEMON_ERR_IO, "Could not start the run");
+	}
+
+	// As the background run, but the stop comes from the timeout
+	for (;;) {
+		const enum ftdi_run_state state = runCPU_poll(&wait_us);
+
+		if (state == FTDI_RUN_FAILED) {
+			uart_capture(NULL);
+			return fail(ctx, UVIEMON_ERR_IO, "Lost the device during the run");
+		}
+
+		if (state == FTDI_RUN_ACTIVE) {
+			if (timeout_ms && !result->timeout && elapsed_ms(&start) >= timeout_ms) {
+				runCPU_stop();
+				result->timeout = true;
+			} else if (wait_us) {
+				usleep(wait_us);
+			}
+
+			continue;
+		}
+
+		if (runCPU_finish(traps) || result->timeout)
+			break;
+
+		if (!runCPU_start(1 << cpu, entries, false)) {
+			uart_capture(NULL);
+			return fail(ctx, UVIEMON_ERR_IO, "Could not start the run again");
+		}
+	}
+
+	uart_capture(NULL);
+	result->trap = traps[cpu];
+	result->cycles = runCPU_cycles(cpu);
+
+	return UVIEMON_OK;
+}
+
+/*
+ * Images and dumps
+ */
+
+/* Compares the RAM with chunk bytes of the image from offset on */
+static int check_chunk(uviemon_context *ctx, const BYTE *image, uint64_t offset, size_t chunk, uint64_t *first_error)
+{
+	if (!ioread8_buffer(ctx->info.ram_start + offset, ctx->memory, chunk))
+		return fail(ctx, UVIEMON_ERR_IO, "Reading the image at %#010x failed",
+			    ctx->info.ram_start + (DWORD) offset);
+
+	if (memcmp(image, ctx->memory, chunk) != 0) {
+		size_t i = 0;
+
+		while (image[i] == ctx->memory[i])
+			i++;
+
+		if (first_error)
+			*first_error = (offset + i) & ~0x3;
+
+		return fail(ctx, UVIEMON_ERR_VERIFY, "Byte %llu of the image differs",
+			    (unsigned long long) (offset + i));
+	}
+
+	return UVIEMON_OK;
+}
+
+static FILE *open_image(uviemon_context *ctx, const char *path, uint64_t *size)
+{
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		fail(ctx, UVIEMON_ERR_FILE, "File '%s' could not be opened", path);
+		return NULL;
+	}
+
+	fseek(fp, 0L, SEEK_END);
+	const long file_size = ftell(fp);
+
+	if (file_size <= IMAGE_OFFSET) {
+		fail(ctx, UVIEMON_ERR_FILE, "File '%s' is too small, needs to be more than 64 KiB", path);
+		fclose(fp);
+		return NULL;
+	}
+
+	// Ignore the elf header for now
+	fseek(fp, IMAGE_OFFSET, SEEK_SET);
+	*size = file_size - IMAGE_OFFSET;
+
+	return fp;
+}
+
+int uviemon_load(uviemon_context *ctx, const char *path, uint64_t *size)
+{
+	uint64_t image_size, done = 0;
+	int result = UVIEMON_OK;
+
+	if (ctx == NULL || !ctx->opened || path == NULL)
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+
+	FILE *fp = open_image(ctx, path, &image_size);
+
+	if (fp == NULL)
+		return UVIEMON_ERR_FILE;
+
+	while (done < image_size) {
+		const size_t chunk = fread(ctx->buffer, 1, sizeof(ctx->buffer), fp);
+
+		if (chunk == 0) {
+			result = fail(ctx, UVIEMON_ERR_FILE, "Reading '%s' failed", path);
+			break;
+		}
+
+		if (!iowrite8_buffer(ctx->info.ram_start + done, ctx->buffer, chunk)) {
+			result = fail(ctx, UVIEMON_ERR_IO, "Writing the image at %#010x failed",
+				      ctx->info.ram_start + (DWORD) done);
+			break;
+		}
+
+		done += chunk;
+		progress(ctx, done, image_size);
+	}
+
+	fclose(fp);
+
+	if (size)
+		*size = done;
+
+	return result;
+}
+
+int uviemon_verify(uviemon_context *ctx, const char *path, uint64_t *first_error)
+{
+	uint64_t image_size, done = 0;
+	int result = UVIEMON_OK;
+
+	if (ctx == NULL || !ctx->opened || path == NULL)
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+
+	FILE *fp = open_image(ctx, path, &image_size);
+
+	if (fp == NULL)
+		return UVIEMON_ERR_FILE;
+
+	while (done < image_size) {
+		const size_t chunk = fread(ctx->buffer, 1, sizeof(ctx->buffer), fp);
+
+		if (chunk == 0) {
+			result = fail(ctx, UVIEMON_ERR_FILE, "Reading '%s' failed", path);
+			break;
+		}
+
+		result = check_chunk(ctx, ctx->buffer, done, chunk, first_error);
+
+		if (result != UVIEMON_OK)
+			break;
+
+		done += chunk;
+		progress(ctx, done, image_size);
+	}
+
+	fclose(fp);
+
+	return result;
+}
+
+int uviemon_dump(uviemon_context *ctx, uint32_t addr, size_t length, const char *path)
+{
+	int result = UVIEMON_OK;
+
+	if (ctx == NULL || !ctx->opened || path == NULL)
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+
+	FILE *fp = fopen(path, "wb");
+
+	if (fp == NULL)
+		return fail(ctx, UVIEMON_ERR_FILE, "File '%s' could not be created", path);
+
+	for (size_t done = 0; done < length; done += CHUNK_BYTES) {
+		const DWORD chunk = length - done < CHUNK_BYTES ? length - done : CHUNK_BYTES;
+
+		if (!ioread8_buffer(addr + done, ctx->buffer, chunk)) {
+			result = fail(ctx, UVIEMON_ERR_IO, "Reading %u bytes at %#010x failed", chunk, addr + (DWORD) done);
+			break;
+		}
+
+		if (fwrite(ctx->buffer, 1, chunk, fp) != chunk) {
+			result = fail(ctx, UVIEMON_ERR_FILE, "Writing '%s' failed", path);
+			break;
+		}
+
+		progress(ctx, done + chunk, length);
+	}
+
+	if (fclose(fp) != 0 && result == UVIEMON_OK)
+		result = fail(ctx, UVIEMON_ERR_FILE, "Writing '%s' failed", path);
+
+	return result;
+}
+
+/*
+ * Prepared images
+ */
+
+struct uviemon_image {
+	uint32_t ram_start;
+	enum ftdi_link link;	// The chunks are commands of that link
+	uint64_t size;
+	BYTE *data;		// As in the file, for verifying
+	ftdi_batch *chunks;	// Sealed writes of CHUNK_BYTES each
+	size_t chunk_count;
+};
+
+int uviemon_image_prepare(uviemon_context *ctx, const char *path, uviemon_image **image)
+{
+	uint64_t size;
+
+	if (ctx == NULL || !ctx->opened || path == NULL || image == NULL)
+		return UVIEMON_ERR_ARGUMENT;
+
+	*image = NULL;
+	select_context(ctx);
+
+	FILE *fp = open_image(ctx, path, &size);
+
+	if (fp == NULL)
+		return UVIEMON_ERR_FILE;
+
+	uviemon_image *img = calloc(1, sizeof(*img));
+
+	if (img != NULL) {
+		img->ram_start = ctx->info.ram_start;
+		img->link = ctx->device.link;
+		img->size = size;
+		img->chunk_count = (size + CHUNK_BYTES - 1) / CHUNK_BYTES;
+		img->data = malloc(size);
+		img->chunks = calloc(img->chunk_count, sizeof(ftdi_batch));
+	}
+
+	if (img == NULL || img->data == NULL || img->chunks == NULL) {
+		fclose(fp);
+		uviemon_image_free(img);
+		return fail(ctx, UVIEMON_ERR_MEMORY, "No memory for an image of %llu bytes", (unsigned long long) size);
+	}
+
+	const size_t read = fread(img->data, 1, size, fp);
+
+	fclose(fp);
+
+	if (read != size) {
+		uviemon_image_free(img);
+		return fail(ctx, UVIEMON_ERR_FILE, "Reading '%s' failed", path);
+	}
+
+	for (size_t i = 0; i < img->chunk_count; i++) {
+		const uint64_t offset = i * CHUNK_BYTES;
+		const DWORD chunk = size - offset < CHUNK_BYTES ? size - offset : CHUNK_BYTES;
+
+		ftdi_batch_init(&img->chunks[i]);
+		ftdi_batch_write8_buffer(&img->chunks[i], img->ram_start + offset, &img->data[offset], chunk);
+		ftdi_batch_seal(&img->chunks[i]);
+	}
+
+	*image = img;
+
+	return UVIEMON_OK;
+}
+
+void uviemon_image_free(uviemon_image *image)
+{
+	if (image == NULL)
+		return;
+
+	for (size_t i = 0; image->chunks != NULL && i < image->chunk_count; i++)
+		ftdi_batch_free(&image->chunks[i]);
+
+	free(image->chunks);
+	free(image->data);
+	free(image);
+}
+
+uint64_t uviemon_image_size(const uviemon_image *image)
+{
+	return image != NULL ? image->size : 0;
+}
+
+static int check_image(uviemon_context *ctx, const uviemon_image *image)
+{
+	if (image->ram_start != ctx->info.ram_start)
+		return fail(ctx, UVIEMON_ERR_ARGUMENT, "Image prepared for RAM at %#010x, the RAM of this CPU is at %#010x",
+			    image->ram_start, ctx->info.ram_start);
+
+	if (image->link != ctx->device.link)
+		return fail(ctx, UVIEMON_ERR_ARGUMENT, "Image prepared for a device on the other link");
+
+	return UVIEMON_OK;
+}
+
+int uviemon_load_image(uviemon_context *ctx, const uviemon_image *image)
+{
+	if (ctx == NULL || !ctx->opened || image == NULL)
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+
+	const int result = check_image(ctx, image);
+
+	if (result != UVIEMON_OK)
+		return result;
+
+	for (size_t i = 0; i < image->chunk_count; i++) {
+		const uint64_t offset = i * CHUNK_BYTES;
+		const uint64_t done = image->size - offset < CHUNK_BYTES ? image->size : offset + CHUNK_BYTES;
+
+		if (ftdi_batch_send_sealed(&image->chunks[i]) != FT_OK)
+			return fail(ctx, UVIEMON_ERR_IO, "Writing the image at %#010x failed",
+				    image->ram_start + (DWORD) offset);
+
+		progress(ctx, done, image->size);
+	}
+
+	return UVIEMON_OK;
+}
+
+int uviemon_verify_image(uviemon_context *ctx, const uviemon_image *image, uint64_t *first_error)
+{
+	if (ctx == NULL || !ctx->opened || image == NULL)
+		return UVIEMON_ERR_ARGUMENT;
+
+	select_context(ctx);
+
+	int result = check_image(ctx, image);
+
+	for (uint64_t done = 0; result == UVIEMON_OK && done < image->size; done += CHUNK_BYTES) {
+		const size_t chunk = image->size - done < CHUNK_BYTES ? image->size - done : CHUNK_BYTES;
+
+		result = check_chunk(ctx, &image->data[done], done, chunk, first_error);
+
+		if (result == UVIEMON_OK)
+			progress(ctx, done + chunk, image->size);
+	}
+
+	return result;
+}
@@ -0,0 +1,123 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Public C API of libuviemon.so, the probe,
+	DSU and loader layers without the console.
+	Every call takes the context of an opened
+	probe, returns UVIEMON_OK or an error code
+	and prints nothing unless asked to, the
+	message of the last error is kept in the
+	context. Memory is moved in bulk straight
+	from and to the buffers of the caller.
+	Probes can be driven from threads of their
+	own, one thread per context at a time.
+	============================================
+*/
+
+#ifndef LIBUVIEMON_H
+#define LIBUVIEMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define UVIEMON_IU_REG_WORDS 136	// 8 windows of %l and %i, then %g
+#define UVIEMON_FPU_REG_WORDS 32
+
+enum uviemon_error {
+	UVIEMON_OK = 0,
+	UVIEMON_ERR_ARGUMENT = -1,	// Bad context, address, length or cpu
+	UVIEMON_ERR_OPEN = -2,		// No probe, no or wrong JTAG chain
+	UVIEMON_ERR_IO = -3,		// USB or JTAG transfer failed
+	UVIEMON_ERR_FILE = -4,		// Image or dump file
+	UVIEMON_ERR_VERIFY = -5,	// Memory differs from the image
+	UVIEMON_ERR_MEMORY = -6
+};
+
+typedef struct uviemon_context uviemon_context;
+typedef struct uviemon_image uviemon_image;
+
+typedef struct {
+	uint32_t idcode;		// The chain fields are 0 on the AHBUART
+	uint32_t ir_length;
+	uint32_t data_length;		// DR of the data register
+	uint32_t command_length;	// DR of the address/command register
+	int cpu_type;			// 0 LEON3, 1 LEON4
+	uint32_t cpu_count;
+	uint32_t ram_start;		// Where images are loaded
+} uviemon_info;
+
+/* One transaction while the core is in debug mode, special registers in DSU order */
+typedef struct {
+	uint32_t y, psr, wim, tbr, pc, npc, fsr, cpsr, trap;
+	uint32_t iu[UVIEMON_IU_REG_WORDS];	// As the DSU maps them, the window of %o is that of %i of cwp - 1
+	uint32_t fpu[UVIEMON_FPU_REG_WORDS];
+} uviemon_registers;
+
+typedef struct {
+	uint8_t trap;		// tt the program ended with, 0x80 for ta 0
+	bool timeout;		// Stopped after the timeout instead
+	uint64_t cycles;	// From the start to the stop
+} uviemon_run_result;
+
+// Called between chunks of the bulk operations with the bytes done so far
+typedef void (*uviemon_progress)(uint64_t done, uint64_t total, void *arg);
+
+/*
+ * cpu_type -1 detects the CPU. The JTAG chain and register lengths are checked
+ * for a single GR712/GR740. *ctx is set even if opening fails, for the error
+ * message, and must be closed in any case. verbose also prints the messages of
+ * the transport to stdout and stderr, as in the console.
+ */
+int uviemon_open(unsigned int device_index, int cpu_type, bool verbose, uviemon_context **ctx);
+
+// The same over the AHBUART on a serial device, path like /dev/ttyUSB0
+int uviemon_open_ahbuart(const char *path, unsigned int baud, int cpu_type, bool verbose, uviemon_context **ctx);
+void uviemon_close(uviemon_context *ctx);
+unsigned int uviemon_device_count(); // FTDI devices connected
+
+int uviemon_get_info(uviemon_context *ctx, uviemon_info *info);
+
+const char *uviemon_strerror(int error);
+const char *uviemon_last_error(const uviemon_context *ctx);
+
+void uviemon_set_verbose(uviemon_context *ctx, bool verbose);
+void uviemon_set_progress(uviemon_context *ctx, uviemon_progress progress, void *arg);
+
+/* Bytes in the order of the big endian target memory, any alignment and length */
+int uviemon_read(uviemon_context *ctx, uint32_t addr, void *data, size_t length);
+int uviemon_write(uviemon_context *ctx, uint32_t addr, const void *data, size_t length);
+
+/* 32 bit words in host order, addr must be word aligned */
+int uviemon_read32(uviemon_context *ctx, uint32_t addr, uint32_t *data, size_t count);
+int uviemon_write32(uviemon_context *ctx, uint32_t addr, const uint32_t *data, size_t count);
+int uviemon_fill32(uviemon_context *ctx, uint32_t addr, uint32_t pattern, size_t count);
+
+int uviemon_snapshot(uviemon_context *ctx, unsigned int cpu, uviemon_registers *regs);
+
+/* Images as for 'load': the first 64 KiB of the file are skipped, the rest goes to RAM */
+int uviemon_load(uviemon_context *ctx, const char *path, uint64_t *size);
+int uviemon_verify(uviemon_context *ctx, const char *path, uint64_t *first_error); // Offset of the first differing word
+int uviemon_dump(uviemon_context *ctx, uint32_t addr, size_t length, const char *path);
+
+/*
+ * Runs the program in RAM on a core from its start, as 'run' does. UART
+ * output goes to uart, stdout if NULL. A timeout_ms of 0 waits for ever.
+ */
+int uviemon_run(uviemon_context *ctx, unsigned int cpu, unsigned int timeout_ms, FILE *uart,
+		uviemon_run_result *result);
+
+/*
+ * The same image read and encoded once for the RAM of ctx, then loaded and
+ * verified with any number of contexts at the same time. It is not changed
+ * by them and can be shared by their threads.
+ */
+int uviemon_image_prepare(uviemon_context *ctx, const char *path, uviemon_image **image);
+void uviemon_image_free(uviemon_image *image);
+uint64_t uviemon_image_size(const uviemon_image *image);
+int uviemon_load_image(uviemon_context *ctx, const uviemon_image *image);
+int uviemon_verify_image(uviemon_context *ctx, const uviemon_image *image, uint64_t *first_error);
+
+#endif /* LIBUVIEMON_H */
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""
+Model of the AHBUART on a pseudo terminal, to check the AHBUART link of
+uviemon without a board.
+
+    ./tools/ahbuart_model.py &
+    ./uviemon -cpu_type 0 -ahbuart <pty printed by the model>
+
+Serves read and write commands of up to 64 words on a sparse memory that
+reads 0 where nothing was written, e.g. load, verify, mem and wmem work on
+it. The 0x55 sync bytes are counted and skipped. On SIGINT or SIGTERM, or
+once uviemon closes the pty, it prints what it served and the first words
+at 0x40000000 to stderr.
+"""
+
+import os
+import signal
+import struct
+import sys
+import tty
+
+READ = 0x80
+WRITE = 0xC0
+SYNC = 0x55
+
+
+class Closed(Exception):
+    pass
+
+
+def stop(*args):
+    raise Closed()
+
+
+class Link:
+    def __init__(self, fd):
+        self.fd = fd
+        self.buf = bytearray()
+
+    def take(self, n):
+        while len(self.buf) < n:
+            data = os.read(self.fd, 65536)
+            if not data:
+                raise Closed()
+            self.buf += data
+        data = bytes(self.buf[:n])
+        del self.buf[:n]
+        return data
+
+
+def main():
+    signal.signal(signal.SIGTERM, stop)
+    signal.signal(signal.SIGINT, stop)
+
+    master, slave = os.openpty()
+    tty.setraw(master)
+    print(os.ttyname(slave), flush=True)
+
+    link = Link(master)
+    mem = {}
+    stats = {'reads': 0, 'writes': 0, 'max burst': 0, 'sync': 0, 'bad': 0}
+
+    try:
+        while True:
+            command = link.take(1)[0]
+
+            if command == SYNC:
+                stats['sync'] += 1
+                continue
+
+            if not command & READ:
+                stats['bad'] += 1
+                print('Bad command byte 0x%02x' % command, file=sys.stderr)
+                continue
+
+            words = (command & 0x3F) + 1
+            addr = struct.unpack('>I', link.take(4))[0] & ~0x3
+            stats['max burst'] = max(stats['max burst'], words)
+
+            if command & WRITE == WRITE:
+                stats['writes'] += words
+                for i in range(words):
+                    mem[addr + 4 * i] = struct.unpack('>I', link.take(4))[0]
+            else:
+                stats['reads'] += words
+                os.write(master, b''.join(struct.pack('>I', mem.get(addr + 4 * i, 0)) for i in range(words)))
+    except (Closed, OSError):
+        pass
+
+    print(', '.join('%s %d' % item for item in stats.items()), file=sys.stderr)
+    print('0x40000000: ' + ' '.join('%08x' % mem.get(0x40000000 + 4 * i, 0) for i in range(8)), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,86 @@
+/*
+ * Run-and-halt check of the DSU run control of uviemon on a board.
+ *
+ *     ./build.sh
+ *     gcc -o tools/run_check tools/run_check.c -L. -luviemon -Wl,-rpath,'$ORIGIN/..' -L./lib/ftdi/build -lftd2xx
+ *     ./tools/run_check [device index] [cpu type, detected if left out]
+ *
+ * Puts an endless loop at the start of RAM, runs it on CPU 0 until the timeout
+ * forces the core into debug mode and reads its DSU control register back.
+ * The core has to have left halt mode, kept the trace and the breaks on errors,
+ * error traps and software breakpoints it was released with and be in debug
+ * mode now. Exits with 1 on the first mismatch.
+ */
+
+#include "../libuviemon.h"
+#include "../leon3_dsu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const uint32_t loop[] = {
+	0x10800000,	// ba .
+	0x01000000	// nop
+};
+
+static const struct {
+	uint32_t bit;
+	bool set;
+	const char *name;
+} expected[] = {
+	{ DSU_CTRL_HL, false, "HL (halt mode)" },
+	{ DSU_CTRL_TE, true, "TE (trace enable)" },
+	{ DSU_CTRL_BE, true, "BE (break on error)" },
+	{ DSU_CTRL_BS, true, "BS (break on software breakpoint)" },
+	{ DSU_CTRL_BZ, true, "BZ (break on error trap)" },
+	{ DSU_CTRL_DM, true, "DM (debug mode)" }
+};
+
+static void check(int rc, uviemon_context *ctx, const char *what)
+{
+	if (rc == UVIEMON_OK)
+		return;
+
+	fprintf(stderr, "%s: %s\n", what, uviemon_last_error(ctx));
+	uviemon_close(ctx);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uviemon_context *ctx;
+	uviemon_info info;
+	uviemon_run_result result;
+	uint32_t ctrl;
+	int failed = 0;
+
+	const int opened = uviemon_open(argc > 1 ? atoi(argv[1]) : 0, argc > 2 ? atoi(argv[2]) : -1,
+					 false, &ctx);
+
+	check(opened, ctx, "Open");
+	check(uviemon_get_info(ctx, &info), ctx, "Info");
+	check(uviemon_write32(ctx, info.ram_start, loop, 2), ctx, "Load");
+	check(uviemon_run(ctx, 0, 200, NULL, &result), ctx, "Run");
+
+	if (!result.timeout) {
+		fprintf(stderr, "The loop stopped on its own with trap 0x%02x\n", result.trap);
+		failed = 1;
+	}
+
+	check(uviemon_read32(ctx, ADDRESSES[info.cpu_type][DSU] + DSU_OFFSET_CPU(0), &ctrl, 1), ctx, "Read back");
+	printf("DSU control of CPU 0 after the halt: 0x%08x\n", ctrl);
+
+	for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+		if (!(ctrl & expected[i].bit) != !expected[i].set) {
+			fprintf(stderr, "%s is %s\n", expected[i].name, expected[i].set ? "clear" : "set");
+			failed = 1;
+		}
+	}
+
+	uviemon_close(ctx);
+
+	if (!failed)
+		printf("OK\n");
+
+	return failed;
+}
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+End-to-end check of the XVC server of uviemon, as an XVC client would use it.
+
+    ./uviemon -xvc 2542 &
+    ./tools/xvc_check.py 2542 [expected IDCODE]
+
+Reads the IDCODE out of the DR after a TAP reset and shifts random patterns
+through the DR and the IR, once as one vector and once split into shifts of
+odd lengths. The patterns have to come back delayed by the chain length, and
+both ways have to return the same TDO. Exits with 1 on the first mismatch.
+"""
+
+import random
+import socket
+import struct
+import sys
+
+
+def recv_all(sock, n):
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            sys.exit('Server closed the connection')
+        data += chunk
+    return data
+
+
+def shift(sock, tms, tdi):
+    """One shift: command, TMS and TDI as lists of bits, returns TDO"""
+    n = len(tms)
+    pack = lambda bits: bytes(sum(b << i for i, b in enumerate(bits[k:k + 8])) for k in range(0, n, 8))
+    sock.sendall(b'shift:' + struct.pack('<I', n) + pack(tms) + pack(tdi))
+    tdo = recv_all(sock, (n + 7) // 8)
+    return [(tdo[i // 8] >> (i % 8)) & 1 for i in range(n)]
+
+
+def shift_split(sock, tms, tdi, lengths):
+    """The same vector in shifts of the given lengths, repeated until it is done"""
+    tdo = []
+    pos = 0
+    i = 0
+    while pos < len(tms):
+        n = lengths[i % len(lengths)]
+        tdo += shift(sock, tms[pos:pos + n], tdi[pos:pos + n])
+        pos += n
+        i += 1
+    return tdo
+
+
+def scan(ir, data_bits):
+    """From Test-Logic-Reset through Shift-DR or Shift-IR and back to Idle"""
+    head = [1, 1, 1, 1, 1, 0, 1] + ([1] if ir else []) + [0, 0]
+    tail = [1, 0]
+    tms = head + [0] * (len(data_bits) - 1) + [1] + tail
+    tdi = [0] * len(head) + data_bits + [0] * len(tail)
+    return tms, tdi, len(head)
+
+
+def delay(tdo, pattern):
+    """Bits the pattern took through the register, None if it never came out"""
+    for d in range(1, len(tdo) - len(pattern) + 1):
+        if tdo[d:d + len(pattern)] == pattern:
+            return d
+    return None
+
+
+def check(sock, ir):
+    name = 'IR' if ir else 'DR'
+    pattern = [random.randint(0, 1) for _ in range(300)]
+    tms, tdi, start = scan(ir, pattern + [0] * 200)
+
+    whole = shift(sock, tms, tdi)
+    split = shift_split(sock, tms, tdi, [1, 7, 9, 13, 3, 64, 2])
+
+    if whole != split:
+        sys.exit('%s scan: split shifts returned other TDO than one shift' % name)
+
+    out = whole[start:start + len(pattern) + 200]
+    d = delay(out, pattern)
+
+    if d is None:
+        sys.exit('%s scan: the pattern did not come back out' % name)
+
+    print('%s scan: %d bits between TDI and TDO' % (name, d))
+    return out
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+
+    sock = socket.create_connection(('localhost', int(sys.argv[1])))
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    sock.sendall(b'getinfo:')
+    info = b''
+    while not info.endswith(b'\n'):
+        info += recv_all(sock, 1)
+    print('getinfo: %s' % info.decode().strip())
+
+    sock.sendall(b'settck:' + struct.pack('<I', 100))
+    print('settck: %u ns' % struct.unpack('<I', recv_all(sock, 4))[0])
+
+    dr = check(sock, False)
+    ir = check(sock, True)
+
+    if ir[:2] != [1, 0]:
+        sys.exit('IR scan: captured IR does not start with 01')
+
+    if dr[0] != 1:
+        sys.exit('DR scan: first device has no IDCODE')
+
+    idcode = sum(b << i for i, b in enumerate(dr[:32]))
+    print('IDCODE: 0x%08x' % idcode)
+
+    if len(sys.argv) > 2 and idcode != int(sys.argv[2], 16):
+        sys.exit('IDCODE is not %s' % sys.argv[2])
+
+    print('OK')
+
+
+if __name__ == '__main__':
+    main()
@@ -12,6 +12,16 @@
 
 #include "ftdi_device.h"
 #include "uviemon_cli.h"
+#include "uviemon_uart.h"
+#include "uviemon_serial.h"
+#include "uviemon_run.h"
+#include "uviemon_gdb.h"
+#include "uviemon_xvc.h"
+#include "uviemon_daemon.h"
+#include "uviemon_gang.h"
+#include "uviemon_farm.h"
+#include "uviemon_ahbuart.h"
+#include "libuviemon.h"
 
 //#include <iostream>			   // cout and cerr
 #include <string.h>			   // Needed for strcmp
@@ -87,14 +97,26 @@ void showHelp()
 	printf("\t -info: \t Version numbers and driver info\n");
 	printf("\t -list: \t List all available FTDI devices\n");
 	printf("\t -cpu_tye <num>: \t 0 for LEON 3 and 1 for LEON4 autodetection used of omitted \n");
-	printf("\t -jtag <num>: \t Open console with jtag device\n\n");
+	printf("\t -jtag <num>: \t Open console with jtag device\n");
+	printf("\t -ahbuart <tty> [baud]: \t Open console with the AHBUART debug link on a serial device instead of JTAG, 115200 baud if omitted\n");
+	printf("\t -uart_log <file>: \t Append UART output of run to a file with timestamps\n");
+	printf("\t -uart_b <baud> [sysclk]: \t Take the UART output of run from channel B of the probe, wired to UART0, up to 12000000 baud, runs set UART0 to it from the system clock in Hz if given\n");
+	printf("\t -gdb <port>: \t Serve gdb on a localhost port instead of the console\n");
+	printf("\t -xvc <port>: \t Serve Xilinx Virtual Cable on a localhost port instead of the console\n");
+	printf("\t -daemon <socket>: \t Keep the device open and take commands of clients on a Unix socket\n");
+	printf("\t -connect <socket> [command]: \t Send a command, or each line of stdin, to a daemon\n");
+	printf("\t -gang <n,n,...> load|verify <file>: \t Load and verify, or only verify, an image on several devices at once\n");
+	printf("\t -farm <manifest> [report]: \t Run the tests of a manifest on all devices, JSON or JUnit (.xml) report\n\n");
 }
 
 int main(int argc, char *argv[])
 {
-	printf("\n  ** uviemon v%s **\n", VERSION);
-	printf("  LEON SPARC V8 Processor debugging monitor using\n");
-	printf("  the FTDI FT2232H chipset for communication.\n\n");
+	// Clients of a daemon print nothing but the output of their commands
+	if (argc < 2 || strcmp(argv[1], "-connect") != 0) {
+		printf("\n  ** uviemon v%s **\n", VERSION);
+		printf("  LEON SPARC V8 Processor debugging monitor using\n");
+		printf("  the FTDI FT2232H chipset for communication.\n\n");
+	}
 
 	if (argc < 2) {
 		fprintf(stderr, "Need a command to work!\n\n");
@@ -105,6 +127,13 @@ int main(int argc, char *argv[])
 	int i = 1;
 	int cpu_type = -1;
 	int device_index = 0;
+	int gdb_port = 0;
+	int xvc_port = 0;
+	const char *daemon_path = NULL;
+	unsigned int serial_baud = 0;
+	unsigned int serial_sysclk = 0;
+	const char *ahbuart_path = NULL;
+	unsigned int ahbuart_baud = AHBUART_DEFAULT_BAUD;
 
 	while(i < argc) {
 		if (strcmp(argv[i], "-list") == 0) {
@@ -138,6 +167,102 @@ int main(int argc, char *argv[])
 			}
 
 			
+		} else if (strcmp(argv[i], "-ahbuart") == 0) {
+			if ( (i + 1) >= argc ) {
+				fprintf(stderr, "-ahbuart requires a serial device\n");
+				return 1;
+			}
+
+			ahbuart_path = argv[++i];
+
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				ahbuart_baud = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-uart_log") == 0) {
+			if ( (i + 1) >= argc ) {
+				fprintf(stderr, "-uart_log requires a file name\n");
+				return 1;
+			}
+
+			if (!uart_log_open(argv[++i]))
+				return 1;
+		} else if (strcmp(argv[i], "-uart_b") == 0) {
+			if ( (i + 1) >= argc ) {
+				fprintf(stderr, "-uart_b requires a baud rate\n");
+				return 1;
+			}
+
+			serial_baud = strtoul(argv[++i], NULL, 10);
+
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				serial_sysclk = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-gdb") == 0) {
+			if ( (i + 1) >= argc ) {
+				fprintf(stderr, "-gdb requires a port\n");
+				return 1;
+			}
+
+			gdb_port = atoi(argv[++i]);
+
+			if (gdb_port <= 0 || gdb_port > 65535) {
+				fprintf(stderr, "Port: %s could not be parsed\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-daemon") == 0) {
+			if ( (i + 1) >= argc ) {
+				fprintf(stderr, "-daemon requires a socket path\n");
+				return 1;
+			}
+
+			daemon_path = argv[++i];
+		} else if (strcmp(argv[i], "-connect") == 0) {
+			if ( (i + 1) >= argc ) {
+				fprintf(stderr, "-connect requires a socket path\n");
+				return 1;
+			}
+
+			// The rest of the arguments is the command, the device is not touched
+			char command[256] = "";
+
+			for (int j = i + 2; j < argc; j++) {
+				if (strlen(command) + strlen(argv[j]) + 2 > sizeof(command)) {
+					fprintf(stderr, "Command too long\n");
+					return 1;
+				}
+
+				if (j > i + 2)
+					strcat(command, " ");
+				strcat(command, argv[j]);
+			}
+
+			return daemon_client(argv[i + 1], i + 2 < argc ? command : NULL);
+		} else if (strcmp(argv[i], "-gang") == 0) {
+			if ( (i + 3) >= argc || (strcmp(argv[i + 2], "load") != 0 && strcmp(argv[i + 2], "verify") != 0)) {
+				fprintf(stderr, "-gang requires a device list, load or verify and an image file\n");
+				return 1;
+			}
+
+			// Opens the devices itself, -cpu_type has to come before
+			return gang_run(argv[i + 1], cpu_type, strcmp(argv[i + 2], "load") == 0, argv[i + 3]);
+		} else if (strcmp(argv[i], "-farm") == 0) {
+			if ( (i + 1) >= argc ) {
+				fprintf(stderr, "-farm requires a manifest\n");
+				return 1;
+			}
+
+			// Opens the devices itself, -cpu_type has to come before
+			return farm_run(argv[i + 1], i + 2 < argc ? argv[i + 2] : NULL, cpu_type);
+		} else if (strcmp(argv[i], "-xvc") == 0) {
+			if ( (i + 1) >= argc ) {
+				fprintf(stderr, "-xvc requires a port\n");
+				return 1;
+			}
+
+			xvc_port = atoi(argv[++i]);
+
+			if (xvc_port <= 0 || xvc_port > 65535) {
+				fprintf(stderr, "Port: %s could not be parsed\n", argv[i]);
+				return 1;
+			}
 		} else {
 			fprintf(stderr, "Uknown command '%s'\n\n", argv[i]);
 			showHelp();
@@ -148,70 +273,54 @@ int main(int argc, char *argv[])
 		i++;
 	}
 
-	int count = get_devices_count();
+	uviemon_context *ctx;
 
-	if (device_index < 0 || device_index >= count) {
-		fprintf(stderr, "Device index cannot be smaller than 0 or larger than %d\n", count);
-		return 1;
-	}
-
-	if (!FT_SUCCESS(ftdi_open_device(device_index, cpu_type))) {
+	if (ahbuart_path != NULL) {
+		if (uviemon_open_ahbuart(ahbuart_path, ahbuart_baud, cpu_type, true, &ctx) != UVIEMON_OK) {
+			fprintf(stderr, "Unable to use the AHBUART on %s. Aborting...\n", ahbuart_path);
+			uviemon_close(ctx);
+			return 1;
+		}
+	} else if (uviemon_open(device_index, cpu_type, true, &ctx) != UVIEMON_OK) {
 		fprintf(stderr, "Unable to use device %d. Aborting...\n", device_index);
+		uviemon_close(ctx);
 		return 1;
 	}
 
-	uint32_t number_jtags = get_JTAG_count();
+	uviemon_info info;
 
-	if (number_jtags == 0) {
-		fprintf(stderr, "No devices connected on the JTAG chain! Exiting.\n");
-		return 1;
-	}
+	uviemon_get_info(ctx, &info);
+	cli_set_context(ctx);
 
-	if (number_jtags > 1) {
-		fprintf(stderr, "More than one device found on the JTAG chain. uviemon can only interface a single GR712!\n");
-		return 1;
+	if (ahbuart_path != NULL) {
+		printf("AHBUART on %s at %u baud\n", ahbuart_path, ahbuart_baud);
+	} else {
+		printf("Number of JTAG devices on chain: 1\n");
+		printf("Device IDCODE: %#010x\n", info.idcode);
+		printf("IR length: %d bits\n", info.ir_length);
+		printf("Data register length: %#010x, %d bits\n", CODE_DATA, info.data_length);
+		printf("Command/Address register length: %#010x, %d bits\n", CODE_ADDR_COMM, info.command_length);
 	}
 
-	uint32_t id = read_idcode();
-	uint32_t irl = scan_IR_length();
-
-	// Must be a 6-bit IR, otherwise something's very wrong!
-	if (irl != 6) {
-		fprintf(stderr, "%d-bit length, bad value!\n", irl);
-		fprintf(stderr, "IR length is unequal to 6 bits. Can only work with the 6-bit GR712 IR! Exiting.\n");
-		return 1;
-	}
-
-
-
-	uint32_t length1 = scan_DR_length(CODE_DATA); // Grab DR Data register length
-
-	// Must be a 33-bit DR, cannot work otherwise, everything's hard-coded
-	if (length1 != 33) {
-		fprintf(stderr, "%d-bit length, bad value!\n", length1);
-		fprintf(stderr, "Data register not working correctly. Need 33-bit GR712 register! Exiting.\n");
-		return 1;
-	}
-
-	uint32_t length2 = scan_DR_length(CODE_ADDR_COMM); // Grab DR Command/Address register
+	printf("OK. Ready!\n\n");
 
-	// Must be a 35-bit DR, cannot work otherwise, everything's hard-coded
-	if (length2 != 35)  {
-		fprintf(stderr, "%d-bit length, bad value!\n", length2);
-		fprintf(stderr, "Address/command register not working correctly. Need 35-bit GR712 register! Exiting.");
+	if (serial_baud && !serial_open(serial_baud, serial_sysclk)) {
+		uviemon_close(ctx);
 		return 1;
 	}
-
-	printf("Number of JTAG devices on chain: %d\n", number_jtags);
-	printf("Device IDCODE: %#x010x\n", id);
-	printf("IR length: %d bits\n", irl);
-	printf("Data register length: %#010x, %d bits\n", CODE_DATA, length1);
-	printf("Command/Address register length: %#010x, %d bits\n", CODE_ADDR_COMM, length2);
-	printf("OK. Ready!\n\n");
 	
-	console();
+	if (gdb_port)
+		gdb_serve(gdb_port);
+	else if (xvc_port)
+		xvc_serve(xvc_port);
+	else if (daemon_path)
+		daemon_serve(daemon_path);
+	else
+		console();
 
-	ftdi_close_device();
+	run_shutdown();
+	uart_log_close();
+	uviemon_close(ctx);
 
 	return 0;
 }
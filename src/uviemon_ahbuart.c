@@ -0,0 +1,149 @@
+#define _DEFAULT_SOURCE // Baud rates above 230400, usleep
+
+#include "uviemon_ahbuart.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define AHBUART_SYNC 0x55	// Sent twice, the AHBUART detects the baud rate from it
+#define AHBUART_SYNC_US 10000
+
+static const struct {
+	unsigned int baud;
+	speed_t speed;
+} speeds[] = {
+	{ 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+	{ 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 }, { 500000, B500000 },
+	{ 921600, B921600 }, { 1000000, B1000000 }, { 1500000, B1500000 }, { 2000000, B2000000 },
+	{ 3000000, B3000000 }, { 4000000, B4000000 }
+};
+
+int ahbuart_open(const char *path, unsigned int baud)
+{
+	static const uint8_t sync[] = { AHBUART_SYNC, AHBUART_SYNC };
+	struct termios tio;
+	speed_t speed = 0;
+
+	for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+		if (speeds[i].baud == baud)
+			speed = speeds[i].speed;
+	}
+
+	if (speed == 0) {
+		fprintf(stderr, "Baud rate %u is not supported for the AHBUART\n", baud);
+		return -1;
+	}
+
+	const int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+	if (fd < 0) {
+		perror("Could not open the AHBUART device");
+		return -1;
+	}
+
+	if (tcgetattr(fd, &tio) != 0) {
+		perror("Could not get the AHBUART settings");
+		close(fd);
+		return -1;
+	}
+
+	// 8N1 without flow control, nothing translated
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+		perror("Could not set up the AHBUART device");
+		close(fd);
+		return -1;
+	}
+
+	tcflush(fd, TCIOFLUSH);
+
+	if (!ahbuart_transfer(fd, sync, sizeof(sync), NULL, 0)) {
+		close(fd);
+		return -1;
+	}
+
+	// Give the AHBUART the time to lock on before the first command
+	tcdrain(fd);
+	usleep(AHBUART_SYNC_US);
+
+	return fd;
+}
+
+void ahbuart_close(int fd)
+{
+	tcdrain(fd);
+	close(fd);
+}
+
+/*
+ * Reads are answered while the rest of the commands still goes out, they
+ * are collected as they come in so that the receive buffer of the tty
+ * never runs full
+ */
+bool ahbuart_transfer(int fd, const uint8_t *out, size_t out_len, uint8_t *in, size_t in_len)
+{
+	size_t sent = 0;
+	size_t received = 0;
+
+	while (sent < out_len || received < in_len) {
+		struct pollfd pfd = { .fd = fd, .events = (sent < out_len ? POLLOUT : 0)
+							  | (received < in_len ? POLLIN : 0) };
+		const int ready = poll(&pfd, 1, AHBUART_TIMEOUT_MS);
+
+		if (ready < 0 && errno == EINTR)
+			continue;
+
+		if (ready < 0) {
+			perror("Could not wait for the AHBUART");
+			return false;
+		}
+
+		if (ready == 0) {
+			fprintf(stderr, "AHBUART timed out, %zu of %zu bytes sent, %zu of %zu received\n",
+				sent, out_len, received, in_len);
+			return false;
+		}
+
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			fprintf(stderr, "AHBUART device failed\n");
+			return false;
+		}
+
+		if (pfd.revents & POLLIN) {
+			const ssize_t n = read(fd, in + received, in_len - received);
+
+			if (n < 0 && errno != EAGAIN && errno != EINTR) {
+				perror("Could not read from the AHBUART");
+				return false;
+			}
+
+			if (n > 0)
+				received += n;
+		}
+
+		if (pfd.revents & POLLOUT) {
+			const ssize_t n = write(fd, out + sent, out_len - sent);
+
+			if (n < 0 && errno != EAGAIN && errno != EINTR) {
+				perror("Could not write to the AHBUART");
+				return false;
+			}
+
+			if (n > 0)
+				sent += n;
+		}
+	}
+
+	return true;
+}
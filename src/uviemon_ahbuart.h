@@ -0,0 +1,41 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	AHBUART debug link: the AHB master behind
+	the debug UART of the GR712RC and GR740,
+	reached through a serial device of the host
+	instead of JTAG. Commands move up to 64
+	words, address and data are big endian:
+
+		10nnnnnn <addr>			read n + 1 words
+		11nnnnnn <addr> <data...>	write n + 1 words
+
+	Only reads are answered, with their words.
+	The batches of ftdi_device.c encode these
+	commands when the device uses this link.
+	============================================
+*/
+
+#ifndef UVIEMON_AHBUART_H
+#define UVIEMON_AHBUART_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AHBUART_READ 0x80
+#define AHBUART_WRITE 0xC0
+#define AHBUART_MAX_BURST 64	// Words of one command
+#define AHBUART_HEADER 5	// Command and address in front of the data
+#define AHBUART_TIMEOUT_MS 1000	// Without any progress
+#define AHBUART_DEFAULT_BAUD 115200
+
+// Returns the file descriptor, -1 if the device cannot be opened at that baud rate
+int ahbuart_open(const char *path, unsigned int baud);
+void ahbuart_close(int fd);
+
+// Sends out and collects the in_len bytes of the answers at the same time
+bool ahbuart_transfer(int fd, const uint8_t *out, size_t out_len, uint8_t *in, size_t in_len);
+
+#endif /* UVIEMON_AHBUART_H */
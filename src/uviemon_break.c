@@ -0,0 +1,585 @@
+#include "uviemon_break.h"
+
+#include "leon3_dsu.h"
+#include "uviemon_step.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TT_WATCHPOINT 0x0b		// watchpoint_detected
+#define TT_BREAKPOINT 0x81		// ta 1
+#define TT_EXIT 0x80			// ta 0, the program ended
+
+#define IU_WATCHPOINTS_DEFAULT 2	// Until the cores could be probed, as on the GR712RC
+#define PROBE_ADDR 0x5a5a5a58		// Written to the watchpoint address registers and read back
+
+enum break_unit {
+	UNIT_NONE,	// No hardware left, not armed
+	UNIT_IU,	// IU watchpoint of each core
+	UNIT_AHB,	// AHB breakpoint of the DSU, catches all bus masters
+	UNIT_SOFT	// ta 1 in place of the instruction
+};
+
+typedef struct {
+	int number;		// 0 for a free entry
+	enum break_type type;
+	DWORD addr;
+	DWORD length;		// Power of two, the address is aligned to it
+	bool soft;		// Software breakpoint requested
+	bool temporary;		// Set by the run control, not listed
+	enum break_unit unit;
+	unsigned int slot;	// IU watchpoint or AHB breakpoint number
+	DWORD original;		// Instruction replaced by ta 1
+	bool inserted;
+} breakpoint;
+
+typedef struct {
+	breakpoint bp[BREAK_MAX];
+	int next_number;
+	unsigned int iu_slots;	// IU watchpoints implemented by the cores
+	bool probed;
+	DWORD armed;		// Cores the breakpoints are armed on
+} break_state;
+
+static break_state break_slots[FTDI_MAX_DEVICES] = { [0] = { .next_number = 1, .iu_slots = IU_WATCHPOINTS_DEFAULT } };
+
+static inline break_state *break_slot()
+{
+	return &break_slots[ftdi_get_device_slot()];
+}
+
+static const char *type_names[] = { "exec", "read", "write", "access" };
+static const char *unit_names[] = { "none", "IU", "AHB", "soft" };
+
+/*
+ * The number of IU watchpoints is a synthesis option, unimplemented %asr
+ * registers read as zero. Only possible while the core is in debug mode.
+ */
+static void probe_iu_watchpoints(DWORD cpu)
+{
+	break_state *breaks = break_slot();
+	DWORD index[DSU_IU_WATCHPOINTS];
+	DWORD data[DSU_IU_WATCHPOINTS];
+	ftdi_batch batch;
+
+	if (breaks->probed || !dsu_get_cpu_in_debug_mode(cpu))
+		return;
+
+	ftdi_batch_init(&batch);
+
+	for (unsigned int n = 0; n < DSU_IU_WATCHPOINTS; n++) {
+		dsu_append_iu_watchpoint(&batch, cpu, n, PROBE_ADDR, 0, 0);
+		index[n] = ftdi_batch_read32(&batch, DSU_BASE(cpu) + DSU_REG_WADDR(n));
+		dsu_append_iu_watchpoint(&batch, cpu, n, 0, 0, 0);
+	}
+
+	if (ftdi_batch_transfer(&batch, data) == FT_OK) {
+		breaks->iu_slots = 0;
+
+		while (breaks->iu_slots < DSU_IU_WATCHPOINTS && data[index[breaks->iu_slots]] == PROBE_ADDR)
+			breaks->iu_slots++;
+
+		breaks->probed = true;
+	}
+
+	ftdi_batch_free(&batch);
+}
+
+/* Data watchpoints need hardware and get it first, then instruction breakpoints */
+static void assign_units()
+{
+	break_state *breaks = break_slot();
+	unsigned int iu = 0, ahb = 0;
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		breakpoint *bp = &breaks->bp[i];
+
+		if (bp->number == 0 || bp->type == BREAK_EXEC)
+			continue;
+
+		if (iu < breaks->iu_slots) {
+			bp->unit = UNIT_IU;
+			bp->slot = iu++;
+		} else if (ahb < DSU_AHB_BREAKPOINTS) {
+			bp->unit = UNIT_AHB;
+			bp->slot = ahb++;
+		} else {
+			bp->unit = UNIT_NONE;
+		}
+	}
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		breakpoint *bp = &breaks->bp[i];
+
+		if (bp->number == 0 || bp->type != BREAK_EXEC)
+			continue;
+
+		if (!bp->soft && iu < breaks->iu_slots) {
+			bp->unit = UNIT_IU;
+			bp->slot = iu++;
+		} else {
+			bp->unit = UNIT_SOFT;
+		}
+	}
+}
+
+static int count_watchpoints()
+{
+	const break_state *breaks = break_slot();
+	int count = 0;
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		if (breaks->bp[i].number != 0 && breaks->bp[i].type != BREAK_EXEC)
+			count++;
+	}
+
+	return count;
+}
+
+static int add(enum break_type type, DWORD addr, DWORD length, bool soft, bool temporary)
+{
+	break_state *breaks = break_slot();
+	breakpoint *bp = NULL;
+
+	if (breaks->armed) {
+		printf("Breakpoints cannot be changed while the cores run\n");
+		return 0;
+	}
+
+	if (type == BREAK_EXEC)
+		length = 4;
+	else if (length < 4)
+		length = 4;
+
+	if ((length & (length - 1)) != 0 || (addr & (length - 1)) != 0) {
+		printf("The length must be a power of two and the address aligned to it\n");
+		return 0;
+	}
+
+	probe_iu_watchpoints(ftdi_get_active_cpu());
+
+	if (type != BREAK_EXEC && count_watchpoints() >= (int) breaks->iu_slots + DSU_AHB_BREAKPOINTS) {
+		printf("All %d hardware watchpoints are in use\n", breaks->iu_slots + DSU_AHB_BREAKPOINTS);
+		return 0;
+	}
+
+	for (int i = 0; i < BREAK_MAX && !bp; i++) {
+		if (breaks->bp[i].number == 0)
+			bp = &breaks->bp[i];
+	}
+
+	if (!bp) {
+		printf("No more than %d breakpoints can be set\n", BREAK_MAX);
+		return 0;
+	}
+
+	*bp = (breakpoint) {
+		.number = breaks->next_number++,
+		.type = type,
+		.addr = addr,
+		.length = length,
+		.soft = soft,
+		.temporary = temporary,
+	};
+
+	assign_units();
+
+	return bp->number;
+}
+
+int break_add(enum break_type type, DWORD addr, DWORD length, bool soft)
+{
+	return add(type, addr, length, soft, false);
+}
+
+int break_add_temporary(DWORD addr)
+{
+	return add(BREAK_EXEC, addr, 4, false, true);
+}
+
+void break_reset()
+{
+	break_state *breaks = break_slot();
+
+	memset(breaks, 0, sizeof(*breaks));
+	breaks->next_number = 1;
+	breaks->iu_slots = IU_WATCHPOINTS_DEFAULT;
+}
+
+bool break_delete(int number)
+{
+	break_state *breaks = break_slot();
+	bool found = false;
+
+	if (breaks->armed)
+		return false;
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		if (breaks->bp[i].number != 0 && (number == 0 || breaks->bp[i].number == number)) {
+			breaks->bp[i].number = 0;
+			found = true;
+		}
+	}
+
+	assign_units();
+
+	return found;
+}
+
+int break_find(enum break_type type, DWORD addr)
+{
+	const break_state *breaks = break_slot();
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		const breakpoint *bp = &breaks->bp[i];
+
+		if (bp->number != 0 && !bp->temporary && bp->type == type && bp->addr == addr)
+			return bp->number;
+	}
+
+	return 0;
+}
+
+bool break_defined()
+{
+	const break_state *breaks = break_slot();
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		if (breaks->bp[i].number != 0)
+			return true;
+	}
+
+	return false;
+}
+
+void break_print()
+{
+	const break_state *breaks = break_slot();
+	bool empty = true;
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		const breakpoint *bp = &breaks->bp[i];
+
+		if (bp->number == 0 || bp->temporary)
+			continue;
+
+		if (empty)
+			printf("   %-3s  %-6s  %-10s  %-6s  %s\n", "NUM", "TYPE", "ADDRESS", "LENGTH", "UNIT");
+
+		empty = false;
+
+		printf("   %-3d  %-6s  0x%08x  %-6u  %s", bp->number, type_names[bp->type], bp->addr,
+		       bp->length, unit_names[bp->unit]);
+
+		if (bp->unit == UNIT_IU || bp->unit == UNIT_AHB)
+			printf(" %u", bp->slot);
+
+		printf("\n");
+	}
+
+	if (empty)
+		printf("No breakpoints or watchpoints set\n");
+	else if (!breaks->probed)
+		printf("Assuming %d IU watchpoints per core until a core could be probed in debug mode\n", breaks->iu_slots);
+}
+
+/* Instructions replaced by software breakpoints, read in one transaction */
+static void read_originals()
+{
+	break_state *breaks = break_slot();
+	DWORD index[BREAK_MAX];
+	DWORD data[BREAK_MAX];
+	ftdi_batch batch;
+
+	ftdi_batch_init(&batch);
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		const breakpoint *bp = &breaks->bp[i];
+
+		if (bp->number != 0 && bp->unit == UNIT_SOFT && !bp->inserted)
+			index[i] = ftdi_batch_read32(&batch, bp->addr);
+	}
+
+	if (batch.reads == 0 || ftdi_batch_transfer(&batch, data) != FT_OK) {
+		ftdi_batch_free(&batch);
+		return;
+	}
+
+	ftdi_batch_free(&batch);
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		breakpoint *bp = &breaks->bp[i];
+
+		if (bp->number == 0 || bp->unit != UNIT_SOFT || bp->inserted)
+			continue;
+
+		bp->original = data[index[i]];
+		bp->inserted = true;
+	}
+}
+
+/* Flush and re-enable the caches through the ASI diagnostic access, as the run script does */
+static void append_cache_flush(ftdi_batch *batch, DWORD cores)
+{
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (!(cores & (1 << cpu)))
+			continue;
+
+		ftdi_batch_write32(batch, DSU_BASE(cpu) + 0x400024, 0x00000002);
+		ftdi_batch_write32(batch, DSU_BASE(cpu) + 0x700000, 0x00eb800f);
+	}
+}
+
+static DWORD iu_flags(const breakpoint *bp)
+{
+	switch (bp->type) {
+	case BREAK_EXEC:
+		return DSU_WP_IF;
+	case BREAK_READ:
+		return DSU_WP_DL;
+	case BREAK_WRITE:
+		return DSU_WP_DS;
+	default:
+		return DSU_WP_DL | DSU_WP_DS;
+	}
+}
+
+static DWORD ahb_flags(const breakpoint *bp)
+{
+	switch (bp->type) {
+	case BREAK_READ:
+		return DSU_AHB_BP_LD;
+	case BREAK_WRITE:
+		return DSU_AHB_BP_ST;
+	default:
+		return DSU_AHB_BP_LD | DSU_AHB_BP_ST;
+	}
+}
+
+/*
+ * Add the writes arming all breakpoints on cores to batch, the cores have to
+ * be in debug mode when it is sent. Returns the DSU control bits the cores
+ * need to enter debug mode on a hit.
+ */
+DWORD break_arm(ftdi_batch *batch, DWORD cores)
+{
+	break_state *breaks = break_slot();
+	DWORD ctrl = DSU_CTRL_BW;
+	bool ahb = false;
+
+	if (!break_defined())
+		return 0;
+
+	read_originals();
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		const breakpoint *bp = &breaks->bp[i];
+		const DWORD mask = ~(bp->length - 1);
+
+		if (bp->number == 0)
+			continue;
+
+		switch (bp->unit) {
+		case UNIT_IU:
+			for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+				if (cores & (1 << cpu))
+					dsu_append_iu_watchpoint(batch, cpu, bp->slot, bp->addr, mask, iu_flags(bp));
+			}
+			break;
+		case UNIT_AHB:
+			ftdi_batch_write32(batch, DSU_CTRL + DSU_AHB_BP_ADDR_1 + bp->slot * 8, bp->addr & ~0x3);
+			ftdi_batch_write32(batch, DSU_CTRL + DSU_AHB_MASK_1 + bp->slot * 8, (mask & ~0x3) | ahb_flags(bp));
+			ahb = true;
+			break;
+		case UNIT_SOFT:
+			if (bp->inserted) {
+				ftdi_batch_write32(batch, bp->addr, BREAK_TRAP_INST);
+				ctrl |= DSU_CTRL_BS;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (ahb)
+		ftdi_batch_write32(batch, DSU_CTRL + DSU_AHB_TRACE_CTRL, DSU_AHB_TRACE_EN | DSU_AHB_TRACE_BR);
+
+	// The instruction caches must not hold the replaced instructions
+	if (ctrl & DSU_CTRL_BS)
+		append_cache_flush(batch, cores);
+
+	breaks->armed = cores;
+
+	return ctrl;
+}
+
+/* Restore the original instructions and disable the hardware, the cores are in debug mode */
+void break_disarm()
+{
+	break_state *breaks = break_slot();
+	bool soft = false, ahb = false;
+	ftdi_batch batch;
+
+	if (!breaks->armed)
+		return;
+
+	ftdi_batch_init(&batch);
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		breakpoint *bp = &breaks->bp[i];
+
+		if (bp->number == 0)
+			continue;
+
+		switch (bp->unit) {
+		case UNIT_IU:
+			for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+				if (breaks->armed & (1 << cpu))
+					dsu_append_iu_watchpoint(&batch, cpu, bp->slot, 0, 0, 0);
+			}
+			break;
+		case UNIT_AHB:
+			ftdi_batch_write32(&batch, DSU_CTRL + DSU_AHB_MASK_1 + bp->slot * 8, 0);
+			ahb = true;
+			break;
+		case UNIT_SOFT:
+			if (bp->inserted) {
+				ftdi_batch_write32(&batch, bp->addr, bp->original);
+				bp->inserted = false;
+				soft = true;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (ahb)
+		ftdi_batch_write32(&batch, DSU_CTRL + DSU_AHB_TRACE_CTRL, 0);
+
+	if (soft)
+		append_cache_flush(&batch, breaks->armed);
+
+	ftdi_batch_send(&batch);
+	ftdi_batch_free(&batch);
+
+	breaks->armed = 0;
+}
+
+static void ignore_step(const step_record *record, void *arg)
+{
+}
+
+/*
+ * A core sitting on a breakpoint would hit it again right away, so each core
+ * executes one instruction before the breakpoints are armed
+ */
+void break_step_over(DWORD cores)
+{
+	if (!break_defined())
+		return;
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (cores & (1 << cpu))
+			step_cpu(cpu, 1, ignore_step, NULL);
+	}
+}
+
+static DWORD read_iu_reg(DWORD cpu, DWORD cwp, DWORD reg)
+{
+	if (reg == 0)
+		return 0;
+	if (reg < 8)
+		return dsu_get_global_reg_single(cpu, reg);
+	if (reg < 16)
+		return dsu_get_output_reg_single(cpu, cwp, reg - 8);
+	if (reg < 24)
+		return dsu_get_local_reg_single(cpu, cwp, reg - 16);
+
+	return dsu_get_input_reg_single(cpu, cwp, reg - 24);
+}
+
+/* Effective address of the load or store at pc, the registers are unchanged after the trap */
+static bool data_address(DWORD cpu, DWORD pc, DWORD *addr)
+{
+	const DWORD inst = ioread32(pc);
+	const DWORD cwp = dsu_get_reg_psr(cpu) & (NWINDOWS - 1);
+
+	if (inst >> 30 != 3)
+		return false;
+
+	*addr = read_iu_reg(cpu, cwp, (inst >> 14) & 0x1f);
+
+	if (inst & (1 << 13))
+		*addr += (DWORD) (((int32_t) (inst << 19)) >> 19); // simm13
+	else
+		*addr += read_iu_reg(cpu, cwp, inst & 0x1f);
+
+	return true;
+}
+
+/* Address of the last access in the AHB trace buffer, the one that hit the AHB breakpoint */
+static DWORD last_ahb_access()
+{
+	const DWORD idx = ioread32(DSU_CTRL + DSU_AHB_TRACE_IDX);
+	const DWORD line = ((idx >> 4) - 1) & (DSU_AHB_TRCE_BUF_LINES - 1);
+	DWORD entry[4];
+
+	// Fields as in struct ahb_trace_buffer_line, the last one is the address
+	ioread32raw(DSU_CTRL + DSU_AHB_TRCE_BUF_START + line * sizeof(entry), entry, 4);
+
+	return entry[3];
+}
+
+static int find_watchpoint(enum break_unit unit, DWORD addr)
+{
+	const break_state *breaks = break_slot();
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		const breakpoint *bp = &breaks->bp[i];
+
+		if (bp->number != 0 && bp->type != BREAK_EXEC && bp->unit == unit &&
+		    ((addr ^ bp->addr) & ~(bp->length - 1)) == 0)
+			return bp->number;
+	}
+
+	return 0;
+}
+
+int break_hit(DWORD cpu, DWORD *addr)
+{
+	const break_state *breaks = break_slot();
+	bool ahb = false;
+	int number;
+
+	if (!break_defined())
+		return 0;
+
+	const DWORD pc = dsu_get_reg_pc(cpu);
+	const DWORD tt = (dsu_get_reg_trap(cpu) >> 4) & 0xff;
+
+	for (int i = 0; i < BREAK_MAX; i++) {
+		const breakpoint *bp = &breaks->bp[i];
+
+		if (bp->number == 0)
+			continue;
+
+		ahb |= bp->unit == UNIT_AHB;
+
+		if (bp->type == BREAK_EXEC && bp->addr == pc && (tt == TT_WATCHPOINT || tt == TT_BREAKPOINT)) {
+			*addr = pc;
+			return bp->number;
+		}
+	}
+
+	if (tt == TT_WATCHPOINT && data_address(cpu, pc, addr) && (number = find_watchpoint(UNIT_IU, *addr)))
+		return number;
+
+	if (ahb && tt != TT_EXIT) {
+		*addr = last_ahb_access();
+		return find_watchpoint(UNIT_AHB, *addr);
+	}
+
+	return 0;
+}
@@ -0,0 +1,52 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Breakpoints and watchpoints. Instruction
+	breakpoints use the IU watchpoints of the
+	cores and fall back to software breakpoints
+	(ta 1) once those are taken, data watch-
+	points use the IU watchpoints and then the
+	AHB breakpoints of the DSU. They are armed
+	when cores are started or continued and
+	removed again once the cores stopped.
+	============================================
+*/
+
+#ifndef UVIEMON_BREAK_H
+#define UVIEMON_BREAK_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+
+#define BREAK_MAX 32
+#define BREAK_TRAP_INST 0x91d02001 // ta 1
+
+enum break_type {
+	BREAK_EXEC,	// Instruction fetch
+	BREAK_READ,	// Data load
+	BREAK_WRITE,	// Data store
+	BREAK_ACCESS	// Data load or store
+};
+
+// Return the breakpoint number, 0 on failure
+int break_add(enum break_type type, DWORD addr, DWORD length, bool soft);
+int break_add_temporary(DWORD addr);
+bool break_delete(int number); // 0 deletes all
+int break_find(enum break_type type, DWORD addr); // Number of a breakpoint, 0 if there is none
+void break_print();
+bool break_defined();
+
+// Called by the run control, see runCPU_start() and runCPU_resume()
+DWORD break_arm(ftdi_batch *batch, DWORD cores);
+void break_disarm();
+void break_step_over(DWORD cores);
+
+// Breakpoint a stopped core is sitting on, 0 if it stopped for another reason
+int break_hit(DWORD cpu, DWORD *addr);
+
+// Forgets the breakpoints and the probed watchpoints, for a newly opened device
+void break_reset();
+
+#endif /* UVIEMON_BREAK_H */
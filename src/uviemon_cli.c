@@ -9,55 +9,101 @@
 	============================================
 */
 
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
 #include "uviemon_cli.h"
 
 #include <stdlib.h>
+#include <time.h>
 #include <math.h>
 #include <unistd.h>   // fork
 #include <fcntl.h>    // open
 #include <sys/wait.h> // wait
 #include <sys/stat.h> // S_IRUSR, S_IWUSR
 #include <errno.h>
+#include <stdarg.h>
+#include <inttypes.h> // PRIu64
 
 #include "address_map.h"
 #include "uviemon_reg.h"
 #include "leon3_dsu.h"
+#include "uviemon_rtt.h"
+#include "uviemon_elf.h"
+#include "uviemon_run.h"
+#include "uviemon_step.h"
+#include "uviemon_break.h"
+#include "uviemon_profile.h"
+#include "uviemon_coverage.h"
+#include "uviemon_stack.h"
+#include "uviemon_crashdump.h"
 //#include "uviemon_opcode.h"
 
+#define STEP_PRINT_MAX 32 // Steps shown with their disassembly, longer runs only print a summary
+
+static uviemon_context *context; // Of the probe the console works on
+static bool background_allowed = true; // The daemon returns the output of a command when it ends
+
 static const char *opcode_filename = "/tmp/opcode.bin";
 static const char *objdump_output = "/tmp/obj_dump_out";
 static const char *obj_dump_cmd[] = { "sparc-elf-objdump", "-b", "binary", "-m", "sparc", "--adjust-vma=0x40000000", "-D", "/tmp/opcode.bin", NULL };
 
 //static int command_count;
 
+// Entry points set with the entry command, the others use the defaults
+static ftdi_core_entry core_entries[DSU_NCPUS];
+static DWORD entry_set = 0;
+
 static const command commands[] =  {
-	{ "help", &cli_help },
-	{ "scan", &cli_scan },
-	{ "reset", &cli_reset },
+	{ "help", &cli_help, BG_DIRECT },
+	{ "scan", &cli_scan, BG_BLOCKED },
+	{ "reset", &cli_reset, BG_BLOCKED },
 	
-	{ "mem", &cli_memx },
-	{ "memh", &cli_memx },
-	{ "memb", &cli_memx },
+	{ "mem", &cli_memx, BG_QUEUED },
+	{ "memh", &cli_memx, BG_QUEUED },
+	{ "memb", &cli_memx, BG_QUEUED },
 	
-	{ "wmem", &cli_wmemx },
-	{ "wmemh", &cli_wmemx },
-	{ "wmemb", &cli_wmemx },
-
-	{ "bdump", &cli_bdump },
-
-	{ "inst", &cli_inst },
-	{ "reg", &cli_reg },
-	{ "cpu", &cli_cpu },
-
-	{ "wash", &cli_washc },
-
-	{ "load", &cli_load },
-	{ "verify", &cli_verify },
-	{ "run", &cli_run }
+	{ "wmem", &cli_wmemx, BG_QUEUED },
+	{ "wmemh", &cli_wmemx, BG_QUEUED },
+	{ "wmemb", &cli_wmemx, BG_QUEUED },
+
+	{ "bdump", &cli_bdump, BG_QUEUED },
+
+	{ "inst", &cli_inst, BG_BLOCKED },
+	{ "reg", &cli_reg, BG_BLOCKED },
+	{ "cpu", &cli_cpu, BG_BLOCKED },
+
+	{ "wash", &cli_washc, BG_QUEUED },
+
+	{ "load", &cli_load, BG_BLOCKED },
+	{ "verify", &cli_verify, BG_QUEUED },
+	{ "run", &cli_run, BG_DIRECT },
+	{ "entry", &cli_entry, BG_DIRECT },
+	{ "halt", &cli_halt, BG_BLOCKED },
+	{ "step", &cli_step, BG_BLOCKED },
+	{ "next", &cli_next, BG_BLOCKED },
+	{ "cont", &cli_cont, BG_DIRECT },
+	{ "break", &cli_break, BG_BLOCKED },
+	{ "watch", &cli_watch, BG_BLOCKED },
+	{ "delete", &cli_delete, BG_BLOCKED },
+	{ "rtt", &cli_rtt, BG_QUEUED },
+	{ "profile", &cli_profile, BG_DIRECT },
+	{ "coverage", &cli_coverage, BG_DIRECT },
+	{ "bench", &cli_bench, BG_BLOCKED },
+	{ "stackuse", &cli_stackuse, BG_BLOCKED },
+	{ "crashdump", &cli_crashdump, BG_BLOCKED },
+
+	{ "stop", &cli_stop, BG_DIRECT },
+	{ "wait", &cli_wait, BG_DIRECT },
+	{ "status", &cli_status, BG_DIRECT }
 }; 
 
 
+static bool command_failed; // The command reported an error, see parse_input()
+
 static DWORD parse_parameter(char *param);
+static void cli_error(const char *format, ...);
+static void execute_command(const command *cmd, const char *name, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+static void print_run_result(BYTE tt);
 
 static void parse_opcode(char *buffer, uint32_t opcode, uint32_t address);
 static int readline(FILE *file, char *buffer, int buffer_length, int *read_length);
@@ -177,9 +223,9 @@ int parse_input(char *input)
 	int param_count = sscanf(input, "%49s %49s %49s %49s", command, params[0], params[1], params[2]);
 	bool command_found = false;
 
-	if (param_count == 0) {
+	if (param_count <= 0) {
 		printf("No command was recognized.\n");
-		return 0;
+		return 1;
 	}
 
 	if (strcmp(command, "exit") == 0)
@@ -189,17 +235,82 @@ int parse_input(char *input)
 	 * if the number of commands ever becomes so large that a simple
 	 * naive search won't be enough. This part has to be rewritten. 
 	 */
+	command_failed = false;
+
 	for(uint32_t i = 0; i < (sizeof(commands) / sizeof(commands[0])); i++) {
 		if (strcmp(command, commands[i].command_name) == 0) {
-			commands[i].function(command, param_count - 1, params);
+			execute_command(&commands[i], command, param_count - 1, params);
 			command_found = true;
 		}
 	}
 
-	if (!command_found)
+	if (!command_found) {
 		printf("Command '%s' not recognized. Type 'help' to get a list of commands.\n", command);
+		return 1;
+	}
 
-	return 0;
+	return command_failed ? 2 : 0;
+}
+
+struct queued_command {
+	const command *cmd;
+	const char *name;
+	int param_count;
+	char (*params)[MAX_PARAM_LENGTH];
+};
+
+static void run_queued_command(void *arg)
+{
+	struct queued_command *queued = arg;
+
+	queued->cmd->function(queued->name, queued->param_count, queued->params);
+	fflush(stdout);
+}
+
+/* While a program runs in the background, JTAG access is left to its I/O thread */
+static void execute_command(const command *cmd, const char *name, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	struct queued_command queued = { cmd, name, param_count, params };
+
+	if (cmd->background == BG_DIRECT || !run_active()) {
+		cmd->function(name, param_count, params);
+		return;
+	}
+
+	if (cmd->background == BG_BLOCKED) {
+		cli_error("'%s' is not available while a program is running, 'stop' or 'wait' for it first.\n", name);
+		return;
+	}
+
+	run_call(run_queued_command, &queued);
+}
+
+void cli_set_context(uviemon_context *ctx)
+{
+	context = ctx;
+}
+
+void cli_allow_background(bool allowed)
+{
+	background_allowed = allowed;
+}
+
+/* Progress of bulk transfers, arg is the message */
+static void print_progress(uint64_t done, uint64_t total, void *arg)
+{
+	printf("%s %d %%\n", (const char *) arg, (int) (done * 100 / total));
+}
+
+/* Error message of a command, which then counts as failed */
+static void cli_error(const char *format, ...)
+{
+	va_list args;
+
+	command_failed = true;
+
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
 }
 
 /* returns 0 on failure */
@@ -247,7 +358,24 @@ void cli_help(const char *command, int param_count, char params[MAX_PARAMETERS][
 
 	printf("  load: \t Write a file with <filePath#1> to the device memory\n");
 	printf("  verify: \t Verify a file written to the device memory with <filePath#1>\n");
-	printf("  run: \t\t Run an executable that has recently been uploaded to memory\n");
+	printf("  run: \t\t Run an executable that has recently been uploaded to memory on the active or [cores#1] ('all' or like 0,1,2,3), 'run &' keeps the console usable, 'sync' halts all cores when one stops\n");
+	printf("  step: \t Execute [number#1] instructions on the active cpu, writing each PC and opcode to [tracePath#2]\n");
+	printf("  next: \t Execute one instruction, calls are run until they return\n");
+	printf("  cont: \t Continue the active or [cores#1] where they stopped, 'cont &' keeps the console usable\n");
+	printf("  break: \t Stop at an instruction <address#1>, 'soft' as [#2] for a software breakpoint, lists all without parameters\n");
+	printf("  watch: \t Stop on 'r', 'w' (default) or 'rw' [#1] accesses to <address#2> and the [length#3] BYTEs after it\n");
+	printf("  delete: \t Delete breakpoint or watchpoint [number#1], all without parameters\n");
+	printf("  halt: \t Halt the active or [cores#1] ('all' or like 0,1,2,3) at the same time and show their state\n");
+	printf("  entry: \t Set the <entry#2> point and [stack#3] of <cpu#1> for run, 'reset' to use the defaults\n");
+	printf("  status: \t Show the state of a program running in the background\n");
+	printf("  stop: \t Stop a program running in the background\n");
+	printf("  wait: \t Wait for a program running in the background to end, at most [timeout#1] seconds\n");
+	printf("  profile: \t Sample the PCs of the active or [cpu#2] for <seconds#1> while it runs, 'sym <elfPath#2>' for function names, 'save <path#2>' writes folded stacks for flame graphs\n");
+	printf("  coverage: \t 'start <elfPath#2> [cpu#3]' collects executed instructions from the trace buffer while programs run or are stepped, 'stop', 'save <path#2> [addr#3]' writes an lcov tracefile or one line per address, shows a summary without parameters\n");
+	printf("  bench: \t Run the program <runs#1> times on the active or [cores#2], shows min/median/max cycles and wall time, 'funcs' as [#3] adds the cycles by function of the last traced instructions\n");
+	printf("  stackuse: \t 'on [size#2]' paints the stacks before every run and shows how deep they were used after it, 'off', 'task <top#2> <size#3>' adds a task stack, 'task clear', measures again without parameters\n");
+	printf("  crashdump: \t Halt all cores and write their registers, trace buffers, stacks and listed memory to the ELF core <file#1>, 'add <address#2> <length#3>' lists memory, 'clear', 'auto <file#2>' dumps runs that end with a trap, 'auto off'\n");
+	printf("  rtt: \t\t Attach the memory console at <address#1>, 'find [start#2] [length#3]', 'sym <elfPath#2>', 'send <channel#2> <text#3>', 'poll' or 'off'\n");
 	printf("  wash: \t Wash memory with a certain DWORD <length#1> of hex DWORD <characters#3> starting at an <address#2>\n\n");
 
 	printf("  exit: \t Exit uviemon\n");
@@ -262,10 +390,455 @@ void cli_scan(const char *command, int param_count, char params[MAX_PARAMETERS][
 	scan_instruction_codes(irl);
 }
 
+/* Parses "all" or a comma separated list of cores like "0,2,3", returns 0 on failure */
+static DWORD parse_cores(const char *param)
+{
+	const uint32_t cpu_count = ftdi_get_cpu_count();
+	DWORD cores = 0;
+	char *end;
+
+	if (strcmp(param, "all") == 0)
+		return (1 << cpu_count) - 1;
+
+	do {
+		const long cpu = strtol(param, &end, 10);
+
+		if (end == param || cpu < 0 || cpu >= (long) cpu_count)
+			return 0;
+
+		cores |= 1 << cpu;
+		param = end + 1;
+	} while (*end == ',');
+
+	return *end == '\0' ? cores : 0;
+}
+
+static void get_run_entries(DWORD cores, ftdi_core_entry *entries)
+{
+	ftdi_default_entries(cores, entries);
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (entry_set & (1 << cpu))
+			entries[cpu] = core_entries[cpu];
+	}
+}
+
+/* Run state of all cores, read in one go so it is coherent */
+static void print_snapshot(DWORD cores)
+{
+	struct dsu_cpu_snapshot snapshot[DSU_NCPUS];
+
+	dsu_get_snapshot(cores, snapshot);
+
+	printf("   %-3s  %-7s  %-10s  %-10s  %-10s  %-7s  %-7s\n", "CPU", "STATE", "PC", "NPC", "PSR", "TRAP", "TBR TT");
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (!(cores & (1 << cpu)))
+			continue;
+
+		const char *state = "running";
+
+		if (snapshot[cpu].ctrl & DSU_CTRL_PE)
+			state = "error";
+		else if (snapshot[cpu].ctrl & DSU_CTRL_DM)
+			state = "debug";
+
+		printf("   %-3d  %-7s  0x%08x  0x%08x  0x%08x  0x%02x     0x%02x\n", cpu, state,
+		       snapshot[cpu].pc, snapshot[cpu].npc, snapshot[cpu].psr,
+		       (snapshot[cpu].trap >> 4) & 0xff, (snapshot[cpu].tbr >> 4) & 0xff);
+	}
+}
+
+/* Deepest use of the stacks painted before the run */
+static void print_stack_use()
+{
+	if (!stack_enabled())
+		return;
+
+	if (stack_measure())
+		stack_print();
+	else
+		cli_error("Could not read the stacks\n");
+}
+
+static void write_crashdump(const char *path)
+{
+	ftdi_core_entry entries[DSU_NCPUS];
+
+	get_run_entries((1 << ftdi_get_cpu_count()) - 1, entries);
+
+	if (crashdump_write(path, entries))
+		printf("Crash dump written to %s\n", path);
+	else
+		cli_error("Could not write the crash dump to %s\n", path);
+}
+
+static void print_run_results(DWORD cores, const BYTE *traps, bool stopped)
+{
+	const bool single = (cores & (cores - 1)) == 0;
+	bool hit = false;
+	DWORD addr;
+
+	// Dumped before anything else, the other cores may still be running
+	for (uint32_t cpu = 0; !stopped && crashdump_get_auto() && cpu < DSU_NCPUS; cpu++) {
+		if ((cores & (1 << cpu)) && traps[cpu] != 0x80 && !break_hit(cpu, &addr)) {
+			write_crashdump(crashdump_get_auto());
+			break;
+		}
+	}
+
+	if (!stopped) {
+		for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+			if (!(cores & (1 << cpu)))
+				continue;
+
+			if (!single)
+				printf("cpu %d:", cpu);
+
+			const int number = break_hit(cpu, &addr);
+
+			if (number) {
+				printf(" => Breakpoint %d at 0x%08x\n", number, addr);
+				hit = true;
+			} else {
+				print_run_result(traps[cpu]);
+			}
+		}
+
+		if (single && !hit) {
+			print_stack_use();
+			return;
+		}
+	}
+
+	print_snapshot(cores);
+	print_stack_use();
+}
+
 void cli_run(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
 {
-	BYTE tt = runCPU(ftdi_get_active_cpu()); // Execute on CPU Core 1
+	DWORD cores = 1 << ftdi_get_active_cpu(); // Execute on CPU Core 1
+	ftdi_core_entry entries[DSU_NCPUS];
+	BYTE traps[DSU_NCPUS];
+	bool background = false;
+	bool sync = false;
+
+	if (run_active()) {
+		printf("A program is already running in the background, 'stop' or 'wait' for it first.\n");
+		return;
+	}
+
+	for (int i = 0; i < param_count; i++) {
+		if (strcmp(params[i], "&") == 0) {
+			background = true;
+		} else if (strcmp(params[i], "sync") == 0) {
+			sync = true;
+		} else if ((cores = parse_cores(params[i])) == 0) {
+			cli_error("Cores must be 'all' or a list like 0,1,2,3\n");
+			return;
+		}
+	}
+
+	if (background && !background_allowed) {
+		cli_error("No background runs through the daemon, run in the foreground\n");
+		return;
+	}
+
+	get_run_entries(cores, entries);
+
+	if (stack_enabled() && !stack_paint(cores, entries))
+		cli_error("Could not paint the stacks\n");
+
+	if (background) {
+		if (!run_background(cores, entries, sync))
+			cli_error("Could not start the background run\n");
+		else
+			printf("Running in the background, 'status', 'stop' or 'wait [seconds]' to follow it.\n");
+
+		return;
+	}
+
+	if (runCPUs(cores, entries, sync, traps))
+		print_run_results(cores, traps, false);
+	else
+		command_failed = true;
+}
+
+void cli_halt(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	DWORD cores = 1 << ftdi_get_active_cpu();
+
+	if (param_count > 1) {
+		cli_error("Halt only takes 'all' or a list of cores like 0,1,2,3\n");
+		return;
+	}
+
+	if (param_count == 1 && (cores = parse_cores(params[0])) == 0) {
+		cli_error("Cores must be 'all' or a list like 0,1,2,3\n");
+		return;
+	}
+
+	// All break now bits go out in one write, so all cores stop in the same cycle
+	dsu_halt_cpus(cores);
+	print_snapshot(cores);
+}
+
+struct step_output {
+	FILE *trace;
+	DWORD count;
+	step_record last;
+};
+
+static void print_step(const step_record *record, void *arg)
+{
+	struct step_output *output = arg;
+	char operation[31];
+
+	if (output->trace)
+		fprintf(output->trace, "%08x %08x\n", record->pc, record->inst);
+
+	if (output->count <= STEP_PRINT_MAX) {
+		parse_opcode(operation, record->inst, record->pc);
+		printf("    %08x  %-30s\n", record->pc, operation);
+	}
+
+	output->last = *record;
+}
+
+static bool check_debug_mode(uint32_t cpu)
+{
+	if (dsu_get_cpu_in_debug_mode(cpu))
+		return true;
+
+	cli_error("CPU %d is running, 'halt' it first\n", cpu);
+	return false;
+}
+
+void cli_step(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	const uint32_t cpu = ftdi_get_active_cpu();
+	struct step_output output = { NULL, 1 };
+	struct timespec start, end;
+
+	if (param_count > 2) {
+		cli_error("Step only takes the [number#1] of instructions and a [tracePath#2]\n");
+		return;
+	}
+
+	if (param_count >= 1 && (output.count = parse_parameter(params[0])) == 0) {
+		print_value_error_msg(params[0]);
+		return;
+	}
+
+	if (!check_debug_mode(cpu))
+		return;
+
+	if (param_count == 2 && (output.trace = fopen(params[1], "w")) == NULL) {
+		cli_error("Could not open trace file %s: %s\n", params[1], strerror(errno));
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	const DWORD done = step_cpu(cpu, output.count, print_step, &output);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (output.trace)
+		fclose(output.trace);
+
+	if (done == 0) {
+		command_failed = true;
+		return;
+	}
+
+	const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	if (output.count > STEP_PRINT_MAX)
+		printf("%u instructions in %.2f s (%.0f/s)\n", done, seconds, done / seconds);
+
+	printf("pc 0x%08x, npc 0x%08x\n", output.last.next_pc, output.last.next_npc);
+}
+
+void cli_next(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	const uint32_t cpu = ftdi_get_active_cpu();
+	char operation[31];
+	step_record record;
+
+	if (!check_debug_mode(cpu))
+		return;
+
+	if (!step_next(cpu, &record)) {
+		command_failed = true;
+		return;
+	}
+
+	parse_opcode(operation, record.inst, record.pc);
+	printf("    %08x  %-30s\n", record.pc, operation);
+	printf("pc 0x%08x, npc 0x%08x\n", record.next_pc, record.next_npc);
+}
+
+void cli_cont(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	DWORD cores = 1 << ftdi_get_active_cpu();
+	BYTE traps[DSU_NCPUS];
+	bool background = false;
+
+	if (run_active()) {
+		printf("A program is already running in the background, 'stop' or 'wait' for it first.\n");
+		return;
+	}
 
+	for (int i = 0; i < param_count; i++) {
+		if (strcmp(params[i], "&") == 0) {
+			background = true;
+		} else if ((cores = parse_cores(params[i])) == 0) {
+			cli_error("Cores must be 'all' or a list like 0,1,2,3\n");
+			return;
+		}
+	}
+
+	if (background && !background_allowed) {
+		cli_error("No background runs through the daemon, continue in the foreground\n");
+		return;
+	}
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if ((cores & (1 << cpu)) && !check_debug_mode(cpu))
+			return;
+	}
+
+	if (background) {
+		if (!run_background_resume(cores))
+			cli_error("Could not continue in the background\n");
+		else
+			printf("Continuing in the background, 'status', 'stop' or 'wait [seconds]' to follow it.\n");
+
+		return;
+	}
+
+	if (resumeCPUs(cores, traps))
+		print_run_results(cores, traps, false);
+	else
+		command_failed = true;
+}
+
+void cli_break(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	DWORD addr;
+	int number;
+
+	if (param_count == 0) {
+		break_print();
+		return;
+	}
+
+	if (param_count > 2 || (param_count == 2 && strcmp(params[1], "soft") != 0)) {
+		cli_error("Usage: break <address> [soft]\n");
+		return;
+	}
+
+	if ((addr = parse_parameter(params[0])) == 0) {
+		print_value_error_msg(params[0]);
+		return;
+	}
+
+	if ((number = break_add(BREAK_EXEC, addr, 4, param_count == 2)) != 0)
+		printf("Breakpoint %d at 0x%08x\n", number, addr);
+}
+
+void cli_watch(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	enum break_type type = BREAK_WRITE;
+	DWORD addr, length = 4;
+	int first = 0;
+	int number;
+
+	if (param_count >= 1 && strcmp(params[0], "r") == 0) {
+		type = BREAK_READ;
+		first = 1;
+	} else if (param_count >= 1 && strcmp(params[0], "w") == 0) {
+		first = 1;
+	} else if (param_count >= 1 && strcmp(params[0], "rw") == 0) {
+		type = BREAK_ACCESS;
+		first = 1;
+	}
+
+	if (param_count - first < 1 || param_count - first > 2) {
+		cli_error("Usage: watch [r|w|rw] <address> [length]\n");
+		return;
+	}
+
+	if ((addr = parse_parameter(params[first])) == 0) {
+		print_value_error_msg(params[first]);
+		return;
+	}
+
+	if (param_count - first == 2 && (length = parse_parameter(params[first + 1])) == 0) {
+		print_value_error_msg(params[first + 1]);
+		return;
+	}
+
+	if ((number = break_add(type, addr, length, false)) != 0)
+		printf("Watchpoint %d at 0x%08x\n", number, addr);
+}
+
+void cli_delete(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	int number = 0;
+
+	if (param_count > 1) {
+		cli_error("Usage: delete [number]\n");
+		return;
+	}
+
+	if (param_count == 1 && (number = parse_parameter(params[0])) == 0) {
+		print_value_error_msg(params[0]);
+		return;
+	}
+
+	if (!break_delete(number))
+		printf("No breakpoint %d\n", number);
+}
+
+void cli_entry(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	ftdi_core_entry defaults[DSU_NCPUS];
+	const uint32_t cpu_count = ftdi_get_cpu_count();
+	uint32_t cpu;
+
+	if (param_count == 0) {
+		get_run_entries((1 << cpu_count) - 1, defaults);
+
+		for (cpu = 0; cpu < cpu_count; cpu++) {
+			printf("   cpu %d: entry 0x%08x stack 0x%08x %s\n", cpu, defaults[cpu].entry,
+			       defaults[cpu].stack, entry_set & (1 << cpu) ? "" : "(default)");
+		}
+
+		return;
+	}
+
+	if (param_count == 1 && strcmp(params[0], "reset") == 0) {
+		entry_set = 0;
+		return;
+	}
+
+	errno = 0;
+	cpu = strtol(params[0], NULL, 10);
+
+	if (errno != 0 || cpu >= cpu_count || param_count < 2) {
+		cli_error("Usage: entry <cpu> <address> [stack]\n");
+		return;
+	}
+
+	ftdi_default_entries(1 << cpu, defaults);
+
+	core_entries[cpu].entry = parse_parameter(params[1]);
+	core_entries[cpu].stack = param_count == 3 ? parse_parameter(params[2]) : defaults[cpu].stack;
+	entry_set |= 1 << cpu;
+}
+
+static void print_run_result(BYTE tt)
+{
 	if (tt < 0x80) // Hardware traps
 	{
 		printf(" => Error: Hardware trap!\n\n");
@@ -287,6 +860,53 @@ void cli_run(const char *command, int param_count, char params[MAX_PARAMETERS][M
 	}
 }
 
+void cli_stop(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	BYTE traps[DSU_NCPUS];
+	DWORD cores;
+	bool stopped;
+
+	if (!run_stop()) {
+		cli_error("No program running in the background\n");
+		return;
+	}
+
+	if (run_wait(RUN_WAIT_FOREVER, traps, &cores, &stopped))
+		print_run_results(cores, traps, stopped);
+}
+
+void cli_wait(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	int timeout_ms = RUN_WAIT_FOREVER;
+	BYTE traps[DSU_NCPUS];
+	DWORD cores;
+	bool stopped;
+
+	if (param_count > 1) {
+		cli_error("Wait only takes an optional timeout in seconds\n");
+		return;
+	}
+
+	if (param_count == 1)
+		timeout_ms = parse_parameter(params[0]) * 1000;
+
+	if (!run_wait(timeout_ms, traps, &cores, &stopped)) {
+		if (run_active())
+			printf("Still running\n");
+		else
+			cli_error("No program running in the background\n");
+
+		return;
+	}
+
+	print_run_results(cores, traps, stopped);
+}
+
+void cli_status(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	run_print_status();
+}
+
 static const char * const get_tt_error_desc(uint32_t error_code)
 {
 	for (uint32_t i = 0; i < sizeof(tt_errors) / sizeof(tt_errors[0]); i++) {
@@ -306,69 +926,26 @@ void cli_reset(const char *command, int param_count, char params[MAX_PARAMETERS]
 
 void cli_load(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
 {
-	FILE *fp;
-	const uint32_t cutoff_size = 64 * 1024;
-	int64_t file_size, bytes_read = 0;
-	size_t current_read;
-	uint8_t byte_buffer[4096];
-	uint32_t buffer[1024];
-	uint32_t write_address = ADDRESSES[ftdi_get_connected_cpu_type()][SDRAM_START_ADDRESS];
-	
-	if (param_count != 1) {
-		printf("load needs the path to the file to load.\n");
-		return;
-	}
-
-	//load(params[0]);
-	
-	fp = fopen(params[0], "rb");
-
-	if (fp == NULL) {
-		fprintf(stderr, "File could not be opnend!\n");
-		return;
-	}
+	uint64_t size;
 
-	/* check filesize */
-	fseek(fp, 0L, SEEK_END);
-	file_size = ftell(fp);
-	fseek(fp, 0L, SEEK_SET);
-
-	if (file_size == 0) {
-		fprintf(stderr, "File is empty!\n");
-		return;
-	}
-
-	if (file_size < cutoff_size) {
-		fprintf(stderr, "FILE size is too small! Needs to be at least 64 KiB...\n");
+	if (param_count != 1) {
+		cli_error("load needs the path to the file to load.\n");
 		return;
 	}
 
-	/* Ignore the the elf header for now */
-	fseek(fp, cutoff_size, SEEK_SET);
-
 	printf("Uploading file '%s' ...\n", params[0]);
-	printf("File size: %ld B\n", file_size);
 
-	while(!feof(fp)) {
-		current_read = fread(byte_buffer, sizeof(uint8_t), 4096, fp);
+	uviemon_set_progress(context, print_progress, "Writing data to memory...");
+	const int result = uviemon_load(context, params[0], &size);
+	uviemon_set_progress(context, NULL, NULL);
 
-		for(uint64_t i = 0; i < current_read / 4; i++) {
-			buffer[i] = byte_buffer[i * 4] << 24
-						| byte_buffer[i * 4 + 1] << 16
-						| byte_buffer[i * 4 + 2] << 8
-						| byte_buffer[i * 4 + 3];
-		}
-		
-		iowrite32_buffer(write_address, buffer, current_read / 4);
-		
-		bytes_read += current_read;
-		write_address += current_read;
-		printf("Writing data to memory... %ld %%\n", (bytes_read * 100) / (file_size - cutoff_size));
+	if (result != UVIEMON_OK) {
+		command_failed = true;
+		fprintf(stderr, "Loading file failed: %s\n", uviemon_last_error(context));
+		return;
 	}
 
-	fclose(fp);
-
-	printf("Bytes read: %ld B\n", bytes_read);
+	printf("Bytes read: %" PRIu64 " B\n", size);
 	printf("Loading file complete!\n");
 }
 
@@ -453,17 +1030,17 @@ void cli_bdump(const char *command, int param_count, char params[MAX_PARAMETERS]
 	DWORD param_1, param_2;
 	
 	if (param_count != 3) {
-		printf("bdump needs 3 parameters start address, length, filename.\n");
+		cli_error("bdump needs 3 parameters start address, length, filename.\n");
 		return;
 	}
 
 	if ( (param_1 = parse_parameter(params[0])) == 0 ) {
-		printf("Parameter 1 must be a positive integer.\n");
+		cli_error("Parameter 1 must be a positive integer.\n");
 		return;
 	}
 
 	if ( (param_2 = parse_parameter(params[1])) == 0 ) {
-			printf("Parameter 2 must be a positive integer.\n");
+			cli_error("Parameter 2 must be a positive integer.\n");
 			return;
 	}
 
@@ -472,80 +1049,27 @@ void cli_bdump(const char *command, int param_count, char params[MAX_PARAMETERS]
 
 void cli_verify(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
 {
-	const uint64_t cutoff_size = 64 * 1024;
+	uint64_t offset;
 
-	DWORD read_address = ADDRESSES[ftdi_get_connected_cpu_type()][SDRAM_START_ADDRESS];
-	FILE *fp;
-	uint64_t file_size, bytes_read = 0;
-	size_t current_read;
-	/* byte buffer for file reading */
-	uint8_t byte_buffer[4096];
-	/* uint32_t buffer to upload to leon machine */
-	uint32_t buffer[1024], buffer_cmp, error_found = 0;
-	
 	if (param_count != 1) {
-		printf("verify needs the path to the file to load.\n");
-		return;
-	}
-
-	fp = fopen(params[0], "rb");
-
-	if (fp == NULL) {
-		fprintf(stderr, "Error loading file!\n");
-		return;
-	}
-
-	/* check filesize */
-	fseek(fp, 0L, SEEK_END);
-	file_size = ftell(fp);
-	fseek(fp, 0L, SEEK_SET);
-
-	if (file_size == 0) {
-		fprintf(stderr, "File is empty!\n");
-		return;
-	}
-
-	if (file_size < cutoff_size) {
-		fprintf(stderr, "FILE size is too small! Needs to be at least 64 KiB...\n");
+		cli_error("verify needs the path to the file to load.\n");
 		return;
 	}
 
-	/* Ignore the the elf header for now */
-	fseek(fp, cutoff_size, SEEK_SET);
-
 	printf("Verifying file '%s'...\n", params[0]);
-	printf("File size: %ld\n", file_size);
-	printf("Verifying file...\n");
-
-	while(!feof(fp)) {
-		current_read = fread(byte_buffer, sizeof(uint8_t), 4096, fp);
-		ioread32_buffer(read_address, buffer, current_read / 4);
-
-		for (uint64_t i = 0; i < current_read / 4; i++) {
-			buffer_cmp = byte_buffer[i * 4] << 24
-						 | byte_buffer[i * 4 + 1] << 16
-						 | byte_buffer[i * 4 + 2] << 8
-						 | byte_buffer[i * 4 + 3];
-			
-
-			if (buffer_cmp != buffer[i]) {
-				printf("Verifying file... ERROR! Byte %ld incorrect!\n", bytes_read + (i * 4));
-				error_found = 1;
-			}
-		}
-		bytes_read += current_read;
-		read_address += current_read;
 
-		printf("Verifying file... %ld %%\n", bytes_read * 100 / (file_size - cutoff_size));
-	}
+	uviemon_set_progress(context, print_progress, "Verifying file...");
+	const int result = uviemon_verify(context, params[0], &offset);
+	uviemon_set_progress(context, NULL, NULL);
 
-	fclose(fp);
+	command_failed = result != UVIEMON_OK;
 
-	if (error_found)
-		printf("Verifying file... Errors found!\n");
+	if (result == UVIEMON_ERR_VERIFY)
+		printf("Verifying file... ERROR! Byte %" PRIu64 " incorrect!\n", offset);
+	else if (result != UVIEMON_OK)
+		fprintf(stderr, "Verifying file failed: %s\n", uviemon_last_error(context));
 	else
 		printf("Verifying file... OK!\n");
-	
 }
 
 /*void verify(std::string path)
@@ -617,21 +1141,21 @@ void cli_washc(const char *command, int param_count, char params[MAX_PARAMETERS]
 
 	if (param_count > 0) {
 		if ( (size = parse_parameter(params[0])) == 0 ) {
-			printf("Paramter 1 size must be a positive integer.\n");
+			cli_error("Paramter 1 size must be a positive integer.\n");
 			return;
 		}
 	}
 
 	if (param_count > 1) {
 		if ( (address = parse_parameter(params[1])) == 0 ) {
-			printf("Paramter 2 address must be a positive integer.\n");
+			cli_error("Paramter 2 address must be a positive integer.\n");
 			return;
 		}
 	}
 
 	if (param_count > 2) {
 		if ( (c = parse_parameter(params[2])) == 0 && errno != 0) {
-			printf("Parameter 3 value must be a positive integer.\n");
+			cli_error("Parameter 3 value must be a positive integer.\n");
 			return;
 		}
 	}
@@ -645,7 +1169,7 @@ void cli_memx(const char *command, int param_count, char params[MAX_PARAMETERS][
 	DWORD param_1, param_2 = 0;
 
 	if (param_count < 1 || param_count > 2) {
-		printf("Command %50s needs between 1 and 2 parameters", command);
+		cli_error("Command %50s needs between 1 and 2 parameters", command);
 		return;
 	}
 
@@ -653,13 +1177,13 @@ void cli_memx(const char *command, int param_count, char params[MAX_PARAMETERS][
 
 	if (param_count == 2)  {
 		if ( (param_2 = parse_parameter(params[1])) == 0) {
-			printf("Parameter 2 must be a positive integer");
+			cli_error("Parameter 2 must be a positive integer");
 			return;
 		}
 	}
 
 	if ( (param_1 = parse_parameter(params[0])) == 0) {
-		printf("Parameter 1 must be a positive integer");
+		cli_error("Parameter 1 must be a positive integer");
 		return;
 	}
 
@@ -677,18 +1201,18 @@ void cli_wmemx(const char *command, int param_count, char params[MAX_PARAMETERS]
 	DWORD param_1, param_2;
 	
 	if (param_count != 2) {
-		printf("Command %50s needs 2 parameters", command);
+		cli_error("Command %50s needs 2 parameters", command);
 		return;
 	}
 
 	if ( (param_1 = parse_parameter(params[0])) == 0) {
-		printf("Parameter 1 must be a positive integer\n");
+		cli_error("Parameter 1 must be a positive integer\n");
 		return;
 	}
 
 	param_2 = parse_parameter(params[1]);
 	if (errno != 0) {
-		printf("Parameter 2 a 32 bit int\n");
+		cli_error("Parameter 2 a 32 bit int\n");
 		return;
 	}
 
@@ -708,13 +1232,13 @@ void cli_inst(const char* command, int param_count, char params[MAX_PARAMETERS][
 	uint32_t cpu = ftdi_get_active_cpu();
 
 	if (param_count > 1) {
-		printf("Inst only needs 1 parameter: the number of lines");
+		cli_error("Inst only needs 1 parameter: the number of lines");
 		return;
 	}
 
 	if (param_count == 1) {
 		if ( (instr_count = strtol(params[0], NULL, 10)) == 0) {
-			printf("Parameter 1 must be a positive integer");
+			cli_error("Parameter 1 must be a positive integer");
 			return;
 		}
 	}
@@ -910,8 +1434,7 @@ void cli_reg(const char *command, int param_count, char params[MAX_PARAMETERS][M
 
 void cli_cpu(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
 {
-    /* TODO: refactor to put this information in ftdi device */
-	uint32_t cpu_count = ftdi_get_connected_cpu_type() == LEON3 ? 2 : 4;
+	uint32_t cpu_count = ftdi_get_cpu_count();
 	uint32_t cpu;
 	
 	if (param_count == 0) {
@@ -928,7 +1451,7 @@ void cli_cpu(const char *command, int param_count, char params[MAX_PARAMETERS][M
 		cpu = strtol(params[1], NULL, 10);
 
 		if (errno != 0) {
-			printf("Could not parse cpu number: %s", params[1]);
+			cli_error("Could not parse cpu number: %s", params[1]);
 			return;
 		}
 		
@@ -951,14 +1474,348 @@ void cli_cpu(const char *command, int param_count, char params[MAX_PARAMETERS][M
 	}
 }
 
+void cli_profile(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	uint32_t cpu = ftdi_get_active_cpu();
+
+	if (param_count == 0) {
+		profile_print(PROFILE_TOP);
+		return;
+	}
+
+	if (strcmp(params[0], "sym") == 0 || strcmp(params[0], "save") == 0) {
+		if (param_count != 2) {
+			cli_error("Usage: profile %s <path>\n", params[0]);
+			return;
+		}
+
+		if (strcmp(params[0], "sym") == 0 && !profile_load_symbols(params[1]))
+			cli_error("Could not read the symbols of %s\n", params[1]);
+		else if (strcmp(params[0], "save") == 0 && !profile_save_folded(params[1]))
+			cli_error("Could not write %s: %s\n", params[1], strerror(errno));
+
+		return;
+	}
+
+	const double seconds = strtod(params[0], NULL);
+
+	if (seconds <= 0 || param_count > 2) {
+		cli_error("Usage: profile <seconds> [cpu]\n");
+		return;
+	}
+
+	if (param_count == 2) {
+		errno = 0;
+		cpu = strtol(params[1], NULL, 10);
+
+		if (errno != 0 || cpu >= ftdi_get_cpu_count()) {
+			print_value_error_msg(params[1]);
+			return;
+		}
+	}
+
+	if (profile_run(cpu, seconds))
+		profile_print(PROFILE_TOP);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	const uint64_t ua = *(const uint64_t *) a, ub = *(const uint64_t *) b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+static double elapsed_seconds(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/*
+ * The cycles of a run are counted by the DSU time tag, from the release of the
+ * cores to the stop of the slowest one, see runCPU_cycles(). The wall time also
+ * contains the USB transfers of starting and polling.
+ */
+void cli_bench(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	DWORD cores = 1 << ftdi_get_active_cpu();
+	ftdi_core_entry entries[DSU_NCPUS];
+	BYTE traps[DSU_NCPUS];
+	bool funcs = false;
+	unsigned long runs;
+	unsigned long failed = 0;
+
+	if (param_count < 1 || (runs = strtoul(params[0], NULL, 10)) == 0) {
+		cli_error("Usage: bench <runs> [cores] [funcs]\n");
+		return;
+	}
+
+	for (int i = 1; i < param_count; i++) {
+		if (strcmp(params[i], "funcs") == 0) {
+			funcs = true;
+		} else if ((cores = parse_cores(params[i])) == 0) {
+			cli_error("Cores must be 'all' or a list like 0,1,2,3\n");
+			return;
+		}
+	}
+
+	uint64_t *cycles = malloc(runs * sizeof(uint64_t));
+	uint64_t *wall_ns = malloc(runs * sizeof(uint64_t));
+
+	if (!cycles || !wall_ns) {
+		cli_error("Too many runs\n");
+		free(cycles);
+		free(wall_ns);
+		return;
+	}
+
+	get_run_entries(cores, entries);
+	profile_cycles_clear();
+
+	for (unsigned long run = 0; run < runs; run++) {
+		struct timespec start, end;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (!runCPUs(cores, entries, false, traps)) {
+			command_failed = true;
+			free(cycles);
+			free(wall_ns);
+			return;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		wall_ns[run] = elapsed_seconds(&start, &end) * 1e9;
+		cycles[run] = 0;
+
+		for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+			if (!(cores & (1 << cpu)))
+				continue;
+
+			if (runCPU_cycles(cpu) > cycles[run])
+				cycles[run] = runCPU_cycles(cpu);
+
+			if (funcs)
+				profile_trace_cycles(cpu, runCPU_cycles(cpu));
+
+			if (traps[cpu] != 0x80 && failed++ == 0) {
+				printf("Run %lu, cpu %d:", run + 1, cpu);
+				print_run_result(traps[cpu]);
+			}
+		}
+	}
+
+	qsort(cycles, runs, sizeof(uint64_t), compare_u64);
+	qsort(wall_ns, runs, sizeof(uint64_t), compare_u64);
+
+	printf("%lu runs", runs);
+	if (failed)
+		printf(", %lu cores did not end with 'ta 0'", failed);
+	printf("\n");
+
+	printf("   %-6s  %-14s  %-14s  %-14s\n", "", "MIN", "MEDIAN", "MAX");
+	printf("   %-6s  %-14" PRIu64 "  %-14" PRIu64 "  %-14" PRIu64 "\n", "cycles",
+	       cycles[0], cycles[runs / 2], cycles[runs - 1]);
+	printf("   %-6s  %-14.6f  %-14.6f  %-14.6f\n", "wall s",
+	       wall_ns[0] / 1e9, wall_ns[runs / 2] / 1e9, wall_ns[runs - 1] / 1e9);
+
+	if (funcs)
+		profile_print_cycles(PROFILE_TOP, runs);
+
+	free(cycles);
+	free(wall_ns);
+}
+
+void cli_stackuse(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	DWORD size = STACK_DEFAULT_SIZE;
+	DWORD top;
+
+	if (param_count == 0) {
+		if (!stack_measure())
+			cli_error("Could not read the stacks\n");
+		else
+			stack_print();
+	} else if (strcmp(params[0], "on") == 0 && param_count <= 2) {
+		if (param_count == 2 && (size = parse_parameter(params[1])) < 4) {
+			print_value_error_msg(params[1]);
+			return;
+		}
+
+		stack_enable(size);
+		printf("Painting %u bytes of stack for every core of a run with 0x%08x\n", size & ~0x3, STACK_PATTERN);
+	} else if (strcmp(params[0], "off") == 0 && param_count == 1) {
+		stack_disable();
+	} else if (strcmp(params[0], "task") == 0 && param_count == 2 && strcmp(params[1], "clear") == 0) {
+		stack_clear_tasks();
+	} else if (strcmp(params[0], "task") == 0 && param_count == 3) {
+		top = parse_parameter(params[1]);
+		size = parse_parameter(params[2]);
+
+		if (!stack_add_task(top, size))
+			cli_error("Task stacks need an aligned top and a size, at most %d of them\n", STACK_MAX_TASKS);
+	} else {
+		cli_error("Usage: stackuse [on [size] | off | task <top> <size> | task clear]\n");
+	}
+}
+
+void cli_crashdump(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	if (param_count == 0) {
+		crashdump_print_ranges();
+	} else if (strcmp(params[0], "add") == 0 && param_count == 3) {
+		if (!crashdump_add_range(parse_parameter(params[1]), parse_parameter(params[2])))
+			printf("At most %d ranges with a length can be listed\n", CRASHDUMP_MAX_RANGES);
+	} else if (strcmp(params[0], "clear") == 0 && param_count == 1) {
+		crashdump_clear_ranges();
+	} else if (strcmp(params[0], "auto") == 0 && param_count == 2) {
+		crashdump_set_auto(strcmp(params[1], "off") == 0 ? NULL : params[1]);
+	} else if (param_count == 1) {
+		write_crashdump(params[0]);
+	} else {
+		cli_error("Usage: crashdump [<file> | add <address> <length> | clear | auto <file> | auto off]\n");
+	}
+}
+
+static void coverage_harvest(void *arg)
+{
+	coverage_poll();
+}
+
+void cli_coverage(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	uint32_t cpu = ftdi_get_active_cpu();
+
+	if (param_count == 0) {
+		coverage_print();
+	} else if (strcmp(params[0], "start") == 0 && (param_count == 2 || param_count == 3)) {
+		if (param_count == 3) {
+			errno = 0;
+			cpu = strtol(params[2], NULL, 10);
+
+			if (errno != 0 || cpu >= ftdi_get_cpu_count()) {
+				print_value_error_msg(params[2]);
+				return;
+			}
+		}
+
+		// The first harvest only notes where the trace buffer stands
+		if (coverage_start(params[1], cpu))
+			run_call(coverage_harvest, NULL);
+		else
+			command_failed = true;
+	} else if (strcmp(params[0], "stop") == 0 && param_count == 1) {
+		if (coverage_active())
+			run_call(coverage_harvest, NULL);
+
+		coverage_stop();
+		coverage_print();
+	} else if (strcmp(params[0], "save") == 0 && (param_count == 2 || param_count == 3)) {
+		const bool per_address = param_count == 3 && strcmp(params[2], "addr") == 0;
+
+		if (coverage_active())
+			run_call(coverage_harvest, NULL);
+
+		if (!coverage_save(params[1], per_address))
+			cli_error("Could not write %s\n", params[1]);
+	} else {
+		cli_error("Usage: coverage [start <elfPath> [cpu] | stop | save <path> [addr]]\n");
+	}
+}
+
+void cli_rtt(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH])
+{
+	DWORD addr = 0;
+
+	if (param_count == 0) {
+		rtt_print_status();
+		return;
+	}
+
+	if (strcmp(params[0], "off") == 0) {
+		rtt_detach();
+		printf("Memory console detached\n");
+		return;
+	} else if (strcmp(params[0], "poll") == 0) {
+		if (rtt_poll() < 0)
+			cli_error("Could not read the memory console\n");
+		return;
+	} else if (strcmp(params[0], "send") == 0) {
+		if (param_count != 3) {
+			cli_error("Command %s send needs a channel and a text\n", command);
+			return;
+		}
+
+		char line[MAX_PARAM_LENGTH + 1];
+		int length = snprintf(line, sizeof(line), "%s\n", params[2]);
+
+		errno = 0;
+		DWORD channel = strtol(params[1], NULL, 10);
+
+		if (errno != 0) {
+			cli_error("Could not parse channel number: %s\n", params[1]);
+			return;
+		}
+
+		// Written to the target with the next poll
+		rtt_send(channel, line, length);
+		return;
+	} else if (strcmp(params[0], "sym") == 0) {
+		elf_symbols syms;
+
+		if (param_count != 2) {
+			cli_error("Command %s sym needs the path of an ELF file\n", command);
+			return;
+		}
+
+		if (!elf_load_symbols(params[1], &syms)) {
+			command_failed = true;
+			return;
+		}
+
+		const elf_symbol *sym = elf_find_symbol(&syms, RTT_SYMBOL);
+
+		if (sym == NULL)
+			cli_error("Symbol %s not found in %s\n", RTT_SYMBOL, params[1]);
+		else
+			addr = sym->value;
+
+		elf_free_symbols(&syms);
+	} else if (strcmp(params[0], "find") == 0) {
+		DWORD start = ADDRESSES[ftdi_get_connected_cpu_type()][SDRAM_START_ADDRESS];
+		DWORD length = 1024 * 1024;
+
+		if (param_count > 1 && (start = parse_parameter(params[1])) == 0) {
+			cli_error("Parameter 2 must be a positive integer\n");
+			return;
+		}
+
+		if (param_count > 2 && (length = parse_parameter(params[2])) == 0) {
+			cli_error("Parameter 3 must be a positive integer\n");
+			return;
+		}
+
+		printf("Scanning 0x%08x to 0x%08x for the memory console...\n", start, start + length);
+
+		if ((addr = rtt_find(start, length)) == 0)
+			printf("No control block found\n");
+	} else if ((addr = parse_parameter(params[0])) == 0) {
+		cli_error("Parameter 1 must be an address or one of find, sym, send, poll or off\n");
+		return;
+	}
+
+	if (addr != 0 && rtt_attach(addr))
+		rtt_print_status();
+}
+
 static void print_register_error_msg(const char * const reg)
 {
-	printf("No such register %s\n", reg);
+	cli_error("No such register %s\n", reg);
 }
 
 static void print_value_error_msg(const char * const value)
 {
-	printf("Could not parse value: %s\n", value);
+	cli_error("Could not parse value: %s\n", value);
 }
 
 static int readline(FILE *file, char *buffer, int buffer_length, int *read_length)
@@ -1047,6 +1904,7 @@ void wmem(DWORD addr, DWORD data)
 {
 	printf("Writing to memory... ");
 	iowrite32(addr, data);
+	dsu_shadow_invalidate_all(); // might have hit the DSU
 	printf("OK!\n");
 }
 
@@ -1054,6 +1912,7 @@ void wmemh(DWORD addr, WORD data)
 {
 	printf("Writing to memory... ");
 	iowrite16(addr, data);
+	dsu_shadow_invalidate_all(); // might have hit the DSU
 	printf("OK!\n");
 }
 
@@ -1061,6 +1920,7 @@ void wmemb(DWORD addr, BYTE data)
 {
 	printf("Writing to memory... ");
 	iowrite8(addr, data);
+	dsu_shadow_invalidate_all(); // might have hit the DSU
 	printf("OK!\n");
 }
 
@@ -1209,39 +2069,25 @@ void memb(DWORD startAddr, DWORD length)
 
 void bdump(DWORD startAddr, DWORD length, const char * const path)
 {
-	FILE *fp;
-	DWORD readBuffer[length];
-	const DWORD charArraySize = length * sizeof(readBuffer[0]);
-	char charArray[charArraySize];
+	uviemon_set_progress(context, print_progress, "Reading data from memory...");
 
-	DWORD dwordLength = ceil(length / sizeof(DWORD)); // Convert byte length to DWORD length
-
-	ioread32_progress(startAddr, readBuffer, dwordLength, true);
-
-	for (DWORD i = 0; i < dwordLength; i++)
-	{
-		DWORD temp = readBuffer[i];
-		charArray[i * 4] = (char)(temp >> 24);
-		charArray[i * 4 + 1] = ((char)(temp >> 16) & 0xFF);
-		charArray[i * 4 + 2] = ((char)(temp >> 8) & 0xFF);
-		charArray[i * 4 + 3] = ((char)(temp)&0xFF);
+	if (uviemon_dump(context, startAddr, length, path) != UVIEMON_OK) {
+		command_failed = true;
+		fprintf(stderr, "Dump failed: %s\n", uviemon_last_error(context));
 	}
 
-	fp = fopen(path, "wb");
-	fwrite(charArray, sizeof(char), charArraySize, fp);
-	fclose(fp);
+	uviemon_set_progress(context, NULL, NULL);
 }
 
 void wash(WORD size, DWORD addr, DWORD c)
 {
-	DWORD data[size];
-
-	for (WORD i = 0; i < size; i++)
-		data[i] = c;
-
 	printf("Writing %#x to %d DWORD(s) in memory, starting at %#08x ...\n", c, size, addr);
 
-	iowrite32_progress(addr, data, size, true);
+	if (uviemon_fill32(context, addr, c, size) != UVIEMON_OK) {
+		command_failed = true;
+		fprintf(stderr, "Wash failed: %s\n", uviemon_last_error(context));
+		return;
+	}
 
 	printf("Wash of %d DWORD(s) complete!\n", size);
 }
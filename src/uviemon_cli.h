@@ -13,6 +13,7 @@
 #define UVIEMON_CLI_HPP
 
 #include "ftdi_device.h"
+#include "libuviemon.h"
 
 #include <stdio.h>
 #include <stdbool.h>
@@ -26,9 +27,17 @@
 #define OBJ_DUMP_STRING_LENGTH 25
 #define VMA_PARAM 5
 
+/* How a command is executed while a program runs in the background */
+enum background_mode {
+	BG_BLOCKED,	// Refused until the program ended
+	BG_QUEUED,	// Queued to the I/O thread, executed between two polls
+	BG_DIRECT	// Executed right away, handles background runs itself
+};
+
 typedef struct {
 	const char *command_name;
 	void (*function)(const char *, int, char [MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+	enum background_mode background;
 } command;
 
 struct tt_error {
@@ -36,7 +45,9 @@ struct tt_error {
 	const char * const error_desc;
 };
 
-int parse_input(char *input);
+void cli_set_context(uviemon_context *ctx); // Bulk commands go through the library
+void cli_allow_background(bool allowed); // Refuses 'run &' and 'cont &' if false
+int parse_input(char *input); // -1 for exit, 1 if no command was recognized, 2 if it reported an error
 void print_help_text();
 
 /* Command functions  */
@@ -53,6 +64,23 @@ void cli_washc (const char *command, int param_count, char params[MAX_PARAMETERS
 void cli_inst  (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
 void cli_reg   (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
 void cli_cpu   (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_rtt   (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_halt  (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_step  (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_next  (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_cont  (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_break (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_watch (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_delete(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_profile(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_coverage(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_bench (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_stackuse(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_crashdump(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_entry (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_stop  (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_wait  (const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
+void cli_status(const char *command, int param_count, char params[MAX_PARAMETERS][MAX_PARAM_LENGTH]);
 
 void wmem(DWORD addr, DWORD data);
 void wmemh(DWORD addr, WORD data);
@@ -0,0 +1,393 @@
+#define _POSIX_C_SOURCE 200809L // strdup
+
+#include "uviemon_coverage.h"
+
+#include "leon3_dsu.h"
+#include "uviemon_elf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>   // fork
+#include <fcntl.h>    // open
+#include <sys/wait.h> // wait
+#include <sys/stat.h> // S_IRUSR, S_IWUSR
+
+#define LINES DSU_INST_TRCE_BUF_LINES
+#define LINE_WORDS (DSU_INST_TRCE_BUF_LINE_SIZE / 4)
+#define TIMETAG_MASK 0x3fffffff
+#define LINE_MULTI_CYCLE 0x40000000	// Continuation line of the instruction before
+
+#define ADDR2LINE "sparc-elf-addr2line"
+
+static const char *addresses_filename = "/tmp/coverage_addresses";
+static const char *lines_filename = "/tmp/coverage_lines";
+
+typedef struct {
+	char elf[256];
+	DWORD start;		// Text segment, one bit per word
+	DWORD end;
+	unsigned char *bitmap;
+	DWORD cpu;
+	bool collecting;	// Harvested along with the polls
+
+	bool primed;		// Trace index and newest timetag known
+	DWORD last_idx;		// Line written next at the last read
+	DWORD last_timetag;
+	unsigned long lines;	// Trace lines harvested
+	unsigned long overruns;	// Reads that found the buffer wrapped
+} coverage_state;
+
+static coverage_state coverage_slots[FTDI_MAX_DEVICES];
+
+static inline coverage_state *coverage_slot()
+{
+	return &coverage_slots[ftdi_get_device_slot()];
+}
+
+static DWORD line_addr(DWORD line)
+{
+	const coverage_state *coverage = coverage_slot();
+
+	return DSU_BASE(coverage->cpu) + DSU_INST_TRCE_BUF_START + (line % LINES) * DSU_INST_TRCE_BUF_LINE_SIZE;
+}
+
+bool coverage_start(const char *elf_path, DWORD cpu)
+{
+	coverage_state *coverage = coverage_slot();
+	DWORD start, end;
+
+	if (!elf_get_text(elf_path, &start, &end))
+		return false;
+
+	free(coverage->bitmap);
+	coverage->bitmap = calloc((end - start) / 4 / 8 + 1, 1);
+
+	if (!coverage->bitmap)
+		return false;
+
+	snprintf(coverage->elf, sizeof(coverage->elf), "%s", elf_path);
+	coverage->start = start & ~0x3;
+	coverage->end = end;
+	coverage->cpu = cpu;
+	coverage->collecting = true;
+	coverage->primed = false;
+	coverage->lines = 0;
+	coverage->overruns = 0;
+
+	return true;
+}
+
+/* The bitmap is kept for saving it */
+void coverage_stop()
+{
+	coverage_slot()->collecting = false;
+}
+
+bool coverage_active()
+{
+	return coverage_slot()->collecting;
+}
+
+void coverage_mark(DWORD pc)
+{
+	coverage_state *coverage = coverage_slot();
+
+	if (!coverage->collecting || pc < coverage->start || pc >= coverage->end)
+		return;
+
+	const DWORD word = (pc - coverage->start) / 4;
+
+	coverage->bitmap[word / 8] |= 1 << (word % 8);
+}
+
+static bool is_covered(DWORD addr)
+{
+	const coverage_state *coverage = coverage_slot();
+	const DWORD word = (addr - coverage->start) / 4;
+
+	return coverage->bitmap[word / 8] & (1 << (word % 8));
+}
+
+/* Reads of count lines from line first on, split where the buffer wraps */
+static DWORD append_lines(ftdi_batch *batch, DWORD first, DWORD count)
+{
+	const DWORD index = batch->reads;
+	const DWORD head = count < LINES - first ? count : LINES - first;
+
+	ftdi_batch_read32_block(batch, line_addr(first), head * LINE_WORDS);
+
+	if (count > head)
+		ftdi_batch_read32_block(batch, line_addr(0), (count - head) * LINE_WORDS);
+
+	return index;
+}
+
+static void mark_lines(const DWORD *data, DWORD count)
+{
+	coverage_state *coverage = coverage_slot();
+
+	for (DWORD i = 0; i < count; i++) {
+		const DWORD *field = &data[i * LINE_WORDS];
+
+		if (!(field[0] & LINE_MULTI_CYCLE))
+			coverage_mark(field[2] & ~0x3);
+	}
+
+	coverage->lines += count;
+}
+
+static bool newer(DWORD timetag, DWORD than)
+{
+	const DWORD age = (timetag - than) & TIMETAG_MASK;
+
+	return age != 0 && age < TIMETAG_MASK / 2;
+}
+
+/*
+ * Harvest the lines written since the last read: one transaction for the trace
+ * index, one for the new lines and the oldest line of the buffer. If that one
+ * is new as well the buffer wrapped, the rest of it is read too.
+ */
+int coverage_poll()
+{
+	coverage_state *coverage = coverage_slot();
+	DWORD data[LINES * LINE_WORDS + 1];
+	ftdi_batch batch;
+
+	if (!coverage->collecting)
+		return -1;
+
+	if (!coverage->primed)
+		dsu_set_cpu_trace_enable(coverage->cpu);
+
+	const DWORD idx = ioread32(DSU_BASE(coverage->cpu) + DSU_INST_TRCE_CTRL) % LINES;
+	const DWORD count = (idx - coverage->last_idx) % LINES;
+
+	if (coverage->primed && count == 0)
+		return 0;
+
+	ftdi_batch_init(&batch);
+
+	if (!coverage->primed) {
+		// Start with the lines written from now on
+		ftdi_batch_read32(&batch, line_addr(idx + LINES - 1));
+
+		if (ftdi_batch_transfer(&batch, data) == FT_OK) {
+			coverage->last_timetag = data[0] & TIMETAG_MASK;
+			coverage->last_idx = idx;
+			coverage->primed = true;
+		}
+
+		ftdi_batch_free(&batch);
+		return 0;
+	}
+
+	const DWORD oldest = ftdi_batch_read32(&batch, line_addr(idx));
+	const DWORD lines = append_lines(&batch, coverage->last_idx, count);
+
+	if (ftdi_batch_transfer(&batch, data) != FT_OK) {
+		ftdi_batch_free(&batch);
+		return 0;
+	}
+
+	mark_lines(&data[lines], count);
+
+	const bool overrun = newer(data[oldest] & TIMETAG_MASK, coverage->last_timetag);
+
+	coverage->last_timetag = data[lines + (count - 1) * LINE_WORDS] & TIMETAG_MASK;
+
+	if (overrun) {
+		coverage->overruns++;
+
+		// Everything else in the buffer is new, lines before it were lost
+		ftdi_batch_clear(&batch);
+		append_lines(&batch, idx, LINES - count);
+
+		if (ftdi_batch_transfer(&batch, data) == FT_OK)
+			mark_lines(data, LINES - count);
+	}
+
+	ftdi_batch_free(&batch);
+	coverage->last_idx = idx;
+
+	return count;
+}
+
+static unsigned long count_covered()
+{
+	const coverage_state *coverage = coverage_slot();
+	unsigned long covered = 0;
+
+	for (DWORD addr = coverage->start; addr < coverage->end; addr += 4)
+		covered += is_covered(addr);
+
+	return covered;
+}
+
+void coverage_print()
+{
+	const coverage_state *coverage = coverage_slot();
+
+	if (!coverage->bitmap) {
+		printf("No coverage collected, 'coverage start <elfPath>' first\n");
+		return;
+	}
+
+	const unsigned long words = (coverage->end - coverage->start) / 4;
+	const unsigned long covered = count_covered();
+
+	printf("0x%08x - 0x%08x: %lu of %lu words executed (%.1f%%)\n", coverage->start, coverage->end,
+	       covered, words, 100.0 * covered / words);
+	printf("%lu trace lines harvested, the buffer overran %lu times%s\n", coverage->lines, coverage->overruns,
+	       coverage->collecting ? "" : ", stopped");
+}
+
+static bool save_per_address(const char *path)
+{
+	const coverage_state *coverage = coverage_slot();
+	FILE *file = fopen(path, "w");
+
+	if (!file)
+		return false;
+
+	for (DWORD addr = coverage->start; addr < coverage->end; addr += 4)
+		fprintf(file, "%08x %d\n", addr, is_covered(addr) ? 1 : 0);
+
+	return fclose(file) == 0;
+}
+
+typedef struct {
+	char *file;
+	unsigned int line;
+	bool hit;
+} source_line;
+
+static int compare_source_lines(const void *a, const void *b)
+{
+	const source_line *la = a, *lb = b;
+	const int order = strcmp(la->file, lb->file);
+
+	if (order)
+		return order;
+
+	return la->line < lb->line ? -1 : la->line > lb->line;
+}
+
+/* sparc-elf-addr2line maps every word of the text segment to file:line */
+static bool run_addr2line()
+{
+	const coverage_state *coverage = coverage_slot();
+	FILE *addresses = fopen(addresses_filename, "w");
+	int status;
+
+	if (!addresses)
+		return false;
+
+	for (DWORD addr = coverage->start; addr < coverage->end; addr += 4)
+		fprintf(addresses, "0x%08x\n", addr);
+
+	fclose(addresses);
+
+	const pid_t pid = fork();
+
+	if (pid == 0) {
+		const int in = open(addresses_filename, O_RDONLY);
+		const int out = open(lines_filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+		dup2(in, 0);
+		dup2(out, 1);
+		execlp(ADDR2LINE, ADDR2LINE, "-e", coverage->elf, (char *) NULL);
+		exit(127);
+	}
+
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Could not run %s\n", ADDR2LINE);
+		return false;
+	}
+
+	return true;
+}
+
+/* lcov tracefile, a source line counts as hit if any of its words was executed */
+static bool save_lcov(const char *path)
+{
+	const coverage_state *coverage = coverage_slot();
+	const size_t words = (coverage->end - coverage->start) / 4;
+	source_line *lines = calloc(words, sizeof(source_line));
+	char buffer[1024];
+	size_t count = 0;
+	FILE *in, *out;
+
+	if (!lines || !run_addr2line() || (in = fopen(lines_filename, "r")) == NULL) {
+		free(lines);
+		return false;
+	}
+
+	for (DWORD addr = coverage->start; count < words && fgets(buffer, sizeof(buffer), in); addr += 4) {
+		char *colon = strrchr(buffer, ':');
+
+		if (!colon || buffer[0] == '?')
+			continue;
+
+		*colon = '\0';
+
+		const unsigned int line = strtoul(colon + 1, NULL, 10);
+
+		if (line == 0)
+			continue;
+
+		lines[count++] = (source_line) { strdup(buffer), line, is_covered(addr) };
+	}
+
+	fclose(in);
+	qsort(lines, count, sizeof(source_line), compare_source_lines);
+
+	if ((out = fopen(path, "w")) == NULL) {
+		for (size_t i = 0; i < count; i++)
+			free(lines[i].file);
+		free(lines);
+		return false;
+	}
+
+	fprintf(out, "TN:\n");
+
+	for (size_t i = 0; i < count;) {
+		const char *file = lines[i].file;
+		unsigned int found = 0, hit = 0;
+
+		fprintf(out, "SF:%s\n", file);
+
+		while (i < count && strcmp(lines[i].file, file) == 0) {
+			const unsigned int line = lines[i].line;
+			bool covered = false;
+
+			for (; i < count && lines[i].line == line && strcmp(lines[i].file, file) == 0; i++)
+				covered |= lines[i].hit;
+
+			fprintf(out, "DA:%u,%d\n", line, covered ? 1 : 0);
+			found++;
+			hit += covered;
+		}
+
+		fprintf(out, "LF:%u\nLH:%u\nend_of_record\n", found, hit);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		free(lines[i].file);
+	free(lines);
+
+	return fclose(out) == 0;
+}
+
+bool coverage_save(const char *path, bool per_address)
+{
+	const coverage_state *coverage = coverage_slot();
+
+	if (!coverage->bitmap) {
+		printf("No coverage collected, 'coverage start <elfPath>' first\n");
+		return false;
+	}
+
+	return per_address ? save_per_address(path) : save_lcov(path);
+}
@@ -0,0 +1,36 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Code coverage: the PCs in the instruction
+	trace buffer are collected into a bitmap
+	with one bit per instruction word of the
+	text segment. Only the lines written since
+	the last read are fetched, along with the
+	polls of a running program. At full speed
+	the trace buffer overruns between two reads,
+	so the coverage of a run is a sample, single
+	stepping covers every instruction.
+	============================================
+*/
+
+#ifndef UVIEMON_COVERAGE_H
+#define UVIEMON_COVERAGE_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+
+bool coverage_start(const char *elf_path, DWORD cpu);
+void coverage_stop(); // Keeps the bitmap for coverage_save()
+bool coverage_active();
+
+// Called with every poll of a running program, returns the new trace lines or -1 if inactive
+int coverage_poll();
+void coverage_mark(DWORD pc);
+
+void coverage_print();
+// lcov tracefile through sparc-elf-addr2line, or one "address hit" line per word
+bool coverage_save(const char *path, bool per_address);
+
+#endif /* UVIEMON_COVERAGE_H */
@@ -0,0 +1,452 @@
+#include "uviemon_crashdump.h"
+
+#include "leon3_dsu.h"
+#include "uviemon_stack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SPECIAL_WORDS ((DSU_REG_TRAP - DSU_REG_Y) / 4 + 1)
+#define FPU_WORDS 32
+#define TRACE_WORDS (DSU_INST_TRCE_BUF_LINES * DSU_INST_TRCE_BUF_LINE_SIZE / 4)
+#define AHB_TRACE_WORDS (DSU_AHB_TRCE_BUF_LINES * 4)
+#define CHUNK_WORDS (16 * 1024 / 4)	// Words per USB transaction for memory
+#define MAX_REGIONS (DSU_NCPUS + CRASHDUMP_MAX_RANGES)
+
+// Special registers in the order of the DSU, from %y on
+#define SPECIAL_PSR ((DSU_REG_PSR - DSU_REG_Y) / 4)
+#define SPECIAL_WIM ((DSU_REG_WIM - DSU_REG_Y) / 4)
+#define SPECIAL_TBR ((DSU_REG_TBR - DSU_REG_Y) / 4)
+#define SPECIAL_PC ((DSU_REG_PC - DSU_REG_Y) / 4)
+#define SPECIAL_NPC ((DSU_REG_NPC - DSU_REG_Y) / 4)
+#define SPECIAL_FSR ((DSU_REG_FSR - DSU_REG_Y) / 4)
+#define SPECIAL_TRAP ((DSU_REG_TRAP - DSU_REG_Y) / 4)
+
+#define PSR_CWP 0x1f
+
+// ELF core file in the layout of SPARC Linux, as read by gdb
+#define EHDR_SIZE 52
+#define PHDR_SIZE 32
+#define ET_CORE 4
+#define EM_SPARC 2
+#define PT_LOAD 1
+#define PT_NOTE 4
+#define NT_PRSTATUS 1
+#define NT_PRFPREG 2
+#define PRSTATUS_SIZE 228
+#define PRSTATUS_CURSIG 12
+#define PRSTATUS_PID 24
+#define PRSTATUS_REG 72		// %g0 - %i7, %psr, %pc, %npc, %y, %wim, %tbr
+#define FPREGSET_SIZE 400
+#define FPREGSET_FSR (33 * 4)
+
+typedef struct {
+	DWORD addr;
+	DWORD length;		// Bytes, a multiple of 4
+	DWORD *data;
+} dump_region;
+
+typedef struct {
+	DWORD ctrl;
+	DWORD special[SPECIAL_WORDS];
+	DWORD iu[DSU_IU_REG_WORDS];
+	DWORD fpu[FPU_WORDS];
+	DWORD trace[TRACE_WORDS + 1];	// Control register first
+} core_state;
+
+typedef struct {
+	BYTE *data;
+	size_t len;
+	size_t size;
+} byte_buffer;
+
+static struct {
+	dump_region ranges[CRASHDUMP_MAX_RANGES];
+	unsigned int range_count;
+	char auto_path[256];
+} crashdump;
+
+bool crashdump_add_range(DWORD addr, DWORD length)
+{
+	if (crashdump.range_count == CRASHDUMP_MAX_RANGES || length == 0)
+		return false;
+
+	// Whole words around the range
+	const DWORD first = addr & ~0x3;
+	const DWORD last = (addr + length + 3) & ~0x3;
+
+	crashdump.ranges[crashdump.range_count++] = (dump_region) { first, last - first, NULL };
+
+	return true;
+}
+
+void crashdump_clear_ranges()
+{
+	crashdump.range_count = 0;
+}
+
+void crashdump_print_ranges()
+{
+	if (crashdump.range_count == 0)
+		printf("Only the stacks are dumped\n");
+
+	for (unsigned int i = 0; i < crashdump.range_count; i++)
+		printf("   0x%08x - 0x%08x\n", crashdump.ranges[i].addr,
+		       crashdump.ranges[i].addr + crashdump.ranges[i].length);
+
+	if (crashdump.auto_path[0])
+		printf("Runs that end with a trap are dumped to %s\n", crashdump.auto_path);
+}
+
+void crashdump_set_auto(const char *path)
+{
+	snprintf(crashdump.auto_path, sizeof(crashdump.auto_path), "%s", path ? path : "");
+}
+
+const char *crashdump_get_auto()
+{
+	return crashdump.auto_path[0] ? crashdump.auto_path : NULL;
+}
+
+/* Registers and trace buffers of all cores and the AHB trace, one transaction */
+static bool capture_cores(DWORD cores, core_state *state, DWORD *ahb)
+{
+	DWORD ctrl[DSU_NCPUS], special[DSU_NCPUS], iu[DSU_NCPUS], fpu[DSU_NCPUS], trace[DSU_NCPUS];
+	ftdi_batch batch;
+
+	ftdi_batch_init(&batch);
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (!(cores & (1 << cpu)))
+			continue;
+
+		ctrl[cpu] = ftdi_batch_read32(&batch, DSU_BASE(cpu));
+		special[cpu] = ftdi_batch_read32_seq(&batch, DSU_BASE(cpu) + DSU_REG_Y, SPECIAL_WORDS);
+		iu[cpu] = ftdi_batch_read32_seq(&batch, DSU_BASE(cpu) + DSU_IU_REG, DSU_IU_REG_WORDS);
+		fpu[cpu] = ftdi_batch_read32_seq(&batch, DSU_BASE(cpu) + DSU_FPU_REG, FPU_WORDS);
+		trace[cpu] = ftdi_batch_read32(&batch, DSU_BASE(cpu) + DSU_INST_TRCE_CTRL);
+		ftdi_batch_read32_block(&batch, DSU_BASE(cpu) + DSU_INST_TRCE_BUF_START, TRACE_WORDS);
+	}
+
+	const DWORD ahb_index = ftdi_batch_read32_seq(&batch, DSU_CTRL + DSU_AHB_TRACE_CTRL, 2);
+	ftdi_batch_read32_block(&batch, DSU_CTRL + DSU_AHB_TRCE_BUF_START, AHB_TRACE_WORDS);
+
+	DWORD *data = malloc(batch.reads * sizeof(DWORD));
+	const bool ok = data && ftdi_batch_transfer(&batch, data) == FT_OK;
+
+	ftdi_batch_free(&batch);
+
+	for (uint32_t cpu = 0; ok && cpu < DSU_NCPUS; cpu++) {
+		if (!(cores & (1 << cpu)))
+			continue;
+
+		state[cpu].ctrl = data[ctrl[cpu]];
+		memcpy(state[cpu].special, &data[special[cpu]], sizeof(state[cpu].special));
+		memcpy(state[cpu].iu, &data[iu[cpu]], sizeof(state[cpu].iu));
+		memcpy(state[cpu].fpu, &data[fpu[cpu]], sizeof(state[cpu].fpu));
+		memcpy(state[cpu].trace, &data[trace[cpu]], sizeof(state[cpu].trace));
+	}
+
+	if (ok)
+		memcpy(ahb, &data[ahb_index], (AHB_TRACE_WORDS + 2) * sizeof(DWORD));
+
+	free(data);
+
+	return ok;
+}
+
+/* The stack from %sp up to its top, or its default size if %sp is elsewhere */
+static dump_region stack_region(const core_state *core, DWORD top)
+{
+	const DWORD cwp = core->special[SPECIAL_PSR] & PSR_CWP;
+	const DWORD sp = core->iu[DSU_IU_OUT(cwp) + 6] & ~0x7;
+
+	if (sp < top && top - sp <= STACK_DEFAULT_SIZE)
+		return (dump_region) { sp, top - sp, NULL };
+
+	return (dump_region) { top - STACK_DEFAULT_SIZE, STACK_DEFAULT_SIZE, NULL };
+}
+
+static bool read_region(dump_region *region, ftdi_batch *batch)
+{
+	region->data = malloc(region->length);
+
+	if (!region->data)
+		return false;
+
+	for (DWORD offset = 0; offset < region->length; offset += CHUNK_WORDS * 4) {
+		const DWORD words = region->length - offset < CHUNK_WORDS * 4 ? (region->length - offset) / 4 : CHUNK_WORDS;
+
+		ftdi_batch_clear(batch);
+		ftdi_batch_read32_block(batch, region->addr + offset, words);
+
+		if (ftdi_batch_transfer(batch, &region->data[offset / 4]) != FT_OK)
+			return false;
+	}
+
+	return true;
+}
+
+static void poke(dump_region *regions, unsigned int count, DWORD addr, DWORD value)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		if (addr >= regions[i].addr && addr - regions[i].addr < regions[i].length)
+			regions[i].data[(addr - regions[i].addr) / 4] = value;
+	}
+}
+
+/*
+ * What a window flush would have done: the locals and ins of every valid
+ * window are stored at its %sp, from the current window up to the invalid one
+ */
+static void flush_windows(const core_state *core, dump_region *regions, unsigned int count)
+{
+	DWORD cwp = core->special[SPECIAL_PSR] & PSR_CWP;
+
+	for (unsigned int n = 0; n < NWINDOWS; n++) {
+		const DWORD sp = core->iu[DSU_IU_OUT(cwp) + 6];
+
+		for (unsigned int i = 0; i < 8 && !(sp & 0x3); i++) {
+			poke(regions, count, sp + i * 4, core->iu[DSU_IU_LOCAL(cwp) + i]);
+			poke(regions, count, sp + 32 + i * 4, core->iu[DSU_IU_IN(cwp) + i]);
+		}
+
+		cwp = (cwp + 1) % NWINDOWS;
+
+		if (core->special[SPECIAL_WIM] & (1 << cwp))
+			break;
+	}
+}
+
+static void put_bytes(byte_buffer *buffer, const void *data, size_t len)
+{
+	if (buffer->len + len > buffer->size) {
+		buffer->size = (buffer->len + len) * 2;
+		buffer->data = realloc(buffer->data, buffer->size);
+
+		if (!buffer->data) {
+			fprintf(stderr, "Out of memory while writing the crash dump!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memcpy(buffer->data + buffer->len, data, len);
+	buffer->len += len;
+}
+
+static void store32(BYTE *p, DWORD value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static void put32(byte_buffer *buffer, DWORD value)
+{
+	BYTE bytes[4];
+
+	store32(bytes, value);
+	put_bytes(buffer, bytes, 4);
+}
+
+static void put16(byte_buffer *buffer, WORD value)
+{
+	const BYTE bytes[2] = { value >> 8, value };
+
+	put_bytes(buffer, bytes, 2);
+}
+
+static void put_words(byte_buffer *buffer, const DWORD *words, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		put32(buffer, words[i]);
+}
+
+static void pad4(byte_buffer *buffer)
+{
+	const BYTE zero[4] = { 0 };
+
+	put_bytes(buffer, zero, (4 - buffer->len % 4) % 4);
+}
+
+static void put_note(byte_buffer *notes, const char *name, DWORD type, const BYTE *desc, size_t size)
+{
+	put32(notes, strlen(name) + 1);
+	put32(notes, size);
+	put32(notes, type);
+	put_bytes(notes, name, strlen(name) + 1);
+	pad4(notes);
+	put_bytes(notes, desc, size);
+	pad4(notes);
+}
+
+/* A note of DSU words, prefixed with the cpu number */
+static void put_dsu_note(byte_buffer *notes, DWORD type, uint32_t cpu, const DWORD *words, size_t count)
+{
+	byte_buffer desc = { 0 };
+
+	put32(&desc, cpu);
+	put_words(&desc, words, count);
+	put_note(notes, "UVIEMON", type, desc.data, desc.len);
+	free(desc.data);
+}
+
+static void put_core_notes(byte_buffer *notes, uint32_t cpu, const core_state *core)
+{
+	const DWORD cwp = core->special[SPECIAL_PSR] & PSR_CWP;
+	BYTE prstatus[PRSTATUS_SIZE] = { 0 };
+	BYTE fpregset[FPREGSET_SIZE] = { 0 };
+	BYTE *reg = &prstatus[PRSTATUS_REG];
+
+	// A big endian short, signals fit into its low byte
+	prstatus[PRSTATUS_CURSIG + 1] = dsu_get_trap_signal(core->special[SPECIAL_TRAP], core->special[SPECIAL_TBR]);
+	store32(&prstatus[PRSTATUS_PID], cpu + 1); // Threads of gdb, numbered from 1
+
+	for (unsigned int i = 0; i < 8; i++) {
+		store32(&reg[i * 4], i ? core->iu[DSU_IU_GLOBAL + i] : 0);
+		store32(&reg[(8 + i) * 4], core->iu[DSU_IU_OUT(cwp) + i]);
+		store32(&reg[(16 + i) * 4], core->iu[DSU_IU_LOCAL(cwp) + i]);
+		store32(&reg[(24 + i) * 4], core->iu[DSU_IU_IN(cwp) + i]);
+	}
+
+	store32(&reg[32 * 4], core->special[SPECIAL_PSR]);
+	store32(&reg[33 * 4], core->special[SPECIAL_PC]);
+	store32(&reg[34 * 4], core->special[SPECIAL_NPC]);
+	store32(&reg[35 * 4], core->special[0]); // %y
+	store32(&reg[36 * 4], core->special[SPECIAL_WIM]);
+	store32(&reg[37 * 4], core->special[SPECIAL_TBR]);
+
+	for (unsigned int i = 0; i < FPU_WORDS; i++)
+		store32(&fpregset[i * 4], core->fpu[i]);
+	store32(&fpregset[FPREGSET_FSR], core->special[SPECIAL_FSR]);
+
+	put_note(notes, "CORE", NT_PRSTATUS, prstatus, sizeof(prstatus));
+	put_note(notes, "CORE", NT_PRFPREG, fpregset, sizeof(fpregset));
+
+	DWORD dsu[SPECIAL_WORDS + 1] = { core->ctrl };
+
+	memcpy(&dsu[1], core->special, sizeof(core->special));
+	put_dsu_note(notes, CRASHDUMP_NT_DSU, cpu, dsu, SPECIAL_WORDS + 1);
+	put_dsu_note(notes, CRASHDUMP_NT_IU_REG, cpu, core->iu, DSU_IU_REG_WORDS);
+	put_dsu_note(notes, CRASHDUMP_NT_INST_TRACE, cpu, core->trace, TRACE_WORDS + 1);
+}
+
+static void put_phdr(byte_buffer *file, DWORD type, DWORD offset, DWORD addr, DWORD size, DWORD flags)
+{
+	put32(file, type);
+	put32(file, offset);
+	put32(file, addr);	// p_vaddr
+	put32(file, addr);	// p_paddr
+	put32(file, size);	// p_filesz
+	put32(file, size);	// p_memsz
+	put32(file, flags);
+	put32(file, 4);		// p_align
+}
+
+static bool write_core(const char *path, DWORD cores, const core_state *state, const DWORD *ahb,
+		       const dump_region *regions, unsigned int count)
+{
+	static const BYTE ident[16] = { 0x7f, 'E', 'L', 'F', 1 /* 32 bit */, 2 /* big endian */, 1 /* version */ };
+	byte_buffer notes = { 0 }, file = { 0 };
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (cores & (1 << cpu))
+			put_core_notes(&notes, cpu, &state[cpu]);
+	}
+
+	put_dsu_note(&notes, CRASHDUMP_NT_AHB_TRACE, 0, ahb, AHB_TRACE_WORDS + 2);
+
+	put_bytes(&file, ident, sizeof(ident));
+	put16(&file, ET_CORE);
+	put16(&file, EM_SPARC);
+	put32(&file, 1);		// e_version
+	put32(&file, 0);		// e_entry
+	put32(&file, EHDR_SIZE);	// e_phoff
+	put32(&file, 0);		// e_shoff
+	put32(&file, 0);		// e_flags
+	put16(&file, EHDR_SIZE);
+	put16(&file, PHDR_SIZE);
+	put16(&file, count + 1);	// e_phnum
+	put16(&file, 0);		// e_shentsize
+	put16(&file, 0);		// e_shnum
+	put16(&file, 0);		// e_shstrndx
+
+	DWORD offset = EHDR_SIZE + (count + 1) * PHDR_SIZE;
+
+	put_phdr(&file, PT_NOTE, offset, 0, notes.len, 0);
+	offset += notes.len;
+
+	for (unsigned int i = 0; i < count; i++) {
+		put_phdr(&file, PT_LOAD, offset, regions[i].addr, regions[i].length, 0x7 /* RWX */);
+		offset += regions[i].length;
+	}
+
+	put_bytes(&file, notes.data, notes.len);
+
+	for (unsigned int i = 0; i < count; i++)
+		put_words(&file, regions[i].data, regions[i].length / 4);
+
+	FILE *out = fopen(path, "wb");
+	bool ok = out && fwrite(file.data, 1, file.len, out) == file.len;
+
+	if (out && fclose(out) != 0)
+		ok = false;
+
+	free(notes.data);
+	free(file.data);
+
+	return ok;
+}
+
+/*
+ * All cores are halted with one write, their registers and the trace buffers
+ * follow in one transaction. Memory comes last, so the stacks can start at
+ * the %sp that was just read.
+ */
+bool crashdump_write(const char *path, const ftdi_core_entry *entries)
+{
+	const DWORD cores = (1 << ftdi_get_cpu_count()) - 1;
+	static core_state state[DSU_NCPUS];
+	static DWORD ahb[AHB_TRACE_WORDS + 2];
+	dump_region regions[MAX_REGIONS];
+	unsigned int count = 0;
+	ftdi_batch batch;
+	bool ok;
+
+	dsu_halt_cpus(cores);
+
+	if (!capture_cores(cores, state, ahb))
+		return false;
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (cores & (1 << cpu))
+			regions[count++] = stack_region(&state[cpu], entries[cpu].stack);
+	}
+
+	for (unsigned int i = 0; i < crashdump.range_count; i++)
+		regions[count++] = crashdump.ranges[i];
+
+	ftdi_batch_init(&batch);
+
+	ok = true;
+	for (unsigned int i = 0; i < count; i++)
+		ok = ok && read_region(&regions[i], &batch);
+
+	ftdi_batch_free(&batch);
+
+	if (ok) {
+		for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+			if (cores & (1 << cpu))
+				flush_windows(&state[cpu], regions, count);
+		}
+
+		ok = write_core(path, cores, state, ahb, regions, count);
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+		free(regions[i].data);
+
+	return ok;
+}
@@ -0,0 +1,44 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Crash dumps: all cores are halted, their
+	registers and trace buffers are captured in
+	a single transaction, then their stacks
+	and listed memory ranges in bursts. The
+	dump is an ELF core file in the layout of
+	SPARC Linux, so gdb shows every core as a
+	thread. The register windows are flushed
+	into the stack memory of the dump for back
+	traces, everything else the DSU has goes
+	into notes of its own.
+	============================================
+*/
+
+#ifndef UVIEMON_CRASHDUMP_H
+#define UVIEMON_CRASHDUMP_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+
+#define CRASHDUMP_MAX_RANGES 16
+
+// Notes named "UVIEMON", each starts with the cpu number
+#define CRASHDUMP_NT_DSU	1	// DSU control, %y up to the trap register
+#define CRASHDUMP_NT_IU_REG	2	// All register windows and the globals
+#define CRASHDUMP_NT_INST_TRACE	3	// Trace control and the 256 lines of the buffer
+#define CRASHDUMP_NT_AHB_TRACE	4	// Trace control, index and buffer, cpu is 0
+
+bool crashdump_add_range(DWORD addr, DWORD length);
+void crashdump_clear_ranges();
+void crashdump_print_ranges();
+
+// Dumps written after a run ends with a trap, NULL to turn off
+void crashdump_set_auto(const char *path);
+const char *crashdump_get_auto();
+
+// entries give the stack tops of all cores
+bool crashdump_write(const char *path, const ftdi_core_entry *entries);
+
+#endif /* UVIEMON_CRASHDUMP_H */
@@ -0,0 +1,377 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "uviemon_daemon.h"
+
+#include "uviemon_cli.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define LINE_LENGTH 256
+
+typedef struct {
+	int fd;
+	char line[LINE_LENGTH];
+	size_t len;
+	bool overlong;		// Rest of a line that did not fit is dropped
+} client;
+
+static struct {
+	client clients[DAEMON_MAX_CLIENTS];
+	unsigned int count;
+	FILE *capture;		// stdout and stderr of one command
+	char *output;
+	size_t output_size;
+	bool shutdown;
+} server;
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+	while (len > 0) {
+		const ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+
+		if (n <= 0)
+			return false;
+
+		data += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool send_frame(int fd, const char *status, const char *data, size_t len)
+{
+	char header[32];
+	const int header_len = snprintf(header, sizeof(header), "%s %zu\n", status, len);
+
+	return send_all(fd, header, header_len) && send_all(fd, data, len);
+}
+
+/* Runs one console command with stdout and stderr redirected into the capture file */
+static int execute(char *line, size_t *len)
+{
+	const int fd = fileno(server.capture);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	const int saved_out = dup(STDOUT_FILENO);
+	const int saved_err = dup(STDERR_FILENO);
+
+	if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0)
+		perror("Could not truncate the command output");
+
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+
+	const int result = parse_input(line);
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(saved_out, STDOUT_FILENO);
+	dup2(saved_err, STDERR_FILENO);
+	close(saved_out);
+	close(saved_err);
+
+	*len = lseek(fd, 0, SEEK_END);
+
+	if (*len > server.output_size) {
+		free(server.output);
+		server.output_size = *len;
+		server.output = malloc(server.output_size);
+
+		if (server.output == NULL) {
+			fprintf(stderr, "Out of memory for the command output!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (pread(fd, server.output, *len, 0) != (ssize_t) *len)
+		*len = 0;
+
+	return result;
+}
+
+/* false once the client is done */
+static bool handle_line(client *c)
+{
+	size_t len = 0;
+
+	c->line[c->len] = '\0';
+
+	if (c->overlong) {
+		const char error[] = "Command too long\n";
+
+		return send_frame(c->fd, "unknown", error, sizeof(error) - 1);
+	}
+
+	if (strcmp(c->line, "shutdown") == 0) {
+		server.shutdown = true;
+		send_frame(c->fd, "bye", NULL, 0);
+		return false;
+	}
+
+	const int result = execute(c->line, &len);
+
+	if (result == -1) {
+		send_frame(c->fd, "bye", server.output, len);
+		return false;
+	}
+
+	static const char *const status[] = { "ok", "unknown", "error" };
+
+	return send_frame(c->fd, status[result], server.output, len);
+}
+
+/* Every complete line that arrived is executed before the next poll */
+static bool handle_input(client *c)
+{
+	char data[LINE_LENGTH];
+	const ssize_t n = recv(c->fd, data, sizeof(data), 0);
+
+	if (n <= 0)
+		return false;
+
+	for (ssize_t i = 0; i < n; i++) {
+		if (data[i] == '\n') {
+			if (c->len > 0 && c->line[c->len - 1] == '\r')
+				c->len--;
+
+			const bool keep = handle_line(c);
+
+			c->len = 0;
+			c->overlong = false;
+
+			if (!keep || server.shutdown)
+				return false;
+		} else if (c->len < LINE_LENGTH - 1) {
+			c->line[c->len++] = data[i];
+		} else {
+			c->overlong = true;
+		}
+	}
+
+	return true;
+}
+
+/* Only a socket nobody answers on is stale */
+static bool daemon_running(const struct sockaddr_un *addr)
+{
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return false;
+
+	const bool running = connect(fd, (const struct sockaddr *) addr, sizeof(*addr)) == 0;
+
+	close(fd);
+
+	return running;
+}
+
+bool daemon_serve(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct pollfd fds[DAEMON_MAX_CLIENTS + 1];
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path '%s' is too long\n", path);
+		return false;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	if (daemon_running(&addr)) {
+		fprintf(stderr, "A daemon is already serving %s\n", path);
+		return false;
+	}
+
+	unlink(path); // Left over from a daemon that did not shut down
+
+	const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	// Only the user who started the daemon may connect and drive the probe
+	const mode_t mask = umask(0077);
+	const bool bound = listener >= 0 && bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+
+	umask(mask);
+
+	if (!bound || listen(listener, DAEMON_MAX_CLIENTS) < 0) {
+		perror("Could not listen on the daemon socket");
+		if (listener >= 0)
+			close(listener);
+		return false;
+	}
+
+	server.capture = tmpfile();
+
+	if (server.capture == NULL) {
+		perror("Could not create the command output file");
+		close(listener);
+		unlink(path);
+		return false;
+	}
+
+	server.count = 0;
+	server.shutdown = false;
+
+	/*
+	 * The output of a command is captured by redirecting stdout and stderr
+	 * while it runs, the I/O thread of a background run would keep writing
+	 * into the capture of whichever command comes next
+	 */
+	cli_allow_background(false);
+	printf("Serving commands on %s, 'uviemon -connect %s <command>'\n", path, path);
+
+	while (!server.shutdown) {
+		fds[0] = (struct pollfd) { .fd = listener, .events = POLLIN };
+
+		for (unsigned int i = 0; i < server.count; i++)
+			fds[i + 1] = (struct pollfd) { .fd = server.clients[i].fd, .events = POLLIN };
+
+		if (poll(fds, server.count + 1, -1) < 0) {
+			perror("Could not wait for clients");
+			break;
+		}
+
+		// Clients are served in the order of the table, one command line after the other
+		for (unsigned int i = 0; i < server.count && !server.shutdown; i++) {
+			client *c = &server.clients[i];
+
+			if ((fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) && !handle_input(c)) {
+				close(c->fd);
+				c->fd = -1;
+			}
+		}
+
+		unsigned int kept = 0;
+
+		for (unsigned int i = 0; i < server.count; i++) {
+			if (server.clients[i].fd >= 0)
+				server.clients[kept++] = server.clients[i];
+		}
+
+		server.count = kept;
+
+		if (fds[0].revents & POLLIN) {
+			const int fd = accept(listener, NULL, NULL);
+
+			if (fd < 0)
+				continue;
+
+			if (server.count == DAEMON_MAX_CLIENTS) {
+				const char error[] = "Too many clients\n";
+
+				send_frame(fd, "bye", error, sizeof(error) - 1);
+				close(fd);
+				continue;
+			}
+
+			server.clients[server.count++] = (client) { .fd = fd };
+		}
+	}
+
+	for (unsigned int i = 0; i < server.count; i++)
+		close(server.clients[i].fd);
+
+	fclose(server.capture);
+	free(server.output);
+	server.output = NULL;
+	server.output_size = 0;
+	close(listener);
+	unlink(path);
+	cli_allow_background(true);
+
+	return true;
+}
+
+/* Returns the status of the reply, NULL if the connection broke */
+static const char *request(FILE *reply, int fd, const char *command)
+{
+	static char status[16];
+	char data[4096];
+	size_t len;
+
+	if (!send_all(fd, command, strlen(command)) || !send_all(fd, "\n", 1))
+		return NULL;
+
+	if (fscanf(reply, "%15s %zu", status, &len) != 2 || fgetc(reply) != '\n')
+		return NULL;
+
+	while (len > 0) {
+		const size_t n = fread(data, 1, len < sizeof(data) ? len : sizeof(data), reply);
+
+		if (n == 0)
+			return NULL;
+
+		fwrite(data, 1, n, stdout);
+		len -= n;
+	}
+
+	return status;
+}
+
+int daemon_client(const char *path, const char *command)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char line[LINE_LENGTH];
+	int result = 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path '%s' is too long\n", path);
+		return 1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("Could not connect to the daemon");
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+
+	FILE *reply = fdopen(dup(fd), "r");
+
+	if (reply == NULL) {
+		close(fd);
+		return 1;
+	}
+
+	if (command != NULL) {
+		const char *status = request(reply, fd, command);
+
+		result = status == NULL || strcmp(status, "unknown") == 0 || strcmp(status, "error") == 0;
+	} else {
+		while (fgets(line, sizeof(line), stdin)) {
+			line[strcspn(line, "\r\n")] = '\0';
+
+			const char *status = request(reply, fd, line);
+
+			if (status == NULL) {
+				result = 1;
+				break;
+			}
+
+			if (strcmp(status, "unknown") == 0 || strcmp(status, "error") == 0)
+				result = 1;
+
+			if (strcmp(status, "bye") == 0)
+				break;
+		}
+	}
+
+	fclose(reply);
+	close(fd);
+
+	return result;
+}
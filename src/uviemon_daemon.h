@@ -0,0 +1,37 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Daemon mode: the probe is opened once and
+	console commands come from any number of
+	clients on a Unix domain socket. Commands
+	are executed one at a time in the order
+	their lines arrive, the output of each is
+	returned in a frame of its own:
+
+		<status> <length>\n<output>
+
+	status is "ok", "error" for commands that
+	reported an error, "unknown" for commands
+	that were not recognized and "bye" after
+	"exit", which only ends the connection.
+	"shutdown" ends the daemon. Programs only
+	run in the foreground, 'run &' and 'cont &'
+	are refused. The socket is only accessible
+	to the user who started the daemon.
+	============================================
+*/
+
+#ifndef UVIEMON_DAEMON_H
+#define UVIEMON_DAEMON_H
+
+#include <stdbool.h>
+
+#define DAEMON_MAX_CLIENTS 32
+
+bool daemon_serve(const char *path);
+
+// Sends the command, or every line of stdin without one, returns the exit code
+int daemon_client(const char *path, const char *command);
+
+#endif /* UVIEMON_DAEMON_H */
@@ -0,0 +1,270 @@
+#include "uviemon_elf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EI_NIDENT	16
+#define ELFCLASS32	1
+#define ELFDATA2MSB	2
+
+#define SHT_SYMTAB	2
+#define SHF_ALLOC	0x2
+#define SHF_EXECINSTR	0x4
+#define STT_FUNC	2
+
+#define EHDR_SIZE	52
+#define SHDR_SIZE	40
+#define SYM_SIZE	16
+
+/* An open ELF file, its byte order comes from the header */
+typedef struct {
+	FILE *file;
+	bool big_endian;
+} elf_file;
+
+static uint32_t get32(const elf_file *elf, const unsigned char *p)
+{
+	if (elf->big_endian)
+		return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+
+	return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+static uint16_t get16(const elf_file *elf, const unsigned char *p)
+{
+	if (elf->big_endian)
+		return (uint16_t)(p[0] << 8 | p[1]);
+
+	return (uint16_t)(p[1] << 8 | p[0]);
+}
+
+static void *read_at(FILE *file, long offset, size_t size)
+{
+	void *buf = malloc(size ? size : 1);
+
+	if (buf == NULL)
+		return NULL;
+
+	if (fseek(file, offset, SEEK_SET) != 0 || fread(buf, 1, size, file) != size) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/* Opens an ELF32 file and reads its header, closes it again on failure */
+static bool elf_open(const char *path, elf_file *elf, unsigned char ehdr[EHDR_SIZE])
+{
+	elf->file = fopen(path, "rb");
+
+	if (elf->file == NULL) {
+		perror("Could not open ELF file");
+		return false;
+	}
+
+	if (fread(ehdr, 1, EHDR_SIZE, elf->file) != EHDR_SIZE
+	    || memcmp(ehdr, "\177ELF", 4) != 0 || ehdr[4] != ELFCLASS32) {
+		fprintf(stderr, "%s is not an ELF32 file\n", path);
+		fclose(elf->file);
+		return false;
+	}
+
+	elf->big_endian = ehdr[5] == ELFDATA2MSB;
+
+	return true;
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+	const elf_symbol *sa = a, *sb = b;
+
+	if (sa->value != sb->value)
+		return sa->value < sb->value ? -1 : 1;
+
+	return 0;
+}
+
+bool elf_load_symbols(const char *path, elf_symbols *syms)
+{
+	unsigned char ehdr[EHDR_SIZE];
+	unsigned char *shdrs = NULL, *symtab = NULL;
+	bool ok = false;
+
+	syms->symbols = NULL;
+	syms->count = 0;
+	syms->strtab = NULL;
+
+	elf_file elf;
+
+	if (!elf_open(path, &elf, ehdr))
+		return false;
+
+	const uint32_t shoff = get32(&elf, ehdr + 32);
+	const uint16_t shentsize = get16(&elf, ehdr + 46);
+	const uint16_t shnum = get16(&elf, ehdr + 48);
+
+	if (shentsize < SHDR_SIZE || shnum == 0)
+		goto no_symtab;
+
+	shdrs = read_at(elf.file, shoff, (size_t) shentsize * shnum);
+
+	if (shdrs == NULL)
+		goto no_symtab;
+
+	for (uint16_t i = 0; i < shnum; i++) {
+		const unsigned char *sh = shdrs + i * shentsize;
+
+		if (get32(&elf, sh + 4) != SHT_SYMTAB)
+			continue;
+
+		const uint32_t link = get32(&elf, sh + 24);
+
+		if (link >= shnum)
+			break;
+
+		const unsigned char *strsh = shdrs + link * shentsize;
+		const uint32_t sym_size = get32(&elf, sh + 20);
+		const uint32_t strtab_size = get32(&elf, strsh + 20);
+
+		symtab = read_at(elf.file, get32(&elf, sh + 16), sym_size);
+		syms->strtab = read_at(elf.file, get32(&elf, strsh + 16), strtab_size + 1);
+
+		if (symtab == NULL || syms->strtab == NULL)
+			break;
+
+		syms->strtab[strtab_size] = '\0';
+		syms->symbols = malloc((sym_size / SYM_SIZE + 1) * sizeof(elf_symbol));
+
+		if (syms->symbols == NULL)
+			break;
+
+		for (uint32_t j = 0; j < sym_size / SYM_SIZE; j++) {
+			const unsigned char *sym = symtab + j * SYM_SIZE;
+			const uint32_t name = get32(&elf, sym);
+
+			// Skip unnamed, section and file symbols
+			if (name == 0 || name >= strtab_size || (sym[12] & 0xf) > STT_FUNC)
+				continue;
+
+			elf_symbol *s = &syms->symbols[syms->count++];
+
+			s->name = syms->strtab + name;
+			s->value = get32(&elf, sym + 4);
+			s->size = get32(&elf, sym + 8);
+			s->func = (sym[12] & 0xf) == STT_FUNC;
+		}
+
+		qsort(syms->symbols, syms->count, sizeof(elf_symbol), compare_symbols);
+		ok = true;
+		break;
+	}
+
+no_symtab:
+	if (!ok) {
+		fprintf(stderr, "No symbol table found in %s\n", path);
+		elf_free_symbols(syms);
+	}
+
+	free(symtab);
+	free(shdrs);
+	fclose(elf.file);
+
+	return ok;
+}
+
+void elf_free_symbols(elf_symbols *syms)
+{
+	free(syms->symbols);
+	free(syms->strtab);
+
+	syms->symbols = NULL;
+	syms->strtab = NULL;
+	syms->count = 0;
+}
+
+const elf_symbol *elf_find_symbol(const elf_symbols *syms, const char *name)
+{
+	for (size_t i = 0; i < syms->count; i++) {
+		if (strcmp(syms->symbols[i].name, name) == 0)
+			return &syms->symbols[i];
+	}
+
+	return NULL;
+}
+
+/* Function containing addr, the symbols are sorted by value */
+const elf_symbol *elf_find_address(const elf_symbols *syms, uint32_t addr)
+{
+	size_t low = 0, high = syms->count;
+
+	// First symbol above addr
+	while (low < high) {
+		const size_t mid = (low + high) / 2;
+
+		if (syms->symbols[mid].value <= addr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	while (low-- > 0) {
+		const elf_symbol *sym = &syms->symbols[low];
+
+		if (!sym->func)
+			continue;
+
+		return addr < sym->value + sym->size || sym->size == 0 ? sym : NULL;
+	}
+
+	return NULL;
+}
+
+/* Address range covering all executable sections */
+bool elf_get_text(const char *path, uint32_t *start, uint32_t *end)
+{
+	unsigned char ehdr[EHDR_SIZE];
+	unsigned char *shdrs = NULL;
+	bool ok = false;
+
+	*start = UINT32_MAX;
+	*end = 0;
+
+	elf_file elf;
+
+	if (!elf_open(path, &elf, ehdr))
+		return false;
+
+	const uint16_t shentsize = get16(&elf, ehdr + 46);
+	const uint16_t shnum = get16(&elf, ehdr + 48);
+
+	if (shentsize < SHDR_SIZE || (shdrs = read_at(elf.file, get32(&elf, ehdr + 32), (size_t) shentsize * shnum)) == NULL)
+		goto out;
+
+	for (uint16_t i = 0; i < shnum; i++) {
+		const unsigned char *sh = shdrs + i * shentsize;
+		const uint32_t flags = get32(&elf, sh + 8);
+		const uint32_t addr = get32(&elf, sh + 12);
+		const uint32_t size = get32(&elf, sh + 20);
+
+		if ((flags & (SHF_ALLOC | SHF_EXECINSTR)) != (SHF_ALLOC | SHF_EXECINSTR) || size == 0)
+			continue;
+
+		if (addr < *start)
+			*start = addr;
+		if (addr + size > *end)
+			*end = addr + size;
+
+		ok = true;
+	}
+
+	if (!ok)
+		fprintf(stderr, "No executable section found in %s\n", path);
+
+out:
+	free(shdrs);
+	fclose(elf.file);
+
+	return ok;
+}
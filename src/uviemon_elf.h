@@ -0,0 +1,38 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Minimal ELF32 reader for the symbol table
+	of the images that are run on the target.
+	============================================
+*/
+
+#ifndef UVIEMON_ELF_H
+#define UVIEMON_ELF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	const char *name;
+	uint32_t value;
+	uint32_t size;
+	bool func;
+} elf_symbol;
+
+typedef struct {
+	elf_symbol *symbols;	// Sorted by value
+	size_t count;
+	char *strtab;		// Backing store of all symbol names
+} elf_symbols;
+
+bool elf_load_symbols(const char *path, elf_symbols *syms);
+void elf_free_symbols(elf_symbols *syms);
+
+const elf_symbol *elf_find_symbol(const elf_symbols *syms, const char *name);
+const elf_symbol *elf_find_address(const elf_symbols *syms, uint32_t addr);
+
+bool elf_get_text(const char *path, uint32_t *start, uint32_t *end);
+
+#endif /* UVIEMON_ELF_H */
@@ -0,0 +1,657 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, open_memstream
+
+#include "uviemon_farm.h"
+
+#include "libuviemon.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <time.h>
+
+#define LINE_LENGTH 1024
+
+typedef struct {
+	char path[256];
+	char name[128];
+	unsigned int expected_trap;
+	unsigned int timeout;	// s
+	double cost;		// Expected s, longest first
+
+	// Results
+	bool done;
+	unsigned int device;
+	int result;		// Of the load and the run
+	char error[256];
+	uviemon_run_result run;
+	double time;		// s, load and run
+	char *uart;
+	size_t uart_len;
+	bool passed;
+} farm_test;
+
+/* Tests in the order dealt, the owner takes them from the head, thieves from the tail */
+typedef struct {
+	unsigned int *items;
+	unsigned int head;
+	unsigned int tail;
+	pthread_mutex_t lock;
+} deque;
+
+typedef struct {
+	unsigned int index;	// Of the FTDI device
+	uviemon_context *ctx;
+	deque queue;
+	pthread_t thread;
+	unsigned int tests;	// Run, including the stolen ones
+	unsigned int stolen;
+	bool lost;		// Stopped after an I/O error
+} probe;
+
+static struct {
+	farm_test *tests;
+	unsigned int count;
+	probe probes[FARM_MAX_PROBES];
+	unsigned int probe_count;
+	pthread_mutex_t print_lock;
+
+	// A test in flight may still be handed back, idle workers wait for it
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	unsigned int running;
+} farm;
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Manifest
+ */
+
+static bool parse_option(farm_test *test, const char *option)
+{
+	const char *value = strchr(option, '=');
+	char *end;
+
+	if (value == NULL)
+		return false;
+
+	value++;
+
+	if (strncmp(option, "trap=", 5) == 0) {
+		test->expected_trap = strtoul(value, &end, 0);
+		return *end == '\0' && test->expected_trap <= 0xFF;
+	} else if (strncmp(option, "timeout=", 8) == 0) {
+		test->timeout = strtoul(value, &end, 10);
+		return *end == '\0' && test->timeout > 0;
+	} else if (strncmp(option, "cost=", 5) == 0) {
+		test->cost = strtod(value, &end);
+		return *end == '\0' && test->cost >= 0;
+	} else if (strncmp(option, "name=", 5) == 0) {
+		snprintf(test->name, sizeof(test->name), "%s", value);
+		return true;
+	}
+
+	return false;
+}
+
+static bool read_manifest(const char *path)
+{
+	char line[LINE_LENGTH];
+	unsigned int number = 0;
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL) {
+		perror("Could not open the manifest");
+		return false;
+	}
+
+	farm.tests = calloc(FARM_MAX_TESTS, sizeof(farm_test));
+	farm.count = 0;
+
+	if (farm.tests == NULL) {
+		fprintf(stderr, "Out of memory for the tests\n");
+		fclose(fp);
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		number++;
+		line[strcspn(line, "#\r\n")] = '\0';
+
+		char *token = strtok(line, " \t");
+
+		if (token == NULL)
+			continue;
+
+		if (farm.count == FARM_MAX_TESTS) {
+			fprintf(stderr, "%s:%u: more than %d tests\n", path, number, FARM_MAX_TESTS);
+			fclose(fp);
+			return false;
+		}
+
+		farm_test *test = &farm.tests[farm.count];
+		const char *base = strrchr(token, '/');
+
+		snprintf(test->path, sizeof(test->path), "%s", token);
+		snprintf(test->name, sizeof(test->name), "%s", base ? base + 1 : token);
+		test->expected_trap = 0x80;
+		test->timeout = FARM_DEFAULT_TIMEOUT;
+		test->cost = -1;
+
+		while ((token = strtok(NULL, " \t")) != NULL) {
+			if (!parse_option(test, token)) {
+				fprintf(stderr, "%s:%u: bad option '%s'\n", path, number, token);
+				fclose(fp);
+				return false;
+			}
+		}
+
+		if (test->cost < 0)
+			test->cost = test->timeout;
+
+		farm.count++;
+	}
+
+	fclose(fp);
+
+	if (farm.count == 0) {
+		fprintf(stderr, "No tests in %s\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Scheduling
+ */
+
+static int by_cost(const void *a, const void *b)
+{
+	const double ca = farm.tests[*(const unsigned int *) a].cost;
+	const double cb = farm.tests[*(const unsigned int *) b].cost;
+
+	return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/* Longest first, round robin, so that every deque starts with the same share */
+static bool deal_tests()
+{
+	unsigned int order[FARM_MAX_TESTS];
+	const unsigned int share = (farm.count + farm.probe_count - 1) / farm.probe_count;
+	bool ok = true;
+
+	for (unsigned int i = 0; i < farm.count; i++)
+		order[i] = i;
+
+	qsort(order, farm.count, sizeof(order[0]), by_cost);
+
+	for (unsigned int p = 0; p < farm.probe_count; p++) {
+		deque *q = &farm.probes[p].queue;
+
+		q->items = malloc(share * sizeof(q->items[0]));
+		q->head = q->tail = 0;
+		pthread_mutex_init(&q->lock, NULL);
+		ok &= q->items != NULL;
+	}
+
+	if (!ok)
+		return false;
+
+	for (unsigned int i = 0; i < farm.count; i++) {
+		deque *q = &farm.probes[i % farm.probe_count].queue;
+
+		q->items[q->tail++] = order[i];
+	}
+
+	return true;
+}
+
+static bool pop_head(deque *q, unsigned int *test)
+{
+	pthread_mutex_lock(&q->lock);
+
+	const bool found = q->head < q->tail;
+
+	if (found)
+		*test = q->items[q->head++];
+
+	pthread_mutex_unlock(&q->lock);
+
+	return found;
+}
+
+static bool pop_tail(deque *q, unsigned int *test)
+{
+	pthread_mutex_lock(&q->lock);
+
+	const bool found = q->head < q->tail;
+
+	if (found)
+		*test = q->items[--q->tail];
+
+	pthread_mutex_unlock(&q->lock);
+
+	return found;
+}
+
+/* Back to the head of the deque it was taken from, or of an empty one */
+static void push_head(deque *q, unsigned int test)
+{
+	pthread_mutex_lock(&q->lock);
+
+	if (q->head == q->tail)
+		q->head = q->tail = 0;
+
+	if (q->head > 0)
+		q->items[--q->head] = test;
+	else
+		q->items[q->tail++] = test;
+
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* Own tests first, then the shortest test of whoever has the most left */
+static bool take_test(probe *self, unsigned int *test)
+{
+	if (pop_head(&self->queue, test))
+		return true;
+
+	for (;;) {
+		deque *victim = NULL;
+		unsigned int most = 0;
+
+		for (unsigned int p = 0; p < farm.probe_count; p++) {
+			deque *q = &farm.probes[p].queue;
+
+			pthread_mutex_lock(&q->lock);
+			const unsigned int left = q->tail - q->head;
+			pthread_mutex_unlock(&q->lock);
+
+			if (left > most) {
+				most = left;
+				victim = q;
+			}
+		}
+
+		if (victim == NULL)
+			return false;
+
+		// Someone else may have emptied it in between
+		if (pop_tail(victim, test)) {
+			self->stolen++;
+			return true;
+		}
+	}
+}
+
+/* false once no test is left and none can come back */
+static bool next_test(probe *self, unsigned int *test)
+{
+	bool found;
+
+	pthread_mutex_lock(&farm.lock);
+
+	while (!(found = take_test(self, test)) && farm.running > 0)
+		pthread_cond_wait(&farm.changed, &farm.lock);
+
+	if (found)
+		farm.running++;
+
+	pthread_mutex_unlock(&farm.lock);
+
+	return found;
+}
+
+static void test_finished(probe *self, unsigned int test, bool hand_back)
+{
+	pthread_mutex_lock(&farm.lock);
+
+	if (hand_back)
+		push_head(&self->queue, test);
+
+	farm.running--;
+	pthread_cond_broadcast(&farm.changed);
+	pthread_mutex_unlock(&farm.lock);
+}
+
+/*
+ * Workers
+ */
+
+/* false if the probe was lost, the test is left for another one then */
+static bool run_test(probe *self, farm_test *test)
+{
+	const double start = now();
+
+	// Output of an attempt on a probe that was lost
+	free(test->uart);
+	test->uart = NULL;
+	test->uart_len = 0;
+
+	FILE *uart = open_memstream(&test->uart, &test->uart_len);
+
+	test->device = self->index;
+	test->result = uviemon_load(self->ctx, test->path, NULL);
+
+	if (test->result == UVIEMON_OK)
+		test->result = uviemon_run(self->ctx, 0, test->timeout * 1000, uart, &test->run);
+
+	if (test->result != UVIEMON_OK)
+		snprintf(test->error, sizeof(test->error), "%s", uviemon_last_error(self->ctx));
+
+	if (uart != NULL)
+		fclose(uart);
+
+	test->time = now() - start;
+	test->passed = test->result == UVIEMON_OK && !test->run.timeout && test->run.trap == test->expected_trap;
+	test->done = test->result != UVIEMON_ERR_IO;
+
+	pthread_mutex_lock(&farm.print_lock);
+
+	printf("[%u] %s %-32s %8.2f s ", self->index, test->passed ? "PASS" : test->done ? "FAIL" : "LOST",
+	       test->name, test->time);
+
+	if (!test->done)
+		printf("%s, the probe stops and the others take over\n", test->error);
+	else if (test->result != UVIEMON_OK)
+		printf("%s\n", test->error);
+	else if (test->run.timeout)
+		printf("timeout after %u s\n", test->timeout);
+	else
+		printf("trap 0x%02x, %llu cycles\n", test->run.trap, (unsigned long long) test->run.cycles);
+
+	fflush(stdout);
+	pthread_mutex_unlock(&farm.print_lock);
+
+	return test->done;
+}
+
+static void *worker(void *arg)
+{
+	probe *self = arg;
+	unsigned int test;
+
+	while (next_test(self, &test)) {
+		self->lost = !run_test(self, &farm.tests[test]);
+		test_finished(self, test, self->lost);
+
+		if (self->lost)
+			break;
+
+		self->tests++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Reports
+ */
+
+static void json_string(FILE *fp, const char *s, size_t len)
+{
+	fputc('"', fp);
+
+	for (size_t i = 0; i < len; i++) {
+		const unsigned char c = s[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", fp);
+		else if (c < 0x20 || c >= 0x7F)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+
+	fputc('"', fp);
+}
+
+static void write_json(FILE *fp, unsigned int passed, double total)
+{
+	fprintf(fp, "{\n  \"tests\": %u,\n  \"passed\": %u,\n  \"failed\": %u,\n  \"time\": %.3f,\n  \"probes\": [",
+		farm.count, passed, farm.count - passed, total);
+
+	for (unsigned int p = 0; p < farm.probe_count; p++)
+		fprintf(fp, "%s%u", p ? ", " : "", farm.probes[p].index);
+
+	fprintf(fp, "],\n  \"results\": [\n");
+
+	for (unsigned int i = 0; i < farm.count; i++) {
+		const farm_test *t = &farm.tests[i];
+
+		fprintf(fp, "    {\"name\": ");
+		json_string(fp, t->name, strlen(t->name));
+		fprintf(fp, ", \"image\": ");
+		json_string(fp, t->path, strlen(t->path));
+		fprintf(fp, ", \"device\": %u, \"passed\": %s, \"time\": %.3f, \"trap\": %u, \"expected_trap\": %u, "
+			"\"timeout\": %s, \"cycles\": %llu, \"error\": ",
+			t->device, t->passed ? "true" : "false", t->time, t->run.trap, t->expected_trap,
+			t->run.timeout ? "true" : "false", (unsigned long long) t->run.cycles);
+
+		if (t->result != UVIEMON_OK)
+			json_string(fp, t->error, strlen(t->error));
+		else
+			fprintf(fp, "null");
+
+		fprintf(fp, ", \"uart\": ");
+		json_string(fp, t->uart ? t->uart : "", t->uart_len);
+		fprintf(fp, "}%s\n", i + 1 < farm.count ? "," : "");
+	}
+
+	fprintf(fp, "  ]\n}\n");
+}
+
+static void xml_string(FILE *fp, const char *s, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		const unsigned char c = s[i];
+
+		if (c == '<')
+			fputs("&lt;", fp);
+		else if (c == '>')
+			fputs("&gt;", fp);
+		else if (c == '&')
+			fputs("&amp;", fp);
+		else if (c == '"')
+			fputs("&quot;", fp);
+		else if (c < 0x20 && c != '\n' && c != '\t')
+			fprintf(fp, "&#x%x;", 0x2400 + c); // Not allowed in XML 1.0, shown as control pictures
+		else if (c >= 0x7F)
+			fprintf(fp, "&#x%x;", c); // Bytes taken as Latin-1
+		else
+			fputc(c, fp);
+	}
+}
+
+static void write_junit(FILE *fp, unsigned int passed, double total)
+{
+	unsigned int errors = 0;
+
+	for (unsigned int i = 0; i < farm.count; i++)
+		errors += farm.tests[i].result != UVIEMON_OK;
+
+	fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	fprintf(fp, "<testsuite name=\"uviemon\" tests=\"%u\" failures=\"%u\" errors=\"%u\" time=\"%.3f\">\n",
+		farm.count, farm.count - passed - errors, errors, total);
+
+	for (unsigned int i = 0; i < farm.count; i++) {
+		const farm_test *t = &farm.tests[i];
+
+		fprintf(fp, "  <testcase classname=\"uviemon.farm\" name=\"");
+		xml_string(fp, t->name, strlen(t->name));
+		fprintf(fp, "\" time=\"%.3f\">\n", t->time);
+
+		fprintf(fp, "    <properties>\n");
+		fprintf(fp, "      <property name=\"device\" value=\"%u\"/>\n", t->device);
+		fprintf(fp, "      <property name=\"trap\" value=\"0x%02x\"/>\n", t->run.trap);
+		fprintf(fp, "      <property name=\"cycles\" value=\"%llu\"/>\n", (unsigned long long) t->run.cycles);
+		fprintf(fp, "    </properties>\n");
+
+		if (t->result != UVIEMON_OK) {
+			fprintf(fp, "    <error message=\"");
+			xml_string(fp, t->error, strlen(t->error));
+			fprintf(fp, "\"/>\n");
+		} else if (t->run.timeout) {
+			fprintf(fp, "    <failure message=\"Timeout after %u s\"/>\n", t->timeout);
+		} else if (!t->passed) {
+			fprintf(fp, "    <failure message=\"Trap 0x%02x, expected 0x%02x\"/>\n", t->run.trap,
+				t->expected_trap);
+		}
+
+		if (t->uart_len > 0) {
+			fprintf(fp, "    <system-out>");
+			xml_string(fp, t->uart, t->uart_len);
+			fprintf(fp, "</system-out>\n");
+		}
+
+		fprintf(fp, "  </testcase>\n");
+	}
+
+	fprintf(fp, "</testsuite>\n");
+}
+
+static bool write_report(const char *path, unsigned int passed, double total)
+{
+	const size_t len = strlen(path);
+	FILE *fp = fopen(path, "w");
+
+	if (fp == NULL) {
+		perror("Could not create the report");
+		return false;
+	}
+
+	if (len > 4 && strcasecmp(path + len - 4, ".xml") == 0)
+		write_junit(fp, passed, total);
+	else
+		write_json(fp, passed, total);
+
+	return fclose(fp) == 0;
+}
+
+/*
+ * Farm
+ */
+
+static void open_probes(int cpu_type, unsigned int devices)
+{
+	farm.probe_count = 0;
+
+	for (unsigned int i = 0; i < devices && farm.probe_count < FARM_MAX_PROBES; i++) {
+		probe *p = &farm.probes[farm.probe_count];
+
+		*p = (probe) { .index = i };
+
+		if (uviemon_open(i, cpu_type, false, &p->ctx) != UVIEMON_OK) {
+			fprintf(stderr, "Device %u left out: %s\n", i, uviemon_last_error(p->ctx));
+			uviemon_close(p->ctx);
+			continue;
+		}
+
+		farm.probe_count++;
+	}
+}
+
+static void free_farm()
+{
+	for (unsigned int p = 0; p < farm.probe_count; p++) {
+		uviemon_close(farm.probes[p].ctx);
+		free(farm.probes[p].queue.items);
+		pthread_mutex_destroy(&farm.probes[p].queue.lock);
+	}
+
+	for (unsigned int i = 0; farm.tests != NULL && i < farm.count; i++)
+		free(farm.tests[i].uart);
+
+	free(farm.tests);
+	farm.tests = NULL;
+	farm.count = 0;
+	farm.probe_count = 0;
+}
+
+int farm_run(const char *manifest, const char *report, int cpu_type)
+{
+	unsigned int passed = 0;
+
+	if (!read_manifest(manifest)) {
+		free_farm();
+		return 1;
+	}
+
+	const unsigned int devices = uviemon_device_count();
+
+	if (devices == 0) {
+		fprintf(stderr, "No FTDI devices connected\n");
+		free_farm();
+		return 1;
+	}
+
+	open_probes(cpu_type, devices);
+
+	if (farm.probe_count == 0 || !deal_tests()) {
+		fprintf(stderr, "No probe to run the tests on\n");
+		free_farm();
+		return 1;
+	}
+
+	pthread_mutex_init(&farm.print_lock, NULL);
+	pthread_mutex_init(&farm.lock, NULL);
+	pthread_cond_init(&farm.changed, NULL);
+	farm.running = 0;
+	printf("Running %u tests on %u probes...\n\n", farm.count, farm.probe_count);
+	fflush(stdout);
+
+	const double start = now();
+
+	// A probe without a thread leaves its tests to the others
+	bool started[FARM_MAX_PROBES];
+
+	for (unsigned int p = 0; p < farm.probe_count; p++)
+		started[p] = pthread_create(&farm.probes[p].thread, NULL, worker, &farm.probes[p]) == 0;
+
+	for (unsigned int p = 0; p < farm.probe_count; p++) {
+		if (started[p])
+			pthread_join(farm.probes[p].thread, NULL);
+	}
+
+	const double total = now() - start;
+
+	for (unsigned int i = 0; i < farm.count; i++) {
+		// A test handed back by the last probe keeps its I/O error
+		if (!farm.tests[i].done && farm.tests[i].result == UVIEMON_OK) {
+			farm.tests[i].result = UVIEMON_ERR_ARGUMENT;
+			snprintf(farm.tests[i].error, sizeof(farm.tests[i].error), "Not run, no worker left");
+		}
+
+		passed += farm.tests[i].passed;
+	}
+
+	printf("\n");
+
+	for (unsigned int p = 0; p < farm.probe_count; p++)
+		printf("Device %u: %u tests, %u of them stolen%s\n", farm.probes[p].index, farm.probes[p].tests,
+		       farm.probes[p].stolen, farm.probes[p].lost ? ", lost" : "");
+
+	printf("%u of %u tests passed in %.2f s\n", passed, farm.count, total);
+
+	const bool written = report == NULL || write_report(report, passed, total);
+	const int result = passed == farm.count && written ? 0 : 1;
+
+	pthread_mutex_destroy(&farm.print_lock);
+	pthread_mutex_destroy(&farm.lock);
+	pthread_cond_destroy(&farm.changed);
+	free_farm();
+
+	return result;
+}
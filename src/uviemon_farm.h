@@ -0,0 +1,38 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Test farm: the images of a manifest are
+	loaded, run and checked on all connected
+	probes at once. Every probe has a worker
+	thread with a deque of tests, dealt longest
+	first. A worker that runs dry steals from
+	the back of the fullest deque, so another
+	board shortens the whole suite. A worker
+	whose probe fails with an I/O error stops
+	and hands its test back, the other probes
+	run it and the rest of its deque. The
+	results are written as JSON, or JUnit for
+	.xml.
+
+	Manifest lines, # starts a comment:
+
+		<image> [trap=0x80] [timeout=60] [cost=<s>] [name=<name>]
+
+	trap is the expected trap, cost the expected
+	seconds for the order, the timeout if not
+	given.
+	============================================
+*/
+
+#ifndef UVIEMON_FARM_H
+#define UVIEMON_FARM_H
+
+#define FARM_MAX_PROBES 15	// FTDI_MAX_DEVICES less the built in device
+#define FARM_MAX_TESTS 4096
+#define FARM_DEFAULT_TIMEOUT 60	// s
+
+// Returns the exit code, 0 if every test passed
+int farm_run(const char *manifest, const char *report, int cpu_type);
+
+#endif /* UVIEMON_FARM_H */
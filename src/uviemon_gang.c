@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include "uviemon_gang.h"
+
+#include "libuviemon.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef struct {
+	unsigned int index;	// Of the FTDI device
+	uviemon_context *ctx;
+	const uviemon_image *image;
+	bool load;
+	pthread_t thread;
+
+	int result;
+	double load_time;
+	double verify_time;
+	uint64_t first_error;
+} board;
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double throughput(uint64_t bytes, double seconds)
+{
+	return seconds > 0 ? bytes / seconds / (1024 * 1024) : 0;
+}
+
+/* Duplicates are dropped, returns the number of devices or 0 if the list is bad */
+static unsigned int parse_devices(const char *list, board *boards)
+{
+	unsigned int count = 0;
+	const char *s = list;
+
+	while (*s) {
+		char *end;
+		const unsigned long index = strtoul(s, &end, 10);
+
+		if (end == s || (*end != ',' && *end != '\0') || count == GANG_MAX_DEVICES)
+			return 0;
+
+		bool known = false;
+
+		for (unsigned int i = 0; i < count; i++)
+			known |= boards[i].index == index;
+
+		if (!known)
+			boards[count++] = (board) { .index = index };
+
+		s = *end ? end + 1 : end;
+	}
+
+	return count;
+}
+
+static void *worker(void *arg)
+{
+	board *b = arg;
+	double start = now();
+
+	if (b->load) {
+		b->result = uviemon_load_image(b->ctx, b->image);
+		b->load_time = now() - start;
+		start = now();
+	}
+
+	if (b->result == UVIEMON_OK) {
+		b->result = uviemon_verify_image(b->ctx, b->image, &b->first_error);
+		b->verify_time = now() - start;
+	}
+
+	return NULL;
+}
+
+static void print_boards(const board *boards, unsigned int count, uint64_t size)
+{
+	printf("\nDevice  Load                     Verify                   Result\n");
+
+	for (unsigned int i = 0; i < count; i++) {
+		const board *b = &boards[i];
+
+		printf("%-6u  ", b->index);
+
+		if (b->load_time > 0)
+			printf("%7.2f s %7.2f MiB/s  ", b->load_time, throughput(size, b->load_time));
+		else
+			printf("%-25s", "-");
+
+		if (b->verify_time > 0)
+			printf("%7.2f s %7.2f MiB/s  ", b->verify_time, throughput(size, b->verify_time));
+		else
+			printf("%-25s", "-");
+
+		if (b->result == UVIEMON_OK)
+			printf("OK\n");
+		else if (b->ctx != NULL)
+			printf("%s\n", uviemon_last_error(b->ctx));
+		else
+			printf("%s\n", uviemon_strerror(b->result));
+	}
+}
+
+int gang_run(const char *devices, int cpu_type, bool load, const char *path)
+{
+	board boards[GANG_MAX_DEVICES];
+	uviemon_image *image = NULL;
+	uviemon_context *first = NULL;
+	unsigned int ok = 0;
+
+	const unsigned int count = parse_devices(devices, boards);
+
+	if (count == 0) {
+		fprintf(stderr, "Devices must be a list like 0,1,2,3 of at most %d\n", GANG_MAX_DEVICES);
+		return 1;
+	}
+
+	// One after the other, opening is short next to the load
+	for (unsigned int i = 0; i < count; i++) {
+		board *b = &boards[i];
+
+		b->result = uviemon_open(b->index, cpu_type, false, &b->ctx);
+
+		if (b->result != UVIEMON_OK) {
+			fprintf(stderr, "Device %u: %s\n", b->index, uviemon_last_error(b->ctx));
+			continue;
+		}
+
+		if (first == NULL)
+			first = b->ctx;
+	}
+
+	if (first == NULL) {
+		fprintf(stderr, "None of the devices could be opened\n");
+	} else if (uviemon_image_prepare(first, path, &image) != UVIEMON_OK) {
+		fprintf(stderr, "%s\n", uviemon_last_error(first));
+	} else {
+		const uint64_t size = uviemon_image_size(image);
+
+		printf("%s %llu bytes of '%s' on %u boards...\n", load ? "Loading" : "Verifying",
+		       (unsigned long long) size, path, count);
+		fflush(stdout);
+
+		const double start = now();
+
+		for (unsigned int i = 0; i < count; i++) {
+			board *b = &boards[i];
+
+			if (b->result != UVIEMON_OK)
+				continue;
+
+			b->image = image;
+			b->load = load;
+
+			if (pthread_create(&b->thread, NULL, worker, b) != 0) {
+				fprintf(stderr, "Device %u: could not start a thread\n", b->index);
+				b->result = UVIEMON_ERR_MEMORY;
+				b->image = NULL; // Not joined
+			}
+		}
+
+		for (unsigned int i = 0; i < count; i++) {
+			if (boards[i].image != NULL)
+				pthread_join(boards[i].thread, NULL);
+		}
+
+		const double total = now() - start;
+
+		print_boards(boards, count, size);
+
+		for (unsigned int i = 0; i < count; i++)
+			ok += boards[i].result == UVIEMON_OK;
+
+		printf("\n%u of %u boards OK in %.2f s, %.2f MiB/s together\n", ok, count, total,
+		       throughput(size * ok, total));
+	}
+
+	uviemon_image_free(image);
+
+	for (unsigned int i = 0; i < count; i++)
+		uviemon_close(boards[i].ctx);
+
+	return ok == count ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Gang programming: the same image is loaded
+	onto several boards at once, one thread per
+	probe. The image is read and encoded only
+	once and shared by all threads. Each board
+	is verified after its load, the time and
+	throughput of every board are reported.
+	============================================
+*/
+
+#ifndef UVIEMON_GANG_H
+#define UVIEMON_GANG_H
+
+#include <stdbool.h>
+
+#define GANG_MAX_DEVICES 15	// FTDI_MAX_DEVICES less the built in device
+
+// devices is a list of device indices like 0,1,2,3. Without load the boards are only verified.
+// Returns the exit code, 0 if every board was programmed.
+int gang_run(const char *devices, int cpu_type, bool load, const char *path);
+
+#endif /* UVIEMON_GANG_H */
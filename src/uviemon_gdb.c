@@ -0,0 +1,753 @@
+#define _POSIX_C_SOURCE 200809L // select
+
+#include "uviemon_gdb.h"
+
+#include "address_map.h"
+#include "leon3_dsu.h"
+#include "uviemon_break.h"
+#include "uviemon_step.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define PACKET_SIZE 0x4000		// Advertised to gdb
+#define CACHE_BLOCK 1024		// Bytes of one SEQ burst
+#define CACHE_BLOCKS 256		// Direct mapped
+#define CACHE_FILL_MAX (PACKET_SIZE / 2 / CACHE_BLOCK + 2)
+#define CACHE_LIMIT 0x80000000		// Memory below, peripherals above are never cached
+
+// gdb's SPARC registers: %g0 - %i7, %f0 - %f31, then %y up to %csr in the order of the DSU
+#define REG_COUNT 72
+#define REG_FPU 32
+#define REG_SPECIAL 64
+#define REG_PSR 65
+#define REG_PC 68
+#define REG_NPC 69
+#define REG_SP 14
+#define SPECIAL_WORDS (REG_COUNT - REG_SPECIAL)
+#define PSR_CWP 0x1f
+
+#define INTERRUPT 0x03
+
+typedef struct {
+	DWORD addr;
+	bool valid;
+	BYTE data[CACHE_BLOCK];
+} cache_block;
+
+static struct {
+	int fd;
+	bool no_ack;
+	bool kill;		// 'k' ends the server
+	DWORD cpu;
+	int signal;		// Of the last stop
+
+	bool regs_valid;
+	DWORD regs[REG_COUNT];
+	cache_block cache[CACHE_BLOCKS];
+
+	BYTE in[PACKET_SIZE];	// Received but not parsed yet
+	size_t in_len;
+	size_t in_pos;
+} gdb;
+
+static char packet[PACKET_SIZE + 1];
+static char reply[PACKET_SIZE + 1];
+
+static int hex_value(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+static DWORD parse_hex(const char **p)
+{
+	DWORD value = 0;
+	int digit;
+
+	while ((digit = hex_value(**p)) >= 0) {
+		value = value << 4 | digit;
+		(*p)++;
+	}
+
+	return value;
+}
+
+static void put_hex(char *out, const BYTE *data, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < len; i++) {
+		out[i * 2] = digits[data[i] >> 4];
+		out[i * 2 + 1] = digits[data[i] & 0xf];
+	}
+
+	out[len * 2] = '\0';
+}
+
+static int read_byte()
+{
+	if (gdb.in_pos == gdb.in_len) {
+		const ssize_t n = recv(gdb.fd, gdb.in, sizeof(gdb.in), 0);
+
+		if (n <= 0)
+			return -1;
+
+		gdb.in_len = n;
+		gdb.in_pos = 0;
+	}
+
+	return gdb.in[gdb.in_pos++];
+}
+
+static bool send_all(const char *data, size_t len)
+{
+	while (len > 0) {
+		const ssize_t n = send(gdb.fd, data, len, 0);
+
+		if (n <= 0)
+			return false;
+
+		data += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+/* Acks and interrupts between packets are skipped, a bad checksum is nacked */
+static bool get_packet(size_t *len)
+{
+	for (;;) {
+		BYTE sum = 0;
+		size_t n = 0;
+		int c;
+
+		while ((c = read_byte()) != '$') {
+			if (c < 0)
+				return false;
+		}
+
+		while ((c = read_byte()) >= 0 && c != '#') {
+			if (n < PACKET_SIZE)
+				packet[n++] = c;
+			sum += c;
+		}
+
+		const int high = read_byte();
+		const int low = read_byte();
+
+		if (c < 0 || low < 0)
+			return false;
+
+		packet[n] = '\0';
+		*len = n;
+
+		if (gdb.no_ack)
+			return true;
+
+		if (hex_value(high) * 16 + hex_value(low) == sum)
+			return send_all("+", 1);
+
+		if (!send_all("-", 1))
+			return false;
+	}
+}
+
+static bool put_packet(const char *data)
+{
+	static char frame[PACKET_SIZE + 5];
+	const size_t len = strlen(data);
+	BYTE sum = 0;
+	int c;
+
+	for (size_t i = 0; i < len; i++)
+		sum += data[i];
+
+	frame[0] = '$';
+	memcpy(&frame[1], data, len);
+	snprintf(&frame[len + 1], 4, "#%02x", sum);
+
+	do {
+		if (!send_all(frame, len + 4))
+			return false;
+
+		if (gdb.no_ack)
+			return true;
+	} while ((c = read_byte()) == '-');
+
+	return c >= 0;
+}
+
+/*
+ * Registers, cache
+ */
+
+static void invalidate()
+{
+	gdb.regs_valid = false;
+
+	for (unsigned int i = 0; i < CACHE_BLOCKS; i++)
+		gdb.cache[i].valid = false;
+}
+
+/* Special registers, the whole register file and the FPU in one transaction */
+static bool read_registers()
+{
+	DWORD data[SPECIAL_WORDS + DSU_IU_REG_WORDS + REG_FPU];
+	ftdi_batch batch;
+
+	ftdi_batch_init(&batch);
+
+	const DWORD special = ftdi_batch_read32_seq(&batch, DSU_BASE(gdb.cpu) + DSU_REG_Y, SPECIAL_WORDS);
+	const DWORD iu = ftdi_batch_read32_seq(&batch, DSU_BASE(gdb.cpu) + DSU_IU_REG, DSU_IU_REG_WORDS);
+	const DWORD fpu = ftdi_batch_read32_seq(&batch, DSU_BASE(gdb.cpu) + DSU_FPU_REG, REG_FPU);
+
+	const bool ok = ftdi_batch_transfer(&batch, data) == FT_OK;
+
+	ftdi_batch_free(&batch);
+
+	if (!ok)
+		return false;
+
+	const DWORD cwp = data[special + REG_PSR - REG_SPECIAL] & PSR_CWP;
+
+	for (unsigned int i = 0; i < 8; i++) {
+		gdb.regs[i] = i ? data[iu + DSU_IU_GLOBAL + i] : 0;
+		gdb.regs[8 + i] = data[iu + DSU_IU_OUT(cwp) + i];
+		gdb.regs[16 + i] = data[iu + DSU_IU_LOCAL(cwp) + i];
+		gdb.regs[24 + i] = data[iu + DSU_IU_IN(cwp) + i];
+	}
+
+	memcpy(&gdb.regs[REG_FPU], &data[fpu], REG_FPU * sizeof(DWORD));
+	memcpy(&gdb.regs[REG_SPECIAL], &data[special], SPECIAL_WORDS * sizeof(DWORD));
+	gdb.regs_valid = true;
+
+	return true;
+}
+
+/* DSU address of register n, the window registers depend on the CWP in psr */
+static DWORD reg_address(unsigned int n, DWORD psr)
+{
+	const DWORD iu = DSU_BASE(gdb.cpu) + DSU_IU_REG;
+	const DWORD cwp = psr & PSR_CWP;
+
+	if (n < 8)
+		return iu + (DSU_IU_GLOBAL + n) * 4;
+	if (n < 16)
+		return iu + (DSU_IU_OUT(cwp) + n - 8) * 4;
+	if (n < 24)
+		return iu + (DSU_IU_LOCAL(cwp) + n - 16) * 4;
+	if (n < 32)
+		return iu + (DSU_IU_IN(cwp) + n - 24) * 4;
+	if (n < REG_SPECIAL)
+		return DSU_BASE(gdb.cpu) + DSU_FPU_REG + (n - REG_FPU) * 4;
+
+	return DSU_BASE(gdb.cpu) + DSU_REG_Y + (n - REG_SPECIAL) * 4;
+}
+
+/* Only the registers that changed are written, all in one USB write */
+static bool write_registers(const DWORD *regs)
+{
+	ftdi_batch batch;
+
+	ftdi_batch_init(&batch);
+
+	for (unsigned int n = 1; n < REG_COUNT; n++) {
+		if (regs[n] != gdb.regs[n])
+			ftdi_batch_write32(&batch, reg_address(n, regs[REG_PSR]), regs[n]);
+	}
+
+	const bool ok = batch.len == 0 || ftdi_batch_send(&batch) == FT_OK;
+
+	ftdi_batch_free(&batch);
+
+	if (ok)
+		memcpy(gdb.regs, regs, sizeof(gdb.regs));
+
+	return ok;
+}
+
+static cache_block *cache_slot(DWORD block)
+{
+	return &gdb.cache[(block / CACHE_BLOCK) % CACHE_BLOCKS];
+}
+
+/* Missing blocks are read in one transaction, one SEQ burst each */
+static bool cache_fill(const DWORD *blocks, unsigned int count)
+{
+	static DWORD data[CACHE_FILL_MAX * CACHE_BLOCK / 4];
+	DWORD index[CACHE_FILL_MAX];
+	DWORD missing[CACHE_FILL_MAX];
+	unsigned int n = 0;
+	ftdi_batch batch;
+
+	ftdi_batch_init(&batch);
+
+	for (unsigned int i = 0; i < count && n < CACHE_FILL_MAX; i++) {
+		const cache_block *slot = cache_slot(blocks[i]);
+
+		if (blocks[i] >= CACHE_LIMIT || (slot->valid && slot->addr == blocks[i]))
+			continue;
+
+		missing[n] = blocks[i];
+		index[n++] = ftdi_batch_read32_seq(&batch, blocks[i], CACHE_BLOCK / 4);
+	}
+
+	const bool ok = n == 0 || ftdi_batch_transfer(&batch, data) == FT_OK;
+
+	ftdi_batch_free(&batch);
+
+	for (unsigned int i = 0; ok && i < n; i++) {
+		cache_block *slot = cache_slot(missing[i]);
+
+		// Memory is big endian
+		for (DWORD w = 0; w < CACHE_BLOCK / 4; w++) {
+			const DWORD word = data[index[i] + w];
+
+			slot->data[w * 4] = word >> 24;
+			slot->data[w * 4 + 1] = word >> 16;
+			slot->data[w * 4 + 2] = word >> 8;
+			slot->data[w * 4 + 3] = word;
+		}
+
+		slot->addr = missing[i];
+		slot->valid = true;
+	}
+
+	return ok;
+}
+
+static bool read_memory(DWORD addr, BYTE *data, DWORD len)
+{
+	DWORD blocks[CACHE_FILL_MAX];
+	unsigned int count = 0;
+
+	if (len == 0)
+		return true;
+
+	if (addr >= CACHE_LIMIT || addr + len > CACHE_LIMIT || addr + len < addr)
+		return ioread8_buffer(addr, data, len);
+
+	for (DWORD block = addr & ~(CACHE_BLOCK - 1); block < addr + len && count < CACHE_FILL_MAX; block += CACHE_BLOCK)
+		blocks[count++] = block;
+
+	if (!cache_fill(blocks, count))
+		return false;
+
+	for (DWORD i = 0; i < len; i++) {
+		const cache_block *slot = cache_slot((addr + i) & ~(CACHE_BLOCK - 1));
+
+		data[i] = slot->data[(addr + i) & (CACHE_BLOCK - 1)];
+	}
+
+	return true;
+}
+
+static bool write_memory(DWORD addr, const BYTE *data, DWORD len)
+{
+	if (len > 0 && !iowrite8_buffer(addr, data, len))
+		return false;
+
+	for (DWORD i = 0; i < len; i++) {
+		cache_block *slot = cache_slot((addr + i) & ~(CACHE_BLOCK - 1));
+
+		if (slot->valid && slot->addr == ((addr + i) & ~(CACHE_BLOCK - 1)))
+			slot->data[(addr + i) & (CACHE_BLOCK - 1)] = data[i];
+	}
+
+	step_invalidate_inst_cache();
+
+	return true;
+}
+
+/* gdb reads the registers, the code around %pc and the frame at %sp after every stop */
+static void prefetch()
+{
+	if (!read_registers())
+		return;
+
+	const DWORD pc = gdb.regs[REG_PC] & ~(CACHE_BLOCK - 1);
+	const DWORD sp = gdb.regs[REG_SP] & ~(CACHE_BLOCK - 1);
+	const DWORD blocks[3] = { pc, sp, sp + CACHE_BLOCK };
+
+	cache_fill(blocks, sp == pc ? 1 : 3);
+}
+
+/*
+ * Run control
+ */
+
+static void keep_record(const step_record *record, void *arg)
+{
+	*(step_record *) arg = *record;
+}
+
+/* Waits at most wait_us for gdb, true if it interrupted or went away */
+static bool interrupted(unsigned int wait_us)
+{
+	struct timeval timeout = { wait_us / 1000000, wait_us % 1000000 };
+	fd_set fds;
+
+	if (gdb.in_pos == gdb.in_len) {
+		FD_ZERO(&fds);
+		FD_SET(gdb.fd, &fds);
+
+		if (select(gdb.fd + 1, &fds, NULL, NULL, &timeout) <= 0)
+			return false;
+	}
+
+	const int c = read_byte();
+
+	return c == INTERRUPT || c < 0;
+}
+
+/* Continue or step, the reply is the stop reason */
+static void resume(bool step)
+{
+	BYTE traps[DSU_NCPUS];
+	bool stopped = false;
+	unsigned int wait_us;
+
+	invalidate();
+
+	if (step) {
+		step_record record;
+
+		gdb.signal = step_cpu(gdb.cpu, 1, keep_record, &record) == 1 ?
+			     dsu_get_trap_signal(record.trap, 0) : DSU_SIGSEGV;
+		snprintf(reply, sizeof(reply), "S%02x", gdb.signal);
+		prefetch();
+		return;
+	}
+
+	if (!runCPU_resume(1 << gdb.cpu)) {
+		snprintf(reply, sizeof(reply), "E01");
+		return;
+	}
+
+	enum ftdi_run_state state;
+
+	while ((state = runCPU_poll(&wait_us)) == FTDI_RUN_ACTIVE) {
+		if (!stopped && interrupted(wait_us)) {
+			runCPU_stop();
+			stopped = true;
+		}
+	}
+
+	if (state == FTDI_RUN_FAILED) {
+		snprintf(reply, sizeof(reply), "E01");
+		return;
+	}
+
+	runCPU_finish(traps);
+
+	DWORD addr;
+
+	if (stopped) {
+		gdb.signal = DSU_SIGINT;
+	} else if (break_hit(gdb.cpu, &addr)) {
+		gdb.signal = DSU_SIGTRAP;
+	} else if (traps[gdb.cpu] == 0x80) {
+		// ta 0, the program ended
+		gdb.signal = DSU_SIGTRAP;
+		snprintf(reply, sizeof(reply), "W00");
+		prefetch();
+		return;
+	} else {
+		gdb.signal = dsu_get_trap_signal(traps[gdb.cpu] << 4, 0);
+	}
+
+	snprintf(reply, sizeof(reply), "S%02x", gdb.signal);
+	prefetch();
+}
+
+/* Z and z: type 0 software, 1 hardware breakpoint, 2 write, 3 read, 4 access watchpoint */
+static void breakpoint(bool insert, const char *args)
+{
+	static const enum break_type types[] = { BREAK_EXEC, BREAK_EXEC, BREAK_WRITE, BREAK_READ, BREAK_ACCESS };
+	const DWORD type = parse_hex(&args);
+
+	if (type > 4 || *args++ != ',') {
+		reply[0] = '\0';
+		return;
+	}
+
+	const DWORD addr = parse_hex(&args);
+	const DWORD kind = *args == ',' ? (args++, parse_hex(&args)) : 4;
+	const int number = break_find(types[type], addr);
+	bool ok = true;
+
+	if (insert && !number)
+		ok = break_add(types[type], addr, type < 2 ? 4 : kind, type == 0) != 0;
+	else if (!insert && number)
+		ok = break_delete(number);
+
+	snprintf(reply, sizeof(reply), ok ? "OK" : "E01");
+}
+
+static void memory_map(const char *args)
+{
+	const DWORD ram = ADDRESSES[ftdi_get_connected_cpu_type()][SDRAM_START_ADDRESS];
+	char xml[512];
+
+	// The PROM is read only for gdb, RAM and the peripherals above it are not
+	snprintf(xml, sizeof(xml),
+		 "<?xml version=\"1.0\"?>"
+		 "<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\""
+		 " \"http://sourceware.org/gdb/gdb-memory-map.dtd\">"
+		 "<memory-map>"
+		 "<memory type=\"rom\" start=\"0x0\" length=\"0x%x\"/>"
+		 "<memory type=\"ram\" start=\"0x%x\" length=\"0x%x\"/>"
+		 "</memory-map>", ram, ram, 0 - ram);
+
+	const DWORD offset = parse_hex(&args);
+	const DWORD length = *args == ',' ? (args++, parse_hex(&args)) : 0;
+	const size_t size = strlen(xml);
+
+	if (offset >= size) {
+		snprintf(reply, sizeof(reply), "l");
+		return;
+	}
+
+	const size_t n = size - offset < length ? size - offset : length;
+
+	snprintf(reply, sizeof(reply), "%c%.*s", offset + n < size ? 'm' : 'l', (int) n, xml + offset);
+}
+
+static void query(const char *query)
+{
+	if (strncmp(query, "Supported", 9) == 0)
+		snprintf(reply, sizeof(reply), "PacketSize=%x;qXfer:memory-map:read+;QStartNoAckMode+;swbreak+;hwbreak+",
+			 PACKET_SIZE);
+	else if (strncmp(query, "Xfer:memory-map:read::", 22) == 0)
+		memory_map(query + 22);
+	else if (strcmp(query, "Attached") == 0)
+		snprintf(reply, sizeof(reply), "1");
+	else if (strcmp(query, "C") == 0)
+		snprintf(reply, sizeof(reply), "QC1");
+	else if (strcmp(query, "fThreadInfo") == 0)
+		snprintf(reply, sizeof(reply), "m1");
+	else if (strcmp(query, "sThreadInfo") == 0)
+		snprintf(reply, sizeof(reply), "l");
+	else if (strcmp(query, "Symbol::") == 0)
+		snprintf(reply, sizeof(reply), "OK");
+}
+
+/* Unescapes X packet data in place, returns its length */
+static size_t binary_data(char *data, size_t len)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < len; i++)
+		data[n++] = data[i] == 0x7d && i + 1 < len ? data[++i] ^ 0x20 : data[i];
+
+	return n;
+}
+
+/* Returns false once the session ends */
+static bool handle_packet(size_t len)
+{
+	const char *args = packet + 1;
+	static BYTE buffer[PACKET_SIZE];
+	DWORD regs[REG_COUNT];
+	DWORD addr, n;
+
+	reply[0] = '\0';
+
+	if (strchr("gGpP", packet[0]) && !gdb.regs_valid && !read_registers()) {
+		snprintf(reply, sizeof(reply), "E01");
+		return put_packet(reply);
+	}
+
+	switch (packet[0]) {
+	case '?':
+		snprintf(reply, sizeof(reply), "S%02x", gdb.signal);
+		break;
+	case 'g':
+		for (n = 0; n < REG_COUNT; n++)
+			snprintf(&reply[n * 8], 9, "%08x", gdb.regs[n]);
+		break;
+	case 'G':
+		for (n = 0; n < REG_COUNT && strlen(args) >= 8; n++, args += 8) {
+			char word[9] = { 0 };
+			const char *p = word;
+
+			memcpy(word, args, 8);
+			regs[n] = parse_hex(&p);
+		}
+
+		snprintf(reply, sizeof(reply), n == REG_COUNT && write_registers(regs) ? "OK" : "E01");
+		break;
+	case 'p':
+		n = parse_hex(&args);
+		if (n < REG_COUNT)
+			snprintf(reply, sizeof(reply), "%08x", gdb.regs[n]);
+		else
+			snprintf(reply, sizeof(reply), "E01");
+		break;
+	case 'P':
+		n = parse_hex(&args);
+		memcpy(regs, gdb.regs, sizeof(regs));
+		if (n < REG_COUNT && *args++ == '=') {
+			regs[n] = parse_hex(&args);
+			snprintf(reply, sizeof(reply), write_registers(regs) ? "OK" : "E01");
+		} else {
+			snprintf(reply, sizeof(reply), "E01");
+		}
+		break;
+	case 'm':
+		addr = parse_hex(&args);
+		n = *args == ',' ? (args++, parse_hex(&args)) : 0;
+		if (n > PACKET_SIZE / 2)
+			n = PACKET_SIZE / 2;
+
+		if (read_memory(addr, buffer, n))
+			put_hex(reply, buffer, n);
+		else
+			snprintf(reply, sizeof(reply), "E01");
+		break;
+	case 'M':
+	case 'X':
+		addr = parse_hex(&args);
+		n = *args == ',' ? (args++, parse_hex(&args)) : 0;
+
+		if (*args++ != ':' || n > PACKET_SIZE) {
+			snprintf(reply, sizeof(reply), "E01");
+			break;
+		}
+
+		// The data has to be all there, gdb never sends less than it announced
+		const size_t data_len = len - (args - packet);
+		bool complete;
+
+		if (packet[0] == 'X') {
+			complete = binary_data(packet + (args - packet), data_len) >= n;
+			memcpy(buffer, args, complete ? n : 0);
+		} else {
+			complete = data_len >= 2 * (size_t) n;
+
+			for (DWORD i = 0; complete && i < n; i++) {
+				const int high = hex_value(args[i * 2]);
+				const int low = hex_value(args[i * 2 + 1]);
+
+				complete = high >= 0 && low >= 0;
+				buffer[i] = high << 4 | low;
+			}
+		}
+
+		snprintf(reply, sizeof(reply), complete && write_memory(addr, buffer, n) ? "OK" : "E01");
+		break;
+	case 'c':
+	case 's':
+		if (*args) {
+			// Continue at an address
+			if (!gdb.regs_valid)
+				read_registers();
+			memcpy(regs, gdb.regs, sizeof(regs));
+			regs[REG_PC] = parse_hex(&args);
+			regs[REG_NPC] = regs[REG_PC] + 4;
+			write_registers(regs);
+		}
+
+		resume(packet[0] == 's');
+		break;
+	case 'Z':
+	case 'z':
+		breakpoint(packet[0] == 'Z', args);
+		break;
+	case 'q':
+		query(args);
+		break;
+	case 'Q':
+		if (strcmp(args, "StartNoAckMode") == 0) {
+			put_packet("OK");
+			gdb.no_ack = true;
+			return true;
+		}
+		break;
+	case 'H':
+	case 'T':
+		snprintf(reply, sizeof(reply), "OK");
+		break;
+	case 'D':
+		put_packet("OK");
+		return false;
+	case 'k':
+		gdb.kill = true;
+		return false;
+	}
+
+	return put_packet(reply);
+}
+
+static void session()
+{
+	size_t len;
+
+	gdb.no_ack = false;
+	gdb.in_len = gdb.in_pos = 0;
+	gdb.signal = DSU_SIGTRAP;
+
+	// The core stops while gdb is attached
+	dsu_halt_cpus(1 << gdb.cpu);
+	invalidate();
+	prefetch();
+
+	while (get_packet(&len) && handle_packet(len))
+		;
+}
+
+bool gdb_serve(int port)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+				    .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	const int on = 1;
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+	    || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listener, 1) < 0) {
+		perror("Could not listen for gdb");
+		if (listener >= 0)
+			close(listener);
+		return false;
+	}
+
+	gdb.cpu = ftdi_get_active_cpu();
+	gdb.kill = false;
+
+	while (!gdb.kill) {
+		printf("Waiting for gdb on port %d of localhost for cpu %d, 'target extended-remote :%d'\n",
+		       port, gdb.cpu, port);
+
+		if ((gdb.fd = accept(listener, NULL, NULL)) < 0) {
+			perror("Could not accept gdb");
+			break;
+		}
+
+		setsockopt(gdb.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		printf("gdb connected\n");
+
+		session();
+
+		close(gdb.fd);
+		printf("gdb disconnected\n");
+	}
+
+	close(listener);
+
+	return true;
+}
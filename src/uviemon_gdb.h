@@ -0,0 +1,25 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	GDB remote serial protocol server on a
+	localhost TCP port. The registers of the
+	stopped core are read in one transaction,
+	memory in blocks of one SEQ burst (1 KiB)
+	that are cached until the core runs again.
+	The blocks around %pc and %sp are fetched
+	right after every stop, before gdb asks.
+	============================================
+*/
+
+#ifndef UVIEMON_GDB_H
+#define UVIEMON_GDB_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+
+// Serves one gdb after the other on the active cpu until one sends 'k'
+bool gdb_serve(int port);
+
+#endif /* UVIEMON_GDB_H */
@@ -0,0 +1,470 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include "uviemon_profile.h"
+
+#include "leon3_dsu.h"
+#include "uviemon_elf.h"
+#include "uviemon_run.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_WORDS (DSU_INST_TRCE_BUF_LINES * DSU_INST_TRCE_BUF_LINE_SIZE / 4)
+#define TIMETAG_MASK 0x3fffffff
+#define LINE_MULTI_CYCLE 0x40000000	// Continuation line of the instruction before
+#define LINE_TRAP 0x2			// The instruction trapped
+
+#define TABLE_INITIAL 1024		// Entries of a hash table, grows at half load
+
+typedef struct {
+	DWORD key[PROFILE_MAX_DEPTH];	// PC, or the frames of a stack
+	unsigned int depth;		// 0 for a free entry
+	DWORD count;
+} profile_entry;
+
+typedef struct {
+	profile_entry *entries;
+	size_t size;
+	size_t used;
+} profile_table;
+
+typedef struct {
+	DWORD timetag;
+	DWORD pc;
+	DWORD inst;
+	bool trap;
+} trace_line;
+
+static struct {
+	elf_symbols syms;
+	bool have_syms;
+
+	profile_table pcs;		// Flat profile, depth 1
+	profile_table stacks;		// Folded stacks
+	profile_table cycles;		// Cycles by function, from the trace of stopped cores
+	uint64_t traced_cycles;
+	DWORD snapshots;
+	DWORD instructions;
+	DWORD errors;
+
+	DWORD cpu;
+	ftdi_batch batch;		// Built once, transferred for every snapshot
+	DWORD data[TRACE_WORDS + 1];
+	DWORD last;			// Timetag of the newest instruction seen
+	bool primed;			// The first snapshot only sets last
+} profile;
+
+static size_t hash(const DWORD *key, unsigned int depth)
+{
+	size_t h = 2166136261u;
+
+	for (unsigned int i = 0; i < depth; i++)
+		h = (h ^ key[i]) * 16777619u;
+
+	return h;
+}
+
+static void table_free(profile_table *table)
+{
+	free(table->entries);
+	memset(table, 0, sizeof(*table));
+}
+
+static void table_add(profile_table *table, const DWORD *key, unsigned int depth, DWORD count);
+
+static void table_grow(profile_table *table)
+{
+	profile_table grown = { calloc(table->size ? table->size * 2 : TABLE_INITIAL, sizeof(profile_entry)),
+				table->size ? table->size * 2 : TABLE_INITIAL, 0 };
+
+	for (size_t i = 0; i < table->size; i++) {
+		if (table->entries[i].depth)
+			table_add(&grown, table->entries[i].key, table->entries[i].depth, table->entries[i].count);
+	}
+
+	free(table->entries);
+	*table = grown;
+}
+
+static void table_add(profile_table *table, const DWORD *key, unsigned int depth, DWORD count)
+{
+	if (table->used * 2 >= table->size)
+		table_grow(table);
+
+	size_t i = hash(key, depth) & (table->size - 1);
+
+	while (table->entries[i].depth) {
+		profile_entry *entry = &table->entries[i];
+
+		if (entry->depth == depth && memcmp(entry->key, key, depth * sizeof(DWORD)) == 0) {
+			entry->count += count;
+			return;
+		}
+
+		i = (i + 1) & (table->size - 1);
+	}
+
+	memcpy(table->entries[i].key, key, depth * sizeof(DWORD));
+	table->entries[i].depth = depth;
+	table->entries[i].count = count;
+	table->used++;
+}
+
+bool profile_load_symbols(const char *path)
+{
+	elf_symbols syms;
+
+	if (!elf_load_symbols(path, &syms))
+		return false;
+
+	if (profile.have_syms)
+		elf_free_symbols(&profile.syms);
+
+	profile.syms = syms;
+	profile.have_syms = true;
+
+	return true;
+}
+
+/* Start of the function containing pc, 0 if unknown */
+static DWORD function_of(DWORD pc)
+{
+	const elf_symbol *sym = profile.have_syms ? elf_find_address(&profile.syms, pc) : NULL;
+
+	return sym ? sym->value : 0;
+}
+
+static bool is_call(DWORD inst)
+{
+	const DWORD op3 = (inst >> 19) & 0x3f;
+
+	return inst >> 30 == 1 || (inst >> 30 == 2 && op3 == 0x38 && ((inst >> 25) & 0x1f) == 15);
+}
+
+/* ret, retl or rett */
+static bool is_return(DWORD inst)
+{
+	const DWORD op3 = (inst >> 19) & 0x3f;
+	const DWORD rs1 = (inst >> 14) & 0x1f;
+
+	if (inst >> 30 != 2)
+		return false;
+
+	return op3 == 0x39 || (op3 == 0x38 && ((inst >> 25) & 0x1f) == 0 && (rs1 == 15 || rs1 == 31));
+}
+
+static int compare_lines(const void *a, const void *b)
+{
+	const DWORD base = profile.last;
+	const DWORD ta = (((const trace_line *) a)->timetag - base) & TIMETAG_MASK;
+	const DWORD tb = (((const trace_line *) b)->timetag - base) & TIMETAG_MASK;
+
+	return ta < tb ? -1 : ta > tb;
+}
+
+/*
+ * Count the instructions of one snapshot in the order they were executed. The
+ * stack is rebuilt along the way: a call or trap pushes the frame it lands
+ * in after its delay slot, a return pops, and with symbols a jump into
+ * another function replaces the current frame.
+ */
+static void count_lines(const trace_line *lines, unsigned int count)
+{
+	DWORD frames[PROFILE_MAX_DEPTH];
+	unsigned int depth = 0;
+	unsigned int pending = 0;	// Lines until a call or return takes effect
+	int direction = 0;		// +1 call, -1 return
+
+	for (unsigned int i = 0; i < count; i++) {
+		const DWORD pc = lines[i].pc;
+		const DWORD func = function_of(pc);
+
+		if (pending && --pending == 0) {
+			if (direction > 0 && depth < PROFILE_MAX_DEPTH)
+				frames[depth++] = func ? func : pc;
+			else if (direction < 0 && depth > 1)
+				depth--;
+			else if (depth > 0)
+				frames[depth - 1] = func ? func : pc;
+		}
+
+		if (depth == 0)
+			frames[depth++] = func ? func : pc;
+		else if (func && func != frames[depth - 1] && !pending)
+			frames[depth - 1] = func;
+
+		table_add(&profile.pcs, &pc, 1, 1);
+		table_add(&profile.stacks, frames, depth, 1);
+
+		if (lines[i].trap) {
+			pending = 1;
+			direction = 1;
+		} else if (is_call(lines[i].inst)) {
+			pending = 2;
+			direction = 1;
+		} else if (is_return(lines[i].inst)) {
+			// rett sits in the delay slot of the jump back
+			pending = ((lines[i].inst >> 19) & 0x3f) == 0x39 ? 1 : 2;
+			direction = -1;
+		}
+	}
+
+	profile.instructions += count;
+}
+
+/* One snapshot, runs on the I/O thread of a background run */
+static void sample(void *arg)
+{
+	trace_line lines[DSU_INST_TRCE_BUF_LINES];
+	unsigned int count = 0;
+	DWORD newest = profile.last;
+
+	if (ftdi_batch_transfer(&profile.batch, profile.data) != FT_OK) {
+		profile.errors++;
+		return;
+	}
+
+	// The index points at the line written next, that is the oldest one
+	const DWORD next = profile.data[0] & (DSU_INST_TRCE_BUF_LINES - 1);
+
+	for (DWORD i = 0; i < DSU_INST_TRCE_BUF_LINES; i++) {
+		const DWORD *field = &profile.data[1 + ((next + i) & (DSU_INST_TRCE_BUF_LINES - 1)) * 4];
+		const DWORD timetag = field[0] & TIMETAG_MASK;
+		const DWORD age = (timetag - profile.last) & TIMETAG_MASK;
+
+		if (field[0] & LINE_MULTI_CYCLE)
+			continue;
+
+		// Seen in an earlier snapshot
+		if (profile.primed && (age == 0 || age > TIMETAG_MASK / 2))
+			continue;
+
+		if (((timetag - newest) & TIMETAG_MASK) < TIMETAG_MASK / 2)
+			newest = timetag;
+
+		lines[count++] = (trace_line) { timetag, field[2] & ~0x3, field[3], field[2] & LINE_TRAP };
+	}
+
+	profile.snapshots++;
+
+	if (profile.primed) {
+		// Lines written while the buffer was read are out of order
+		qsort(lines, count, sizeof(lines[0]), compare_lines);
+		count_lines(lines, count);
+	}
+
+	profile.last = newest;
+	profile.primed = true;
+}
+
+void profile_cycles_clear()
+{
+	table_free(&profile.cycles);
+	profile.traced_cycles = 0;
+}
+
+/*
+ * Each instruction gets the cycles up to the next one in the trace buffer of
+ * a stopped core, lines more than window cycles before the stop are skipped.
+ * The whole buffer is read in one transaction.
+ */
+DWORD profile_trace_cycles(DWORD cpu, uint64_t window)
+{
+	DWORD data[TRACE_WORDS + 1];
+	ftdi_batch batch;
+	DWORD pc = 0, timetag = 0, cycles = 0;
+	bool first = true;
+
+	ftdi_batch_init(&batch);
+	ftdi_batch_read32(&batch, DSU_BASE(cpu) + DSU_INST_TRCE_CTRL);
+	ftdi_batch_read32_block(&batch, DSU_BASE(cpu) + DSU_INST_TRCE_BUF_START, TRACE_WORDS);
+
+	const FT_STATUS status = ftdi_batch_transfer(&batch, data);
+
+	ftdi_batch_free(&batch);
+
+	if (status != FT_OK)
+		return 0;
+
+	const DWORD next = data[0] & (DSU_INST_TRCE_BUF_LINES - 1);
+	const DWORD newest = data[1 + ((next - 1) & (DSU_INST_TRCE_BUF_LINES - 1)) * 4] & TIMETAG_MASK;
+
+	for (DWORD i = 0; i < DSU_INST_TRCE_BUF_LINES; i++) {
+		const DWORD *field = &data[1 + ((next + i) & (DSU_INST_TRCE_BUF_LINES - 1)) * 4];
+		const DWORD line_timetag = field[0] & TIMETAG_MASK;
+
+		if ((field[0] & LINE_MULTI_CYCLE) || ((newest - line_timetag) & TIMETAG_MASK) > window)
+			continue;
+
+		if (!first) {
+			const DWORD func = function_of(pc);
+			const DWORD delta = (line_timetag - timetag) & TIMETAG_MASK;
+
+			table_add(&profile.cycles, func ? &func : &pc, 1, delta);
+			cycles += delta;
+		}
+
+		pc = field[2] & ~0x3;
+		timetag = line_timetag;
+		first = false;
+	}
+
+	profile.traced_cycles += cycles;
+
+	return cycles;
+}
+
+static double elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void enable_trace(void *arg)
+{
+	dsu_set_cpu_trace_enable(profile.cpu);
+}
+
+/*
+ * Snapshots go out back to back, each is a single transaction: the trace
+ * index and the whole buffer. The core keeps running. During a background run
+ * every snapshot is handed to its I/O thread, so the UART is still served.
+ */
+DWORD profile_run(DWORD cpu, double seconds)
+{
+	struct timespec start, now;
+
+	table_free(&profile.pcs);
+	table_free(&profile.stacks);
+	profile.snapshots = 0;
+	profile.instructions = 0;
+	profile.errors = 0;
+	profile.primed = false;
+	profile.cpu = cpu;
+
+	ftdi_batch_init(&profile.batch);
+	ftdi_batch_read32(&profile.batch, DSU_BASE(cpu) + DSU_INST_TRCE_CTRL);
+	ftdi_batch_read32_block(&profile.batch, DSU_BASE(cpu) + DSU_INST_TRCE_BUF_START, TRACE_WORDS);
+
+	run_call(enable_trace, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		run_call(sample, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (elapsed(&start, &now) < seconds && profile.errors == 0);
+
+	ftdi_batch_free(&profile.batch);
+
+	printf("%u snapshots in %.2f s (%.0f/s), %u instructions traced\n", profile.snapshots,
+	       elapsed(&start, &now), profile.snapshots / elapsed(&start, &now), profile.instructions);
+
+	if (profile.errors)
+		printf("Stopped after a transfer error\n");
+	else if (profile.instructions == 0)
+		printf("No instructions were traced, is cpu %d running?\n", cpu);
+
+	return profile.instructions;
+}
+
+static void frame_name(DWORD addr, char *buffer, size_t size)
+{
+	const elf_symbol *sym = profile.have_syms ? elf_find_address(&profile.syms, addr) : NULL;
+
+	if (sym && sym->value == addr)
+		snprintf(buffer, size, "%s", sym->name);
+	else if (sym)
+		snprintf(buffer, size, "%s+0x%x", sym->name, addr - sym->value);
+	else
+		snprintf(buffer, size, "0x%08x", addr);
+}
+
+static int compare_counts(const void *a, const void *b)
+{
+	const DWORD ca = ((const profile_entry *) a)->count;
+	const DWORD cb = ((const profile_entry *) b)->count;
+
+	return ca > cb ? -1 : ca < cb;
+}
+
+/* Self time of functions with symbols, of single PCs without */
+void profile_print(unsigned int top)
+{
+	profile_table flat = { 0 };
+	char name[128];
+
+	if (profile.instructions == 0) {
+		printf("No profile recorded\n");
+		return;
+	}
+
+	for (size_t i = 0; i < profile.pcs.size; i++) {
+		const profile_entry *entry = &profile.pcs.entries[i];
+		const DWORD func = entry->depth ? function_of(entry->key[0]) : 0;
+
+		if (entry->depth)
+			table_add(&flat, func ? &func : entry->key, 1, entry->count);
+	}
+
+	qsort(flat.entries, flat.size, sizeof(profile_entry), compare_counts);
+
+	printf("   %-7s  %-10s  %s\n", "SELF", "COUNT", profile.have_syms ? "FUNCTION" : "PC");
+
+	for (size_t i = 0; i < flat.size && i < top && flat.entries[i].depth; i++) {
+		frame_name(flat.entries[i].key[0], name, sizeof(name));
+		printf("   %6.2f%%  %-10u  %s\n", 100.0 * flat.entries[i].count / profile.instructions,
+		       flat.entries[i].count, name);
+	}
+
+	table_free(&flat);
+}
+
+void profile_print_cycles(unsigned int top, unsigned int runs)
+{
+	char name[128];
+
+	if (profile.traced_cycles == 0 || runs == 0) {
+		printf("No cycles traced, is the trace buffer enabled?\n");
+		return;
+	}
+
+	qsort(profile.cycles.entries, profile.cycles.size, sizeof(profile_entry), compare_counts);
+
+	printf("   %-7s  %-10s  %s\n", "CYCLES", "PER RUN", profile.have_syms ? "FUNCTION" : "PC");
+
+	for (size_t i = 0; i < profile.cycles.size && i < top && profile.cycles.entries[i].depth; i++) {
+		frame_name(profile.cycles.entries[i].key[0], name, sizeof(name));
+		printf("   %6.2f%%  %-10.1f  %s\n", 100.0 * profile.cycles.entries[i].count / profile.traced_cycles,
+		       (double) profile.cycles.entries[i].count / runs, name);
+	}
+
+	// Sorted in place, the table can no longer be added to
+	profile_cycles_clear();
+}
+
+bool profile_save_folded(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	char name[128];
+
+	if (!file)
+		return false;
+
+	for (size_t i = 0; i < profile.stacks.size; i++) {
+		const profile_entry *entry = &profile.stacks.entries[i];
+
+		if (!entry->depth)
+			continue;
+
+		for (unsigned int d = 0; d < entry->depth; d++) {
+			frame_name(entry->key[d], name, sizeof(name));
+			fprintf(file, "%s%s", d ? ";" : "", name);
+		}
+
+		fprintf(file, " %u\n", entry->count);
+	}
+
+	return fclose(file) == 0;
+}
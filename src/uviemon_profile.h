@@ -0,0 +1,43 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Statistical profiler: the instruction trace
+	buffer of a running core is read in one
+	transaction after the other, the instruct-
+	ions traced since the previous snapshot are
+	counted by PC and by call stack. The stacks
+	are rebuilt from the calls and returns in
+	each snapshot, so they reach back at most
+	one trace buffer (256 instructions).
+
+	Cycles by function come from the time tags
+	of the trace buffer after a run stopped,
+	they cover its last 256 instructions.
+	============================================
+*/
+
+#ifndef UVIEMON_PROFILE_H
+#define UVIEMON_PROFILE_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_TOP 20		// Lines of the flat profile
+
+bool profile_load_symbols(const char *path);
+
+// Samples cpu for the given time, a background run keeps being served
+DWORD profile_run(DWORD cpu, double seconds);
+
+void profile_print(unsigned int top);
+
+// Cycles by function from the trace buffer of a stopped core, summed over runs
+void profile_cycles_clear();
+DWORD profile_trace_cycles(DWORD cpu, uint64_t window);
+void profile_print_cycles(unsigned int top, unsigned int runs); // Clears the cycles
+bool profile_save_folded(const char *path); // One "caller;callee count" line per stack
+
+#endif /* UVIEMON_PROFILE_H */
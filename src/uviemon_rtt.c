@@ -0,0 +1,382 @@
+#include "uviemon_rtt.h"
+#include "uviemon_uart.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Control block:
+ *   char acID[16]          "SEGGER RTT"
+ *   int MaxNumUpBuffers
+ *   int MaxNumDownBuffers
+ *   descriptors of all up, then all down buffers
+ */
+#define RTT_ID_0 0x53454747 // "SEGG"
+#define RTT_ID_1 0x45522052 // "ER R"
+#define RTT_ID_2 0x54540000 // "TT\0\0"
+
+#define RTT_HEADER_WORDS 6
+#define RTT_MAX_CHANNELS 16
+
+// Buffer descriptor: sName, pBuffer, SizeOfBuffer, WrOff, RdOff, Flags
+#define RTT_DESC_WORDS 6
+#define RTT_DESC_BUFFER 1
+#define RTT_DESC_SIZE 2
+#define RTT_DESC_WR_OFF 3
+#define RTT_DESC_RD_OFF 4
+
+#define RTT_MAX_POLL_BYTES (64 * 1024) // Per up channel and poll
+#define RTT_LINE_LENGTH 256
+
+typedef struct {
+	DWORD buffer;
+	DWORD size;
+	char line[RTT_LINE_LENGTH]; // Output of up channels other than 0
+	size_t line_len;
+	char *pending;		    // Host input not yet written to a down channel
+	size_t pending_len;
+} rtt_channel;
+
+typedef struct {
+	bool attached;
+	DWORD addr;
+	DWORD num_up;
+	DWORD num_down;
+	rtt_channel up[RTT_MAX_CHANNELS];
+	rtt_channel down[RTT_MAX_CHANNELS];
+} rtt_state;
+
+static rtt_state rtt_slots[FTDI_MAX_DEVICES];
+
+static inline rtt_state *rtt_slot()
+{
+	return &rtt_slots[ftdi_get_device_slot()];
+}
+
+
+static bool read_block(DWORD addr, DWORD *data, DWORD words)
+{
+	ftdi_batch batch;
+
+	ftdi_batch_init(&batch);
+	ftdi_batch_read32_block(&batch, addr, words);
+
+	const bool ok = ftdi_batch_transfer(&batch, data) == FT_OK;
+
+	ftdi_batch_free(&batch);
+
+	return ok;
+}
+
+// Memory is big endian, the first byte of a DWORD is its MSB
+static char byte_at(const DWORD *words, DWORD base, DWORD addr)
+{
+	return (words[(addr - base) / 4] >> (8 * (3 - (addr & 0x3)))) & 0xFF;
+}
+
+DWORD rtt_find(DWORD startAddr, DWORD length)
+{
+	const DWORD chunk = 16 * 1024;
+	DWORD *data = malloc(chunk + 2 * 4);
+
+	if (data == NULL) {
+		fprintf(stderr, "Out of memory while scanning for the control block!\n");
+		return 0;
+	}
+
+	startAddr &= ~0x3;
+	length &= ~0x3;
+
+	for (DWORD offset = 0; offset < length; offset += chunk) {
+		// Overlap by two DWORDs so that an ID across chunks is found as well, but not past the end
+		const DWORD addr = startAddr + offset;
+		const DWORD overlap = offset + chunk < length ? 2 * 4 : 0;
+		const DWORD words = ((length - offset < chunk ? length - offset : chunk) + overlap) / 4;
+
+		if (!read_block(addr, data, words))
+			break;
+
+		for (DWORD i = 0; i + 2 < words; i++) {
+			if (data[i] == RTT_ID_0 && data[i + 1] == RTT_ID_1 && data[i + 2] == RTT_ID_2) {
+				free(data);
+				return addr + i * 4;
+			}
+		}
+	}
+
+	free(data);
+
+	return 0;
+}
+
+bool rtt_attach(DWORD addr)
+{
+	DWORD header[RTT_HEADER_WORDS];
+	DWORD desc[2 * RTT_MAX_CHANNELS * RTT_DESC_WORDS];
+	rtt_state *rtt = rtt_slot();
+
+	rtt_detach();
+
+	if (!read_block(addr, header, RTT_HEADER_WORDS))
+		return false;
+
+	if (header[0] != RTT_ID_0 || header[1] != RTT_ID_1 || header[2] != RTT_ID_2) {
+		printf("No memory console control block at 0x%08x\n", addr);
+		return false;
+	}
+
+	const DWORD num_up = header[4];
+	const DWORD num_down = header[5];
+
+	if (num_up > RTT_MAX_CHANNELS || num_down > RTT_MAX_CHANNELS) {
+		printf("Control block at 0x%08x has %u up and %u down channels, at most %d are supported\n",
+		       addr, num_up, num_down, RTT_MAX_CHANNELS);
+		return false;
+	}
+
+	if (!read_block(addr + RTT_HEADER_WORDS * 4, desc, (num_up + num_down) * RTT_DESC_WORDS))
+		return false;
+
+	for (DWORD i = 0; i < num_up + num_down; i++) {
+		rtt_channel *ch = i < num_up ? &rtt->up[i] : &rtt->down[i - num_up];
+
+		ch->buffer = desc[i * RTT_DESC_WORDS + RTT_DESC_BUFFER];
+		ch->size = desc[i * RTT_DESC_WORDS + RTT_DESC_SIZE];
+	}
+
+	rtt->addr = addr;
+	rtt->num_up = num_up;
+	rtt->num_down = num_down;
+	rtt->attached = true;
+
+	return true;
+}
+
+void rtt_detach()
+{
+	rtt_state *rtt = rtt_slot();
+
+	for (DWORD i = 0; i < RTT_MAX_CHANNELS; i++) {
+		free(rtt->down[i].pending);
+		rtt->down[i].pending = NULL;
+		rtt->down[i].pending_len = 0;
+		rtt->up[i].line_len = 0;
+	}
+
+	rtt->attached = false;
+}
+
+bool rtt_attached()
+{
+	return rtt_slot()->attached;
+}
+
+void rtt_print_status()
+{
+	const rtt_state *rtt = rtt_slot();
+
+	if (!rtt->attached) {
+		printf("Memory console not attached\n");
+		return;
+	}
+
+	printf("Memory console at 0x%08x\n", rtt->addr);
+
+	for (DWORD i = 0; i < rtt->num_up; i++)
+		printf("  up %u:   buffer 0x%08x, %u bytes\n", i, rtt->up[i].buffer, rtt->up[i].size);
+
+	for (DWORD i = 0; i < rtt->num_down; i++)
+		printf("  down %u: buffer 0x%08x, %u bytes, %zu bytes pending\n", i,
+		       rtt->down[i].buffer, rtt->down[i].size, rtt->down[i].pending_len);
+}
+
+bool rtt_send(DWORD channel, const char *data, size_t length)
+{
+	rtt_state *rtt = rtt_slot();
+
+	if (!rtt->attached || channel >= rtt->num_down) {
+		printf("No memory console down channel %u\n", channel);
+		return false;
+	}
+
+	rtt_channel *ch = &rtt->down[channel];
+	char *pending = realloc(ch->pending, ch->pending_len + length);
+
+	if (pending == NULL) {
+		fprintf(stderr, "Out of memory while queueing console input!\n");
+		return false;
+	}
+
+	memcpy(pending + ch->pending_len, data, length);
+	ch->pending = pending;
+	ch->pending_len += length;
+
+	return true;
+}
+
+static void channel_putc(DWORD channel, char c)
+{
+	if (channel == 0) {
+		uart_putc(c);
+		return;
+	}
+
+	rtt_channel *ch = &rtt_slot()->up[channel];
+
+	ch->line[ch->line_len++] = c;
+
+	if (c == '\n' || ch->line_len == RTT_LINE_LENGTH) {
+		printf("[%u] %.*s%s", channel, (int) ch->line_len, ch->line, c == '\n' ? "" : "\n");
+		ch->line_len = 0;
+	}
+}
+
+typedef struct {
+	DWORD start;	// Byte offsets in the buffer
+	DWORD end;
+	DWORD base;	// Aligned address of the first DWORD read
+	DWORD index;	// Result index of the first DWORD
+} segment;
+
+// Queue the burst for the bytes [start, end) of an up buffer
+static void queue_segment(ftdi_batch *batch, const rtt_channel *ch, segment *seg, DWORD start, DWORD end)
+{
+	const DWORD first = (ch->buffer + start) & ~0x3;
+	const DWORD last = (ch->buffer + end + 3) & ~0x3;
+
+	seg->start = start;
+	seg->end = end;
+	seg->base = first;
+	seg->index = ftdi_batch_read32_block(batch, first, (last - first) / 4);
+}
+
+/*
+ * Move all new data from the up channels to the host and pending host input
+ * to the down channels. One transaction reads all descriptors, a second one
+ * carries the bursts for the new data and the updated ring buffer offsets.
+ */
+int rtt_poll()
+{
+	DWORD desc[2 * RTT_MAX_CHANNELS * RTT_DESC_WORDS];
+	segment segs[RTT_MAX_CHANNELS][2];
+	size_t sent[RTT_MAX_CHANNELS] = { 0 };
+	DWORD *data = NULL;
+	ftdi_batch batch;
+	int moved = 0;
+	rtt_state *rtt = rtt_slot();
+
+	if (!rtt->attached)
+		return 0;
+
+	const DWORD desc_addr = rtt->addr + RTT_HEADER_WORDS * 4;
+
+	if (!read_block(desc_addr, desc, (rtt->num_up + rtt->num_down) * RTT_DESC_WORDS))
+		return -1;
+
+	ftdi_batch_init(&batch);
+
+	for (DWORD i = 0; i < rtt->num_up; i++) {
+		const rtt_channel *ch = &rtt->up[i];
+		const DWORD *d = desc + i * RTT_DESC_WORDS;
+		DWORD wr = d[RTT_DESC_WR_OFF], rd = d[RTT_DESC_RD_OFF];
+		DWORD budget = RTT_MAX_POLL_BYTES, count;
+
+		segs[i][0].start = segs[i][0].end = 0;
+		segs[i][1].start = segs[i][1].end = 0;
+
+		if (ch->size == 0 || wr >= ch->size || rd >= ch->size || wr == rd)
+			continue;
+
+		// Up to the write offset or the end of the buffer, then from the start
+		count = wr > rd ? wr - rd : ch->size - rd;
+		count = count > budget ? budget : count;
+
+		queue_segment(&batch, ch, &segs[i][0], rd, rd + count);
+		rd = (rd + count) % ch->size;
+		budget -= count;
+
+		if (rd == 0 && wr > 0 && budget > 0) {
+			count = wr > budget ? budget : wr;
+
+			queue_segment(&batch, ch, &segs[i][1], 0, count);
+			rd = count;
+		}
+
+		// Hand the space back to the target after the data was read
+		ftdi_batch_write32(&batch, desc_addr + (i * RTT_DESC_WORDS + RTT_DESC_RD_OFF) * 4, rd);
+	}
+
+	for (DWORD i = 0; i < rtt->num_down; i++) {
+		rtt_channel *ch = &rtt->down[i];
+		const DWORD *d = desc + (rtt->num_up + i) * RTT_DESC_WORDS;
+		DWORD wr = d[RTT_DESC_WR_OFF];
+		const DWORD rd = d[RTT_DESC_RD_OFF];
+
+		if (ch->pending_len == 0 || ch->size == 0 || wr >= ch->size || rd >= ch->size)
+			continue;
+
+		size_t count = (rd + ch->size - wr - 1) % ch->size;
+
+		if (count > ch->pending_len)
+			count = ch->pending_len;
+
+		if (count == 0)
+			continue;
+
+		// Up to the end of the ring and the rest from its start
+		for (size_t j = 0; j < count; ) {
+			const size_t len = count - j < ch->size - wr ? count - j : ch->size - wr;
+
+			ftdi_batch_write8_buffer(&batch, ch->buffer + wr, (const BYTE *) &ch->pending[j], len);
+			wr = (wr + len) % ch->size;
+			j += len;
+		}
+
+		// Publish the new data only after it was written
+		ftdi_batch_write32(&batch, desc_addr + ((rtt->num_up + i) * RTT_DESC_WORDS + RTT_DESC_WR_OFF) * 4, wr);
+
+		sent[i] = count;
+		moved += count;
+	}
+
+	if (batch.reads > 0) {
+		data = malloc(batch.reads * sizeof(DWORD));
+
+		if (data == NULL) {
+			fprintf(stderr, "Out of memory while reading the memory console!\n");
+			ftdi_batch_free(&batch);
+			return -1;
+		}
+	}
+
+	if (ftdi_batch_transfer(&batch, data) != FT_OK) {
+		free(data);
+		ftdi_batch_free(&batch);
+		return -1;
+	}
+
+	// The input leaves the queue only once it is in the target, a failed poll sends it again
+	for (DWORD i = 0; i < rtt->num_down; i++) {
+		rtt_channel *ch = &rtt->down[i];
+
+		memmove(ch->pending, ch->pending + sent[i], ch->pending_len - sent[i]);
+		ch->pending_len -= sent[i];
+	}
+
+	for (DWORD i = 0; i < rtt->num_up; i++) {
+		for (int s = 0; s < 2; s++) {
+			const segment *seg = &segs[i][s];
+
+			for (DWORD off = seg->start; off < seg->end; off++)
+				channel_putc(i, byte_at(data + seg->index, seg->base, rtt->up[i].buffer + off));
+
+			moved += seg->end - seg->start;
+		}
+	}
+
+	free(data);
+	ftdi_batch_free(&batch);
+
+	return moved;
+}
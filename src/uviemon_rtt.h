@@ -0,0 +1,33 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Memory console: the target writes its log
+	into ring buffers described by a control
+	block in RAM (SEGGER RTT layout), uviemon
+	drains them over JTAG with burst reads and
+	can send input to the target the same way.
+	============================================
+*/
+
+#ifndef UVIEMON_RTT_H
+#define UVIEMON_RTT_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RTT_SYMBOL "_SEGGER_RTT"
+
+DWORD rtt_find(DWORD startAddr, DWORD length);
+
+bool rtt_attach(DWORD addr);
+void rtt_detach();
+bool rtt_attached();
+void rtt_print_status();
+
+bool rtt_send(DWORD channel, const char *data, size_t length);
+int rtt_poll();
+
+#endif /* UVIEMON_RTT_H */
@@ -0,0 +1,368 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, pthread_condattr_setclock
+
+#include "uviemon_run.h"
+#include "leon3_dsu.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+enum run_state {
+	RUN_IDLE,	// No program started in the background, or its result was collected
+	RUN_RUNNING,	// The I/O thread is polling the target
+	RUN_DONE	// The program ended, the thread waits to be joined
+};
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;	// State changes and finished calls, for the console
+	pthread_cond_t wake;	// Pending calls and stop requests, for the I/O thread
+	bool initialized;
+
+	enum run_state state;
+	ftdi_device *device;	// Of the console, selected by the I/O thread
+	DWORD cores;
+	bool sync;
+	bool resume;		// Continue stopped cores instead of starting the program
+	ftdi_core_entry entries[DSU_NCPUS];
+	BYTE traps[DSU_NCPUS];
+	bool stop;
+	bool failed;		// The link failed, the traps are 0
+	struct timespec started;
+	struct timespec ended;
+
+	void (*call)(void *);	// Pending console call
+	void *call_arg;
+} run;
+
+static void run_init()
+{
+	pthread_condattr_t attr;
+
+	if (run.initialized)
+		return;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	pthread_mutex_init(&run.lock, NULL);
+	pthread_cond_init(&run.changed, &attr);
+	pthread_cond_init(&run.wake, &attr);
+	pthread_condattr_destroy(&attr);
+
+	run.initialized = true;
+}
+
+static void timespec_add_us(struct timespec *ts, long us)
+{
+	ts->tv_sec += us / 1000000;
+	ts->tv_nsec += (us % 1000000) * 1000;
+
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static double elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void print_cores(DWORD cores)
+{
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (cores & (1 << cpu))
+			printf(" %d", cpu);
+	}
+
+	printf("\n");
+}
+
+/* Run a pending console call, the lock is held on entry and exit */
+static void serve_call()
+{
+	void (*call)(void *) = run.call;
+
+	pthread_mutex_unlock(&run.lock);
+	call(run.call_arg);
+	pthread_mutex_lock(&run.lock);
+
+	run.call = NULL;
+	pthread_cond_broadcast(&run.changed);
+}
+
+/*
+ * The I/O thread: the only one touching the transport while the program runs.
+ * Between two polls it serves calls from the console and stop requests, the
+ * poll interval is slept on a condition so those are picked up right away.
+ */
+static void *run_thread(void *arg)
+{
+	bool stop_sent = false;
+	unsigned int wait_us;
+	BYTE traps[DSU_NCPUS];
+
+	ftdi_select_device(run.device);
+
+	const bool started = run.resume ? runCPU_resume(run.cores)
+					: runCPU_start(run.cores, run.entries, run.sync);
+
+	pthread_mutex_lock(&run.lock);
+
+	run.failed = !started;
+
+	while (!run.failed) {
+		pthread_mutex_unlock(&run.lock);
+		const enum ftdi_run_state state = runCPU_poll(&wait_us);
+		pthread_mutex_lock(&run.lock);
+
+		if (run.call)
+			serve_call();
+
+		if (state == FTDI_RUN_FAILED) {
+			run.failed = true;
+			break;
+		}
+
+		if (state == FTDI_RUN_DONE) {
+			pthread_mutex_unlock(&run.lock);
+			const bool done = runCPU_finish(traps);
+			pthread_mutex_lock(&run.lock);
+
+			// The program has to be started again, unless the user stopped it
+			if (!done && !run.stop) {
+				pthread_mutex_unlock(&run.lock);
+				const bool restarted = runCPU_start(run.cores, run.entries, run.sync);
+				pthread_mutex_lock(&run.lock);
+
+				run.failed = !restarted;
+				continue;
+			}
+
+			break;
+		}
+
+		if (run.stop && !stop_sent) {
+			pthread_mutex_unlock(&run.lock);
+			runCPU_stop();
+			pthread_mutex_lock(&run.lock);
+			stop_sent = true;
+			continue;
+		}
+
+		if (wait_us && !run.call) {
+			struct timespec deadline;
+
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			timespec_add_us(&deadline, wait_us);
+			pthread_cond_timedwait(&run.wake, &run.lock, &deadline);
+		}
+	}
+
+	if (run.failed)
+		memset(traps, 0, sizeof(traps));
+
+	memcpy(run.traps, traps, sizeof(traps));
+	run.state = RUN_DONE;
+	clock_gettime(CLOCK_MONOTONIC, &run.ended);
+	pthread_cond_broadcast(&run.changed);
+	pthread_mutex_unlock(&run.lock);
+
+	printf(run.failed ? "\nBackground run lost the device, 'wait' to clean up.\n"
+			  : "\nBackground run ended, 'wait' for the result.\n");
+	fflush(stdout);
+
+	return NULL;
+}
+
+static bool start_thread(DWORD cores, const ftdi_core_entry *entries, bool sync, bool resume)
+{
+	run_init();
+
+	if (run_active())
+		return false;
+
+	pthread_mutex_lock(&run.lock);
+
+	// Result of a previous run that nobody waited for
+	if (run.state == RUN_DONE)
+		pthread_join(run.thread, NULL);
+
+	run.state = RUN_RUNNING;
+	run.device = ftdi_get_device();
+	run.cores = cores;
+	run.sync = sync;
+	run.resume = resume;
+	if (entries)
+		memcpy(run.entries, entries, sizeof(run.entries));
+	run.stop = false;
+	run.failed = false;
+	run.call = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &run.started);
+
+	if (pthread_create(&run.thread, NULL, run_thread, NULL) != 0) {
+		run.state = RUN_IDLE;
+		pthread_mutex_unlock(&run.lock);
+		return false;
+	}
+
+	pthread_mutex_unlock(&run.lock);
+
+	return true;
+}
+
+bool run_background(DWORD cores, const ftdi_core_entry *entries, bool sync)
+{
+	return start_thread(cores, entries, sync, false);
+}
+
+bool run_background_resume(DWORD cores)
+{
+	return start_thread(cores, NULL, false, true);
+}
+
+bool run_active()
+{
+	bool active;
+
+	if (!run.initialized)
+		return false;
+
+	pthread_mutex_lock(&run.lock);
+	active = run.state == RUN_RUNNING;
+	pthread_mutex_unlock(&run.lock);
+
+	return active;
+}
+
+bool run_stop()
+{
+	if (!run_active())
+		return false;
+
+	pthread_mutex_lock(&run.lock);
+	run.stop = true;
+	pthread_cond_signal(&run.wake);
+	pthread_mutex_unlock(&run.lock);
+
+	return true;
+}
+
+/*
+ * Wait up to timeout_ms for the background run to end and collect its result.
+ * Returns false on timeout or if there is nothing to wait for.
+ */
+bool run_wait(int timeout_ms, BYTE *traps, DWORD *cores, bool *stopped)
+{
+	struct timespec deadline;
+
+	if (!run.initialized)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timespec_add_us(&deadline, (long) timeout_ms * 1000);
+
+	pthread_mutex_lock(&run.lock);
+
+	while (run.state == RUN_RUNNING) {
+		if (timeout_ms == RUN_WAIT_FOREVER)
+			pthread_cond_wait(&run.changed, &run.lock);
+		else if (pthread_cond_timedwait(&run.changed, &run.lock, &deadline) != 0)
+			break;
+	}
+
+	if (run.state != RUN_DONE) {
+		pthread_mutex_unlock(&run.lock);
+		return false;
+	}
+
+	pthread_join(run.thread, NULL);
+
+	memcpy(traps, run.traps, sizeof(run.traps));
+	*cores = run.cores;
+	*stopped = run.stop;
+	run.state = RUN_IDLE;
+
+	pthread_mutex_unlock(&run.lock);
+
+	return true;
+}
+
+void run_print_status()
+{
+	struct timespec now;
+
+	if (!run.initialized) {
+		printf("No program was started in the background\n");
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&run.lock);
+
+	switch (run.state) {
+	case RUN_IDLE:
+		printf("No program running in the background\n");
+		break;
+	case RUN_RUNNING:
+		printf("Running for %.1f s%s on cpu", elapsed(&run.started, &now), run.stop ? ", stopping," : "");
+		print_cores(run.cores);
+		break;
+	case RUN_DONE:
+		printf("%s after %.1f s, 'wait' to collect the result\n", run.failed ? "Lost the device" : "Ended",
+		       elapsed(&run.started, &run.ended));
+
+		for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+			if (run.cores & (1 << cpu))
+				printf("   cpu %d: tt 0x%02x\n", cpu, run.traps[cpu]);
+		}
+		break;
+	}
+
+	pthread_mutex_unlock(&run.lock);
+}
+
+/* Stops a background run and waits for it, e.g. before the device is closed */
+void run_shutdown()
+{
+	BYTE traps[DSU_NCPUS];
+	DWORD cores;
+	bool stopped;
+
+	if (!run.initialized)
+		return;
+
+	run_stop();
+	run_wait(RUN_WAIT_FOREVER, traps, &cores, &stopped);
+}
+
+void run_call(void (*fn)(void *), void *arg)
+{
+	bool served = false;
+
+	if (run.initialized) {
+		pthread_mutex_lock(&run.lock);
+
+		if (run.state == RUN_RUNNING) {
+			run.call = fn;
+			run.call_arg = arg;
+			pthread_cond_signal(&run.wake);
+
+			while (run.call && run.state == RUN_RUNNING)
+				pthread_cond_wait(&run.changed, &run.lock);
+
+			// Not served if the program ended before the call was picked up
+			served = run.call == NULL;
+			run.call = NULL;
+		}
+
+		pthread_mutex_unlock(&run.lock);
+	}
+
+	// Nothing runs, the transport is free
+	if (!served)
+		fn(arg);
+}
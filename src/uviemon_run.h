@@ -0,0 +1,33 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Background execution: an I/O thread owns
+	the JTAG transport while a program runs,
+	it polls the target and executes commands
+	of the console between two polls.
+	============================================
+*/
+
+#ifndef UVIEMON_RUN_H
+#define UVIEMON_RUN_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+
+#define RUN_WAIT_FOREVER -1
+
+// Core sets, entries and traps as for runCPUs()
+bool run_background(DWORD cores, const ftdi_core_entry *entries, bool sync);
+bool run_background_resume(DWORD cores); // Continue cores stopped in debug mode
+bool run_active();
+bool run_stop();
+bool run_wait(int timeout_ms, BYTE *traps, DWORD *cores, bool *stopped);
+void run_print_status();
+void run_shutdown();
+
+// Executes fn on the I/O thread between two polls, or right away if nothing runs
+void run_call(void (*fn)(void *), void *arg);
+
+#endif /* UVIEMON_RUN_H */
@@ -0,0 +1,396 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include "uviemon_semihost.h"
+#include "uviemon_uart.h"
+
+#include "ftdi_device.h"
+#include "leon3_dsu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEMIHOST_MAX_FILES 32
+#define SEMIHOST_MAX_NAME 1024
+#define SEMIHOST_CHUNK (64 * 1024) // Host buffer for read and write requests
+
+typedef struct {
+	int files[SEMIHOST_MAX_FILES]; // Host fds opened by the target, -1 (or 0 before the first run) if unused
+	struct timespec start_time;
+	int last_errno;
+} semihost_state;
+
+// Per device, see ftdi_get_device_slot()
+static semihost_state semihost_slots[FTDI_MAX_DEVICES];
+
+static inline semihost_state *semihost_slot()
+{
+	return &semihost_slots[ftdi_get_device_slot()];
+}
+
+/* A new program starts, files of the previous one are closed */
+void semihost_start()
+{
+	semihost_state *semihost = semihost_slot();
+
+	semihost_finish();
+
+	clock_gettime(CLOCK_MONOTONIC, &semihost->start_time);
+	semihost->last_errno = 0;
+}
+
+void semihost_finish()
+{
+	semihost_state *semihost = semihost_slot();
+
+	for (int i = 0; i < SEMIHOST_MAX_FILES; i++) {
+		// Files opened by the target never use the console descriptors
+		if (semihost->files[i] > STDERR_FILENO)
+			close(semihost->files[i]);
+
+		semihost->files[i] = -1;
+	}
+}
+
+/* Handles are the host fds, only the console and files opened by the target are accepted */
+static bool valid_handle(uint32_t handle)
+{
+	const semihost_state *semihost = semihost_slot();
+
+	if (handle <= STDERR_FILENO)
+		return true;
+
+	for (int i = 0; i < SEMIHOST_MAX_FILES; i++) {
+		if (semihost->files[i] == (int) handle)
+			return true;
+	}
+
+	return false;
+}
+
+static uint32_t fail(int error)
+{
+	semihost_slot()->last_errno = error;
+	return (uint32_t) -1;
+}
+
+static uint32_t sys_open(const uint32_t *params)
+{
+	// ARM semihosting modes: r, rb, r+, r+b, w, wb, w+, w+b, a, ab, a+, a+b
+	static const int flags[] = {
+		O_RDONLY, O_RDWR,
+		O_WRONLY | O_CREAT | O_TRUNC, O_RDWR | O_CREAT | O_TRUNC,
+		O_WRONLY | O_CREAT | O_APPEND, O_RDWR | O_CREAT | O_APPEND
+	};
+	char name[SEMIHOST_MAX_NAME + 1];
+	const uint32_t mode = params[1];
+	const uint32_t length = params[2];
+
+	if (mode > 11 || length > SEMIHOST_MAX_NAME)
+		return fail(EINVAL);
+
+	if (!ioread8_buffer(params[0], (BYTE *) name, length))
+		return fail(EIO);
+
+	name[length] = '\0';
+
+	// The console
+	if (strcmp(name, ":tt") == 0)
+		return mode < 4 ? STDIN_FILENO : STDOUT_FILENO;
+
+	semihost_state *semihost = semihost_slot();
+	int slot = 0;
+
+	while (slot < SEMIHOST_MAX_FILES && semihost->files[slot] >= 0)
+		slot++;
+
+	if (slot == SEMIHOST_MAX_FILES)
+		return fail(EMFILE);
+
+	const int fd = open(name, flags[mode / 2], 0644);
+
+	if (fd < 0)
+		return fail(errno);
+
+	semihost->files[slot] = fd;
+
+	return fd;
+}
+
+static uint32_t sys_close(const uint32_t *params)
+{
+	semihost_state *semihost = semihost_slot();
+
+	for (int i = 0; i < SEMIHOST_MAX_FILES; i++) {
+		if (semihost->files[i] == (int) params[0]) {
+			close(semihost->files[i]);
+			semihost->files[i] = -1;
+			return 0;
+		}
+	}
+
+	// Closing the console is fine, it just stays open
+	return params[0] <= STDERR_FILENO ? 0 : fail(EBADF);
+}
+
+static uint32_t sys_write(const uint32_t *params)
+{
+	semihost_state *semihost = semihost_slot();
+	const int fd = params[0];
+	uint32_t addr = params[1];
+	uint32_t remaining = params[2];
+	BYTE *buffer;
+
+	if (!valid_handle(fd))
+		return fail(EBADF);
+
+	if ((buffer = malloc(SEMIHOST_CHUNK)) == NULL)
+		return fail(ENOMEM);
+
+	while (remaining > 0) {
+		const uint32_t length = remaining > SEMIHOST_CHUNK ? SEMIHOST_CHUNK : remaining;
+
+		if (!ioread8_buffer(addr, buffer, length)) {
+			semihost->last_errno = EIO;
+			break;
+		}
+
+		if (fd == STDOUT_FILENO) {
+			// Keep the order with the UART output
+			for (uint32_t i = 0; i < length; i++)
+				uart_putc(buffer[i]);
+		} else {
+			const ssize_t written = write(fd, buffer, length);
+
+			if (written < 0) {
+				semihost->last_errno = errno;
+				break;
+			}
+
+			if ((uint32_t) written < length) {
+				remaining -= written;
+				break;
+			}
+		}
+
+		addr += length;
+		remaining -= length;
+	}
+
+	free(buffer);
+
+	return remaining;
+}
+
+static uint32_t sys_read(const uint32_t *params)
+{
+	semihost_state *semihost = semihost_slot();
+	const int fd = params[0];
+	uint32_t addr = params[1];
+	uint32_t remaining = params[2];
+	BYTE *buffer;
+
+	if (!valid_handle(fd))
+		return fail(EBADF);
+
+	if ((buffer = malloc(SEMIHOST_CHUNK)) == NULL)
+		return fail(ENOMEM);
+
+	if (fd == STDIN_FILENO)
+		uart_flush(); // Show the prompt before waiting for input
+
+	while (remaining > 0) {
+		const uint32_t length = remaining > SEMIHOST_CHUNK ? SEMIHOST_CHUNK : remaining;
+		const ssize_t count = read(fd, buffer, length);
+
+		if (count < 0) {
+			semihost->last_errno = errno;
+			break;
+		}
+
+		if (count > 0 && !iowrite8_buffer(addr, buffer, count)) {
+			semihost->last_errno = EIO;
+			break;
+		}
+
+		addr += count;
+		remaining -= count;
+
+		// End of file, or a console line
+		if ((uint32_t) count < length)
+			break;
+	}
+
+	free(buffer);
+
+	return remaining;
+}
+
+static uint32_t sys_seek(const uint32_t *params)
+{
+	if (!valid_handle(params[0]))
+		return fail(EBADF);
+
+	if (lseek(params[0], params[1], SEEK_SET) < 0)
+		return fail(errno);
+
+	return 0;
+}
+
+static uint32_t sys_flen(const uint32_t *params)
+{
+	const int fd = params[0];
+
+	if (!valid_handle(fd))
+		return fail(EBADF);
+
+	const off_t position = lseek(fd, 0, SEEK_CUR);
+	const off_t length = lseek(fd, 0, SEEK_END);
+
+	if (position < 0 || length < 0)
+		return fail(errno);
+
+	lseek(fd, position, SEEK_SET);
+
+	return length;
+}
+
+static uint32_t sys_clock()
+{
+	const semihost_state *semihost = semihost_slot();
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - semihost->start_time.tv_sec) * 100
+		+ (now.tv_nsec - semihost->start_time.tv_nsec) / 10000000;
+}
+
+static uint32_t sys_write0(uint32_t addr)
+{
+	BYTE chunk[64];
+
+	// Strings are read in small bursts until the terminating zero
+	for (;;) {
+		if (!ioread8_buffer(addr, chunk, sizeof(chunk)))
+			return fail(EIO);
+
+		for (size_t i = 0; i < sizeof(chunk); i++) {
+			if (chunk[i] == '\0')
+				return 0;
+
+			uart_putc(chunk[i]);
+		}
+
+		addr += sizeof(chunk);
+	}
+}
+
+static uint32_t serve(uint32_t op, uint32_t param_addr)
+{
+	uint32_t params[4];
+	BYTE c;
+
+	switch (op) {
+	case SYS_WRITEC:
+		if (!ioread8_buffer(param_addr, &c, 1))
+			return fail(EIO);
+
+		uart_putc(c);
+		return 0;
+	case SYS_WRITE0:
+		return sys_write0(param_addr);
+	case SYS_CLOCK:
+		return sys_clock();
+	case SYS_TIME:
+		return time(NULL);
+	case SYS_ERRNO:
+		return semihost_slot()->last_errno;
+	}
+
+	// All other operations take a parameter block
+	ioread32_buffer(param_addr, params, 3);
+
+	switch (op) {
+	case SYS_OPEN:
+		return sys_open(params);
+	case SYS_CLOSE:
+		return sys_close(params);
+	case SYS_WRITE:
+		return sys_write(params);
+	case SYS_READ:
+		return sys_read(params);
+	case SYS_SEEK:
+		return sys_seek(params);
+	case SYS_FLEN:
+		return sys_flen(params);
+	}
+
+	fprintf(stderr, "Unknown semihosting operation 0x%02x\n", op);
+
+	return fail(ENOSYS);
+}
+
+/*
+ * Check if the core stopped for a semihosting request, serve it and resume
+ * the core behind the marker instruction, along with the other cores of
+ * resume (bit mask) that were halted with it. Returns false for any other stop.
+ */
+bool semihost_service(uint32_t cpu, uint32_t resume)
+{
+	DWORD regs[5];
+	ftdi_batch batch;
+
+	// PSR, PC, NPC and trap register, then the instruction after the breakpoint
+	ftdi_batch_init(&batch);
+	ftdi_batch_read32(&batch, DSU_BASE(cpu) + DSU_REG_PSR);
+	ftdi_batch_read32_seq(&batch, DSU_BASE(cpu) + DSU_REG_PC, 2);
+	ftdi_batch_read32(&batch, DSU_BASE(cpu) + DSU_REG_TRAP);
+
+	if (ftdi_batch_transfer(&batch, regs) != FT_OK) {
+		ftdi_batch_free(&batch);
+		return false;
+	}
+
+	const uint32_t cwp = regs[0] & (NWINDOWS - 1);
+	const uint32_t pc = regs[1];
+	const uint32_t tt = (regs[3] >> 4) & 0xff;
+
+	if (tt != SEMIHOST_TRAP) {
+		ftdi_batch_free(&batch);
+		return false;
+	}
+
+	// %o0, %o1 and the marker
+	ftdi_batch_clear(&batch);
+	ftdi_batch_read32_seq(&batch, DSU_REG_OUT(cpu, cwp), 2);
+	ftdi_batch_read32(&batch, pc + 4);
+
+	if (ftdi_batch_transfer(&batch, regs) != FT_OK || regs[2] != SEMIHOST_MARKER) {
+		ftdi_batch_free(&batch);
+		return false;
+	}
+
+	const uint32_t result = serve(regs[0], regs[1]);
+
+	// Return the result and continue behind the marker, all in one write
+	const uint32_t brk = dsu_shadow_get_break_step();
+	const uint32_t cores = (resume | (1 << cpu)) & DSU_BREAK_NOW_MASK;
+
+	ftdi_batch_clear(&batch);
+	ftdi_batch_write32(&batch, DSU_REG_OUT(cpu, cwp), result);
+	ftdi_batch_write32(&batch, DSU_BASE(cpu) + DSU_REG_PC, pc + 8);
+	ftdi_batch_write32(&batch, DSU_BASE(cpu) + DSU_REG_NPC, pc + 12);
+	ftdi_batch_write32(&batch, DSU_CTRL + DSU_BREAK_STEP, brk | cores);
+	ftdi_batch_write32(&batch, DSU_CTRL + DSU_BREAK_STEP, brk & ~cores);
+	ftdi_batch_send(&batch);
+	ftdi_batch_free(&batch);
+
+	dsu_shadow_invalidate_all();
+
+	return true;
+}
@@ -0,0 +1,48 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Semihosting: file I/O of the target served
+	by the host while a program is running.
+
+	The target stops with a software breakpoint
+	that is followed by a marker instruction,
+	%o0 holds the operation and %o1 the address
+	of the parameter block (DWORDs). The result
+	is returned in %o0, operation numbers and
+	parameter blocks follow ARM semihosting:
+
+		semihost_call:
+			ta	1
+			sethi	%hi(0x53454d00), %g0	! marker
+			retl
+			 nop
+	============================================
+*/
+
+#ifndef UVIEMON_SEMIHOST_H
+#define UVIEMON_SEMIHOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SEMIHOST_TRAP	0x81		// ta 1
+#define SEMIHOST_MARKER	0x0114D153	// sethi %hi(0x53454d00), %g0
+
+#define SYS_OPEN	0x01	// { name, mode, name length } -> handle or -1
+#define SYS_CLOSE	0x02	// { handle } -> 0 or -1
+#define SYS_WRITEC	0x03	// %o1 points to the character
+#define SYS_WRITE0	0x04	// %o1 points to a zero terminated string
+#define SYS_WRITE	0x05	// { handle, buffer, length } -> bytes not written
+#define SYS_READ	0x06	// { handle, buffer, length } -> bytes not read
+#define SYS_SEEK	0x0A	// { handle, position } -> 0 or -1
+#define SYS_FLEN	0x0C	// { handle } -> file length or -1
+#define SYS_CLOCK	0x10	// centiseconds since the start of the run
+#define SYS_TIME	0x11	// seconds since the epoch
+#define SYS_ERRNO	0x13	// errno of the last failed operation
+
+void semihost_start();
+bool semihost_service(uint32_t cpu, uint32_t resume);
+void semihost_finish();
+
+#endif /* UVIEMON_SEMIHOST_H */
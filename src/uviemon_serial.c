@@ -0,0 +1,216 @@
+#define _DEFAULT_SOURCE // usleep
+
+#include "uviemon_serial.h"
+
+#include "ftdi_device.h"
+#include "uviemon_uart.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SERIAL_READ_TIMEOUT_MS 20	// A read returns what came in by then
+#define SERIAL_LATENCY_MS 2
+#define SERIAL_CHUNK 4096		// 3.4 ms at 12 Mbaud
+#define SERIAL_REOPEN_US 100000
+#define SERIAL_DRAIN_MAX_MS 1000
+
+typedef struct {
+	FT_HANDLE handle;
+	char serial[16];		// Of channel B
+	unsigned int baud;
+	int scaler;			// Of UART0, -1 if left to the target
+	ftdi_device *device;		// The reader thread works on its UART output
+	pthread_t thread;
+	atomic_bool stop;
+	atomic_uint reads;		// Finished by the reader thread
+	bool active;
+} serial_port;
+
+static serial_port serial_slots[FTDI_MAX_DEVICES];
+
+static inline serial_port *serial_slot()
+{
+	return &serial_slots[ftdi_get_device_slot()];
+}
+
+static bool configure(serial_port *p)
+{
+	if (FT_OpenEx(p->serial, FT_OPEN_BY_SERIAL_NUMBER, &p->handle) != FT_OK)
+		return false;
+
+	FT_STATUS ft_status = FT_ResetDevice(p->handle);
+
+	ft_status |= FT_SetBitMode(p->handle, 0x0, FT_BITMODE_RESET);
+	ft_status |= FT_SetBaudRate(p->handle, p->baud);
+	ft_status |= FT_SetDataCharacteristics(p->handle, FT_BITS_8, FT_STOP_BITS_1, FT_PARITY_NONE);
+	ft_status |= FT_SetFlowControl(p->handle, FT_FLOW_NONE, 0, 0);
+	ft_status |= FT_SetLatencyTimer(p->handle, SERIAL_LATENCY_MS);
+	ft_status |= FT_SetTimeouts(p->handle, SERIAL_READ_TIMEOUT_MS, 0);
+	ft_status |= FT_Purge(p->handle, FT_PURGE_RX | FT_PURGE_TX);
+
+	if (ft_status != FT_OK) {
+		FT_Close(p->handle);
+		return false;
+	}
+
+	return true;
+}
+
+/* A channel that fails is opened again, it went away with the probe */
+static void *reader(void *arg)
+{
+	serial_port *p = arg;
+	BYTE data[SERIAL_CHUNK];
+
+	ftdi_select_device(p->device);
+
+	while (!atomic_load(&p->stop)) {
+		DWORD len = 0;
+
+		if (FT_Read(p->handle, data, sizeof(data), &len) != FT_OK) {
+			fprintf(stderr, "Lost channel B %s, opening it again...\n", p->serial);
+			FT_Close(p->handle);
+
+			bool reopened = false;
+
+			while (!atomic_load(&p->stop) && !(reopened = configure(p)))
+				usleep(SERIAL_REOPEN_US);
+
+			if (!reopened) {
+				p->handle = NULL;
+				return NULL;
+			}
+
+			continue;
+		}
+
+		for (DWORD i = 0; i < len; i++)
+			uart_putc((char) data[i]);
+
+		atomic_fetch_add(&p->reads, 1);
+	}
+
+	return NULL;
+}
+
+/* The APBUART sends at sysclk / (8 * (scaler + 1)), the nearest scaler has to be close enough */
+static int scaler_for(unsigned int baud, unsigned int sysclk)
+{
+	const uint64_t divisor = 8ULL * baud;
+	const int64_t scaler = (int64_t) ((sysclk + divisor / 2) / divisor) - 1;
+
+	if (scaler < 0 || scaler > SERIAL_SCALER_MAX) {
+		fprintf(stderr, "%u baud cannot be set on UART0 with a %u Hz system clock\n", baud, sysclk);
+		return -1;
+	}
+
+	const double actual = (double) sysclk / (8.0 * (scaler + 1));
+
+	if (fabs(actual - baud) > baud * SERIAL_BAUD_TOLERANCE / 100.0) {
+		fprintf(stderr, "UART0 would send at %.0f baud instead of %u with a %u Hz system clock\n",
+			actual, baud, sysclk);
+		return -1;
+	}
+
+	return scaler;
+}
+
+bool serial_open(unsigned int baud, unsigned int sysclk)
+{
+	const ftdi_device *dev = ftdi_get_device();
+	const size_t len = strlen(dev->serial);
+
+	if (baud < SERIAL_MIN_BAUD || baud > SERIAL_MAX_BAUD) {
+		fprintf(stderr, "Baud rate %u is not between %d and %d\n", baud, SERIAL_MIN_BAUD, SERIAL_MAX_BAUD);
+		return false;
+	}
+
+	// The channels of a probe share the serial number up to the letter at the end
+	if (len == 0 || dev->serial[len - 1] != 'A') {
+		fprintf(stderr, "Device %d is not channel A of an FT2232H, no channel B to open\n", dev->device_index);
+		return false;
+	}
+
+	const int scaler = sysclk ? scaler_for(baud, sysclk) : -1;
+
+	if (sysclk && scaler < 0)
+		return false;
+
+	serial_close();
+
+	serial_port *p = serial_slot();
+
+	strcpy(p->serial, dev->serial);
+	p->serial[len - 1] = 'B';
+	p->baud = baud;
+	p->scaler = scaler;
+	p->device = ftdi_get_device();
+	atomic_store(&p->stop, false);
+
+	if (!configure(p)) {
+		fprintf(stderr, "Could not open channel B %s at %u baud\n", p->serial, baud);
+		return false;
+	}
+
+	if (pthread_create(&p->thread, NULL, reader, p) != 0) {
+		fprintf(stderr, "Could not start the reader of channel B\n");
+		FT_Close(p->handle);
+		return false;
+	}
+
+	p->active = true;
+	printf("UART0 output from channel B %s at %u baud\n", p->serial, baud);
+
+	if (scaler < 0)
+		printf("The target has to set UART0 to %u baud, no system clock given to set it\n", baud);
+	else
+		printf("Runs set the UART0 scaler to %d\n", scaler);
+
+	return true;
+}
+
+void serial_close()
+{
+	serial_port *p = serial_slot();
+
+	if (!p->active)
+		return;
+
+	atomic_store(&p->stop, true);
+	pthread_join(p->thread, NULL);
+
+	if (p->handle != NULL)
+		FT_Close(p->handle);
+
+	p->active = false;
+}
+
+bool serial_active()
+{
+	return serial_slot()->active;
+}
+
+int serial_scaler()
+{
+	const serial_port *p = serial_slot();
+
+	return p->active ? p->scaler : -1;
+}
+
+/* The read running now may have started before the last character came in */
+void serial_drain()
+{
+	serial_port *p = serial_slot();
+
+	if (!p->active)
+		return;
+
+	const unsigned int reads = atomic_load(&p->reads);
+
+	for (int ms = 0; atomic_load(&p->reads) - reads < 2 && ms < SERIAL_DRAIN_MAX_MS; ms++)
+		usleep(1000);
+}
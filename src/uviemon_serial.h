@@ -0,0 +1,40 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Channel B of the FT2232H as an async serial
+	port wired to UART0 of the target. A thread
+	of its own reads it and hands the characters
+	to the UART output with host timestamps,
+	while channel A only does the debug access.
+	Runs then leave UART0 on its pin and no
+	longer drain its FIFO over JTAG. With the
+	system clock given, every run programs the
+	UART0 scaler for the baud rate, otherwise
+	the target software has to set that rate.
+	============================================
+*/
+
+#ifndef UVIEMON_SERIAL_H
+#define UVIEMON_SERIAL_H
+
+#include <stdbool.h>
+
+#define SERIAL_MAX_BAUD 12000000	// FT2232H in async serial mode
+#define SERIAL_MIN_BAUD 300
+#define SERIAL_SCALER_MAX 0xFFF		// 12-bit scaler reload value of the APBUART
+#define SERIAL_BAUD_TOLERANCE 2		// Percent the scaler may miss the baud rate by
+
+// Channel B of the selected device, found by its serial number. sysclk is the
+// system clock of the target in Hz, 0 if the target sets the UART0 baud rate.
+bool serial_open(unsigned int baud, unsigned int sysclk);
+void serial_close();
+bool serial_active();
+
+// UART0 scaler reload value for the runs, -1 if the target sets it
+int serial_scaler();
+
+// Waits until the characters that arrived so far went to the UART output
+void serial_drain();
+
+#endif /* UVIEMON_SERIAL_H */
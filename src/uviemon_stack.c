@@ -0,0 +1,199 @@
+#include "uviemon_stack.h"
+
+#include "leon3_dsu.h"
+
+#include <stdio.h>
+
+#define CHUNK_WORDS (16 * 1024 / 4)	// Words per USB transaction
+#define SCAN_BLOCK 64			// Words compared without a branch
+
+typedef struct {
+	DWORD top;		// Stacks grow down from here
+	DWORD size;
+	int cpu;		// -1 - number for a task
+	DWORD used;		// Bytes, set by stack_measure()
+	bool measured;
+} stack_region;
+
+static struct {
+	bool enabled;
+	DWORD size;			// Of the core stacks
+	stack_region tasks[STACK_MAX_TASKS];
+	unsigned int task_count;
+
+	stack_region regions[DSU_NCPUS + STACK_MAX_TASKS];	// Of the last run
+	unsigned int count;
+} stack;
+
+void stack_enable(DWORD size)
+{
+	stack.enabled = true;
+	stack.size = size & ~0x3;
+}
+
+void stack_disable()
+{
+	stack.enabled = false;
+}
+
+bool stack_enabled()
+{
+	return stack.enabled;
+}
+
+bool stack_add_task(DWORD top, DWORD size)
+{
+	if (stack.task_count == STACK_MAX_TASKS || size < 4 || (top & 0x3))
+		return false;
+
+	stack.tasks[stack.task_count] = (stack_region) { top, size & ~0x3, -1 - (int) stack.task_count, 0, false };
+	stack.task_count++;
+
+	return true;
+}
+
+void stack_clear_tasks()
+{
+	stack.task_count = 0;
+}
+
+bool stack_paint(DWORD cores, const ftdi_core_entry *entries)
+{
+	static DWORD pattern[CHUNK_WORDS];
+	ftdi_batch batch;
+	bool ok = true;
+
+	if (pattern[0] != STACK_PATTERN) {
+		for (DWORD i = 0; i < CHUNK_WORDS; i++)
+			pattern[i] = STACK_PATTERN;
+	}
+
+	stack.count = 0;
+
+	for (uint32_t cpu = 0; cpu < DSU_NCPUS; cpu++) {
+		if (cores & (1 << cpu))
+			stack.regions[stack.count++] = (stack_region) { entries[cpu].stack & ~0x7, stack.size, cpu, 0, false };
+	}
+
+	for (unsigned int i = 0; i < stack.task_count; i++)
+		stack.regions[stack.count++] = stack.tasks[i];
+
+	ftdi_batch_init(&batch);
+
+	for (unsigned int i = 0; ok && i < stack.count; i++) {
+		const stack_region *region = &stack.regions[i];
+
+		for (DWORD offset = 0; ok && offset < region->size; offset += CHUNK_WORDS * 4) {
+			const DWORD words = region->size - offset < CHUNK_WORDS * 4 ? (region->size - offset) / 4 : CHUNK_WORDS;
+
+			ftdi_batch_clear(&batch);
+			ftdi_batch_write32_block(&batch, region->top - region->size + offset, pattern, words);
+			ok = ftdi_batch_send(&batch) == FT_OK;
+		}
+	}
+
+	ftdi_batch_free(&batch);
+
+	return ok;
+}
+
+/*
+ * Index of the first word that is not the pattern, count if there is none.
+ * Whole blocks are compared without an early exit, which the compiler turns
+ * into vector instructions, only the block with a difference is searched.
+ */
+static DWORD find_overwritten(const DWORD *data, DWORD count)
+{
+	DWORD block = 0;
+
+	for (; block + SCAN_BLOCK <= count; block += SCAN_BLOCK) {
+		DWORD diff = 0;
+
+		for (DWORD i = 0; i < SCAN_BLOCK; i++)
+			diff |= data[block + i] ^ STACK_PATTERN;
+
+		if (diff)
+			break;
+	}
+
+	for (DWORD i = block; i < count; i++) {
+		if (data[i] != STACK_PATTERN)
+			return i;
+	}
+
+	return count;
+}
+
+/* Reads from the far end up, in one transaction per chunk, until the first overwritten word */
+static bool measure_region(stack_region *region, DWORD *data, ftdi_batch *batch)
+{
+	const DWORD bottom = region->top - region->size;
+
+	for (DWORD offset = 0; offset < region->size; offset += CHUNK_WORDS * 4) {
+		const DWORD words = region->size - offset < CHUNK_WORDS * 4 ? (region->size - offset) / 4 : CHUNK_WORDS;
+
+		ftdi_batch_clear(batch);
+		ftdi_batch_read32_block(batch, bottom + offset, words);
+
+		if (ftdi_batch_transfer(batch, data) != FT_OK)
+			return false;
+
+		const DWORD index = find_overwritten(data, words);
+
+		if (index < words) {
+			region->used = region->size - offset - index * 4;
+			region->measured = true;
+			return true;
+		}
+	}
+
+	region->used = 0;
+	region->measured = true;
+
+	return true;
+}
+
+bool stack_measure()
+{
+	static DWORD data[CHUNK_WORDS];
+	ftdi_batch batch;
+	bool ok = true;
+
+	ftdi_batch_init(&batch);
+
+	for (unsigned int i = 0; ok && i < stack.count; i++)
+		ok = measure_region(&stack.regions[i], data, &batch);
+
+	ftdi_batch_free(&batch);
+
+	return ok;
+}
+
+void stack_print()
+{
+	if (stack.count == 0) {
+		printf("No stacks painted, 'stackuse on' and run first\n");
+		return;
+	}
+
+	printf("   %-8s  %-10s  %-10s  %-10s  %s\n", "STACK", "TOP", "SIZE", "USED", "");
+
+	for (unsigned int i = 0; i < stack.count; i++) {
+		const stack_region *region = &stack.regions[i];
+		char name[16];
+
+		if (region->cpu >= 0)
+			snprintf(name, sizeof(name), "cpu %d", region->cpu);
+		else
+			snprintf(name, sizeof(name), "task %d", -1 - region->cpu);
+
+		if (!region->measured) {
+			printf("   %-8s  0x%08x  %-10u  %-10s\n", name, region->top, region->size, "-");
+			continue;
+		}
+
+		printf("   %-8s  0x%08x  %-10u  %-10u  %5.1f%%%s\n", name, region->top, region->size, region->used,
+		       100.0 * region->used / region->size,
+		       region->used == region->size ? " overflow?" : "");
+	}
+}
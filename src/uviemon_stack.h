@@ -0,0 +1,39 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Stack usage: the stacks of the cores of a
+	run and of registered tasks are filled with
+	a pattern before the run starts. After it
+	stopped, each stack is read from its far
+	end in bursts until the first overwritten
+	word, the deepest the program went.
+	============================================
+*/
+
+#ifndef UVIEMON_STACK_H
+#define UVIEMON_STACK_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+
+#define STACK_PATTERN 0x5a5aa5a5
+#define STACK_DEFAULT_SIZE (64 * 1024) // Distance of the default stacks of a multi-core run
+#define STACK_MAX_TASKS 16
+
+void stack_enable(DWORD size);
+void stack_disable();
+bool stack_enabled();
+
+// A stack growing down from top that is painted along with the core stacks
+bool stack_add_task(DWORD top, DWORD size);
+void stack_clear_tasks();
+
+// Before the cores are released, entries are those of the run
+bool stack_paint(DWORD cores, const ftdi_core_entry *entries);
+// After they stopped
+bool stack_measure();
+void stack_print();
+
+#endif /* UVIEMON_STACK_H */
@@ -0,0 +1,236 @@
+#include "uviemon_step.h"
+
+#include "leon3_dsu.h"
+#include "uviemon_break.h"
+#include "uviemon_coverage.h"
+
+#include <stdio.h>
+
+#define STEP_CHUNK 128			// Steps queued per USB transaction
+#define STEP_REGS ((DSU_REG_TRAP - DSU_REG_PC) / 4 + 1) // PC, NPC, FSR, CPSR, trap
+#define NEXT_MAX_RESUMES 64		// Recursion levels 'next' follows back to the caller
+
+#define INST_CACHE_SIZE 4096		// Direct mapped, by word address
+
+/* Opcodes of executed instructions, code does not change while stepping */
+typedef struct {
+	DWORD addr;
+	DWORD inst;
+	bool valid;
+} cached_inst;
+
+static cached_inst inst_caches[FTDI_MAX_DEVICES][INST_CACHE_SIZE];
+
+static inline cached_inst *inst_cache_slot()
+{
+	return inst_caches[ftdi_get_device_slot()];
+}
+
+void step_invalidate_inst_cache()
+{
+	cached_inst *inst_cache = inst_cache_slot();
+
+	for (int i = 0; i < INST_CACHE_SIZE; i++)
+		inst_cache[i].valid = false;
+}
+
+static unsigned int inst_slot(DWORD addr)
+{
+	return (addr >> 2) & (INST_CACHE_SIZE - 1);
+}
+
+/* Fills in the opcodes of records, all misses are read in one transaction */
+static void fetch_instructions(step_record *records, DWORD count)
+{
+	cached_inst *inst_cache = inst_cache_slot();
+	DWORD index[STEP_CHUNK];
+	DWORD data[STEP_CHUNK];
+	bool missed[STEP_CHUNK];
+	ftdi_batch batch;
+
+	ftdi_batch_init(&batch);
+
+	for (DWORD i = 0; i < count; i++) {
+		const unsigned int slot = inst_slot(records[i].pc);
+
+		missed[i] = !inst_cache[slot].valid || inst_cache[slot].addr != records[i].pc;
+
+		if (missed[i])
+			index[i] = ftdi_batch_read32(&batch, records[i].pc);
+		else
+			records[i].inst = inst_cache[slot].inst;
+	}
+
+	if (batch.reads > 0 && ftdi_batch_transfer(&batch, data) != FT_OK) {
+		for (DWORD i = 0; i < batch.reads; i++)
+			data[i] = 0;
+	}
+
+	ftdi_batch_free(&batch);
+
+	for (DWORD i = 0; i < count; i++) {
+		const unsigned int slot = inst_slot(records[i].pc);
+
+		if (!missed[i])
+			continue;
+
+		records[i].inst = data[index[i]];
+		inst_cache[slot].addr = records[i].pc;
+		inst_cache[slot].inst = records[i].inst;
+		inst_cache[slot].valid = true;
+	}
+}
+
+DWORD step_read_inst(DWORD addr)
+{
+	step_record record = { .pc = addr };
+
+	fetch_instructions(&record, 1);
+
+	return record.inst;
+}
+
+/*
+ * Execute count instructions on a core that is in debug mode. Every step is a
+ * write of the break and single step register that resumes the core for one
+ * instruction, followed by reads of its control register and PC to trap
+ * register. A step takes a few cycles, far less than one JTAG scan, so up to
+ * STEP_CHUNK steps are queued without waiting for the host. Each chunk ends
+ * with the core held in debug mode again.
+ *
+ * Returns the number of executed instructions, fewer than count if the core
+ * did not return to debug mode or the transfer failed.
+ */
+DWORD step_cpu(DWORD cpu, DWORD count, step_callback callback, void *arg)
+{
+	const DWORD brk = dsu_shadow_get_break_step();
+	const DWORD step = (brk | DSU_SINGLE_STEP(cpu)) & ~DSU_BREAK_NOW(cpu);
+	const DWORD hold = (brk | DSU_BREAK_NOW(cpu)) & ~DSU_SINGLE_STEP(cpu);
+
+	DWORD ctrl[STEP_CHUNK];
+	DWORD regs[STEP_CHUNK];
+	DWORD data[STEP_CHUNK * (STEP_REGS + 1)];
+	step_record records[STEP_CHUNK];
+	DWORD pc = dsu_get_reg_pc(cpu);
+	DWORD done = 0;
+	bool ok = true;
+	ftdi_batch batch;
+
+	step_invalidate_inst_cache();
+	ftdi_batch_init(&batch);
+
+	while (ok && done < count) {
+		const DWORD chunk = count - done < STEP_CHUNK ? count - done : STEP_CHUNK;
+		DWORD executed = 0;
+
+		ftdi_batch_clear(&batch);
+
+		for (DWORD i = 0; i < chunk; i++) {
+			ftdi_batch_write32(&batch, DSU_CTRL + DSU_BREAK_STEP, step);
+			ctrl[i] = ftdi_batch_read32(&batch, DSU_BASE(cpu));
+			regs[i] = ftdi_batch_read32_seq(&batch, DSU_BASE(cpu) + DSU_REG_PC, STEP_REGS);
+		}
+
+		ftdi_batch_write32(&batch, DSU_CTRL + DSU_BREAK_STEP, hold);
+
+		if (ftdi_batch_transfer(&batch, data) != FT_OK)
+			break;
+
+		for (DWORD i = 0; i < chunk; i++) {
+			// Still running: the instruction did not complete in time
+			if (!(data[ctrl[i]] & DSU_CTRL_DM)) {
+				fprintf(stderr, "CPU %d did not return to debug mode after a step\n", cpu);
+				ok = false;
+				break;
+			}
+
+			records[i].pc = pc;
+			records[i].next_pc = data[regs[i]];
+			records[i].next_npc = data[regs[i] + 1];
+			records[i].trap = data[regs[i] + STEP_REGS - 1];
+			pc = records[i].next_pc;
+			executed++;
+		}
+
+		fetch_instructions(records, executed);
+
+		for (DWORD i = 0; i < executed; i++) {
+			coverage_mark(records[i].pc);
+			callback(&records[i], arg);
+		}
+
+		done += executed;
+	}
+
+	ftdi_batch_free(&batch);
+	dsu_shadow_invalidate_all();
+
+	return done;
+}
+
+/* call, or jmpl with %o7 as link register */
+static bool is_call(DWORD inst)
+{
+	const DWORD op = inst >> 30;
+	const DWORD rd = (inst >> 25) & 0x1f;
+	const DWORD op3 = (inst >> 19) & 0x3f;
+
+	return op == 1 || (op == 2 && op3 == 0x38 && rd == 15);
+}
+
+static void store_record(const step_record *record, void *arg)
+{
+	*(step_record *) arg = *record;
+}
+
+/*
+ * Execute one instruction, a call runs until it returned to the instruction
+ * after its delay slot in the same stack frame. The return is caught by a
+ * temporary breakpoint, so the call runs at full speed with the UART being
+ * captured, and stops early at breakpoints inside it.
+ */
+bool step_next(DWORD cpu, step_record *record)
+{
+	step_invalidate_inst_cache();
+
+	const DWORD pc = dsu_get_reg_pc(cpu);
+	const DWORD inst = step_read_inst(pc);
+	const DWORD cwp = dsu_get_reg_psr(cpu) & (NWINDOWS - 1);
+	const DWORD sp = dsu_get_reg_sp(cpu, cwp);
+	const DWORD ret = pc + 8;
+	BYTE traps[DSU_NCPUS];
+	DWORD now = pc;
+	DWORD addr;
+
+	if (!is_call(inst))
+		return step_cpu(cpu, 1, store_record, record) == 1;
+
+	const int temporary = break_add_temporary(ret);
+
+	if (temporary == 0)
+		return false;
+
+	for (int i = 0; i < NEXT_MAX_RESUMES; i++) {
+		if (!resumeCPUs(1 << cpu, traps)) {
+			break_delete(temporary);
+			return false;
+		}
+
+		now = dsu_get_reg_pc(cpu);
+
+		// Stopped somewhere else, or back in the frame of the call
+		if (break_hit(cpu, &addr) != temporary ||
+		    dsu_get_reg_sp(cpu, dsu_get_reg_psr(cpu) & (NWINDOWS - 1)) == sp)
+			break;
+	}
+
+	break_delete(temporary);
+
+	record->pc = pc;
+	record->inst = inst;
+	record->next_pc = now;
+	record->next_npc = dsu_get_reg_npc(cpu);
+	record->trap = dsu_get_reg_trap(cpu);
+
+	return true;
+}
@@ -0,0 +1,36 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Single stepping through the DSU break and
+	single step register. Many steps and their
+	PC/NPC/trap readback are queued into one
+	USB transaction, so step traces run at the
+	rate of the JTAG link.
+	============================================
+*/
+
+#ifndef UVIEMON_STEP_H
+#define UVIEMON_STEP_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+
+typedef struct {
+	DWORD pc;	// Address of the executed instruction
+	DWORD inst;	// Its opcode
+	DWORD next_pc;	// PC and NPC after the step
+	DWORD next_npc;
+	DWORD trap;	// DSU trap register after the step
+} step_record;
+
+typedef void (*step_callback)(const step_record *record, void *arg);
+
+DWORD step_cpu(DWORD cpu, DWORD count, step_callback callback, void *arg);
+bool step_next(DWORD cpu, step_record *record);
+
+DWORD step_read_inst(DWORD addr);
+void step_invalidate_inst_cache();
+
+#endif /* UVIEMON_STEP_H */
@@ -0,0 +1,132 @@
+#define _POSIX_C_SOURCE 200809L // localtime_r, clock_gettime
+
+#include "uviemon_uart.h"
+
+#include "ftdi_device.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#define UART_LINE_LENGTH 256
+
+// Lines of the devices are collected apart, the log file is shared
+typedef struct {
+	char line[UART_LINE_LENGTH];
+	size_t line_len;
+	struct timespec line_time; // Host time of the first character in line
+	FILE *capture;
+} uart_state;
+
+static uart_state uart_slots[FTDI_MAX_DEVICES];
+
+static inline uart_state *uart_slot()
+{
+	return &uart_slots[ftdi_get_device_slot()];
+}
+
+static FILE *log_file = NULL;
+
+// Characters also come from the reader threads of channel B
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void flush();
+
+
+bool uart_log_open(const char *path)
+{
+	FILE *file = fopen(path, "a");
+
+	if (file == NULL) {
+		perror("Could not open UART log file");
+		return false;
+	}
+
+	uart_log_close();
+	pthread_mutex_lock(&lock);
+	log_file = file;
+	pthread_mutex_unlock(&lock);
+
+	return true;
+}
+
+void uart_log_close()
+{
+	pthread_mutex_lock(&lock);
+
+	if (log_file != NULL) {
+		flush();
+		fclose(log_file);
+		log_file = NULL;
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+void uart_capture(FILE *file)
+{
+	pthread_mutex_lock(&lock);
+	flush();
+	uart_slot()->capture = file;
+	pthread_mutex_unlock(&lock);
+}
+
+static void log_line(const uart_state *uart)
+{
+	char stamp[32];
+	struct tm tm;
+
+	localtime_r(&uart->line_time.tv_sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+	fprintf(log_file, "[%s.%03ld] ", stamp, uart->line_time.tv_nsec / 1000000);
+	fwrite(uart->line, 1, uart->line_len, log_file);
+
+	// Lines cut at the buffer size or by uart_flush() are continued in the log
+	if (uart->line[uart->line_len - 1] != '\n')
+		fputc('\n', log_file);
+
+	fflush(log_file);
+}
+
+static void flush()
+{
+	uart_state *uart = uart_slot();
+
+	if (uart->line_len == 0)
+		return;
+
+	FILE *out = uart->capture != NULL ? uart->capture : stdout;
+
+	fwrite(uart->line, 1, uart->line_len, out);
+	fflush(out);
+
+	if (log_file != NULL)
+		log_line(uart);
+
+	uart->line_len = 0;
+}
+
+void uart_flush()
+{
+	pthread_mutex_lock(&lock);
+	flush();
+	pthread_mutex_unlock(&lock);
+}
+
+void uart_putc(char c)
+{
+	uart_state *uart = uart_slot();
+
+	pthread_mutex_lock(&lock);
+
+	if (uart->line_len == 0)
+		clock_gettime(CLOCK_REALTIME, &uart->line_time);
+
+	uart->line[uart->line_len++] = c;
+
+	if (c == '\n' || uart->line_len == UART_LINE_LENGTH)
+		flush();
+
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,29 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Console output of the target while a program
+	is running, from the UART or channel 0 of the
+	memory console. Characters are collected per
+	line and written to stdout, or a capture
+	file of the device, and optionally to a log
+	file with host timestamps.
+	============================================
+*/
+
+#ifndef UVIEMON_UART_H
+#define UVIEMON_UART_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+bool uart_log_open(const char *path);
+void uart_log_close();
+
+// Lines of the selected device go to file instead of stdout, NULL for stdout
+void uart_capture(FILE *file);
+
+void uart_putc(char c);
+void uart_flush();
+
+#endif /* UVIEMON_UART_H */
@@ -0,0 +1,348 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "uviemon_xvc.h"
+
+#include "leon3_dsu.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_BITS (XVC_MAX_VECTOR * 8)
+#define MAX_BYTE_CLOCKS 65536		// Length of one 0x39 command
+#define MAX_TMS_CLOCKS 7		// Bit 7 of a 0x6B command holds TDI
+
+// Worst case is a TMS command of 3 bytes for every bit
+#define MAX_COMMANDS (MAX_BITS * 3 + 1)
+// Worst case is a result byte for every bit, when TDI changes with every TMS clock
+#define MAX_RESULTS MAX_BITS
+
+enum segment_type {
+	SEGMENT_BYTES,	// 0x39: whole TDI bytes with TMS low
+	SEGMENT_BITS,	// 0x3B: up to 7 TDI bits with TMS low
+	SEGMENT_TMS	// 0x6B: up to 7 TMS bits with TDI held
+};
+
+static BYTE tms[XVC_MAX_VECTOR];
+static BYTE tdi[XVC_MAX_VECTOR];
+static BYTE tdo[XVC_MAX_VECTOR];
+static BYTE commands[MAX_COMMANDS];
+static BYTE results[MAX_RESULTS];
+static int tms_pin;		// Level the last TMS clock left on the pin
+
+static inline int get_bit(const BYTE *vector, DWORD bit)
+{
+	return (vector[bit / 8] >> (bit % 8)) & 1;
+}
+
+static inline void set_bit(BYTE *vector, DWORD bit, int value)
+{
+	vector[bit / 8] |= value << (bit % 8);
+}
+
+/* Bits from start on with TMS low, counted up to max */
+static DWORD tms_low_run(DWORD start, DWORD end, DWORD max)
+{
+	DWORD run = 0;
+
+	while (start + run < end && run < max && !get_bit(tms, start + run))
+		run++;
+
+	return run;
+}
+
+/*
+ * Splits the vector into MPSSE commands. Runs of 8 or more bits with TMS
+ * low are shifted as bytes and the rest of the run as bits, everything
+ * else as TMS clocks for as long as TDI does not change. The data commands
+ * leave TMS where the last TMS clock put it, so they only follow once the
+ * pin is low: the first low bit after a high one is always a TMS clock.
+ * The same split is used for the commands and for the results.
+ */
+static enum segment_type next_segment(DWORD pos, DWORD end, int pin, DWORD *len)
+{
+	const DWORD run = tms_low_run(pos, end, MAX_BYTE_CLOCKS * 8);
+
+	if (!pin && run >= 8) {
+		*len = run & ~0x7;
+		return SEGMENT_BYTES;
+	}
+
+	if (!pin && run > 0) {
+		*len = run;
+		return SEGMENT_BITS;
+	}
+
+	const int held = get_bit(tdi, pos);
+	DWORD n = 1;
+
+	// Stop in front of a byte run only if the pin is low by then
+	while (pos + n < end && n < MAX_TMS_CLOCKS && get_bit(tdi, pos + n) == held
+	       && (get_bit(tms, pos + n - 1) || tms_low_run(pos + n, end, 8) < 8))
+		n++;
+
+	*len = n;
+
+	return SEGMENT_TMS;
+}
+
+/* Level of the TMS pin after the segment, data commands keep it low */
+static int pin_after(enum segment_type type, DWORD pos, DWORD len)
+{
+	return type == SEGMENT_TMS ? get_bit(tms, pos + len - 1) : 0;
+}
+
+static DWORD encode(DWORD bits, int pin, DWORD *result_len)
+{
+	DWORD out = 0;
+	DWORD in = 0;
+	DWORD len;
+
+	for (DWORD pos = 0; pos < bits; pos += len) {
+		const enum segment_type type = next_segment(pos, bits, pin, &len);
+
+		switch (type) {
+		case SEGMENT_BYTES:
+			commands[out++] = 0x39; // Clock bytes in and out, LSB first
+			commands[out++] = (len / 8 - 1) & 0xFF;
+			commands[out++] = (len / 8 - 1) >> 8;
+
+			if (pos % 8 == 0) {
+				memcpy(&commands[out], &tdi[pos / 8], len / 8);
+			} else {
+				memset(&commands[out], 0, len / 8);
+
+				for (DWORD i = 0; i < len; i++)
+					set_bit(&commands[out], i, get_bit(tdi, pos + i));
+			}
+
+			out += len / 8;
+			in += len / 8;
+			break;
+		case SEGMENT_BITS:
+			commands[out++] = 0x3B; // Clock bits in and out, LSB first
+			commands[out++] = len - 1;
+			commands[out] = 0;
+
+			for (DWORD i = 0; i < len; i++)
+				set_bit(&commands[out], i, get_bit(tdi, pos + i));
+
+			out++;
+			in++;
+			break;
+		case SEGMENT_TMS:
+			commands[out++] = 0x6B; // Clock TMS with read
+			commands[out++] = len - 1;
+			commands[out] = get_bit(tdi, pos) << 7;
+
+			for (DWORD i = 0; i < len; i++)
+				set_bit(&commands[out], i, get_bit(tms, pos + i));
+
+			out++;
+			in++;
+			break;
+		}
+
+		pin = pin_after(type, pos, len);
+	}
+
+	// Send immediate, don't wait for the latency timer to return the data
+	commands[out++] = 0x87;
+	*result_len = in;
+
+	return out;
+}
+
+/* Bit commands shift TDO in from the top, byte commands return it in place */
+static void decode(DWORD bits, int pin)
+{
+	DWORD in = 0;
+	DWORD len;
+
+	memset(tdo, 0, (bits + 7) / 8);
+
+	for (DWORD pos = 0; pos < bits; pos += len) {
+		const enum segment_type type = next_segment(pos, bits, pin, &len);
+
+		pin = pin_after(type, pos, len);
+
+		if (type == SEGMENT_BYTES) {
+			if (pos % 8 == 0) {
+				memcpy(&tdo[pos / 8], &results[in], len / 8);
+			} else {
+				for (DWORD i = 0; i < len; i++)
+					set_bit(tdo, pos + i, get_bit(&results[in], i));
+			}
+
+			in += len / 8;
+		} else {
+			const BYTE value = results[in++] >> (8 - len);
+
+			for (DWORD i = 0; i < len; i++)
+				set_bit(tdo, pos + i, (value >> i) & 1);
+		}
+	}
+}
+
+static bool shift(DWORD bits)
+{
+	DWORD result_len;
+	const DWORD len = encode(bits, tms_pin, &result_len);
+
+	if (ftdi_mpsse_transfer(commands, len, results, result_len) != FT_OK)
+		return false;
+
+	decode(bits, tms_pin);
+
+	if (bits > 0)
+		tms_pin = get_bit(tms, bits - 1);
+
+	return true;
+}
+
+static bool receive(int fd, void *data, size_t len)
+{
+	while (len > 0) {
+		const ssize_t n = recv(fd, data, len, 0);
+
+		if (n <= 0)
+			return false;
+
+		data = (BYTE *) data + n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool send_all(int fd, const void *data, size_t len)
+{
+	while (len > 0) {
+		const ssize_t n = send(fd, data, len, 0);
+
+		if (n <= 0)
+			return false;
+
+		data = (const BYTE *) data + n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static DWORD get_le32(const BYTE *data)
+{
+	return data[0] | data[1] << 8 | data[2] << 16 | (DWORD) data[3] << 24;
+}
+
+static void put_le32(BYTE *data, DWORD value)
+{
+	for (int i = 0; i < 4; i++)
+		data[i] = value >> (8 * i);
+}
+
+/* Commands are "getinfo:", "settck:<period>" and "shift:<bits><tms><tdi>" */
+static void session(int fd)
+{
+	char command[8];
+	BYTE word[4];
+
+	for (;;) {
+		size_t len = 0;
+
+		// Up to and including the colon
+		do {
+			if (len == sizeof(command) || !receive(fd, &command[len], 1))
+				return;
+		} while (command[len++] != ':');
+
+		if (len == 8 && memcmp(command, "getinfo:", 8) == 0) {
+			char info[32];
+
+			snprintf(info, sizeof(info), "xvcServer_v1.0:%d\n", XVC_MAX_VECTOR);
+
+			if (!send_all(fd, info, strlen(info)))
+				return;
+		} else if (len == 7 && memcmp(command, "settck:", 7) == 0) {
+			// The TCK of uviemon stays, the client gets told what it is
+			if (!receive(fd, word, 4))
+				return;
+
+			put_le32(word, ftdi_get_tck_period());
+
+			if (!send_all(fd, word, 4))
+				return;
+		} else if (len == 6 && memcmp(command, "shift:", 6) == 0) {
+			if (!receive(fd, word, 4))
+				return;
+
+			const DWORD bits = get_le32(word);
+			const DWORD bytes = (bits + 7) / 8;
+
+			if (bytes > XVC_MAX_VECTOR) {
+				fprintf(stderr, "XVC vector of %u bits is too long\n", bits);
+				return;
+			}
+
+			if (!receive(fd, tms, bytes) || !receive(fd, tdi, bytes))
+				return;
+
+			if (!shift(bits) || !send_all(fd, tdo, bytes))
+				return;
+		} else {
+			fprintf(stderr, "Unknown XVC command '%.*s'\n", (int) len, command);
+			return;
+		}
+	}
+}
+
+bool xvc_serve(int port)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+				    .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	static const BYTE reset_tap[] = { 0x4B, 0x04, 0b00111111 };
+	const int on = 1;
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+	    || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listener, 1) < 0) {
+		perror("Could not listen for XVC");
+		if (listener >= 0)
+			close(listener);
+		return false;
+	}
+
+	for (;;) {
+		printf("Waiting for XVC on port %d of localhost, TCK period %u ns\n", port, ftdi_get_tck_period());
+
+		const int fd = accept(listener, NULL, NULL);
+
+		if (fd < 0) {
+			perror("Could not accept XVC");
+			break;
+		}
+
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		printf("XVC connected\n");
+
+		// Unknown after uviemon used the TAP, a high pin costs one TMS clock at most
+		tms_pin = 1;
+
+		session(fd);
+
+		// The client may have left the TAP anywhere and touched the DSU
+		ftdi_mpsse_transfer(reset_tap, sizeof(reset_tap), NULL, 0);
+		dsu_shadow_invalidate_all();
+
+		close(fd);
+		printf("XVC disconnected\n");
+	}
+
+	close(listener);
+
+	return false;
+}
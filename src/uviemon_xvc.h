@@ -0,0 +1,27 @@
+/*
+	============================================
+	uviemon: free(TM) replacement for grmon
+
+	Xilinx Virtual Cable server on a localhost
+	TCP port, for tools that shift raw JTAG.
+	Every shift: vector becomes the longest
+	MPSSE byte and bit clocking commands that
+	fit it, written at once, and its TDO comes
+	back in a single read. The TCK stays at
+	the frequency uviemon configured.
+	============================================
+*/
+
+#ifndef UVIEMON_XVC_H
+#define UVIEMON_XVC_H
+
+#include "ftdi_device.h"
+
+#include <stdbool.h>
+
+#define XVC_MAX_VECTOR 32768 // Bytes of the TMS and of the TDI vector
+
+// Serves one client after the other until listening fails
+bool xvc_serve(int port);
+
+#endif /* UVIEMON_XVC_H */